@@ -2,44 +2,62 @@
 #define BCACHE_H
 
 #include <iostream>
-#include <map>
+#include <vector>
 #include <string>
 #include <set>
+#include <unordered_map>
 
 #include "BackupEntry.h"
-#include "FaubCache.h"   // for cmpName
+#include "FaubCache.h"   // for nameSortKey
+#include "DirStamps.h"
 
 
 using namespace std;
 
-typedef map<unsigned int, BackupEntry>::iterator bcMapIT;
+typedef unordered_map<md5Digest, vector<unsigned int>, md5DigestHash> md5IndexType;
 
 
+/* the entries are kept by id in one flat array, indexed by filename and MD5 with
+ * hash tables.  a removed entry's slot is left empty (no filename) rather than
+ * reused, so ids and pointers to other entries stay valid while callers remove
+ * entries as they walk the cache.  adding an entry can move them all; pointers
+ * from the get*() functions don't survive an addOrUpdate() of a new file. */
 class BackupCache {
     string uuid;
+    vector<BackupEntry> entries;
+    size_t entryCount;
+    unordered_map<string, unsigned int> indexByFilename;
+    md5IndexType indexByMD5;
+
+    // ids in filename (i.e. date) order, only sorted when it's asked for
+    vector<unsigned int> sortedIds;
+    bool sorted;
 
 public:
-    map<unsigned int, BackupEntry> rawData;
-    map<string, set<unsigned int> > indexByMD5;
-    map<string, unsigned int, cmpName> indexByFilename;
     bool updated;
     string inProcess;
+    DirStamps dirStamps;
     
     BackupEntry* getByFilename(string filename);
-    set<BackupEntry*> getByMD5(string md5);
+    vector<BackupEntry*> getByMD5(md5Digest md5);
+    BackupEntry* getById(unsigned int id) { return id < entries.size() && entries[id].filename.length() ? &entries[id] : NULL; }
     void addOrUpdate(BackupEntry updatedEntry, bool markCurrent = false, bool md5Updated = false);
     void updateAges(time_t refTime = 0);
-    void reStatMD5(string md5);
+    void reStatMD5(md5Digest md5);
     void remove(BackupEntry oldEntry);
     
-    bcMapIT getLastBackup() { return (indexByFilename.size() ? rawData.find((--indexByFilename.end())->second) : rawData.end()); }
-    bcMapIT getEnd() { return rawData.end(); }
+    vector<BackupEntry*> getAll();          // in the order they were added
+    vector<BackupEntry*> getSorted();       // by filename (see cmpName)
+    BackupEntry* getLastBackup();
+    md5IndexType& getMD5Index() { return indexByMD5; }
+    size_t numberOfBackups() { return entryCount; }
+    size_t numberOfMD5s() { return indexByMD5.size(); }
     
     string size();
-    string size(string md5);
+    string size(md5Digest md5);
     string fullDump();
     
-    void setUUID(string aUuid) { uuid = aUuid; }
+    void setUUID(string aUuid) { uuid = aUuid; dirStamps.setFilename(slashConcat(GLOBALS.cacheDir, uuid, SUFFIX_DIRSTAMPS)); }
     string cacheFilename() { return(slashConcat(GLOBALS.cacheDir, uuid, uuid) + ".1f"); }
     void saveCache(string oldBaseDir = "", string newBaseDir = "");  // only specify base dirs when relocating
     bool restoreCache(bool nukeFirst = false);
@@ -30,7 +30,8 @@ public:
     BackupConfig(bool makeTemp = 0);
     ~BackupConfig();
     
-    bool isFaub() { return settings[sFaub].value.length(); };
+    bool isFaub() { return settings[sFaub].value.length() || settings[sAgent].value.length(); };
+    digestType digest() { digestType algorithm = dMD5; digestFromName(settings[sDigest].value, algorithm); return algorithm; }
     
     void fullDump();
     
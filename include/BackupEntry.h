@@ -2,19 +2,54 @@
 #define ENTRY_H
 
 #include <string>
+#include <ostream>
+#include <stdint.h>
 #include <time.h>
 #include <pcre++.h>
 
 using namespace pcrepp;
 using namespace std;
 
-class BackupEntry {
-    Pcre dateRE;
 
+/* what a backup's content is identified by, picked per profile with "digest": MD5, or
+ * BLAKE3 cut to the same 128 bits (see Blake3.h).  either fits an md5Digest, and each
+ * cache entry records which one it holds. */
+enum digestType { dMD5 = 0, dBLAKE3 = 1 };
+
+string digestName(digestType algorithm, bool forDisplay = false);   // e.g. "md5" or "MD5"
+bool digestFromName(string name, digestType& algorithm);
+
+
+/* an MD5 (or a BLAKE3, see above) held as its 16 bytes rather than as 32 hex
+ * characters.  all zeros stands for no digest (i.e. not calculated yet). */
+struct md5Digest {
+    uint64_t words[2];
+
+    static md5Digest fromHex(string hex);   // all zeros if 'hex' isn't an MD5
+    string hex() const;
+
+    bool empty() const { return !words[0] && !words[1]; }
+    bool operator==(const md5Digest& other) const { return words[0] == other.words[0] && words[1] == other.words[1]; }
+    bool operator!=(const md5Digest& other) const { return !(*this == other); }
+    bool operator<(const md5Digest& other) const { return words[0] != other.words[0] ? words[0] < other.words[0] : words[1] < other.words[1]; }
+
+    md5Digest() { words[0] = words[1] = 0; }
+};
+
+// the digest is already evenly distributed; no need to hash it again
+struct md5DigestHash {
+    size_t operator()(const md5Digest& digest) const { return digest.words[0] ^ digest.words[1]; }
+};
+
+ostream& operator<<(ostream& out, const md5Digest& digest);
+
+
+class BackupEntry {
     public:
         bool            current;
         string          filename;
-        string          md5;
+        md5Digest       md5;
+        digestType      algorithm;      // of md5
         unsigned int    links;
         time_t          mtime;
         unsigned long   size;
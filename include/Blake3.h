@@ -0,0 +1,40 @@
+
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+/* blake3Stream
+ *
+ * BLAKE3 (hash mode, no key), as an alternative to MD5 for identifying a backup's content.
+ * BLAKE3 splits its input into 1KB chunks that are hashed independently and then combined
+ * as a binary tree, so chunks (and then each level of the tree's nodes) are hashed side by
+ * side in vector lanes (see lanes.h), 4 to 16 at a time depending on the CPU.  Small
+ * updates are gathered until there's enough to fill the lanes, and the last chunk is only
+ * hashed by final(), since it's finished differently.  final() gives the first 'bytes' (up
+ * to 64) of the output as hex, the same as b3sum --length, and readies the stream for new
+ * data.
+ */
+
+class blake3Stream {
+    uint32_t cvStack[54][8];    // completed subtrees, one per set bit of the chunk count
+    size_t stackDepth;
+    uint64_t chunks;            // hashed so far
+    string pending;             // not yet hashed
+
+    void hashChunks(const unsigned char *data, size_t count);
+    void addSubtree(uint32_t cv[8], uint64_t size);
+
+public:
+    static string engine();
+
+    void update(const void *data, size_t count);
+    string final(size_t bytes = 32);
+
+    blake3Stream() : stackDepth(0), chunks(0) {}
+};
+
+#endif
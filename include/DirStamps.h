@@ -0,0 +1,75 @@
+
+#ifndef DIRSTAMPS_H
+#define DIRSTAMPS_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <sys/stat.h>
+
+using namespace std;
+
+#define SUFFIX_DIRSTAMPS    "dir_stamps"
+
+/* DirStamps
+ *
+ * The mtime and link count of each directory in a profile's backup tree (the top
+ * directory and its year, month and day subdirectories) as of the last time it was
+ * read, along with the names it held.  Adding, removing or renaming a backup changes
+ * the mtime of the directory it's in, so a directory that still matches its stamp holds
+ * the same backups it did then.  Scans skip reading it (only its recorded subdirectories
+ * are checked) and the caches keep what they already know about the backups in it.
+ *
+ * A directory modified in the same second it's read can't be trusted that way, since
+ * a second change within that second wouldn't move its mtime; it isn't stamped and
+ * gets read again next time.  Neither is one that a scan asks to see again (rescan()),
+ * e.g. because it holds an in-process backup that may need cleaning up later.
+ *
+ * --recalc ignores the stamps and rereads everything.
+ */
+
+class DirStamps {
+    struct stampType {
+        time_t mtime;
+        nlink_t links;
+        vector<string> subDirs;     // the ones walked
+        vector<string> names;       // everything in it, sorted
+    };
+
+    map<string, stampType> stamps;
+    set<string> confirmed;      // found unchanged during this run
+    set<string> seen;           // checked or read during this run
+    set<string> unstable;       // to be read again next run
+    string filename;
+    bool loaded;
+    bool dirty;
+
+    void load();
+
+public:
+    void setFilename(string stampsFile) { filename = stampsFile; stamps.clear(); confirmed.clear(); seen.clear(); loaded = dirty = false; }
+
+    // whether a scan should consult stamps for this directory ('depth' 0 is the top of the walk)
+    bool tracks(string dir, unsigned int depth);
+
+    // true if 'dir' (as just stat'd) matches its stamp; the stat-less version stats it itself
+    bool unchanged(string dir, struct stat& statData);
+    bool unchanged(string dir);
+
+    // true if 'path' is in a directory found unchanged this run, and was there when it was read
+    bool holds(string path);
+
+    // the (untracked) subdirectories walked in directories found unchanged this run, e.g. faub backups
+    vector<string> heldSubDirs();
+
+    vector<string> subDirs(string dir);
+    void record(string dir, struct stat& statData, vector<string>& subDirNames, vector<string>& names);
+    void rescan(string dir);
+    void clear();
+    void save();
+
+    DirStamps() : loaded(false), dirty(false) {}
+};
+
+#endif
@@ -8,6 +8,8 @@
 #include "globals.h"
 #include "util_generic.h"
 #include "FaubEntry.h"
+#include "InodeIndex.h"
+#include "DirStamps.h"
 #include "tagging.h"
 
 
@@ -17,21 +19,46 @@ using namespace std;
 /* cmpName is to allow a full path filename (/var/backups/2023/01/mybackup-20230105.tgz)
  to be sorted based on the filename and not the directory.  this is helpful if the same
  profile is run with and without the --time option, resulting in some files being in
- the month directory and others being in month/day. */
+ the month directory and others being in month/day.
+
+ the key it compares (the filename with any '-'s removed) is worked out once, when a
+ backupName is created, rather than on every comparison. */
+inline string nameSortKey(const string& path) {
+    string key;
+
+    // the filename as pathSplit() would have it
+    if (path == "..")
+        return ".";
+
+    auto pos = path.rfind("/");
+    pos = pos == string::npos ? 0 : path.length() > 1 ? pos + 1 : path.length();
+    key.reserve(path.length() - pos);
+
+    for (; pos < path.length(); ++pos)
+        if (path[pos] != '-')
+            key += path[pos];
+
+    return key;
+}
+
+
+// a backup's full path along with its sort key
+struct backupName : public string {
+    string sortKey;
+
+    backupName(const string& path) : string(path), sortKey(nameSortKey(path)) {}
+    backupName(const char *path) : backupName(string(path)) {}
+};
+
+
 struct cmpName {
-    bool operator()(const string& a, const string& b) const {
-        auto aps = pathSplit(a);
-        auto bps = pathSplit(b);
-        
-        aps.file.erase(remove(aps.file.begin(), aps.file.end(), '-'), aps.file.end());
-        bps.file.erase(remove(bps.file.begin(), bps.file.end(), '-'), bps.file.end());
-        
-        return aps.file < bps.file;
+    bool operator()(const backupName& a, const backupName& b) const {
+        return a.sortKey < b.sortKey;
     }
 };
 
 
-typedef map<string, FaubEntry, cmpName>::iterator myMapIT;
+typedef map<backupName, FaubEntry, cmpName>::iterator myMapIT;
 
 
 class FaubCache {
@@ -39,10 +66,16 @@ private:
     string uuid;
     string baseDir;
     string coreProfile;
-    map<string, FaubEntry, cmpName> backups;
+    map<backupName, FaubEntry, cmpName> backups;
     string inProcessFilename;
+    InodeIndex inodeIndex;
+    DirStamps dirStamps;
     
     void restoreCache_internal(string backupDir);
+    set<string> backupDirs();
+    bool unindexBackup(string backupDir, InodeSet& inodes, myMapIT next, myMapIT prev, size_t *freedBytes);
+    void restatFromIndex(myMapIT backup, myMapIT prevBackup);
+    void cleanupVanished(string backupDir, string profileName);
 
 public:
     void restoreCache(string profileName);
@@ -60,14 +93,15 @@ public:
     myMapIT findBackup(string backupDir, myMapIT backupIT);
     vector<string> findBackups(string backupDir);
 
-    void removeBackup(map<string, FaubEntry>::iterator which) {
-        GLOBALS.tags.removeTagsOn(which->first);
-        which->second.removeEntry();
-        backups.erase(which);
-    }
+    bool removeBackup(myMapIT which, size_t *freedBytes = NULL);
     
     void updateDiffFiles(string backupDir, set<string> files);
+    bool loadDiffFiles(string backupDir, set<string>& files);
     bool displayDiffFiles(string backupDir);
+    
+    bool loadManifest(string backupDir, map<string, manifestEntry>& manifest);
+    void updateManifest(string backupDir, map<string, manifestEntry>& manifest);
+    void updateDirLinks(string backupDir, set<string>& paths);
     void compare(string backupA, string backupB, string threshold);
 
     bool tagBackup(string tagname, string backup);
@@ -75,6 +109,7 @@ public:
 
     void cleanup();
     void recache(string targetDir, time_t deletedtime = 0, bool forceAll = false);
+    void recordStats(string backupDir, DiskStats ds, map<ino_t, inodeSizeType>& files);
     string getInProcessFilename() { return inProcessFilename; }
     void renameBaseDirTo(string newDir);
     string getBaseDir() { return baseDir; }
@@ -85,7 +120,6 @@ public:
     FaubCache() {}
     ~FaubCache() {}
     
-    friend bool fcCleanupCallback(pdCallbackData &file);
     friend bool restoreCacheCallback(pdCallbackData &file);
 };
 
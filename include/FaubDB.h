@@ -0,0 +1,60 @@
+
+#ifndef FAUBDB_H
+#define FAUBDB_H
+
+#include <string>
+#include <map>
+
+using namespace std;
+
+/* FaubDB
+ *
+ * The stats of every backup in a profile, kept in one file rather than a faub_stats
+ * file per backup, so that loading a profile's history is a single read instead of
+ * an open per backup.
+ *
+ * The file is a log.  Each change appends a record and the last record for a backup
+ * wins.  Records are one per line: "+stats<TAB>profile<TAB>directory" sets a backup's
+ * stats and "-<TAB><TAB>directory" drops them.  The directory is last since it's the
+ * only field that could contain a tab.  Once superseded records outnumber the live
+ * ones the file is compacted, i.e. rewritten with only the live records.
+ *
+ * Appends and compaction take an exclusive flock() so that another managebackups
+ * (e.g. a stats run alongside a backup) doesn't lose records.
+ *
+ * There's one FaubDB per profile uuid, shared process-wide via FaubDB::forUuid().
+ */
+
+struct faubRecordType {
+    string profile;
+    string stats;
+};
+
+
+class FaubDB {
+    string dir;
+    string filename;
+    map<string, faubRecordType> records;
+    size_t logRecords;
+    bool loaded;
+
+    void load();
+    void parse(string& data);
+    void importStatsFiles();
+    bool append(string record);
+    bool compact();
+
+public:
+    bool get(string backupDir, faubRecordType& record);
+    bool put(string backupDir, string profile, string stats);
+    void remove(string backupDir);
+
+    // every backup with stats, by directory
+    map<string, faubRecordType>& all() { load(); return records; }
+
+    static FaubDB& forUuid(string uuid);
+
+    FaubDB(string cacheDir) : dir(cacheDir), logRecords(0), loaded(false) {}
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <set>
+#include <map>
 #include <sys/stat.h>
 #include "globals.h"
 #include "util_generic.h"
@@ -13,6 +14,18 @@ using namespace std;
 #define SUFFIX_FAUBSTATS     "faub_stats"
 #define SUFFIX_FAUBINODES    "faub_inodes"
 #define SUFFIX_FAUBDIFF      "faub_diff"
+#define SUFFIX_FAUBMANIFEST  "faub_manifest"
+#define SUFFIX_FAUBDIRLINKS  "faub_dirlinks"
+#define SUFFIX_FAUBINDEX     "faub_index"
+#define SUFFIX_FAUBDB        "faub_db"
+
+
+// per-file detail recorded as a faub backup is received
+struct manifestEntry {
+    string digest;      // MD5; empty if it was never seen on the wire
+    long size;
+    time_t mtime;
+};
 
 
 class FaubEntry {
@@ -21,10 +34,11 @@ private:
     string directory;
     string profile;
     string uuid;
+    string cacheKey;    // cache path less the suffix; MD5'ing the directory every time adds up
     
 public:
     bool updated;
-    set<ino_t> inodes;
+    InodeSet inodes;
     DiskStats ds;
     size_t modifiedFiles;
     size_t unchangedFiles;
@@ -39,7 +53,7 @@ public:
     int dow;
     time_t holdDate;
     
-    string cacheFilename(string suffix) { return (slashConcat(GLOBALS.cacheDir, uuid, MD5string(directory)) + "." + suffix); }
+    string cacheFilename(string suffix) { return cacheKey + "." + suffix; }
     string getDir() { return directory; }
     
     int filenameDayAge();
@@ -55,8 +69,15 @@ public:
     void saveInodes();
     
     void updateDiffFiles(set<string> files);
+    bool loadDiffFiles(set<string>& files);
     bool displayDiffFiles();
     
+    bool loadManifest(map<string, manifestEntry>& manifest);
+    void saveManifest(map<string, manifestEntry>& manifest);
+    
+    bool loadDirLinks(set<string>& paths);
+    void saveDirLinks(set<string>& paths);
+    
     void renameDirectoryTo(string newDir, string baseDir);
     void removeEntry();
         
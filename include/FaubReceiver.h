@@ -0,0 +1,177 @@
+#ifndef FAUBRECEIVER_H
+#define FAUBRECEIVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include "BackupConfig.h"
+#include "FaubSession.h"
+#include "faub.h"
+#include "ipc.h"
+
+#define RECEIVER_HIGHWATER  (32 * 1024 * 1024)  // stop reading from clients while this much received data awaits the disk
+#define RECEIVER_LOWWATER   (8 * 1024 * 1024)   // and start again once it's down to this
+#define RECEIVER_CHUNK      (256 * 1024)        // most file content handed to a worker at once
+
+using namespace std;
+
+
+// where a session is in the faub protocol, i.e. what we expect from the client next
+enum receiverStateType { psConnecting, psCaps, psCapsValue, psCount, psFsName, psEntryName, psEntryInts, psWaitRequests,
+                         psTouchReply, psHeader, psLinkLength, psLinkTarget, psFileSize, psFileData, psMore, psFinishing, psClosing };
+
+
+struct receiverSessionType;
+
+// disk-side work for a session.  'work' runs on a worker thread, 'then' back on the event loop.
+struct receiverJobType {
+    function<void()> work;
+    function<void()> then;
+    size_t bytes;       // received data held by the job (counts toward RECEIVER_HIGHWATER)
+    bool always;        // run even after the session has failed (its cleanup)
+};
+
+
+struct receiverCompletionType {
+    receiverSessionType *rs;
+    function<void()> then;
+    string failure;
+    bool always;
+};
+
+
+// a descriptor registered with the event loop; a socket's single descriptor serves both directions
+#define WANT_READ   0x1
+#define WANT_WRITE  0x2
+
+struct receiverWatchType {
+    receiverSessionType *rs;
+    int fd;
+    unsigned int events;    // WANT_READ and/or WANT_WRITE as registered
+};
+
+
+struct receiverSessionType {
+    BackupConfig *config;
+    IPC_Base *client;
+    PipeExec *command;          // the faub command when client isn't an agent
+    receiverWatchType readWatch;
+    receiverWatchType writeWatch;
+    receiverStateType state;
+    bool blocked;               // waiting on our own work before the rest of the input makes sense
+    bool failing;
+    time_t lastHeard;
+    unsigned int timeout;
+
+    string inBuf;
+    size_t inPos;
+    string outBuf;
+
+    __int64_t clientCaps;
+    __int64_t totalFS;
+    string prevDir;
+    string newDir;
+    string tempDir;
+
+    // phase 1 entries waiting to be compared
+    string entryName;
+    vector<localEntryType> entries;
+
+    // phase 2 & 3
+    string requests;
+    vector<string> needed;
+    vector<bool> touched;
+    size_t nextNeeded;
+    __int64_t header[4];
+    __int64_t remaining;
+
+    // worker side
+    unique_ptr<FaubSession> session;
+    unique_ptr<DirEntryWriter> writer;
+
+    // guarded by the receiver's poolLock
+    deque<receiverJobType> jobs;
+    bool scheduled;
+    bool failed;
+};
+
+
+/* FaubReceiver
+ *
+ * --multiplex: the server's half of many faub backups at once from a single process.
+ * Each profile's client (its agent, or its faub command) is read and written without
+ * blocking from one event loop (epoll, or kqueue off Linux), which follows each
+ * session through the same protocol fs_serverProcessing() follows with blocking
+ * reads.  Anything that touches the disk -- comparing to the previous backup,
+ * writing what arrives, the final links and rename -- runs on a pool of worker
+ * threads, one job at a time per session and in order, through the same
+ * FaubSession & DirEntryWriter the blocking path uses.
+ * When more received data is waiting on the workers than RECEIVER_HIGHWATER the loop
+ * stops reading until it drains, so a slow disk holds the clients back rather than
+ * filling memory.
+ */
+class FaubReceiver {
+    size_t workers;
+    size_t maxSessions;
+    int pollFd;
+    int wakePipe[2];
+    receiverWatchType wakeWatch;
+
+    vector<BackupConfig*> waiting;
+    vector<receiverSessionType*> sessions;
+    vector<PipeExec*> reaping;              // finished commands whose children haven't exited yet
+    bool throttled;                         // not reading from anyone while the workers catch up
+    bool interrupted;
+    time_t lastTick;
+
+    mutex poolLock;
+    condition_variable poolReady;
+    deque<receiverSessionType*> ready;
+    deque<receiverCompletionType> completions;
+    size_t pendingBytes;
+    bool stopping;
+    mutex finishLock;                       // backups are put in place (and reported) one at a time
+    mutex forkLock;                         // so no faub command inherits another session's pipes
+
+    void worker();
+    void queue(receiverSessionType *rs, function<void()> work, function<void()> then = NULL, size_t bytes = 0, bool always = false);
+    void wake();
+    void complete();
+
+    void start(BackupConfig *config);
+    void connect(receiverSessionType *rs);
+    void connected(receiverSessionType *rs);
+    void begin(receiverSessionType *rs);
+    void watch(receiverSessionType *rs);
+    void reconcile(receiverWatchType& w, unsigned int events);
+    void unwatch(receiverSessionType *rs);
+    void waitReady(vector<pair<receiverWatchType*, unsigned int>>& readyWatches);
+    void readable(receiverSessionType *rs);
+    void writable(receiverSessionType *rs);
+    void parse(receiverSessionType *rs);
+    bool step(receiverSessionType *rs);
+    void compareEntries(receiverSessionType *rs, bool last);
+    void expectNeeded(receiverSessionType *rs);
+    void entryDone(receiverSessionType *rs);
+    void closeClient(receiverSessionType *rs);
+    void closeSession(receiverSessionType *rs);
+    void fail(receiverSessionType *rs, string reason);
+    void retire(receiverSessionType *rs);
+    void tick();
+
+public:
+    vector<BackupConfig*> handBack;         // replica sources, which fs_startServer() handles
+
+    FaubReceiver(size_t workerThreads, size_t maxConcurrent);
+    ~FaubReceiver();
+
+    void add(BackupConfig& config) { waiting.insert(waiting.end(), &config); }
+    bool run();
+};
+
+#endif
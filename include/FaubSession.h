@@ -0,0 +1,116 @@
+#ifndef FAUBSESSION_H
+#define FAUBSESSION_H
+
+#include <string>
+#include <set>
+#include <map>
+#include <tuple>
+#include "BackupConfig.h"
+#include "FaubEntry.h"
+#include "util_generic.h"
+
+using namespace std;
+
+/* FaubSession
+ *
+ * The server's half of one faub backup, whichever way the client's half arrives.
+ * fs_serverProcessing() drives it with blocking reads (or a scan of a local source)
+ * and the --multiplex receiver (FaubReceiver) from its event loop.  Both make the
+ * same calls in the same order for each filesystem the client sends:
+ *
+ *      startFS()                   the filesystem's name
+ *      compare()                   each entry of phase 1, deciding what's needed
+ *      requestDigest()             phase 2, each needed entry in order (hashfirst only)
+ *      linkTouched() / received()  phase 3, each needed entry in order
+ *      finishFS()                  phase 4
+ *
+ * and finish() once the client has no more.  Nothing in here exits; problems with
+ * individual entries are logged and counted, and finish() says whether the backup
+ * could be put in place.
+ */
+
+// an mtime-only change the client can confirm via digest instead of sending (hashfirst)
+struct touchCandidateType {
+    string prevFilename;
+    long size;
+    string digest;
+};
+
+
+class FaubSession {
+    map<string, manifestEntry> prevManifest;
+    map<ino_t, inodeSizeType> backupFiles;
+    set<string> backupDirs;
+    set<string> backupSymLinks;
+    bool unlistableNames;           // a path with a newline, which the per-line cache records can't hold
+    timer fsTime;
+
+    void tallyFile(struct stat& fileStat, bool linkedToPrev);
+    void tallyDirs(string entry, bool isDir);
+    string prevDigest(string file, long size, time_t mtime);
+
+public:
+    BackupConfig& config;
+    string prevDir;
+    string currentDir;              // the temp dir until finish() renames it
+    string originalCurrentDir;
+    bool local;
+    bool incTime;
+    bool ignoreTouch;
+    bool hashFirst;
+    bool animate;                   // draw the progress bar
+    bool trackInterrupt;            // keep GLOBALS.interruptFilename on the backup being built
+    __int64_t totalFS;
+    int completeFS;
+    timer backupTime;
+
+    size_t maxLinksReached;
+    size_t fileTotal;
+    size_t filesModified;
+    size_t filesHardLinked;
+    size_t filesSymLinked;
+    size_t receivedSymLinks;
+    size_t unmodDirs;
+    size_t linkErrors;
+    size_t touchMatches;
+    bool abortBackupAtEnd;
+
+    // usage of the new backup, tallied as it's built (see tallyFile())
+    DiskStats backupStats;
+
+    // all modified files (used to create the --diff list)
+    set<string> modifiedFiles;
+
+    // digest, size & mtime of every regular file in this backup
+    map<string, manifestEntry> manifest;
+
+    /* the current filesystem */
+    string fs;
+    set<string> neededFiles;                        // requested from the client, in the order they'll arrive
+    map<string, time_t> dirMtimes;                  // set at the very end
+    map<string, string> hardLinkList;               // unchanged entries to link from the previous backup
+    map<string, string> symLinkList;                // unchanged symlinks to recreate
+    map<string, string> duplicateList;              // unchanged files to copy because maxLinks is reached
+    map<string, touchCandidateType> touchCandidates;
+    long fsTotalBytesNeeded;
+    long fsBytesReceived;
+    size_t checkpointTotal;
+
+    FaubSession(BackupConfig& sessionConfig, string previousDir, string newDir, bool localSource, __int64_t clientCaps,
+                __int64_t filesystems, string tempExtension);
+
+    void startFS(string fsName);
+    void compare(string filename, long mtime, long mode, long size);
+    string requestDigest(string file);
+    bool isTouchCandidate(string file) { return hashFirst && touchCandidates.find(file) != touchCandidates.end(); }
+    string touchDigest(string file) { return touchCandidates[file].digest; }
+    void linkTouched(string file);
+    void received(string file, tuple<string, int, time_t, long, string> entryResult);
+    void finishFS();
+    bool finish();
+
+    string destination(string file) { return slashConcat(currentDir, file); }
+    void progress(int step);
+};
+
+#endif
@@ -0,0 +1,93 @@
+
+#ifndef INODEINDEX_H
+#define INODEINDEX_H
+
+#include <string>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <sys/stat.h>
+
+#include "InodeSet.h"
+
+using namespace std;
+
+/* InodeIndex
+ *
+ * A per-profile index of every inode in the profile's faub backups: its size and how
+ * many backups reference it.  With it, removing a backup is a matter of walking that
+ * backup's inode list rather than the backups themselves - inodes whose count drops
+ * to zero are the space freed, and the next backup's usage can be recalculated from
+ * its own and its new predecessor's inode lists.
+ *
+ * The index also records which backups it covers.  It's only trusted when that matches
+ * the profile's backups exactly; otherwise callers fall back to walking (recache()),
+ * and a full recache (--recalc) rebuilds it.
+ *
+ * Like FaubDB the file is a log: a snapshot of the whole index followed by a record per
+ * change (a backup added or removed, the base directory renamed), so saving a backup
+ * appends just that backup's inodes.  Knowing which backups are covered only needs the
+ * backup names, so the inode table is read only when sizes or counts are needed.  Once
+ * INDEX_COMPACT changes follow the snapshot the file is rewritten as a new one.
+ * Appends and rewrites take an exclusive flock() so that concurrent runs on the same
+ * profile (e.g. a cron backup and a manual one) don't lose each other's changes.
+ */
+
+struct inodeSizeType {
+    size_t size;
+    size_t blocks;
+};
+
+
+class InodeIndex {
+    struct refType {
+        size_t size;
+        size_t blocks;
+        unsigned int refs;
+    };
+
+    struct recordReader;
+
+    unordered_map<ino_t, refType> inodes;
+    set<string> backups;
+    string filename;
+    string pending;             // changes since the last save, as log records
+    size_t logRecords;          // changes following the file's snapshot, including those pending
+    bool loaded;
+    bool inodesLoaded;
+    bool rewrite;               // cleared; save a new snapshot rather than appending
+    bool damaged;               // the file has a partial or unreadable record
+
+    void load(bool withInodes = false);
+    void replay(int fd, bool withInodes);
+    bool replayLog(string& data, size_t pos, bool withInodes);
+    bool apply(char type, recordReader& reader, bool withInodes, size_t *freedBytes = NULL, size_t *freedBlocks = NULL);
+    void record(char type, string& payload, size_t *freedBytes = NULL, size_t *freedBlocks = NULL);
+    bool writeSnapshot();
+
+public:
+    void setFilename(string indexFile) {
+        filename = indexFile;
+        pending.clear();
+        logRecords = 0;
+        loaded = inodesLoaded = rewrite = damaged = false;
+    }
+
+    // true if the index describes exactly these backups
+    bool covers(const set<string>& backupDirs);
+    bool contains(string backupDir) { load(); return backups.find(backupDir) != backups.end(); }
+
+    void addBackup(string backupDir, map<ino_t, inodeSizeType>& files);
+
+    // drop a backup's references; returns the bytes (and 'freedBlocks') no longer referenced
+    size_t removeBackup(string backupDir, InodeSet& backupInodes, size_t& freedBlocks);
+
+    bool sizeOf(ino_t inode, inodeSizeType& size);
+    void renameBackups(string oldBaseDir, string newBaseDir);
+    void clear();
+    void save();
+
+    InodeIndex() : logRecords(0), loaded(false), inodesLoaded(false), rewrite(false), damaged(false) {}
+};
+
+#endif
@@ -0,0 +1,100 @@
+
+#ifndef INODESET_H
+#define INODESET_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sys/types.h>
+
+using namespace std;
+
+/* InodeSet
+ *
+ * A set of inode numbers kept as a sorted array.  A std::set spends ~40 bytes of
+ * node overhead on every 8-byte inode and chases pointers on every lookup; a
+ * profile's history can hold tens of millions of inodes, so here they're packed
+ * and searched with a binary search instead.
+ *
+ * Inserts are appended and the array is only sorted (and de-duplicated) when it's
+ * next read, so building a set in bulk costs a single sort.  Interleaving inserts
+ * with lookups would re-sort each time; collect first, then query.
+ *
+ * A set can also be saved to and mapped from a file (see InodeSet.cc for the
+ * format).  A mapped set is used in place, read-only; the first insert copies it
+ * into memory.
+ */
+
+class InodeSet {
+    vector<ino_t> inodes;
+    bool sorted;
+
+    // when mapped, the set is the 'mappedCount' inodes at 'mapped' rather than 'inodes'
+    const ino_t *mapped;
+    size_t mappedCount;
+    void *mapBase;
+    size_t mapLength;
+
+    void finalize() {
+        sort(inodes.begin(), inodes.end());
+        inodes.erase(unique(inodes.begin(), inodes.end()), inodes.end());
+        sorted = true;
+    }
+
+    void unmap();
+    void unmapToMemory();
+
+public:
+    void insert(ino_t inode) {
+        if (mapped != NULL)
+            unmapToMemory();
+
+        if (sorted && inodes.size() && inode <= inodes.back())
+            sorted = false;
+
+        inodes.push_back(inode);
+    }
+
+    bool contains(ino_t inode) { return binary_search(begin(), end(), inode); }
+
+    size_t size() { return end() - begin(); }
+    bool empty() { return mapped == NULL ? inodes.empty() : !mappedCount; }
+    bool isMapped() { return mapped != NULL; }
+    void reserve(size_t count) { if (mapped == NULL) inodes.reserve(count); }
+    void clear() { unmap(); vector<ino_t>().swap(inodes); sorted = true; }
+
+    const ino_t *begin() {
+        if (mapped != NULL) return mapped;
+        if (!sorted) finalize();
+        return inodes.data();
+    }
+
+    const ino_t *end() { return begin() + (mapped != NULL ? mappedCount : inodes.size()); }
+
+    // call 'callback' on each inode of this set that isn't in 'other' - a single pass over both
+    template <typename F> void forEachNotIn(InodeSet& other, F callback) {
+        auto otherIt = other.begin();
+        auto otherEnd = other.end();
+
+        for (auto inode: *this) {
+            while (otherIt != otherEnd && *otherIt < inode)
+                ++otherIt;
+
+            if (otherIt == otherEnd || *otherIt != inode)
+                callback(inode);
+        }
+    }
+
+    // binary file format; false if 'filename' isn't one (e.g. an old text list) or can't be read
+    bool mapFile(string filename);
+    bool saveFile(string filename);
+
+    InodeSet& operator=(const InodeSet& other);
+    InodeSet& operator=(InodeSet&& other);
+    InodeSet(const InodeSet& other) : InodeSet() { *this = other; }
+    InodeSet(InodeSet&& other) : InodeSet() { *this = move(other); }
+    InodeSet() : sorted(true), mapped(NULL), mappedCount(0), mapBase(NULL), mapLength(0) {}
+    ~InodeSet() { unmap(); }
+};
+
+#endif
@@ -0,0 +1,52 @@
+
+#ifndef MULTIMD5_H
+#define MULTIMD5_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+/* MultiMD5
+ *
+ * MD5 is serial within a stream, but independent streams can be hashed side by side:
+ * one set of vector instructions runs the same MD5 step for several streams at once,
+ * each in its own 32-bit lane.  On x86-64 that's 4 lanes with SSE2, 8 with AVX2 and 16
+ * with AVX-512, picked at runtime by what the CPU supports.  Elsewhere it falls back to
+ * plain C, one stream at a time (lanes() is then 1 and callers are better off with
+ * MD5file()'s OpenSSL).  The digests are the same as any other MD5's.
+ *
+ * Data is given to each stream with update() and buffered until every stream that's in
+ * use has at least a block (64 bytes) to hash, so feeding the streams in turn, a chunk
+ * each, keeps all the lanes busy.  final() returns a stream's digest (as hex) and frees
+ * the stream up to start on new data.
+ */
+
+class MultiMD5 {
+    struct streamType {
+        uint32_t state[4];
+        uint64_t length;        // bytes given to update() so far
+        string pending;         // not yet hashed
+        size_t consumed;        // leading bytes of pending that have been hashed
+        bool active;
+
+        streamType() : length(0), consumed(0), active(false) {}
+    };
+
+    vector<streamType> streams;
+
+    void hashReady(bool partial);
+
+public:
+    // the number of streams hashed at once on this CPU, and what's doing it (e.g. "avx2")
+    static unsigned int lanes();
+    static string engine();
+
+    void update(size_t stream, const void *data, size_t count);
+    string final(size_t stream);
+
+    MultiMD5(size_t numStreams) : streams(numStreams) {}
+};
+
+#endif
@@ -0,0 +1,62 @@
+
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <sys/time.h>
+
+using namespace std;
+
+/* RateLimiter
+ *
+ * A token bucket that holds this process to a number of bytes per second.  Each
+ * chunk that's read or written is reported via consume(), which sleeps just long
+ * enough to keep the average at the current rate.  Up to a second's worth of unused
+ * allowance can build up, so short bursts aren't penalized.
+ *
+ * The rate comes from a spec of comma-separated entries, each a size per second (as
+ * accepted by approx2bytes(), e.g. "500K" or "10M"), optionally restricted to a time
+ * of day with "@HH[:MM]-HH[:MM]".  The first entry whose window covers the current
+ * time applies and an entry without a window covers any time.  When none applies the
+ * rate is unlimited.  For example "2M@08-18,20M" allows 2MB/s during business hours
+ * and 20MB/s otherwise, while "1M@09-17" only limits during the day.
+ *
+ * consume() may be called from several threads at once; they share the one allowance.
+ */
+
+struct rateWindowType {
+    int startMinute;    // minutes past midnight; a window may wrap past midnight
+    int endMinute;
+    size_t bytesPerSec;
+};
+
+
+class RateLimiter {
+    vector<rateWindowType> schedule;
+    double tokens;
+    struct timeval last;
+    time_t rateCheckedAt;
+    size_t rate;
+    mutex limitLock;
+
+public:
+    // parse a spec (see above); false with 'error' set if it's invalid
+    bool setSpec(string spec, string& error);
+
+    // account for 'bytes' of I/O, sleeping if we're ahead of the allowed rate
+    void consume(size_t bytes);
+
+    // bytes per second allowed right now; 0 for unlimited
+    size_t currentRate();
+
+    bool active() { return schedule.size(); }
+
+    // the same spec with every rate split 'parts' ways (for profiles run in parallel)
+    static string divideSpec(string spec, int parts);
+
+    RateLimiter() : tokens(0), rateCheckedAt(0), rate(0) { last.tv_sec = last.tv_usec = 0; }
+};
+
+#endif
@@ -14,7 +14,7 @@ enum SetType { INT, STRING, BOOL, OCTAL, SIZE, STRING_VECTOR };
 enum SetSpecifier { sTitle, sDirectory, sBackupFilename, sBackupCommand, sDays, sWeeks, sMonths, sYears, sFailsafeBackups, sFailsafeDays,
     sSCPTo, sSFTPTo, sPruneLive, sNotify, sMaxLinks, sIncTime, sNos, sMinSize, sDOW, sFP, sMode, sMinSpace, sMinSFTPSpace, sNice, sTripwire, 
     sNotifyEvery, sMailFrom, sLeaveOutput, sFaub, sUID, sGID, sConsolidate, sBloat, sUUID, sFailsafeSlow, sDefault, sDataOnly, sInclude, sExclude,
-    sFilterDirs, sPaths, sArchive, sReplicateTo, sIgnoreTouch };
+    sFilterDirs, sPaths, sArchive, sReplicateTo, sIgnoreTouch, sAgent, sAgentKey, sBwLimit, sIOLimit, sDigest };
 
 extern map<string, int>settingMap;
 
@@ -1,3 +1,6 @@
+#ifndef FAUB_H
+#define FAUB_H
+
 #include <string>
 #include <vector>
 #include "BackupConfig.h"
@@ -5,12 +8,48 @@
 
 using namespace std;
 
+#define FAUB_AGENT_PORT     4750    // default port for --listen and --agent
+#define FAUB_AGENT_TIMEOUT  60
+#define FAUB_FANOUT_WAIT    600     // default secs an agent waits for all servers of a fan-out group
+#define FAUB_FANOUT_TIMEOUT 3600    // fanned-out sessions wait on each other, so allow much longer I/O gaps
+
+
+// a directory entry found by scanning a local source (same detail a client sends in phase 1)
+struct localEntryType {
+    string filename;
+    time_t mtime;
+    mode_t mode;
+    off_t size;
+};
+
+
+// one server being fed by a faub client session
+struct clientDestType {
+    IPC_Base *server;
+    bool hashFirst;
+};
+
 
 string mostRecentBackupDir(string backupDir);
-string newBackupDir(string backupDir);
-void fs_serverProcessing(PipeExec& client, BackupConfig& config, string prevDir, string currentDir);
+string mostRecentBackupDirSince(string backupDir, string sinceDir, string profileName);
+string newBackupDir(BackupConfig& config);
+void fs_serverProcessing(IPC_Base *client, BackupConfig& config, string prevDir, string currentDir, vector<string> localPaths = {});
 void fs_startServer(BackupConfig& config);
-size_t fc_scanToServer(string entryName, IPC_Base& server);
-size_t fc_sendFilesToServer(IPC_Base& server);
+string fs_faubCommand(BackupConfig& config);
+bool fs_multiplexable(BackupConfig& config);
+TCP_Socket *fs_connectAgent(BackupConfig& config, string& error);
+void fs_verifyStats(BackupConfig& config, string backupDir, DiskStats& tallied);
+void fs_replicaReceive(IPC_Base *client, BackupConfig& config);
+size_t fc_scanToServer(BackupConfig& config, string entryName, IPC_Base& server);
+size_t fc_scanToServers(BackupConfig& config, string entryName, vector<IPC_Base*> servers);
+size_t fc_scanLocal(BackupConfig& config, string entryName, vector<localEntryType>& entries);
+size_t fc_sendFilesToServer(IPC_Base& server, bool hashFirst = false);
+size_t fc_sendFilesToServers(vector<clientDestType>& dests);
+void fc_clientSession(BackupConfig& config, vector<string> paths, IPC_Base& server, bool hashFirst);
+void fc_clientSession(BackupConfig& config, vector<string> paths, vector<clientDestType>& dests);
 void fc_mainEngine(BackupConfig& config, vector<string> paths);
+void fc_agent(BackupConfig& config, string address, vector<string> paths);
+void fc_replicaSource(BackupConfig& config);
 void pruneFaub(BackupConfig& config);
+
+#endif
@@ -6,11 +6,13 @@
 
 #include <unistd.h>
 #include <set>
+#include <atomic>
 
 #include "cxxopts.hpp"
 #include "colors.h"
 #include "debug.h"
 #include "tagging.h"
+#include "RateLimiter.h"
 
 
 /*
@@ -153,6 +155,20 @@
 #define CLI_FORMAT "format"
 #define CLI_INTERACTIVE "interactive"
 #define CLI_IGNORETOUCH "ignoretouch"
+#define CLI_AGENT "agent"
+#define CLI_AGENTKEY "agentkey"
+#define CLI_LISTEN "listen"
+#define CLI_UNENCRYPTED "unencrypted"
+#define CLI_MAXPARALLEL "maxparallel"
+#define CLI_MULTIPLEX "multiplex"
+#define CLI_FANOUT "fanout"
+#define CLI_FANOUTWAIT "fanoutwait"
+#define CLI_REPLICASOURCE "replicasource"
+#define CLI_BWLIMIT "bwlimit"
+#define CLI_IOLIMIT "iolimit"
+#define CLI_DIGEST "digest"
+#define CLI_VERIFYSTATS "verifystats"
+#define CLI_THREADS "threads"
 
 // conf file regexes
 #define CAPTURE_VALUE string("((?:\\s|=|:|\\b)+)(.*?)\\s*?")
@@ -202,6 +218,11 @@
 #define RE_ARCHIVE "(archive|archived)"
 #define RE_REPLICATETO "(rep|replicate|replicateto)"
 #define RE_IGNORETOUCH "(ignoretouch)"
+#define RE_AGENT "(agent)"
+#define RE_AGENTKEY "(agentkey|agent_key)"
+#define RE_BWLIMIT "(bwlimit|bw_limit|netlimit)"
+#define RE_IOLIMIT "(iolimit|io_limit|disklimit)"
+#define RE_DIGEST "(digest)"
 
 #define INTERP_FULLDIR "{fulldir}"
 #define INTERP_SUBDIR "{subdir}"
@@ -217,7 +238,7 @@ struct global_vars {
     int sessionId;
     unsigned int debugSelector;
     time_t startupTime;
-    unsigned long statsCount;
+    atomic<unsigned long> statsCount;     // updated from worker threads
     unsigned long md5Count;
     int pid;
     cxxopts::ParseResult cli;
@@ -233,6 +254,8 @@ struct global_vars {
     int pipes[2][2];
     set<int> reapedPids;
     Tagging tags;
+    RateLimiter netLimit;
+    RateLimiter diskLimit;
 };
 
 #endif
@@ -5,6 +5,9 @@
 #include <string>
 #include <vector>
 #include <tuple>
+#include "RateLimiter.h"
+#include "BackupEntry.h"
+#include "util_generic.h"
 
 #define BUFFER_SIZE     (1024 * 64)
 #define NET_DELIM       ";\n"
@@ -12,6 +15,19 @@
 #define NET_OVER_DELIM  string(string(NET_OVER) + string(NET_DELIM)).c_str()
 #define NET_ABORT       "=-_/ABORT;=-0,"
 
+// optional capabilities a newer client can announce before the filesystem count.
+// older servers never see this because they don't ask for any capabilities.
+#define NET_CAPS            ((__int64_t)0x4D42434150530000)
+#define NET_CAP_HASHFIRST   0x1     // client compares digests before sending touched files
+#define NET_CAP_REPLICA     0x2     // client is a backup server sending its backups (see fc_replicaSource() in faub.cc)
+#define NET_TOUCH_MATCH     1       // hashfirst reply: client copy matches the server's digest
+#define NET_TOUCH_SEND      0       // hashfirst reply: full dir entry follows
+
+// faub agent greeting and session flags (see fc_agent() in faub.cc)
+#define NET_AGENT_HELLO         ((__int64_t)0x4D424147454E5400)
+#define NET_AGENT_IGNORETOUCH   0x1     // server wants hashfirst (--ignoretouch)
+#define NET_AGENT_EXCLUDE       0x2     // the session's pattern is an exclude rather than an include
+
 
 using namespace std;
 
@@ -32,17 +48,21 @@ protected:
     string strBuf;
     char rawBuf[BUFFER_SIZE];
     int ioErrors;
+    bool writeFailed;       // the other end is gone; later writes are dropped
+    bool softFail;          // a write timeout marks the connection failed rather than throwing
+    RateLimiter *limiter;
     
 public:
     /* structors */
-    IPC_Base(int rFd, int wFd, unsigned int timeout = 120) : readFd(rFd), writeFd(wFd), timeoutSecs(timeout) { ioErrors = 0; };
+    IPC_Base(int rFd, int wFd, unsigned int timeout = 120) : readFd(rFd), writeFd(wFd), timeoutSecs(timeout), limiter(NULL) {
+        ioErrors = 0; writeFailed = softFail = false; };
     ~IPC_Base() { ipcClose(); }
     
     /* reads */
     ssize_t ipcRead(void *data, size_t count);
     __int64_t ipcRead();
     string ipcReadTo(string delimiter);
-    tuple<string, int, time_t, long> ipcReadToFile(string filename, bool preDelete = false);
+    tuple<string, int, time_t, long, string> ipcReadToFile(string filename, bool preDelete = false);
     void readAndTrash();
     bool readAndMatch(string matchStr);
     string statefulReadAndMatchRegex(string regex);
@@ -53,26 +73,79 @@ public:
     ssize_t ipcWrite(__int64_t data);
     void ipcSendDirEntry(string filename);
     void ipcSendRawFile(string filename, __int64_t fileSize = 0);
+    static void ipcSendDirEntry(string filename, vector<IPC_Base*> destinations);
+    static void ipcSendRawFile(string filename, __int64_t fileSize, vector<IPC_Base*> destinations);
     
     /* administration */
     void ipcClose();
+    void setTimeout(unsigned int timeout) { timeoutSecs = timeout; }
+    unsigned int getTimeout() { return timeoutSecs; }
+    void setLimiter(RateLimiter *rateLimiter) { limiter = rateLimiter; }   // throttle reads & writes
+    void setSoftFail(bool soft) { softFail = soft; }
+    void setFailed() { writeFailed = true; }
+    bool failed() { return writeFailed; }
+    int descriptor() { return readFd; }
+    int writeDescriptor() { return writeFd; }
+    string takeBuffered() { string data; data.swap(strBuf); return data; }   // read ahead but not yet consumed
+};
+
+
+/********************************************************************
+ * DirEntryWriter
+ * Saves one directory entry (as sent by ipcSendDirEntry) as its pieces
+ * arrive: the header, then a symlink's target or a file's size and its
+ * content in as many chunks as it takes.  A directory is complete after
+ * its header.  ipcReadToFile() feeds it from blocking reads and the
+ * --multiplex receiver (FaubReceiver) from its event loop.  result()
+ * means the same as ipcReadToFile()'s return value.
+ *******************************************************************/
+class DirEntryWriter {
+    string filename;
+    bool preDelete;
+    long uid, gid, mode, mtime;
+    long totalBytes;
+    FILE *dataf;
+    bool skipData;
+    bool decided;       // outcome is already known (directories, symlinks, unwritable paths)
+    string errorMsg;
+    md5Stream digest;
+    tuple<string, int, time_t, long, string> outcome;
+
+public:
+    DirEntryWriter(string entryFilename, bool preDeleteEntry = false) : filename(entryFilename), preDelete(preDeleteEntry),
+        uid(0), gid(0), mode(0), mtime(0), totalBytes(0), dataf(NULL), skipData(false), decided(false) {}
+    ~DirEntryWriter() { if (dataf != NULL) fclose(dataf); }
+    DirEntryWriter(const DirEntryWriter&) = delete;
+    DirEntryWriter& operator=(const DirEntryWriter&) = delete;
+
+    void header(long entryUid, long entryGid, long entryMode, long entryMtime);
+    void symlinkTarget(string target);
+    void fileSize(long size);
+    void fileData(const char *data, size_t count);
+    tuple<string, int, time_t, long, string> result();
 };
 
 
 /********************************************************************
  * TCP_Socket
- * This adds basic socket operations on top of IPC_Base.
+ * This adds basic socket operations on top of IPC_Base.  Addresses
+ * starting with a slash are unix domain socket paths.
  *******************************************************************/
 class TCP_Socket : public IPC_Base {
 public:
     /* structors */
     TCP_Socket(int port, int backlog, unsigned int timeout);   // listen as server
-    TCP_Socket(string server, int port, unsigned int timeout); // connect as client
+    TCP_Socket(string address, int port, int backlog, unsigned int timeout);   // listen on address or unix socket path
+    TCP_Socket(string server, int port, unsigned int timeout); // connect as client (host/IP or unix socket path)
     TCP_Socket(int fd, unsigned int timeout);                  // just set fds
     ~TCP_Socket() { ipcClose(); }
     
     /* administration */
-    TCP_Socket accept();
+    int accept();
+    
+    /* pass an open descriptor (plus a little data) to another process over a unix socket */
+    bool sendFd(int fd, __int64_t data);
+    int receiveFd(__int64_t& data);
 };
 
 
@@ -147,7 +220,7 @@ public:
     
     /* execution */
     int execute(string procName = "", bool leaveFinalOutput = false, bool noDestruct = false, bool noErrToDisk = false, bool noTmpCleanup = false);
-    bool execute2file(string toFile, string procName = "");
+    bool execute2file(string toFile, string procName = "", string *digest = NULL, string likelyMatch = "", digestType algorithm = dMD5);
     
     /* administration */
     string errorOutput();
@@ -156,6 +229,7 @@ public:
     int closeWrite();
     int closeAll();
     void pickupTheKids();
+    bool reapIfDone();
 };
 
 #endif
@@ -0,0 +1,127 @@
+
+#ifndef LANES_H
+#define LANES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* lanes
+ *
+ * pieces shared by the hashes that run several 32-bit word streams side by side in
+ * vector registers, one stream per lane (MultiMD5 and BLAKE3).  each loadBlocks*()
+ * reads a 64-byte block from every lane's data (at 'offset') and transposes them so
+ * that w[word] holds that word of each lane's block.  the wider ones are compiled for
+ * their instruction set and must only be called once the CPU is known to support it.
+ */
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+#define HAVE_LANES
+
+typedef uint32_t v4u __attribute__((vector_size(16)));
+typedef uint32_t v8u __attribute__((vector_size(32)));
+typedef uint32_t v16u __attribute__((vector_size(64)));
+
+// sse2 is part of x86-64 itself
+static inline __attribute__((always_inline)) void loadBlocks4(const unsigned char *data[], size_t offset, v4u w[16]) {
+    for (int quarter = 0; quarter < 4; ++quarter) {
+        __m128i r[4];
+        for (int lane = 0; lane < 4; ++lane)
+            r[lane] = _mm_loadu_si128((const __m128i*)(data[lane] + offset + quarter * 16));
+
+        __m128i t0 = _mm_unpacklo_epi32(r[0], r[1]), t1 = _mm_unpacklo_epi32(r[2], r[3]);
+        __m128i t2 = _mm_unpackhi_epi32(r[0], r[1]), t3 = _mm_unpackhi_epi32(r[2], r[3]);
+
+        w[quarter * 4 + 0] = (v4u)_mm_unpacklo_epi64(t0, t1);
+        w[quarter * 4 + 1] = (v4u)_mm_unpackhi_epi64(t0, t1);
+        w[quarter * 4 + 2] = (v4u)_mm_unpacklo_epi64(t2, t3);
+        w[quarter * 4 + 3] = (v4u)_mm_unpackhi_epi64(t2, t3);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) void loadBlocks8(const unsigned char *data[], size_t offset, v8u w[16]) {
+    for (int half = 0; half < 2; ++half) {
+        __m256i r[8], t[8], u[8];
+        for (int lane = 0; lane < 8; ++lane)
+            r[lane] = _mm256_loadu_si256((const __m256i*)(data[lane] + offset + half * 32));
+
+        // 4x4 transposes within each 128 bits, then pair up the halves
+        for (int lane = 0; lane < 8; lane += 4) {
+            t[lane + 0] = _mm256_unpacklo_epi32(r[lane + 0], r[lane + 1]);
+            t[lane + 1] = _mm256_unpackhi_epi32(r[lane + 0], r[lane + 1]);
+            t[lane + 2] = _mm256_unpacklo_epi32(r[lane + 2], r[lane + 3]);
+            t[lane + 3] = _mm256_unpackhi_epi32(r[lane + 2], r[lane + 3]);
+
+            u[lane + 0] = _mm256_unpacklo_epi64(t[lane + 0], t[lane + 2]);
+            u[lane + 1] = _mm256_unpackhi_epi64(t[lane + 0], t[lane + 2]);
+            u[lane + 2] = _mm256_unpacklo_epi64(t[lane + 1], t[lane + 3]);
+            u[lane + 3] = _mm256_unpackhi_epi64(t[lane + 1], t[lane + 3]);
+        }
+
+        for (int word = 0; word < 4; ++word) {
+            w[half * 8 + word] = (v8u)_mm256_permute2x128_si256(u[word], u[word + 4], 0x20);
+            w[half * 8 + word + 4] = (v8u)_mm256_permute2x128_si256(u[word], u[word + 4], 0x31);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+static inline __attribute__((always_inline)) void loadBlocks16(const unsigned char *data[], size_t offset, v16u w[16]) {
+    __m512i r[16], t[16], u[16];
+    for (int lane = 0; lane < 16; ++lane)
+        r[lane] = _mm512_loadu_si512((const void*)(data[lane] + offset));
+
+    // 4x4 transposes within each 128 bits
+    for (int lane = 0; lane < 16; lane += 4) {
+        t[lane + 0] = _mm512_unpacklo_epi32(r[lane + 0], r[lane + 1]);
+        t[lane + 1] = _mm512_unpackhi_epi32(r[lane + 0], r[lane + 1]);
+        t[lane + 2] = _mm512_unpacklo_epi32(r[lane + 2], r[lane + 3]);
+        t[lane + 3] = _mm512_unpackhi_epi32(r[lane + 2], r[lane + 3]);
+
+        u[lane + 0] = _mm512_unpacklo_epi64(t[lane + 0], t[lane + 2]);
+        u[lane + 1] = _mm512_unpackhi_epi64(t[lane + 0], t[lane + 2]);
+        u[lane + 2] = _mm512_unpacklo_epi64(t[lane + 1], t[lane + 3]);
+        u[lane + 3] = _mm512_unpackhi_epi64(t[lane + 1], t[lane + 3]);
+    }
+
+    // then a 4x4 transpose of the 128 bit pieces
+    for (int word = 0; word < 4; ++word) {
+        __m512i v0 = _mm512_shuffle_i32x4(u[word], u[word + 4], _MM_SHUFFLE(1, 0, 1, 0));
+        __m512i v1 = _mm512_shuffle_i32x4(u[word], u[word + 4], _MM_SHUFFLE(3, 2, 3, 2));
+        __m512i v2 = _mm512_shuffle_i32x4(u[word + 8], u[word + 12], _MM_SHUFFLE(1, 0, 1, 0));
+        __m512i v3 = _mm512_shuffle_i32x4(u[word + 8], u[word + 12], _MM_SHUFFLE(3, 2, 3, 2));
+
+        w[word + 0] = (v16u)_mm512_shuffle_i32x4(v0, v2, _MM_SHUFFLE(2, 0, 2, 0));
+        w[word + 4] = (v16u)_mm512_shuffle_i32x4(v0, v2, _MM_SHUFFLE(3, 1, 3, 1));
+        w[word + 8] = (v16u)_mm512_shuffle_i32x4(v1, v3, _MM_SHUFFLE(2, 0, 2, 0));
+        w[word + 12] = (v16u)_mm512_shuffle_i32x4(v1, v3, _MM_SHUFFLE(3, 1, 3, 1));
+    }
+}
+#endif
+
+
+// which of the above the CPU can run: the number of lanes (1 if none) and a name for it
+struct laneEngineType {
+    unsigned int lanes;
+    const char *name;
+};
+
+static inline laneEngineType laneEngine() {
+#if defined(HAVE_LANES)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f"))
+        return { 16, "avx512" };
+
+    if (__builtin_cpu_supports("avx2"))
+        return { 8, "avx2" };
+
+    return { 4, "sse2" };
+#else
+    return { 1, "scalar" };
+#endif
+}
+
+#endif
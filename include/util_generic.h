@@ -12,6 +12,10 @@
 
 #include "pcre++.h"
 #include "globals.h"
+#include "InodeSet.h"
+#include "DirStamps.h"
+#include "BackupEntry.h"
+#include "Blake3.h"
 
 using namespace pcrepp;
 using namespace std;
@@ -164,8 +168,44 @@ string getDirUp(string path);
 string slashConcat(string str1, string str2, string str3 = "");
 
 string MD5file(string filename, bool quiet = 0, string reason = "");
+string digestFile(string filename, digestType algorithm, bool quiet = 0, string reason = "");
+
+// digest a batch of files using up to 'threads' at once; digests come back in the same order
+vector<string> digestFiles(vector<string>& filenames, digestType algorithm, int threads);
 string MD5string(string data);
 
+// incremental MD5 for data that's only seen once, e.g. as it streams off the wire
+class md5Stream {
+    struct evp_md_ctx_st *context;
+    
+public:
+    void update(const void *data, size_t count);
+    string final();
+    
+    md5Stream();
+    ~md5Stream();
+    md5Stream(const md5Stream&) = delete;
+    md5Stream& operator=(const md5Stream&) = delete;
+};
+
+// the same for either digestType (BLAKE3's cut to 128 bits, like MD5's)
+class digestStream {
+    digestType algorithm;
+    md5Stream md5;
+    blake3Stream blake3;
+
+public:
+    void update(const void *data, size_t count);
+    string final();
+
+    digestStream(digestType anAlgorithm = dMD5) : algorithm(anAlgorithm) {}
+};
+
+// keyed digest, random nonce and constant-time compare for authenticating peers
+string HMACsha256(string key, string data);
+string randomHex(size_t bytes);
+bool secureEquals(string a, string b);
+
 string onevarsprintf(string format, string data);
 
 string approximate(size_t size, int maxUnits = -1, bool commas = false, bool base10 = false);
@@ -221,7 +261,21 @@ int mkbasedirs(string path);
 time_t userInput2timet(string input);
 
 // du -s
-DiskStats dus(string path, set<ino_t>& seenInodes, set<ino_t>& newInodes);
+struct dusWalkType {
+    struct fileType {
+        ino_t inode;
+        size_t size;
+        size_t blocks;
+    };
+    
+    vector<fileType> files;
+    size_t dirs;
+    size_t symLinks;
+};
+
+void dusWalk(string path, dusWalkType& walk);
+DiskStats dusTally(dusWalkType& walk, InodeSet& seenInodes, InodeSet& newInodes);
+DiskStats dus(string path, InodeSet& seenInodes, InodeSet& newInodes);
 DiskStats dus(string path);
 
 string errorcom(string profile, string message);
@@ -241,6 +295,15 @@ string getUserHomeDir(int uid = -1);
 
 int getUidFromName(string userName);
 
+// the date (and time, if included) in a backup's name, e.g. "-2023-01-05@10:15:23"
+struct backupDateType {
+    int year, month, day;
+    int hour, minute, second;
+    bool hasTime;
+};
+
+bool parseBackupDate(const string& filename, backupDateType& date);
+
 time_t filename2Mtime(string filename);
 
 int forkMvCmd(string oldDir, string newDir);
@@ -261,8 +324,11 @@ struct pdCallbackData {
 
 enum backupTypes { SINGLE_ONLY, FAUB_ONLY, ALL_BACKUPS };
 
-string processDirectory(string directory, string pattern, bool exclude, bool filterDirs, bool (*callback)(pdCallbackData&), void *passData, int maxDepth = -1, bool includeTopDir = false, bool followSymLinks = false);
-string processDirectoryBackups(string directory, string pattern, bool exclude, bool (*callback)(pdCallbackData&), void *passData, backupTypes backupType, int maxDepth = -1, bool followSymLinks = true);
+// a backup's path: year/month or year/month/day directories then the backup
+#define BACKUP_PATH_REGEX "./\\d{4}/\\d{2}(?:/\\d{2}){0,1}/(?!\\d{2}\\b)[^/]+$"
+
+string processDirectory(string directory, string pattern, bool exclude, bool filterDirs, bool (*callback)(pdCallbackData&), void *passData, int maxDepth = -1, bool includeTopDir = false, bool followSymLinks = false, DirStamps *stamps = NULL);
+string processDirectoryBackups(string directory, string pattern, bool exclude, bool (*callback)(pdCallbackData&), void *passData, backupTypes backupType, int maxDepth = -1, bool followSymLinks = true, DirStamps *stamps = NULL);
 
 string progressPercentageA(long totalIterations, int totalSteps = 7, long iterationsComplete = 0, int stepsComplete = 0, string detail = "");
 string progressPercentageB(long totalBytes, long completedBytes);
@@ -2,10 +2,14 @@
 #include <map>
 #include <string>
 #include <set>
+#include <algorithm>
 #include <fstream>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <string.h>
 
 #include "BackupEntry.h"
 #include "BackupCache.h"
@@ -19,7 +23,192 @@ extern void cleanupAndExitOnError();
 
 using namespace std;
 
+#define CACHE_MAGIC     "MB1FCACH"
+#define CACHE_VERSION   3           // version 1 was a line of text per entry; 2 had no digest type
+
+/* the cache file is a header, then 'count' fixed-size records (one per backup),
+ * then a string table holding the filenames the records refer to.  numbers are
+ * in the machine's byte order; the file is only meant for the machine that wrote
+ * it.  earlier versions (whose digests are all MD5s) are still read and are
+ * replaced the next time the cache is saved. */
+struct cacheFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t count;
+    uint64_t stringsSize;
+};
+
+struct cacheFileRecord {
+    uint64_t mtime;
+    uint64_t size;
+    uint64_t duration;
+    uint64_t nameOffset;    // into the string table
+    uint32_t nameLength;
+    uint32_t links;
+    unsigned char md5[16];
+    uint32_t digest;        // digestType of md5
+    uint32_t unused;
+};
+
+struct cacheFileRecordV2 {
+    uint64_t mtime;
+    uint64_t size;
+    uint64_t duration;
+    uint64_t nameOffset;
+    uint32_t nameLength;
+    uint32_t links;
+    unsigned char md5[16];
+};
+
+
+/* read a cache file of any version into 'entries'.  the file is mapped rather than
+ * read and binary records are converted directly, with no per-line parsing. */
+bool readCacheFile(string filename, vector<BackupEntry>& entries) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat statData;
+    if (fstat(fd, &statData)) {
+        close(fd);
+        return false;
+    }
+
+    if (!statData.st_size) {
+        close(fd);
+        return true;
+    }
+
+    size_t length = statData.st_size;
+    char *data = (char*)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return false;
+
+    auto header = (cacheFileHeader*)data;
+    if (length >= sizeof(cacheFileHeader) && !memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic))) {
+        size_t recordSize = header->version == 2 ? sizeof(cacheFileRecordV2) : sizeof(cacheFileRecord);
+        size_t available = length - sizeof(cacheFileHeader);
+
+        // bound count and stringsSize by the file's length before multiplying so a
+        // damaged header can't wrap the size calculation
+        if ((header->version != CACHE_VERSION && header->version != 2) || header->recordSize != recordSize ||
+            header->count > available / recordSize ||
+            header->stringsSize != available - header->count * recordSize)
+            log("error: " + filename + " is an unrecognized or damaged cache; ignoring it");
+        else {
+            auto records = data + sizeof(cacheFileHeader);
+            auto strings = records + header->count * recordSize;
+            entries.reserve(entries.size() + header->count);
+
+            // a version 2 record is the start of a current one
+            for (uint64_t i = 0; i < header->count; ++i) {
+                auto record = (cacheFileRecord*)(records + i * recordSize);
+                if (record->nameOffset > header->stringsSize ||
+                    record->nameLength > header->stringsSize - record->nameOffset ||
+                    (header->version != 2 && record->digest > dBLAKE3))
+                    continue;
+
+                BackupEntry entry;
+                entry.filename.assign(strings + record->nameOffset, record->nameLength);
+                memcpy(entry.md5.words, record->md5, sizeof(record->md5));
+                entry.algorithm = header->version == 2 ? dMD5 : (digestType)record->digest;
+                entry.links = record->links;
+                entry.mtime = record->mtime;
+                entry.size = record->size;
+                entry.duration = record->duration;
+                entries.insert(entries.end(), entry);
+            }
+        }
+    }
+    else {
+        // version 1
+        char *pos = data;
+        char *end = data + length;
+
+        while (pos < end) {
+            char *eol = (char*)memchr(pos, '\n', end - pos);
+            if (eol == NULL)
+                eol = end;
+
+            BackupEntry entry;
+            if (entry.string2class(string(pos, eol - pos)))
+                entries.insert(entries.end(), entry);
+
+            pos = eol + 1;
+        }
+    }
+
+    munmap(data, length);
+    return true;
+}
+
+
+/* write entries to a cache file, via a temporary file that's renamed into place so
+ * that a reader never sees a partial cache.  entries under 'oldBaseDir' are recorded
+ * under 'newBaseDir' instead, for relocating a profile. */
+bool writeCacheFile(string filename, vector<BackupEntry*>& entries, string oldBaseDir = "", string newBaseDir = "") {
+    vector<cacheFileRecord> records;
+    string strings;
+
+    records.reserve(entries.size());
+    for (auto entry: entries) {
+        cacheFileRecord record;
+        string name = entry->filename;
+
+        // only entries with a digest are worth keeping; the version 1 format skipped these too
+        if (entry->md5.empty())
+            continue;
+        
+        memcpy(record.md5, entry->md5.words, sizeof(record.md5));
+        record.digest = entry->algorithm;
+        record.unused = 0;
+
+        if (oldBaseDir.length() && name.find(oldBaseDir) == 0)
+            name = slashConcat(newBaseDir, name.substr(oldBaseDir.length()));
+
+        record.mtime = entry->mtime;
+        record.size = entry->size;
+        record.duration = entry->duration;
+        record.links = entry->links;
+        record.nameOffset = strings.length();
+        record.nameLength = name.length();
+        strings += name;
+
+        records.insert(records.end(), record);
+    }
+
+    cacheFileHeader header;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.recordSize = sizeof(cacheFileRecord);
+    header.count = records.size();
+    header.stringsSize = strings.length();
+
+    string tempFilename = filename + ".tmp." + to_string(getpid());
+    ofstream cacheFile(tempFilename, ios::binary | ios::trunc);
+    if (!cacheFile.is_open())
+        return false;
+
+    cacheFile.write((char*)&header, sizeof(header));
+    cacheFile.write((char*)records.data(), records.size() * sizeof(cacheFileRecord));
+    cacheFile.write(strings.data(), strings.length());
+    cacheFile.close();
+
+    if (cacheFile.fail() || rename(tempFilename.c_str(), filename.c_str())) {
+        unlink(tempFilename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
 BackupCache::BackupCache() {
+    entryCount = 0;
+    sorted = true;
     updated = false;
     inProcess = "";
 }
@@ -31,38 +220,31 @@ BackupCache::~BackupCache() {
 }
 
 void BackupCache::updateAges(time_t refTime) {
-    for (auto &raw: rawData)
-        raw.second.updateAges(refTime);
+    for (auto &entry: entries)
+        if (entry.filename.length())
+            entry.updateAges(refTime);
 }
 
 
 void BackupCache::saveCache(string oldBaseDir, string newBaseDir) {
-    ofstream cacheFile;
     string cFname = cacheFilename();
+    vector<BackupEntry*> current;
     
-    if (!rawData.size())
+    if (!entryCount)
         return;
     
     mkdirp(pathSplit(cFname).dir);
     
-    cacheFile.open(cFname);
-    if (cacheFile.is_open()) {
-        unsigned int count = 0;
-        
-        // write raw data
-        for (auto &raw: rawData) {
-            
-            // files need to be able to fall out of the cache if they disappear from the filesystem.
-            // "current" means the file was seen in the most recent filesystem scan.
-            if (raw.second.current) {
-                DEBUG(D_cache) DFMT(cFname << ": writing cache entry " << raw.second.class2string());
-                cacheFile << raw.second.class2string(oldBaseDir, newBaseDir) << endl;
-                ++count;
-            }
+    // files need to be able to fall out of the cache if they disappear from the filesystem.
+    // "current" means the file was seen in the most recent filesystem scan.
+    for (auto entry: getAll())
+        if (entry->current) {
+            DEBUG(D_cache) DFMT(cFname << ": writing cache entry " << entry->class2string());
+            current.insert(current.end(), entry);
         }
-        
-        cacheFile.close();
-        DEBUG(D_cache) DFMT("cache saved to " << cFname << " (" << count << " entries)");
+    
+    if (writeCacheFile(cFname, current, oldBaseDir, newBaseDir)) {
+        DEBUG(D_cache) DFMT("cache saved to " << cFname << " (" << current.size() << " entries)");
     }
     else {
         log("unable to save cache to " + cFname);
@@ -78,29 +260,25 @@ void BackupCache::saveCache(string oldBaseDir, string newBaseDir) {
 
 
 bool BackupCache::restoreCache(bool nukeFirst) {
-    ifstream cacheFile;
     string cFname = cacheFilename();
+    vector<BackupEntry> fileEntries;
     
-    cacheFile.open(cFname);
-    if (cacheFile.is_open()) {
+    if (readCacheFile(cFname, fileEntries)) {
         
         if (nukeFirst) {
-            rawData.clear();
+            entries.clear();
             indexByMD5.clear();
             indexByFilename.clear();
+            entryCount = 0;
         }
         
-        unsigned int count = 0;
-        string cacheData;
-        while (getline(cacheFile, cacheData)) {
-            ++count;
-            BackupEntry entry;
-            if (entry.string2class(cacheData))
-                addOrUpdate(entry);
-        }
+        entries.reserve(entries.size() + fileEntries.size());
+        indexByFilename.reserve(indexByFilename.size() + fileEntries.size());
         
-        cacheFile.close();
-        DEBUG(D_cache) DFMT("loaded " << plurali(count, "cache entr") << " from " << cFname);
+        for (auto &entry: fileEntries)
+            addOrUpdate(entry);
+        
+        DEBUG(D_cache) DFMT("loaded " << plurali(fileEntries.size(), "cache entr") << " from " << cFname);
         return true;
     }
     
@@ -110,31 +288,85 @@ bool BackupCache::restoreCache(bool nukeFirst) {
 
 BackupEntry* BackupCache::getByFilename(string filename) {
     auto filename_it = indexByFilename.find(filename);
-    if (filename_it != indexByFilename.end()) {
-        auto raw_it = rawData.find(filename_it->second);
-        if (raw_it != rawData.end()) {
-            return &raw_it->second;
-        }
-    }
     
-    return(NULL);
+    return filename_it == indexByFilename.end() ? NULL : &entries[filename_it->second];
 }
 
-set<BackupEntry*> BackupCache::getByMD5(string md5) {
-    set<BackupEntry*> result;
+
+vector<BackupEntry*> BackupCache::getByMD5(md5Digest md5) {
+    vector<BackupEntry*> result;
     
     auto md5_it = indexByMD5.find(md5);
-    if (md5_it != indexByMD5.end()) {
-        for (auto &fileID: md5_it->second) {
-            auto raw_it = rawData.find(fileID);
-            if (raw_it != rawData.end()) {
-                result.insert(&raw_it->second);
-            }
-        }
+    if (md5_it != indexByMD5.end())
+        for (auto fileID: md5_it->second)
+            result.insert(result.end(), &entries[fileID]);
+    
+    return result;
+}
+
+
+vector<BackupEntry*> BackupCache::getAll() {
+    vector<BackupEntry*> result;
+    result.reserve(entryCount);
+    
+    for (auto &entry: entries)
+        if (entry.filename.length())
+            result.insert(result.end(), &entry);
+    
+    return result;
+}
+
+
+vector<BackupEntry*> BackupCache::getSorted() {
+    if (!sorted) {
+        // each entry's sort key is made once here rather than on every comparison
+        vector<pair<string, unsigned int>> keys;
+        keys.reserve(entryCount);
+        
+        for (unsigned int id = 0; id < entries.size(); ++id)
+            if (entries[id].filename.length())
+                keys.insert(keys.end(), make_pair(nameSortKey(entries[id].filename), id));
+        
+        // names with equal keys (e.g. the same file in a day and a non-day subdir) are
+        // ordered by full filename, then id, so the order is the same from run to run
+        sort(keys.begin(), keys.end(), [this](const pair<string, unsigned int>& a, const pair<string, unsigned int>& b) {
+            if (a.first != b.first)
+                return a.first < b.first;
+
+            if (entries[a.second].filename != entries[b.second].filename)
+                return entries[a.second].filename < entries[b.second].filename;
+
+            return a.second < b.second;
+        });
+        
+        sortedIds.clear();
+        sortedIds.reserve(keys.size());
+        
+        for (auto &key: keys)
+            sortedIds.insert(sortedIds.end(), key.second);
+        
+        sorted = true;
     }
+    
+    vector<BackupEntry*> result;
+    result.reserve(sortedIds.size());
+    
+    for (auto id: sortedIds)
+        result.insert(result.end(), &entries[id]);
+    
     return result;
 }
 
+
+BackupEntry* BackupCache::getLastBackup() {
+    if (!entryCount)
+        return NULL;
+    
+    getSorted();
+    return &entries[sortedIds.back()];
+}
+
+
 void BackupCache::addOrUpdate(BackupEntry updatedEntry, bool markCurrent, bool md5Updated) {
     auto filename_it = indexByFilename.find(updatedEntry.filename);
     updatedEntry.current = markCurrent;
@@ -144,71 +376,38 @@ void BackupCache::addOrUpdate(BackupEntry updatedEntry, bool markCurrent, bool m
     
     // filename doesn't exist
     if (filename_it == indexByFilename.end()) {
-        unsigned int index = rawData.rbegin() == rawData.rend() ? 1 : rawData.rbegin()->first + 1;
-        
-        // add rawData
-        rawData.insert(rawData.end(), pair<unsigned int, BackupEntry>(index, updatedEntry));
-        
-        // update filename index
-        indexByFilename.insert(indexByFilename.end(), pair<string, unsigned int>(updatedEntry.filename, index));
+        unsigned int index = entries.size();
         
-        // update MD5 index
-        auto md5_it = indexByMD5.find(updatedEntry.md5);
-        set<unsigned int> md5_list;
+        entries.insert(entries.end(), updatedEntry);
+        indexByFilename.insert({updatedEntry.filename, index});
+        indexByMD5[updatedEntry.md5].push_back(index);
         
-        // is there an index (set) of files for this MD5?
-        if (md5_it != indexByMD5.end())
-            md5_it->second.insert(index);
-        else {
-            set<unsigned int> newSet;
-            newSet.insert(index);
-            indexByMD5.insert(indexByMD5.end(), pair<string, set<unsigned int> >(updatedEntry.md5, newSet));
-        }
+        ++entryCount;
+        sorted = false;
     }
     // filename does exist and we're updating it's data
     else {
         unsigned int index = filename_it->second;
-        auto raw_it = rawData.find(index);
-        if (raw_it != rawData.end()) {
-            auto backupEntry = raw_it->second;
-            string oldMD5 = backupEntry.md5;
-            
-            // update the rawData entry
-            raw_it->second = updatedEntry;
-            DEBUG(D_cache) DFMT("updated raw data for " << backupEntry.filename);
+        md5Digest oldMD5 = entries[index].md5;
+        
+        entries[index] = updatedEntry;
+        DEBUG(D_cache) DFMT("updated raw data for " << updatedEntry.filename);
+        
+        // if the md5 changed move the entry to the new md5's list
+        if (updatedEntry.md5 != oldMD5) {
+            auto md5_it = indexByMD5.find(oldMD5);
             
-            // if the md5 changed...
-            if (updatedEntry.md5 != oldMD5) {
-                auto md5_it = indexByMD5.find(oldMD5);
-                
-                // if the old one is in the index, remove it
-                if (md5_it != indexByMD5.end()) {
-                    md5_it->second.erase(index);
-                    DEBUG(D_cache) DFMT("(" << markCurrent << ") removed reference from old md5 (" << oldMD5 << ") to " << backupEntry.filename);
-                    
-                    if (!md5_it->second.size()) {
-                        indexByMD5.erase(oldMD5);
-                        DEBUG(D_cache) DFMT("(" << markCurrent << ") dropping old md5 " << oldMD5 << ", as " << backupEntry.filename << " was the last reference");
-                    }
-                }
+            if (md5_it != indexByMD5.end()) {
+                md5_it->second.erase(std::remove(md5_it->second.begin(), md5_it->second.end(), index), md5_it->second.end());
+                DEBUG(D_cache) DFMT("(" << markCurrent << ") removed reference from old md5 (" << oldMD5 << ") to " << updatedEntry.filename);
                 
-                // if the new md5 isn't in the index, add it
-                md5_it = indexByMD5.find(updatedEntry.md5);
-                if (md5_it != indexByMD5.end()) {
-                    md5_it->second.insert(index);
-                }
-                // if the md5 is already there, then just add this file to its list
-                else {
-                    set<unsigned int> newSet;
-                    newSet.insert(index);
-                    indexByMD5.insert(indexByMD5.end(), pair<string, set<unsigned int> >(updatedEntry.md5, newSet));
+                if (md5_it->second.empty()) {
+                    indexByMD5.erase(md5_it);
+                    DEBUG(D_cache) DFMT("(" << markCurrent << ") dropping old md5 " << oldMD5 << ", as " << updatedEntry.filename << " was the last reference");
                 }
             }
-        }
-        else {
-            // entry is in the filenameIndex but not the raw data.  should never get here.
-            SCREENERR("LOGIC ERROR - NO RAW DATA");
-            cleanupAndExitOnError();
+            
+            indexByMD5[updatedEntry.md5].push_back(index);
         }
     }
 }
@@ -219,69 +418,73 @@ void BackupCache::remove(BackupEntry oldEntry) {
     auto filename_it = indexByFilename.find(oldEntry.filename);
     if (filename_it != indexByFilename.end()) {
         unsigned int index = filename_it->second;
-        indexByFilename.erase(oldEntry.filename);    // and remove it
+        indexByFilename.erase(filename_it);    // and remove it
         DEBUG(D_cache) DFMT("removed " << oldEntry.filename << " from filename index");
         
-        // find the entry in the raw data
-        auto raw_it = rawData.find(index);
-        if (raw_it != rawData.end()) {
-            string fileMD5 = raw_it->second.md5;
-            rawData.erase(index);                    // and remove it
-            DEBUG(D_cache) DFMT("removed " << index << " from raw data");
+        // find the entry in the md5 index
+        md5Digest fileMD5 = entries[index].md5;
+        auto md5_it = indexByMD5.find(fileMD5);
+        if (md5_it != indexByMD5.end()) {
+            md5_it->second.erase(std::remove(md5_it->second.begin(), md5_it->second.end(), index), md5_it->second.end());
+            DEBUG(D_cache) DFMT("removed " << fileMD5 << " from md5 index");
             
-            // find the entry in the md5 index
-            auto md5_it = indexByMD5.find(fileMD5);
-            if (md5_it != indexByMD5.end()) {
-                md5_it->second.erase(index);     // and remove it
-                DEBUG(D_cache) DFMT("removed " << fileMD5 << " from md5 index");
-                
-                if (!md5_it->second.size()) {      // if that was the last/only file with that MD5
-                    indexByMD5.erase(fileMD5);    // then remove that MD5 entirely from the index
-                    DEBUG(D_cache) DFMT("removed final reference to " << fileMD5);
-                }
+            if (md5_it->second.empty()) {      // if that was the last/only file with that MD5
+                indexByMD5.erase(md5_it);      // then remove that MD5 entirely from the index
+                DEBUG(D_cache) DFMT("removed final reference to " << fileMD5);
             }
         }
+        
+        // leave the slot empty so the other ids stay put
+        entries[index] = BackupEntry();
+        DEBUG(D_cache) DFMT("removed " << index << " from raw data");
+        
+        --entryCount;
+        sorted = false;
     }
 }
 
 
 string BackupCache::size() {
-    return (to_string(rawData.size()) + string(" cache entries, ") +
+    return (to_string(entryCount) + string(" cache entries, ") +
             to_string(indexByFilename.size()) + string(" filename index, ") +
             to_string(indexByMD5.size()) + string(" MD5 index"));
 }
 
-string BackupCache::size(string md5) {
+string BackupCache::size(md5Digest md5) {
     auto md5_it = indexByMD5.find(md5);
     if (md5_it != indexByMD5.end()) {
-        return(md5_it->first + ": " + to_string(md5_it->second.size()));
+        return(md5_it->first.hex() + ": " + to_string(md5_it->second.size()));
     }
-    return (md5 + ": 0");
+    return (md5.hex() + ": 0");
 }
 
 string BackupCache::fullDump() {
     string result ("RAW Data\n");
-    for (auto &raw: rawData) {
-        result += "\tid:" + to_string(raw.first) +
-        ", file:" + raw.second.filename +
-        ", md5:" + raw.second.md5 +
-        ", size:" + to_string(raw.second.size) +
-        ", inod:" + to_string(raw.second.inode) +
-        ", dage:" + to_string(raw.second.fnameDayAge) +
-        ", dow:" + dw(raw.second.dow) +
-        ", day:" + to_string(raw.second.date_day) +
-        ", lnks:" + to_string(raw.second.links) +
-        ", mtim:" + to_string(raw.second.mtime) + "\n";
+    for (unsigned int id = 0; id < entries.size(); ++id) {
+        auto &entry = entries[id];
+        if (!entry.filename.length())
+            continue;
+        
+        result += "\tid:" + to_string(id) +
+        ", file:" + entry.filename +
+        ", " + digestName(entry.algorithm) + ":" + entry.md5.hex() +
+        ", size:" + to_string(entry.size) +
+        ", inod:" + to_string(entry.inode) +
+        ", dage:" + to_string(entry.fnameDayAge) +
+        ", dow:" + dw(entry.dow) +
+        ", day:" + to_string(entry.date_day) +
+        ", lnks:" + to_string(entry.links) +
+        ", mtim:" + to_string(entry.mtime) + "\n";
     }
     
     result += "\nFilename Index\n";
-    for (auto &filename: indexByFilename) {
-        result += "\t" + filename.first + ": " + to_string(filename.second) + "\n";
+    for (auto entry: getSorted()) {
+        result += "\t" + entry->filename + ": " + to_string(indexByFilename[entry->filename]) + "\n";
     }
     
     result += "\nMD5 Index\n";
     for (auto &md5: indexByMD5) {
-        result += "\t" + md5.first + ": ";
+        result += "\t" + md5.first.hex() + ": ";
         
         string detail;
         for (auto &fileID: md5.second) {
@@ -295,22 +498,20 @@ string BackupCache::fullDump() {
 }
 
 
-void BackupCache::reStatMD5(string md5) {
+void BackupCache::reStatMD5(md5Digest md5) {
     struct stat statBuf;
     
     auto md5_it = indexByMD5.find(md5);
     if (md5_it != indexByMD5.end()) {
         
         for (auto &fileID: md5_it->second) {
-            auto raw_it = rawData.find(fileID);
+            auto &entry = entries[fileID];
             
-            if (raw_it != rawData.end()) {
-                if (!mystat(raw_it->second.filename, &statBuf)) {
-                    raw_it->second.links = statBuf.st_nlink;
-                    raw_it->second.mtime = statBuf.st_mtime;
-                    raw_it->second.inode = statBuf.st_ino;
-                    DEBUG(D_cache) DFMT("restat: " << raw_it->second.filename << " (links " << raw_it->second.links << ")");
-                }
+            if (!mystat(entry.filename, &statBuf)) {
+                entry.links = statBuf.st_nlink;
+                entry.mtime = statBuf.st_mtime;
+                entry.inode = statBuf.st_ino;
+                DEBUG(D_cache) DFMT("restat: " << entry.filename << " (links " << entry.links << ")");
             }
         }
     }
@@ -318,8 +519,6 @@ void BackupCache::reStatMD5(string md5) {
 
 
 bool bcCleanupCallback(pdCallbackData &file) {
-    ifstream origCacheFile;
-    ofstream newCacheFile;
     BackupCache* cache = (BackupCache*)file.dataPtr;
     const string suffixNew = ".new";
     const string suffixUpdate = ".updating";
@@ -328,45 +527,31 @@ bool bcCleanupCallback(pdCallbackData &file) {
     
     // simplistic locking -- only one process succeeds at the rename when -K is elected
     if (!S_ISDIR(file.statData.st_mode) && !rename(file.filename.c_str(), workingFilename.c_str())) {
-        unsigned int verifiedBackups = 0;
-        
-        origCacheFile.open(workingFilename.c_str());
+        vector<BackupEntry> entries;
         
-        if (origCacheFile.is_open()) {
-            newCacheFile.open(newFilename.c_str());
+        if (readCacheFile(workingFilename, entries)) {
+            vector<BackupEntry*> verified;
             
-            if (newCacheFile.is_open()) {
-                string cacheData;
-                while (getline(origCacheFile, cacheData)) {
-                    BackupEntry entry;
-                    
-                    if (entry.string2class(cacheData)) {
-                        
-                        if (exists(entry.filename)) {
-                            newCacheFile << cacheData << endl;
-                            ++verifiedBackups;
-                        }
-                        else {
-                            log(entry.filename + " has vanished, updating cache");
-                            auto cacheEntry = cache->getByFilename(entry.filename);
-                            if (cacheEntry != NULL)
-                                cache->remove(*cacheEntry);
-                        }
-                    }
+            for (auto &entry: entries) {
+                if (cache->dirStamps.holds(entry.filename) || exists(entry.filename))
+                    verified.insert(verified.end(), &entry);
+                else {
+                    log(entry.filename + " has vanished, updating cache");
+                    auto cacheEntry = cache->getByFilename(entry.filename);
+                    if (cacheEntry != NULL)
+                        cache->remove(*cacheEntry);
                 }
-                
-                newCacheFile.close();
             }
-            else {
+            
+            if (verified.size() && !writeCacheFile(newFilename, verified)) {
                 SCREENERR(log("error: unable to create " + newFilename+ " - " + strerror(errno)));
                 rename(workingFilename.c_str(), file.filename.c_str());
                 cleanupAndExitOnError();
             }
             
-            origCacheFile.close();
             unlink(workingFilename.c_str());
             
-            if (verifiedBackups) {
+            if (verified.size()) {
                 if (rename(newFilename.c_str(), file.filename.c_str())) {
                     SCREENERR(log("error: unable to rename " + newFilename + " to " + file.filename + " (cache lost) - " + strerror(errno)));
                     cleanupAndExitOnError();
@@ -96,6 +96,11 @@ BackupConfig::BackupConfig(bool makeTemp) {
     settings.insert(settings.end(), Setting(CLI_ARCHIVE, RE_ARCHIVE, BOOL, "false"));
     settings.insert(settings.end(), Setting(CLI_REPLICATETO, RE_REPLICATETO, STRING, ""));
     settings.insert(settings.end(), Setting(CLI_IGNORETOUCH, RE_IGNORETOUCH, BOOL, "false"));
+    settings.insert(settings.end(), Setting(CLI_AGENT, RE_AGENT, STRING, ""));
+    settings.insert(settings.end(), Setting(CLI_AGENTKEY, RE_AGENTKEY, STRING, ""));
+    settings.insert(settings.end(), Setting(CLI_BWLIMIT, RE_BWLIMIT, STRING, ""));
+    settings.insert(settings.end(), Setting(CLI_IOLIMIT, RE_IOLIMIT, STRING, ""));
+    settings.insert(settings.end(), Setting(CLI_DIGEST, RE_DIGEST, STRING, "md5"));
 }
 
 
@@ -242,6 +247,8 @@ void BackupConfig::saveConfig() {
         
         newFile << "\n# faub-style backups\n";
         newFile << settings[sFaub].confPrint("ssh remoteserver managebackups --path /usr/local/bin");
+        newFile << settings[sAgent].confPrint("remoteserver:4750");
+        newFile << settings[sAgentKey].confPrint("/etc/managebackups.key");
         newFile << "\n# single-file-style backup (alternative to faub)\n";
         newFile << settings[sBackupFilename].confPrint("myuser.tgz");
         newFile << settings[sBackupCommand].confPrint("tar czf - /usr/local/bin");
@@ -253,6 +260,8 @@ void BackupConfig::saveConfig() {
         newFile << settings[sMode].confPrint();
         newFile << settings[sIncTime].confPrint();
         newFile << settings[sMinSpace].confPrint("2G");
+        newFile << settings[sBwLimit].confPrint("2M@08-18,20M");
+        newFile << settings[sIOLimit].confPrint("50M@08-18");
         newFile << settings[sBloat].confPrint() << "\n\n";
 
         newFile << commentLine << "# Pruning\n" << commentLine << "\n";
@@ -268,6 +277,7 @@ void BackupConfig::saveConfig() {
 
         newFile << commentLine << "# Linking\n" << commentLine << "\n";
         newFile << settings[sMaxLinks].confPrint();
+        newFile << settings[sDigest].confPrint("blake3");
     }
 
     newFile.close();
@@ -590,29 +600,27 @@ void BackupConfig::setPreviousFailures(unsigned int count) {
    'maxBackups' backups.
  */
 size_t BackupConfig::getRecentAvgSize(int maxBackups) {
-    auto cacheSize = cache.indexByFilename.size();
+    auto cacheSize = cache.numberOfBackups();
     auto fcacheSize = fcache.size();
     size_t runningTotal = 0;
     int counted = 0;
     
     if (cacheSize > fcacheSize) {
-        auto backupIt = cache.indexByFilename.end();
+        auto sortedEntries = cache.getSorted();
         
-        if (cacheSize)
-            while (--backupIt != cache.indexByFilename.begin() && counted < maxBackups) {
-                auto rawIt = cache.rawData.find(backupIt->second);
-                if (rawIt != cache.rawData.end()) {
-                    
-                    // check for overflow
-                    if (runningTotal > SIZE_MAX - rawIt->second.size) {
-                        log("warning: used " + to_string(counted) + " instead of " + to_string(maxBackups) + " backups to determine average size due to variable overflow");
-                        break;
-                    }
-                    
-                    ++counted;
-                    runningTotal += rawIt->second.size;
-                }
+        // newest first; the oldest backup isn't included
+        for (auto idx = sortedEntries.size(); idx > 1 && counted < maxBackups; --idx) {
+            auto entry = sortedEntries[idx - 1];
+            
+            // check for overflow
+            if (runningTotal > SIZE_MAX - entry->size) {
+                log("warning: used " + to_string(counted) + " instead of " + to_string(maxBackups) + " backups to determine average size due to variable overflow");
+                break;
             }
+            
+            ++counted;
+            runningTotal += entry->size;
+        }
     }
     else {
         auto backupIt = fcache.getEnd();
@@ -2,6 +2,8 @@
 #include <iostream>
 #include <string>
 #include <math.h>
+#include <string.h>
+#include <algorithm>
 #include "BackupEntry.h"
 #include <pcre++.h>
 #include "util_generic.h"
@@ -13,9 +15,73 @@ using namespace pcrepp;
 using namespace std;
 
 
+string digestName(digestType algorithm, bool forDisplay) {
+    if (algorithm == dBLAKE3)
+        return forDisplay ? "BLAKE3" : "blake3";
+
+    return forDisplay ? "MD5" : "md5";
+}
+
+
+bool digestFromName(string name, digestType& algorithm) {
+    transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+    if (name == "md5" || name == "")
+        algorithm = dMD5;
+    else if (name == "blake3")
+        algorithm = dBLAKE3;
+    else
+        return false;
+
+    return true;
+}
+
+
+md5Digest md5Digest::fromHex(string hex) {
+    md5Digest digest;
+    unsigned char bytes[16];
+
+    if (hex.length() != 32)
+        return digest;
+
+    for (int i = 0; i < 16; ++i) {
+        int high = isdigit(hex[i * 2]) ? hex[i * 2] - '0' : hex[i * 2] - 'a' + 10;
+        int low = isdigit(hex[i * 2 + 1]) ? hex[i * 2 + 1] - '0' : hex[i * 2 + 1] - 'a' + 10;
+
+        if (high < 0 || high > 15 || low < 0 || low > 15)
+            return digest;
+
+        bytes[i] = high << 4 | low;
+    }
+
+    memcpy(digest.words, bytes, sizeof(bytes));
+    return digest;
+}
+
+
+string md5Digest::hex() const {
+    static const char *digits = "0123456789abcdef";
+    unsigned char bytes[16];
+    string result(32, '0');
+
+    memcpy(bytes, words, sizeof(bytes));
+    for (int i = 0; i < 16; ++i) {
+        result[i * 2] = digits[bytes[i] >> 4];
+        result[i * 2 + 1] = digits[bytes[i] & 15];
+    }
+
+    return result;
+}
+
+
+ostream& operator<<(ostream& out, const md5Digest& digest) {
+    return out << (digest.empty() ? "" : digest.hex());
+}
+
+
 BackupEntry::BackupEntry() {
-    dateRE = Pcre(DATE_REGEX);
-    md5 = filename = "";
+    filename = "";
+    algorithm = dMD5;
     links = mtime = size = inode = fnameDayAge = dow = date_day = duration = current = name_mtime = 0;
 }
 
@@ -27,7 +93,7 @@ string BackupEntry::class2string(string oldBaseDir, string newBaseDir) {
         filename = slashConcat(newBaseDir, filename);
     }
     
-    return("[" + filename + "]," + md5 + "," + to_string(links) + "," + to_string(mtime) + "," +
+    return("[" + filename + "]," + md5.hex() + "," + to_string(links) + "," + to_string(mtime) + "," +
             to_string(size) + "," + to_string(duration));
 }
 
@@ -37,7 +103,7 @@ bool BackupEntry::string2class(string data) {
     try {
         if (regEx.search(data) && regEx.matches() > 4) {
             filename = regEx.get_match(0);
-            md5 = regEx.get_match(1);
+            md5 = md5Digest::fromHex(regEx.get_match(1));
             links = stoi(regEx.get_match(2));
             mtime = stol(regEx.get_match(3));
             size = stol(regEx.get_match(4));
@@ -62,11 +128,12 @@ BackupEntry* BackupEntry::updateAges(time_t refTime) {
     // identical backups from different days that we've hardlinked together will all share the 
     // same mtime (single inode).  so mtime is useless for calculating the age.  we have to rely
     // on the date format that's near the end of the filename.
+    backupDateType date;
     
-    if (dateRE.search(filename) && dateRE.matches() > 2) {
-        date_year  = stoi(dateRE.get_match(0));
-        date_month = stoi(dateRE.get_match(1));
-        date_day   = stoi(dateRE.get_match(2));
+    if (parseBackupDate(filename, date)) {
+        date_year  = date.year;
+        date_month = date.month;
+        date_day   = date.day;
     }
     else {   // should never get here due to a similar regex limiting filenames getting initially added to the cache
         SCREENERR("error: cannot parse date/time from backup filename (" << filename << ")");
@@ -96,10 +163,10 @@ BackupEntry* BackupEntry::updateAges(time_t refTime) {
 
 
 bool BackupEntry::calculateMD5(string reason) {
-    md5 = MD5file(filename, !NOTQUIET || !ANIMATE, reason);
+    md5 = md5Digest::fromHex(digestFile(filename, algorithm, !NOTQUIET || !ANIMATE, reason));
 
-    if (md5.length())
+    if (!md5.empty())
         ++GLOBALS.md5Count;
 
-    return md5.length();
+    return !md5.empty();
 }
@@ -0,0 +1,372 @@
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include "Blake3.h"
+#include "lanes.h"
+
+#define BLOCK_LEN       64
+#define CHUNK_LEN       1024
+#define CHUNK_BLOCKS    (CHUNK_LEN / BLOCK_LEN)
+#define MAX_LANES       16
+#define MAX_SUBTREE     256                     // chunks hashed as one piece
+#define MAX_PENDING     (256 * CHUNK_LEN)       // small updates are gathered up to this
+
+// domain flags
+#define CHUNK_START     1
+#define CHUNK_END       2
+#define PARENT          4
+#define ROOT            8
+
+
+static const uint32_t IV[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+// the message word order for each round (each row is the one before it permuted)
+static const uint8_t schedule[7][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    {  2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8 },
+    {  3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1 },
+    { 10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6 },
+    { 12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4 },
+    {  9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7 },
+    { 11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13 },
+};
+
+
+static inline uint32_t le32(const unsigned char *data) {
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+
+/* the seven rounds of the compression function over 'V', either a plain uint32_t or a
+ * vector of them, one per lane (the same arrangement as MultiMD5's md5Compress()). */
+#define ROTR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+#define G(a, b, c, d, x, y)  \
+    a = a + b + x;  d = ROTR(d ^ a, 16);  c = c + d;  b = ROTR(b ^ c, 12);  \
+    a = a + b + y;  d = ROTR(d ^ a, 8);   c = c + d;  b = ROTR(b ^ c, 7);
+
+template<typename V>
+static inline __attribute__((always_inline)) void blake3Round(V v[16], const V m[16], const uint8_t s[16]) {
+    G(v[0], v[4], v[ 8], v[12], m[s[ 0]], m[s[ 1]]);
+    G(v[1], v[5], v[ 9], v[13], m[s[ 2]], m[s[ 3]]);
+    G(v[2], v[6], v[10], v[14], m[s[ 4]], m[s[ 5]]);
+    G(v[3], v[7], v[11], v[15], m[s[ 6]], m[s[ 7]]);
+
+    G(v[0], v[5], v[10], v[15], m[s[ 8]], m[s[ 9]]);
+    G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+    G(v[2], v[7], v[ 8], v[13], m[s[12]], m[s[13]]);
+    G(v[3], v[4], v[ 9], v[14], m[s[14]], m[s[15]]);
+}
+
+// spelled out rather than looped so that the schedule lookups happen at compile time
+template<typename V>
+static inline __attribute__((always_inline)) void blake3Rounds(V v[16], const V m[16]) {
+    blake3Round(v, m, schedule[0]);
+    blake3Round(v, m, schedule[1]);
+    blake3Round(v, m, schedule[2]);
+    blake3Round(v, m, schedule[3]);
+    blake3Round(v, m, schedule[4]);
+    blake3Round(v, m, schedule[5]);
+    blake3Round(v, m, schedule[6]);
+}
+
+
+// compress one block, giving the full 16 words of output (the first 8 are the chaining value)
+static void compress(const uint32_t cv[8], const uint32_t m[16], uint64_t counter, uint32_t blockLen, uint32_t flags, uint32_t out[16]) {
+    uint32_t v[16] = { cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+                       IV[0], IV[1], IV[2], IV[3], (uint32_t)counter, (uint32_t)(counter >> 32), blockLen, flags };
+
+    blake3Rounds(v, m);
+
+    for (int word = 0; word < 8; ++word) {
+        out[word] = v[word] ^ v[word + 8];
+        out[word + 8] = v[word + 8] ^ cv[word];
+    }
+}
+
+
+/* the engines hash 'blocks' blocks from each lane's data and leave each lane's chaining
+ * value in 'cvs': either whole chunks, numbered from 'counter' on, or (given PARENT for
+ * 'flags') parent nodes of a block each.  the templates are the parts common to every
+ * width; the loads are per instruction set (see lanes.h). */
+typedef void (*lanesFunc)(const unsigned char *data[], size_t blocks, uint64_t counter, uint32_t flags, uint32_t *cvs[]);
+
+static inline uint32_t blockFlags(uint32_t flags, size_t block, size_t blocks) {
+    return flags == PARENT ? PARENT : (block ? 0 : CHUNK_START) | (block == blocks - 1 ? CHUNK_END : 0);
+}
+
+
+static void lanesScalar(const unsigned char *data[], size_t blocks, uint64_t counter, uint32_t flags, uint32_t *cvs[]) {
+    uint32_t cv[8], m[16], out[16];
+    memcpy(cv, IV, sizeof(IV));
+
+    for (size_t block = 0; block < blocks; ++block) {
+        for (int word = 0; word < 16; ++word)
+            m[word] = le32(data[0] + block * BLOCK_LEN + word * 4);
+
+        compress(cv, m, flags == PARENT ? 0 : counter, BLOCK_LEN, blockFlags(flags, block, blocks), out);
+        memcpy(cv, out, sizeof(cv));
+    }
+
+    memcpy(cvs[0], cv, sizeof(cv));
+}
+
+
+template<typename V, int LANES>
+static inline __attribute__((always_inline)) void startLanes(uint64_t counter, uint32_t flags, V h[8], V& counterLow, V& counterHigh) {
+    uint32_t low[LANES], high[LANES];
+
+    for (int lane = 0; lane < LANES; ++lane) {
+        uint64_t laneCounter = flags == PARENT ? 0 : counter + lane;
+        low[lane] = (uint32_t)laneCounter;
+        high[lane] = (uint32_t)(laneCounter >> 32);
+    }
+
+    memcpy(&counterLow, low, sizeof(low));
+    memcpy(&counterHigh, high, sizeof(high));
+
+    for (int word = 0; word < 8; ++word)
+        h[word] = V{} + IV[word];
+}
+
+
+template<typename V>
+static inline __attribute__((always_inline)) void laneBlock(V h[8], const V m[16], const V& counterLow, const V& counterHigh, uint32_t flags) {
+    V v[16] = { h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+                V{} + IV[0], V{} + IV[1], V{} + IV[2], V{} + IV[3], counterLow, counterHigh, V{} + BLOCK_LEN, V{} + flags };
+
+    blake3Rounds(v, m);
+
+    for (int word = 0; word < 8; ++word)
+        h[word] = v[word] ^ v[word + 8];
+}
+
+
+template<typename V, int LANES>
+static inline __attribute__((always_inline)) void storeLanes(V h[8], uint32_t *cvs[]) {
+    uint32_t words[8][LANES];
+    memcpy(words, h, sizeof(words));
+
+    for (int lane = 0; lane < LANES; ++lane)
+        for (int word = 0; word < 8; ++word)
+            cvs[lane][word] = words[word][lane];
+}
+
+
+#if defined(HAVE_LANES)
+static void lanesSSE2(const unsigned char *data[], size_t blocks, uint64_t counter, uint32_t flags, uint32_t *cvs[]) {
+    v4u h[8], m[16], counterLow, counterHigh;
+    startLanes<v4u, 4>(counter, flags, h, counterLow, counterHigh);
+
+    for (size_t block = 0; block < blocks; ++block) {
+        loadBlocks4(data, block * BLOCK_LEN, m);
+        laneBlock(h, m, counterLow, counterHigh, blockFlags(flags, block, blocks));
+    }
+
+    storeLanes<v4u, 4>(h, cvs);
+}
+
+__attribute__((target("avx2")))
+static void lanesAVX2(const unsigned char *data[], size_t blocks, uint64_t counter, uint32_t flags, uint32_t *cvs[]) {
+    v8u h[8], m[16], counterLow, counterHigh;
+    startLanes<v8u, 8>(counter, flags, h, counterLow, counterHigh);
+
+    for (size_t block = 0; block < blocks; ++block) {
+        loadBlocks8(data, block * BLOCK_LEN, m);
+        laneBlock(h, m, counterLow, counterHigh, blockFlags(flags, block, blocks));
+    }
+
+    storeLanes<v8u, 8>(h, cvs);
+}
+
+__attribute__((target("avx512f")))
+static void lanesAVX512(const unsigned char *data[], size_t blocks, uint64_t counter, uint32_t flags, uint32_t *cvs[]) {
+    v16u h[8], m[16], counterLow, counterHigh;
+    startLanes<v16u, 16>(counter, flags, h, counterLow, counterHigh);
+
+    for (size_t block = 0; block < blocks; ++block) {
+        loadBlocks16(data, block * BLOCK_LEN, m);
+        laneBlock(h, m, counterLow, counterHigh, blockFlags(flags, block, blocks));
+    }
+
+    storeLanes<v16u, 16>(h, cvs);
+}
+#endif
+
+
+struct blake3EngineType {
+    lanesFunc lanes;
+    unsigned int width;
+    string name;
+};
+
+
+static const blake3EngineType& blake3Engine() {
+    static blake3EngineType engine = []() -> blake3EngineType {
+        auto lanes = laneEngine();
+
+        switch (lanes.lanes) {
+#if defined(HAVE_LANES)
+            case 16: return { lanesAVX512, 16, lanes.name };
+            case 8:  return { lanesAVX2, 8, lanes.name };
+            case 4:  return { lanesSSE2, 4, lanes.name };
+#endif
+            default: return { lanesScalar, 1, lanes.name };
+        }
+    }();
+
+    return engine;
+}
+
+
+string blake3Stream::engine() { return blake3Engine().name; }
+
+
+/* run 'count' inputs through the engine, a lane's worth at a time.  the first input is at
+ * 'data' and each is 'stride' bytes on from the one before; their chaining values go to
+ * 'cvs' in the same order.  a lane's output is only stored after every lane's input has
+ * been read, so parents can be written over the level of nodes they're made from. */
+static void hashLanes(const unsigned char *data, size_t stride, size_t count, size_t blocks, uint64_t counter, uint32_t flags, uint32_t (*cvs)[8]) {
+    auto &engine = blake3Engine();
+
+    for (size_t first = 0; first < count; first += engine.width) {
+        size_t group = min(count - first, (size_t)engine.width);
+        const unsigned char *laneData[MAX_LANES];
+        uint32_t *laneCVs[MAX_LANES];
+        uint32_t spareCVs[MAX_LANES][8];
+
+        // unused lanes rehash the group's last input and their result is dropped
+        for (size_t lane = 0; lane < engine.width; ++lane) {
+            laneData[lane] = data + (first + min(lane, group - 1)) * stride;
+            laneCVs[lane] = lane < group ? cvs[first + lane] : spareCVs[lane];
+        }
+
+        // a lone input is quicker through the plain version than one lane of the vectors
+        if (group == 1)
+            lanesScalar(laneData, blocks, counter + first, flags, laneCVs);
+        else
+            engine.lanes(laneData, blocks, counter + first, flags, laneCVs);
+    }
+}
+
+
+// fold a completed subtree of 'size' chunks (a power of two, starting at a multiple of it)
+// into the tree: each trailing zero bit of the new count, in units of 'size', is a bigger
+// subtree that's now complete, so its left half comes off the stack and merges in
+void blake3Stream::addSubtree(uint32_t cv[8], uint64_t size) {
+    uint32_t m[16], out[16];
+    uint64_t total = (chunks += size) / size;
+
+    memcpy(m + 8, cv, 8 * sizeof(uint32_t));
+    while (!(total & 1)) {
+        memcpy(m, cvStack[--stackDepth], 8 * sizeof(uint32_t));
+        compress(IV, m, 0, BLOCK_LEN, PARENT, out);
+        memcpy(m + 8, out, 8 * sizeof(uint32_t));
+        total >>= 1;
+    }
+
+    memcpy(cvStack[stackDepth++], m + 8, 8 * sizeof(uint32_t));
+}
+
+
+// hash 'count' whole chunks (none of them the last) as the biggest subtrees they allow,
+// each level of a subtree's nodes spread across the lanes
+void blake3Stream::hashChunks(const unsigned char *data, size_t count) {
+    uint32_t cvs[MAX_SUBTREE][8];
+
+    while (count) {
+        uint64_t size = MAX_SUBTREE;
+        while (size > count || chunks % size)
+            size /= 2;
+
+        hashLanes(data, CHUNK_LEN, size, CHUNK_BLOCKS, chunks, 0, cvs);
+        for (size_t nodes = size / 2; nodes; nodes /= 2)
+            hashLanes((const unsigned char*)cvs, 2 * sizeof(cvs[0]), nodes, 1, 0, PARENT, cvs);
+
+        addSubtree(cvs[0], size);
+        data += size * CHUNK_LEN;
+        count -= size;
+    }
+}
+
+
+void blake3Stream::update(const void *data, size_t count) {
+    auto input = (const unsigned char*)data;
+
+    while (count) {
+        // more has arrived, so nothing that's waiting is the last chunk
+        if (pending.length() == MAX_PENDING) {
+            hashChunks((const unsigned char*)pending.data(), MAX_PENDING / CHUNK_LEN);
+            pending.clear();
+        }
+
+        // large pieces are hashed straight from the caller's data, keeping back the last chunk
+        if (pending.empty() && count > MAX_PENDING) {
+            size_t whole = (count - 1) / CHUNK_LEN;
+
+            hashChunks(input, whole);
+            input += whole * CHUNK_LEN;
+            count -= whole * CHUNK_LEN;
+        }
+
+        size_t take = min(count, MAX_PENDING - pending.length());
+        pending.append((const char*)input, take);
+        input += take;
+        count -= take;
+    }
+}
+
+
+string blake3Stream::final(size_t bytes) {
+    uint32_t cv[8], m[16], out[16];
+    unsigned char block[BLOCK_LEN];
+    uint32_t blockLen = 0, flags = 0;
+
+    // what's waiting ahead of the last chunk (which may be partial, or empty if there's no data)
+    size_t whole = pending.length() ? (pending.length() - 1) / CHUNK_LEN : 0;
+    hashChunks((const unsigned char*)pending.data(), whole);
+
+    string last = pending.substr(whole * CHUNK_LEN);
+    size_t blocks = max((last.length() + BLOCK_LEN - 1) / BLOCK_LEN, (size_t)1);
+    uint64_t counter = chunks;
+
+    // the last chunk, up to its last block, which is left for the output node
+    memcpy(cv, IV, sizeof(IV));
+    for (size_t index = 0; index < blocks; ++index) {
+        blockLen = min(last.length() - index * BLOCK_LEN, (size_t)BLOCK_LEN);
+        flags = (index ? 0 : CHUNK_START) | (index == blocks - 1 ? CHUNK_END : 0);
+
+        memset(block, 0, sizeof(block));
+        memcpy(block, last.data() + index * BLOCK_LEN, blockLen);
+        for (int word = 0; word < 16; ++word)
+            m[word] = le32(block + word * 4);
+
+        if (index < blocks - 1) {
+            compress(cv, m, counter, blockLen, flags, out);
+            memcpy(cv, out, sizeof(cv));
+        }
+    }
+
+    // then up the stack of completed subtrees to the root, newest first
+    while (stackDepth) {
+        compress(cv, m, counter, blockLen, flags, out);
+
+        memcpy(m, cvStack[--stackDepth], 8 * sizeof(uint32_t));
+        memcpy(m + 8, out, 8 * sizeof(uint32_t));
+        memcpy(cv, IV, sizeof(IV));
+        counter = 0;
+        blockLen = BLOCK_LEN;
+        flags = PARENT;
+    }
+
+    compress(cv, m, 0, blockLen, flags | ROOT, out);
+
+    bytes = min(bytes, sizeof(out));
+    char hex[sizeof(out) * 2 + 1];
+    for (size_t byte = 0; byte < bytes; ++byte)
+        snprintf(hex + byte * 2, 3, "%02x", (out[byte / 4] >> (byte % 4 * 8)) & 0xff);
+
+    chunks = 0;
+    pending.clear();
+    return string(hex, bytes * 2);
+}
@@ -0,0 +1,274 @@
+
+#include <fstream>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "DirStamps.h"
+#include "util_generic.h"
+#include "debug.h"
+
+#define STAMPS_MAGIC "mbstamps1\n"
+
+
+static bool readString(ifstream& stampsFile, string& str) {
+    uint64_t length = 0;
+    if (!stampsFile.read((char*)&length, sizeof(length)) || length > PATH_MAX)
+        return false;
+
+    str.resize(length);
+    return (bool)stampsFile.read(str.data(), length);
+}
+
+
+static bool readStrings(ifstream& stampsFile, vector<string>& strs) {
+    uint64_t count = 0;
+    if (!stampsFile.read((char*)&count, sizeof(count)))
+        return false;
+
+    // grown as strings are actually read so that a damaged count can't allocate ahead of the file
+    strs.clear();
+    strs.reserve(min(count, (uint64_t)1024));
+
+    for (uint64_t i = 0; i < count; ++i) {
+        string str;
+        if (!readString(stampsFile, str))
+            return false;
+
+        strs.insert(strs.end(), move(str));
+    }
+
+    return true;
+}
+
+
+static void writeString(ofstream& stampsFile, const string& str) {
+    uint64_t length = str.length();
+    stampsFile.write((char*)&length, sizeof(length));
+    stampsFile.write(str.data(), length);
+}
+
+
+static void writeStrings(ofstream& stampsFile, const vector<string>& strs) {
+    uint64_t count = strs.size();
+    stampsFile.write((char*)&count, sizeof(count));
+
+    for (auto &str: strs)
+        writeString(stampsFile, str);
+}
+
+
+/* stored in binary as names can hold anything but a slash: the magic string, a count
+ * of directories, then for each its path, mtime, link count, the subdirectories to
+ * walk and the names it held (each list a count followed by length + characters). */
+void DirStamps::load() {
+    if (loaded)
+        return;
+
+    loaded = true;
+    stamps.clear();
+
+    ifstream stampsFile(filename, ios::binary);
+    if (!stampsFile.is_open())
+        return;
+
+    char magic[sizeof(STAMPS_MAGIC) - 1];
+    uint64_t count = 0;
+
+    if (!stampsFile.read(magic, sizeof(magic)) || memcmp(magic, STAMPS_MAGIC, sizeof(magic)) ||
+        !stampsFile.read((char*)&count, sizeof(count)))
+        return;
+
+    for (uint64_t i = 0; i < count; ++i) {
+        string dir;
+        stampType stamp;
+        int64_t mtime;
+        uint64_t links;
+
+        if (!readString(stampsFile, dir) || !stampsFile.read((char*)&mtime, sizeof(mtime)) ||
+            !stampsFile.read((char*)&links, sizeof(links)) || !readStrings(stampsFile, stamp.subDirs) ||
+            !readStrings(stampsFile, stamp.names)) {
+            stamps.clear();
+            return;
+        }
+
+        stamp.mtime = mtime;
+        stamp.links = links;
+        stamps[dir] = stamp;
+    }
+
+    DEBUG(D_cache) DFMT("loaded " << plural(stamps.size(), "directory stamp") << " from " << filename);
+}
+
+
+bool DirStamps::tracks(string dir, unsigned int depth) {
+    if (!depth)
+        return true;
+
+    auto name = pathSplit(dir).file;
+    if (!name.length())
+        return false;
+
+    for (auto c: name)
+        if (c < '0' || c > '9')
+            return false;
+
+    return true;
+}
+
+
+bool DirStamps::unchanged(string dir, struct stat& statData) {
+    load();
+    seen.insert(dir);
+
+    auto it = stamps.find(dir);
+    if (it == stamps.end() || it->second.mtime != statData.st_mtime || it->second.links != statData.st_nlink)
+        return false;
+
+    confirmed.insert(dir);
+    return true;
+}
+
+
+bool DirStamps::unchanged(string dir) {
+    if (confirmed.find(dir) != confirmed.end())
+        return true;
+
+    if (seen.find(dir) != seen.end())
+        return false;
+
+    struct stat statData;
+    return !mystat(dir, &statData) && unchanged(dir, statData);
+}
+
+
+vector<string> DirStamps::subDirs(string dir) {
+    load();
+
+    auto it = stamps.find(dir);
+    return it == stamps.end() ? vector<string>() : it->second.subDirs;
+}
+
+
+vector<string> DirStamps::heldSubDirs() {
+    vector<string> paths;
+
+    for (auto &dir: confirmed)
+        for (auto &subDir: stamps[dir].subDirs)
+            if (!tracks(subDir, 1))
+                paths.insert(paths.end(), slashConcat(dir, subDir));
+
+    return paths;
+}
+
+
+bool DirStamps::holds(string path) {
+    auto ps = pathSplit(path);
+
+    if (!unchanged(ps.dir))
+        return false;
+
+    auto &names = stamps[ps.dir].names;
+    return binary_search(names.begin(), names.end(), ps.file);
+}
+
+
+void DirStamps::record(string dir, struct stat& statData, vector<string>& subDirNames, vector<string>& names) {
+    load();
+    seen.insert(dir);
+
+    // too recent to trust (or asked not to); read it again next time
+    if (unstable.find(dir) != unstable.end() || statData.st_mtime >= time(NULL) - 1) {
+        if (stamps.erase(dir))
+            dirty = true;
+
+        return;
+    }
+
+    stampType stamp;
+    stamp.mtime = statData.st_mtime;
+    stamp.links = statData.st_nlink;
+    stamp.names = names;
+    sort(stamp.names.begin(), stamp.names.end());
+
+    stamp.subDirs = subDirNames;
+
+    stamps[dir] = stamp;
+    dirty = true;
+}
+
+
+void DirStamps::rescan(string dir) {
+    unstable.insert(dir);
+    confirmed.erase(dir);
+
+    if (stamps.erase(dir))
+        dirty = true;
+}
+
+
+void DirStamps::clear() {
+    load();
+    stamps.clear();
+    confirmed.clear();
+    dirty = true;
+}
+
+
+void DirStamps::save() {
+    if (!loaded || !filename.length())
+        return;
+
+    // directories that weren't come across this run are gone (or another profile's now)
+    if (seen.size()) {
+        for (auto it = stamps.begin(); it != stamps.end();) {
+            if (seen.find(it->first) == seen.end()) {
+                it = stamps.erase(it);
+                dirty = true;
+            }
+            else
+                ++it;
+        }
+    }
+
+    if (!dirty)
+        return;
+
+    string tempFilename = filename + ".tmp." + to_string(getpid());
+    mkdirp(pathSplit(filename).dir);
+
+    ofstream stampsFile(tempFilename, ios::binary | ios::trunc);
+    if (!stampsFile.is_open()) {
+        log("error: unable to create " + tempFilename + errtext());
+        return;
+    }
+
+    stampsFile.write(STAMPS_MAGIC, sizeof(STAMPS_MAGIC) - 1);
+
+    uint64_t count = stamps.size();
+    stampsFile.write((char*)&count, sizeof(count));
+
+    for (auto &stamp: stamps) {
+        int64_t mtime = stamp.second.mtime;
+        uint64_t links = stamp.second.links;
+
+        writeString(stampsFile, stamp.first);
+        stampsFile.write((char*)&mtime, sizeof(mtime));
+        stampsFile.write((char*)&links, sizeof(links));
+        writeStrings(stampsFile, stamp.second.subDirs);
+        writeStrings(stampsFile, stamp.second.names);
+    }
+
+    stampsFile.close();
+    if (stampsFile.fail() || rename(tempFilename.c_str(), filename.c_str())) {
+        log("error: unable to save " + filename + errtext());
+        unlink(tempFilename.c_str());
+        return;
+    }
+
+    dirty = false;
+}
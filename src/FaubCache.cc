@@ -3,6 +3,9 @@
 #include <algorithm>
 #include <queue>
 #include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <dirent.h>
 #include <unistd.h>
 #include "globals.h"
@@ -12,11 +15,14 @@
 #include "debug.h"
 #include "FastCache.h"
 #include "tagging.h"
+#include "FaubDB.h"
 
 
 FaubCache::FaubCache(string path, string profileName, string aUuid) {
     baseDir = path;
     uuid = aUuid;
+    inodeIndex.setFilename(slashConcat(GLOBALS.cacheDir, uuid, SUFFIX_FAUBINDEX));
+    dirStamps.setFilename(slashConcat(GLOBALS.cacheDir, uuid, SUFFIX_DIRSTAMPS));
     
     if (path.length())
         restoreCache(profileName);
@@ -26,6 +32,8 @@ FaubCache::FaubCache(string path, string profileName, string aUuid) {
 void FaubCache::restoreCache(string path, string profileName, string aUuid) {
     baseDir = path;
     uuid = aUuid;
+    inodeIndex.setFilename(slashConcat(GLOBALS.cacheDir, uuid, SUFFIX_FAUBINDEX));
+    dirStamps.setFilename(slashConcat(GLOBALS.cacheDir, uuid, SUFFIX_DIRSTAMPS));
     
     if (path.length())
         restoreCache(profileName);
@@ -33,7 +41,6 @@ void FaubCache::restoreCache(string path, string profileName, string aUuid) {
 
 
 void FaubCache::restoreCache_internal(string backupDir) {
-    Pcre regEx(DATE_REGEX);
     FaubEntry entry(backupDir, coreProfile, uuid);
     auto success = entry.loadStats();
     DEBUG(D_cache) DFMT("loading cache for " << backupDir << (success ? ": success" : ": failed"));
@@ -44,25 +51,19 @@ void FaubCache::restoreCache_internal(string backupDir) {
          * duration are lost. let's use the start time (from the filename) as a ballpark to seed
          * the finish time, which will allow the stats output to show an age. */
         
-        if (regEx.search(pathSplit(backupDir).file) && regEx.matches() > 2) {
+        backupDateType date;
+        
+        if (parseBackupDate(pathSplit(backupDir).file, date)) {
             struct tm t;
             
-            t.tm_year = stoi(regEx.get_match(0)) - 1900;
-            t.tm_mon  = stoi(regEx.get_match(1)) - 1;
-            t.tm_mday = stoi(regEx.get_match(2));
+            t.tm_year = date.year - 1900;
+            t.tm_mon  = date.month - 1;
+            t.tm_mday = date.day;
+            t.tm_hour = date.hour;
+            t.tm_min  = date.minute;
+            t.tm_sec  = date.second;
             t.tm_isdst = -1;
             
-            if (regEx.matches() > 5) {
-                t.tm_hour = stoi(regEx.get_match(3));
-                t.tm_min = stoi(regEx.get_match(4));
-                t.tm_sec = stoi(regEx.get_match(5));
-            }
-            else {
-                t.tm_hour = 0;
-                t.tm_min = 0;
-                t.tm_sec = 0;
-            }
-            
             if (!entry.finishTime)
                 entry.finishTime = mktime(&t);
             
@@ -96,6 +97,7 @@ bool restoreCacheCallback(pdCallbackData &file) {
     // check for in process backups
     if (data->tempRE->search(file.filename)) {
         data->fc->inProcessFilename = file.filename;
+        data->fc->dirStamps.rescan(pathSplit(file.filename).dir);
         
         if (GLOBALS.startupTime - file.statData.st_mtime > 60*60*5) {
             if (GLOBALS.cli.count(CLI_TEST))
@@ -133,7 +135,17 @@ void FaubCache::restoreCache(string profileName) {
     coreProfile = profileName;
     DEBUG(D_faub) DFMT(profileName);
     
-    processDirectoryBackups(ue(baseDir), "/" + coreProfile + "-", true, restoreCacheCallback, &data, FAUB_ONLY);
+    if (GLOBALS.cli.count(CLI_RECALC))
+        dirStamps.clear();
+    
+    processDirectoryBackups(ue(baseDir), "/" + coreProfile + "-", true, restoreCacheCallback, &data, FAUB_ONLY, -1, true, &dirStamps);
+    
+    // directories that haven't changed since they were last read were skipped; load the
+    // backups that were in them
+    Pcre backupRE(BACKUP_PATH_REGEX);
+    for (auto &backupDir: dirStamps.heldSubDirs())
+        if (backups.find(backupDir) == backups.end() && backupRE.search(backupDir))
+            restoreCache_internal(backupDir);
 
     restoreTimer.stop();
     
@@ -141,6 +153,7 @@ void FaubCache::restoreCache(string profileName) {
 
     // all backups are loaded; now see which are missing stats and recache them
     recache("");
+    dirStamps.save();
 }
 
 /*
@@ -155,10 +168,14 @@ void FaubCache::restoreCache(string profileName) {
  
  (3) as required - the general catch all case is to loop through all backups of
  the profile and run dus() on any that we don't already have cached stats on.
+ 
+ the slow part, walking each backup, doesn't depend on any other backup so it's
+ spread across a pool of threads (--threads).  what does depend on the previous
+ backup is deciding which files are new vs hardlinked; that's a cheap pass over
+ each walk's inodes, done in order as the walks complete.
  */
 void FaubCache::recache(string targetDir, time_t deletedTime, bool forceAll) {
-    myMapIT prevBackup = backups.end();
-    unsigned int recached = 0;
+    myMapIT prevExamined = backups.end();
     bool nextOneToo = false;
     statusMessage message("recalculating disk usage... ");
     timer recacheTimer;
@@ -168,6 +185,8 @@ void FaubCache::recache(string targetDir, time_t deletedTime, bool forceAll) {
     if (targetDir.length() && backups.find(targetDir) == backups.end())
         restoreCache_internal(targetDir);
     
+    // select the backups to recache, each paired with the backup before it
+    vector<pair<myMapIT, myMapIT>> selected;
     for (auto aBackup = backups.begin(); aBackup != backups.end(); ++aBackup) {
         DEBUG(D_recalc) DFMT("examining " << aBackup->first);
         bool deletedMatch = deletedTime && filename2Mtime(aBackup->first) > deletedTime;
@@ -187,6 +206,84 @@ void FaubCache::recache(string targetDir, time_t deletedTime, bool forceAll) {
             // because a change in that one could effect the next one
             nextOneToo) {
             
+            DEBUG(D_recalc) DFMT("selected " << aBackup->first << " (" <<
+                              to_string(forceAll) + string(",") +
+                              to_string(targetDir.length() && targetDir == aBackup->first) + "," +
+                              to_string(!targetDir.length() && ((!aBackup->second.ds.usedInBytes && !aBackup->second.ds.savedInBytes) || deletedMatch)) + "," +
+                              to_string(nextOneToo) + ")");
+            
+            selected.insert(selected.end(), make_pair(aBackup, prevExamined));
+            
+            // when we're recaching a single backup no need to loop through the rest of them
+            if (targetDir.length() || deletedMatch)
+                break;
+            
+            // the above "break" knocks out targeted backups and redoing the one right after a delete.
+            // what remains are that we're doing all of them (forceAll) or walking through all of them
+            // and just doing the ones that are missing stats.  if it's the latter and we're just updating
+            // missing stats, we need to do one more after each missing stats one.
+            if (!forceAll)
+                nextOneToo = !nextOneToo;
+        }
+        
+        prevExamined = aBackup;
+    }
+    
+    if (selected.size()) {
+        NOTQUIET && ANIMATE && message.show();
+        
+        /* walk the selected backups in a pool of threads.  workers only run a limited
+         * distance ahead of the merge so the walks waiting to be merged don't pile up. */
+        size_t workers = min(max(GLOBALS.cli.count(CLI_THREADS) ? GLOBALS.cli[CLI_THREADS].as<int>() : (int)thread::hardware_concurrency(), 1), (int)selected.size());
+        size_t window = workers * 2;
+        vector<dusWalkType> walks(selected.size());
+        vector<bool> walked(selected.size(), false);
+        size_t nextWalk = 0;
+        size_t merged = 0;
+        mutex walkLock;
+        condition_variable walkChange;
+        
+        auto worker = [&]() {
+            while (1) {
+                size_t index;
+                {
+                    unique_lock<mutex> guard(walkLock);
+                    walkChange.wait(guard, [&]() { return nextWalk >= selected.size() || nextWalk < merged + window; });
+                    
+                    if (nextWalk >= selected.size())
+                        return;
+                    
+                    index = nextWalk++;
+                }
+                
+                dusWalk(selected[index].first->first, walks[index]);
+                
+                {
+                    lock_guard<mutex> guard(walkLock);
+                    walked[index] = true;
+                }
+                walkChange.notify_all();
+            }
+        };
+        
+        // a full recache rebuilds the inode index from scratch
+        if (forceAll)
+            inodeIndex.clear();
+        
+        DEBUG(D_faub) DFMT("walking " << plural(selected.size(), "backup") << " with " << plural(workers, "thread"));
+        vector<thread> pool;
+        for (size_t i = 0; i < workers; ++i)
+            pool.insert(pool.end(), thread(worker));
+        
+        // merge each walk, in order, against the backup before it
+        for (size_t index = 0; index < selected.size(); ++index) {
+            {
+                unique_lock<mutex> guard(walkLock);
+                walkChange.wait(guard, [&]() { return (bool)walked[index]; });
+            }
+            
+            auto aBackup = selected[index].first;
+            auto prevBackup = selected[index].second;
             bool gotPrev = prevBackup != backups.end();
             string prevDesc;
             if (gotPrev) {
@@ -194,32 +291,38 @@ void FaubCache::recache(string targetDir, time_t deletedTime, bool forceAll) {
                 prevDesc = pathSplit(prevBackup->first).file;
             }
             
-            if (!recached)
-                NOTQUIET && ANIMATE && message.show();
+            InodeSet emptySet;
+            auto& seenInodes = gotPrev ? prevBackup->second.inodes : emptySet;
+            auto& newInodes = aBackup->second.inodes;
+            
+            // swap this backup's entries in the inode index for what the walk found
+            bool reindex = forceAll || inodeIndex.contains(aBackup->first);
+            map<ino_t, inodeSizeType> indexFiles;
+            if (inodeIndex.contains(aBackup->first)) {
+                size_t freedBlocks;
+                newInodes.clear();
+                aBackup->second.loadInodes();
+                inodeIndex.removeBackup(aBackup->first, newInodes, freedBlocks);
+            }
+            
+            if (reindex)
+                for (auto &file: walks[index].files)
+                    indexFiles[file.inode] = {file.size, file.blocks};
             
-            ++recached;
-            set<ino_t> emptySet;
-            aBackup->second.unloadInodes();
-            auto ds = dus(aBackup->first, gotPrev ? prevBackup->second.inodes : emptySet, aBackup->second.inodes);
+            DiskStats ds = dusTally(walks[index], seenInodes, newInodes);
+            
+            // this walk is done with; let the workers move on
+            vector<dusWalkType::fileType>().swap(walks[index].files);
+            {
+                lock_guard<mutex> guard(walkLock);
+                merged = index + 1;
+            }
+            walkChange.notify_all();
             
             DEBUG(D_any) DFMT("dus " << aBackup->first << ": " <<
                               ds.usedInBytes + ds.savedInBytes << " total, " <<
-                              ds.usedInBytes << " used (" <<
-                              to_string(forceAll) + string(",") +
-                              to_string(targetDir.length() && targetDir == aBackup->first) + "," +
-                              to_string(!targetDir.length() && ((!aBackup->second.ds.usedInBytes && !aBackup->second.ds.savedInBytes) || deletedMatch)) + "," +
-                              to_string(nextOneToo) + ")" +
+                              ds.usedInBytes << " used" <<
                               (gotPrev ? "; " + prevDesc : "; -"));
-
-//            string reason = targetDir.length() && targetDir == aBackup->first ? "specific" :
-//                (!targetDir.length() && (!aBackup->second.ds.usedInBytes && !aBackup->second.ds.savedInBytes)) ? "missing" :
-//                (!targetDir.length() && deletedMatch) ? "post-delete" :
-//                nextOneToo ? "next" : "?";
-//            
-//            log("stat calc " + aBackup->first + " (" + reason + "): " +
-//                              to_string(ds.usedInBytes + ds.savedInBytes) + " total, " +
-//                              to_string(ds.usedInBytes) + " used" +
-//                              (gotPrev ? "; vs " + prevDesc : "; -"));
             
             aBackup->second.ds = ds;
             aBackup->second.updated = true;
@@ -229,6 +332,9 @@ void FaubCache::recache(string targetDir, time_t deletedTime, bool forceAll) {
             aBackup->second.saveStats();
             aBackup->second.saveInodes();
             
+            if (reindex)
+                inodeIndex.addBackup(aBackup->first, indexFiles);
+            
             if (forceAll && NOTQUIET) {
                 ANIMATE && message.remove();
                 
@@ -240,38 +346,185 @@ void FaubCache::recache(string targetDir, time_t deletedTime, bool forceAll) {
             // all keep their inode lists populated at the same time.
             if (gotPrev)
                 prevBackup->second.unloadInodes();
-            
-            // when we're recaching a single backup no need to loop through the rest of them
-            if (targetDir.length() || deletedMatch)
-                break;
-            
-            // the above "break" knocks out targeted backups and redoing the one right after a delete.
-            // what remains are that we're doing all of them (forceAll) or walking through all of them
-            // and just doing the ones that are missing stats.  if it's the latter and we're just updating
-            // missing stats, we need to do one more after each missing stats one.
-            if (!forceAll)
-                nextOneToo = !nextOneToo;
         }
         
-        prevBackup = aBackup;
-    }
-    
-    if (recached)
+        for (auto &walker: pool)
+            walker.join();
+        
+        inodeIndex.save();
+        
         NOTQUIET && ANIMATE && !forceAll && message.remove();
+    }
     
     if (forceAll && NOTQUIET)
-        cout << "caches updated for " << plural(recached, "backup") << "." << endl;
+        cout << "caches updated for " << plural(selected.size(), "backup") << "." << endl;
     
     recacheTimer.stop();
     DEBUG(D_faub) DFMT("complete - " << recacheTimer.elapsed(5));
     
-    if (recached) {
+    if (selected.size()) {
         FastCache fc;
         fc.invalidate();
     }
 }
 
 
+/*
+ recordStats() saves disk usage that's already known, such as the faub server's tally
+ of a backup it just received, in place of a recache() walk.  'files' are the inodes
+ (and their sizes) of every file in the backup, for comparing the next backup against
+ and for the inode index.
+ */
+void FaubCache::recordStats(string backupDir, DiskStats ds, map<ino_t, inodeSizeType>& files) {
+    if (backups.find(backupDir) == backups.end())
+        restoreCache_internal(backupDir);
+    
+    auto backup = backups.find(backupDir);
+    if (backup == backups.end())
+        return;
+    
+    DEBUG(D_any) DFMT("tallied " << backupDir << ": " << ds.usedInBytes + ds.savedInBytes << " total, " << ds.usedInBytes << " used");
+    
+    backup->second.ds = ds;
+    backup->second.updated = true;
+    backup->second.dirs = ds.dirs;
+    backup->second.slinks = ds.symLinks;
+    backup->second.modifiedFiles = ds.mods;
+    backup->second.saveStats();
+    
+    // a backup being redone (no --time) replaces its earlier self in the inode index
+    if (inodeIndex.contains(backupDir)) {
+        size_t freedBlocks;
+        backup->second.unloadInodes();
+        backup->second.loadInodes();
+        inodeIndex.removeBackup(backupDir, backup->second.inodes, freedBlocks);
+    }
+    
+    auto others = backupDirs();
+    others.erase(backupDir);
+    if (inodeIndex.covers(others)) {
+        inodeIndex.addBackup(backupDir, files);
+        inodeIndex.save();
+    }
+    
+    backup->second.inodes.clear();
+    backup->second.inodes.reserve(files.size());
+    for (auto &file: files)
+        backup->second.inodes.insert(file.first);
+    
+    backup->second.saveInodes();
+    backup->second.unloadInodes();
+    
+    FastCache fc;
+    fc.invalidate();
+}
+
+
+set<string> FaubCache::backupDirs() {
+    set<string> dirs;
+    
+    for (auto &backup: backups)
+        dirs.insert(dirs.end(), backup.first);
+    
+    return dirs;
+}
+
+
+/*
+ removeBackup() drops a backup from the cache.  when the inode index covers the profile
+ the backup's inodes are released from it, which gives the space freed ('freedBytes'),
+ and the next backup's usage is updated from the index.  false means there was no usable
+ index and the caller should recache() the next backup instead.
+ */
+bool FaubCache::removeBackup(myMapIT which, size_t *freedBytes) {
+    GLOBALS.tags.removeTagsOn(which->first);
+    
+    bool indexed = inodeIndex.covers(backupDirs());
+    auto next = std::next(which);
+    auto prev = which == backups.begin() ? backups.end() : std::prev(which);
+    
+    if (indexed) {
+        which->second.unloadInodes();
+        which->second.loadInodes();
+    }
+    
+    which->second.removeEntry();
+    auto dir = which->first;
+    auto inodes = move(which->second.inodes);
+    which->second.unloadInodes();
+    backups.erase(which);
+    
+    return indexed && unindexBackup(dir, inodes, next, prev, freedBytes);
+}
+
+
+// release a deleted backup from the inode index and restat the one that followed it
+bool FaubCache::unindexBackup(string backupDir, InodeSet& inodes, myMapIT next, myMapIT prev, size_t *freedBytes) {
+    size_t freedBlocks;
+    auto freed = inodeIndex.removeBackup(backupDir, inodes, freedBlocks);
+    
+    if (freedBytes != NULL)
+        *freedBytes = freed;
+    
+    DEBUG(D_prune) DFMT("released " << backupDir << " from the inode index; " << approximate(freed) << " freed");
+    
+    if (next != backups.end())
+        restatFromIndex(next, prev);
+    
+    inodeIndex.save();
+    return true;
+}
+
+
+/*
+ restatFromIndex() recalculates a backup's usage after the backup before it has changed,
+ the same as recache() would but from the two backups' inode lists and the inode index
+ rather than by walking.  dirs, symlinks and the backup's total size don't change; only
+ the split between used (new inodes) and saved (hardlinked to the previous backup) does.
+ */
+void FaubCache::restatFromIndex(myMapIT backup, myMapIT prevBackup) {
+    bool gotPrev = prevBackup != backups.end();
+    InodeSet emptySet;
+    
+    if (gotPrev)
+        prevBackup->second.loadInodes();
+    
+    backup->second.loadInodes();
+    auto& seenInodes = gotPrev ? prevBackup->second.inodes : emptySet;
+    auto& ds = backup->second.ds;
+    size_t totalBytes = ds.usedInBytes + ds.savedInBytes;
+    size_t totalBlocks = ds.usedInBlocks + ds.savedInBlocks;
+    
+    ds.usedInBytes = ds.usedInBlocks = ds.mods = 0;
+    backup->second.inodes.forEachNotIn(seenInodes, [&](ino_t inode) {
+        inodeSizeType size;
+        
+        if (inodeIndex.sizeOf(inode, size)) {
+            ds.usedInBytes += size.size;
+            ds.usedInBlocks += size.blocks;
+            ++ds.mods;
+        }
+    });
+    
+    ds.savedInBytes = totalBytes - min(ds.usedInBytes, totalBytes);
+    ds.savedInBlocks = totalBlocks - min(ds.usedInBlocks, totalBlocks);
+    
+    DEBUG(D_any) DFMT("restat " << backup->first << ": " << totalBytes << " total, " << ds.usedInBytes << " used" <<
+                      (gotPrev ? "; " + pathSplit(prevBackup->first).file : "; -"));
+    
+    backup->second.modifiedFiles = ds.mods;
+    backup->second.updated = true;
+    backup->second.saveStats();
+    
+    if (gotPrev)
+        prevBackup->second.unloadInodes();
+    backup->second.unloadInodes();
+    
+    FastCache fc;
+    fc.invalidate();
+}
+
+
 DiskStats FaubCache::getTotalStats() {
     DiskStats ds;
     
@@ -291,6 +544,36 @@ void FaubCache::updateDiffFiles(string searchTerm, set<string> files) {
 }
 
 
+bool FaubCache::loadDiffFiles(string backupDir, set<string>& files) {
+    auto backupIt = backups.find(backupDir);
+    return (backupIt != backups.end() && backupIt->second.loadDiffFiles(files));
+}
+
+
+bool FaubCache::loadManifest(string backupDir, map<string, manifestEntry>& manifest) {
+    auto backupIt = backups.find(backupDir);
+    return (backupIt != backups.end() && backupIt->second.loadManifest(manifest));
+}
+
+
+void FaubCache::updateManifest(string backupDir, map<string, manifestEntry>& manifest) {
+    auto backupIt = backups.find(backupDir);
+    if (backupIt != backups.end())
+        backupIt->second.saveManifest(manifest);
+    else
+        cerr << "unable to find " << backupDir << " in cache." << endl;
+}
+
+
+void FaubCache::updateDirLinks(string backupDir, set<string>& paths) {
+    auto backupIt = backups.find(backupDir);
+    if (backupIt != backups.end())
+        backupIt->second.saveDirLinks(paths);
+    else
+        cerr << "unable to find " << backupDir << " in cache." << endl;
+}
+
+
 myMapIT FaubCache::findBackup(string searchTerm, myMapIT backupIT) {
     set<string> contenders;
     string tagMatch;
@@ -589,59 +872,56 @@ void FaubCache::compare(string backupA, string backupB, string givenThreshold) {
 }
 
 
-bool fcCleanupCallback(pdCallbackData &file) {
-    ifstream cacheFile;
-    string backupDir, fullId, profileName;
-    FaubCache *fc = (FaubCache*)file.dataPtr;
+// a backup that has stats cached but no longer exists on disk
+void FaubCache::cleanupVanished(string backupDir, string profileName) {
+    auto targetMtime = filename2Mtime(backupDir);
     
-    cacheFile.open(file.filename);
-    
-    if (cacheFile.is_open()) {
-        cacheFile >> fullId;
-        cacheFile.close();
-        
-        backupDir = fullId;
+    if (profileName.length()) {
+        Pcre yearRE("^20\\d{2}$");
+        auto parentDir = backupDir;
+        auto ps = pathSplit(parentDir);
         
-        auto pos = fullId.find(";;");
-        if (pos != string::npos) {
-            profileName = fullId.substr(pos + 2, string::npos);
-            backupDir.erase(backupDir.find(";;"));  // erase the profile name portion
+        while (parentDir.length() > 1 && parentDir.find("/") != string::npos && !yearRE.search(ps.file)) {
+            parentDir = ps.dir;
+            ps = pathSplit(parentDir);
         }
         
-        // if the backup directory referenced in the cache file no longer exists
-        // delete the cache file
-        if (!exists(backupDir)) {
-            auto targetMtime = filename2Mtime(backupDir);
+        auto bdir = pathSplit(parentDir).dir;
+        if (profileName == coreProfile && bdir == baseDir) {
+            FaubEntry entry(backupDir, coreProfile, uuid);
+            auto indexed = backups.find(backupDir) == backups.end() && inodeIndex.contains(backupDir);
             
-            if (profileName.length()) {
-                Pcre yearRE("^20\\d{2}$");
-                auto parentDir = backupDir;
-                auto ps = pathSplit(parentDir);
-                
-                while (parentDir.length() > 1 && parentDir.find("/") != string::npos && !yearRE.search(ps.file)) {
-                    parentDir = ps.dir;
-                    ps = pathSplit(parentDir);
-                }
+            if (indexed) {
+                auto known = backupDirs();
+                known.insert(backupDir);
+                indexed = inodeIndex.covers(known);
+            }
+            
+            if (indexed)
+                entry.loadInodes();
+            
+            entry.removeEntry();
+            log(backupDir + " has vanished, updating cache");
+            
+            // update the next backup from the inode index or, without one, re-dus it
+            if (indexed) {
+                auto next = backups.begin();
+                while (next != backups.end() && filename2Mtime(next->first) <= targetMtime)
+                    ++next;
                 
-                auto bdir = pathSplit(parentDir).dir;
-                if (profileName == fc->coreProfile && bdir == fc->baseDir) {
-                    FaubEntry entry(backupDir, fc->coreProfile, fc->uuid);
-                    entry.removeEntry();
-                    log(backupDir + " has vanished, updating cache");
-
-                    // re-dus the next backup
-                    fc->recache("", targetMtime);
-                }
+                auto prev = next == backups.begin() ? backups.end() : std::prev(next);
+                unindexBackup(backupDir, entry.inodes, next, prev, NULL);
+                entry.unloadInodes();
             }
+            else
+                recache("", targetMtime);
         }
     }
-    
-    return true;
 }
 
 
 /* cleanup()
- Walk through this cache's files looking for caches that reference backups
+ Walk through the profile's cached stats looking for any that reference backups
  that no longer exist (have been removed).  When one is found, we delete the
  cache files. But we also look for the next backup matching the same dir +
  profile name as the deleted one and recalculate (dus) its disk usage because
@@ -649,9 +929,15 @@ bool fcCleanupCallback(pdCallbackData &file) {
  missing from the same dir + profile we re-dus the next one that's found.
  */
 void FaubCache::cleanup() {
-    FaubCache *fc = this;
+    vector<pair<string, string>> vanished;
+    
+    // collected first as cleanupVanished() drops the records being walked
+    for (auto &record: FaubDB::forUuid(uuid).all())
+        if (!dirStamps.holds(record.first) && !exists(record.first))
+            vanished.insert(vanished.end(), make_pair(record.first, record.second.profile));
     
-    processDirectory(slashConcat(GLOBALS.cacheDir, uuid), string(SUFFIX_FAUBSTATS) + "$", false, false, fcCleanupCallback, fc);
+    for (auto &backup: vanished)
+        cleanupVanished(backup.first, backup.second);
 }
 
 
@@ -659,6 +945,8 @@ void FaubCache::renameBaseDirTo(string newDir) {
     for (auto &backup: backups)
         backup.second.renameDirectoryTo(newDir, baseDir);
     
+    inodeIndex.renameBackups(baseDir, newDir);
+    inodeIndex.save();
     baseDir = newDir;
 }
 
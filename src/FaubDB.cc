@@ -0,0 +1,275 @@
+
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "FaubDB.h"
+#include "FaubEntry.h"
+#include "globals.h"
+#include "util_generic.h"
+#include "debug.h"
+
+// compact once the log holds this many more records than there are backups
+#define COMPACT_SLACK   64
+
+
+FaubDB& FaubDB::forUuid(string uuid) {
+    // deliberately never freed; FaubEntry destructors can still be saving stats during exit
+    static map<string, FaubDB*> *dbs = new map<string, FaubDB*>;
+
+    string cacheDir = slashConcat(GLOBALS.cacheDir, uuid);
+    auto it = dbs->find(cacheDir);
+
+    if (it == dbs->end())
+        it = dbs->insert(dbs->end(), make_pair(cacheDir, new FaubDB(cacheDir)));
+
+    return *it->second;
+}
+
+
+// the whole file from an open descriptor, in one read where possible
+static string readAll(int fd) {
+    struct stat statData;
+    string data;
+
+    if (fstat(fd, &statData) || !statData.st_size)
+        return data;
+
+    data.resize(statData.st_size);
+    size_t got = 0;
+    ssize_t bytes;
+
+    while (got < data.length() && (bytes = pread(fd, &data[got], data.length() - got, got)) > 0)
+        got += bytes;
+
+    data.resize(got);
+    return data;
+}
+
+
+void FaubDB::parse(string& data) {
+    size_t pos = 0;
+    size_t eol;
+
+    // a line without its newline is a partial append (e.g. a full disk); ignore it
+    while ((eol = data.find('\n', pos)) != string::npos) {
+        auto tab1 = data.find('\t', pos);
+        auto tab2 = tab1 < eol ? data.find('\t', tab1 + 1) : string::npos;
+
+        if (tab2 < eol) {
+            string backupDir = data.substr(tab2 + 1, eol - tab2 - 1);
+
+            if (data[pos] == '+')
+                records[backupDir] = {data.substr(tab1 + 1, tab2 - tab1 - 1), data.substr(pos + 1, tab1 - pos - 1)};
+            else
+                records.erase(backupDir);
+
+            ++logRecords;
+        }
+
+        pos = eol + 1;
+    }
+}
+
+
+void FaubDB::load() {
+    if (loaded)
+        return;
+
+    loaded = true;
+    filename = slashConcat(dir, SUFFIX_FAUBDB);
+    records.clear();
+    logRecords = 0;
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT)
+            importStatsFiles();
+
+        return;
+    }
+
+    flock(fd, LOCK_SH);
+    string data = readAll(fd);
+    close(fd);
+
+    parse(data);
+    DEBUG(D_cache) DFMT("loaded " << filename << ": " << plural(records.size(), "backup") << " in " << plural(logRecords, "record"));
+
+    if (logRecords > 2 * records.size() + COMPACT_SLACK)
+        compact();
+}
+
+
+/* caches from before the database have a faub_stats file per backup: the backup's
+ * directory and profile ("dir;;profile") on the first line and its stats on the
+ * second.  they're read into the database once and removed. */
+void FaubDB::importStatsFiles() {
+    DIR *dirHandle = opendir(dir.c_str());
+    string suffix = string(".") + SUFFIX_FAUBSTATS;
+    vector<string> imported;
+    string data;
+    struct dirent *entry;
+
+    if (dirHandle == NULL)
+        return;
+
+    while ((entry = readdir(dirHandle)) != NULL) {
+        string name = entry->d_name;
+        if (name.length() <= suffix.length() || name.compare(name.length() - suffix.length(), suffix.length(), suffix))
+            continue;
+
+        ifstream statsFile(slashConcat(dir, name));
+        string fullId, stats;
+
+        if (!(statsFile >> fullId >> stats))
+            continue;
+
+        auto pos = fullId.find(";;");
+        string backupDir = fullId.substr(0, pos);
+        string profile = pos == string::npos ? "" : fullId.substr(pos + 2);
+
+        records[backupDir] = {profile, stats};
+        data += "+" + stats + "\t" + profile + "\t" + backupDir + "\n";
+        imported.insert(imported.end(), slashConcat(dir, name));
+    }
+
+    closedir(dirHandle);
+
+    if (imported.size() && append(data)) {
+        logRecords = records.size();
+        DEBUG(D_cache) DFMT("imported " << plural(imported.size(), "stats file") << " into " << filename);
+
+        for (auto &statsFile: imported)
+            unlink(statsFile.c_str());
+    }
+}
+
+
+bool FaubDB::append(string record) {
+    mkdirp(dir);
+
+    while (1) {
+        int fd = open(filename.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (fd < 0)
+            break;
+
+        flock(fd, LOCK_EX);
+
+        // if the file was compacted (replaced) while we waited for the lock, append to the new one
+        struct stat fdStat, fileStat;
+        if (fstat(fd, &fdStat) || stat(filename.c_str(), &fileStat) || fdStat.st_ino != fileStat.st_ino) {
+            close(fd);
+            continue;
+        }
+
+        bool success = write(fd, record.data(), record.length()) == (ssize_t)record.length();
+        close(fd);
+
+        if (success)
+            return true;
+
+        break;
+    }
+
+    log("error: unable to update " + filename + errtext());
+    return false;
+}
+
+
+/* rewrite the log with just the live records.  the file is re-read under the lock
+ * first so that records appended by another process since we loaded are kept. */
+bool FaubDB::compact() {
+    int fd;
+
+    while (1) {
+        fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            return false;
+
+        flock(fd, LOCK_EX);
+
+        // as in append(), if another compaction replaced the file while we waited, start over on the new one
+        struct stat fdStat, fileStat;
+        if (!fstat(fd, &fdStat) && !stat(filename.c_str(), &fileStat) && fdStat.st_ino == fileStat.st_ino)
+            break;
+
+        close(fd);
+    }
+
+    string data = readAll(fd);
+    records.clear();
+    logRecords = 0;
+    parse(data);
+
+    data.clear();
+    for (auto &record: records)
+        data += "+" + record.second.stats + "\t" + record.second.profile + "\t" + record.first + "\n";
+
+    string tempFilename = filename + ".tmp." + to_string(getpid());
+    ofstream tempFile(tempFilename, ios::trunc);
+    tempFile << data;
+    tempFile.close();
+
+    bool success = !tempFile.fail() && !rename(tempFilename.c_str(), filename.c_str());
+    if (success) {
+        DEBUG(D_cache) DFMT("compacted " << filename << " from " << plural(logRecords, "record") << " to " << records.size());
+        logRecords = records.size();
+    }
+    else {
+        log("error: unable to compact " + filename + errtext());
+        unlink(tempFilename.c_str());
+    }
+
+    close(fd);
+    return success;
+}
+
+
+bool FaubDB::get(string backupDir, faubRecordType& record) {
+    load();
+
+    auto it = records.find(backupDir);
+    if (it == records.end())
+        return false;
+
+    record = it->second;
+    return true;
+}
+
+
+bool FaubDB::put(string backupDir, string profile, string stats) {
+    load();
+
+    auto it = records.find(backupDir);
+    if (it != records.end() && it->second.profile == profile && it->second.stats == stats)
+        return true;
+
+    records[backupDir] = {profile, stats};
+    if (!append("+" + stats + "\t" + profile + "\t" + backupDir + "\n"))
+        return false;
+
+    if (++logRecords > 2 * records.size() + COMPACT_SLACK)
+        compact();
+
+    return true;
+}
+
+
+void FaubDB::remove(string backupDir) {
+    load();
+
+    if (!records.erase(backupDir))
+        return;
+
+    append("-\t\t" + backupDir + "\n");
+
+    if (++logRecords > 2 * records.size() + COMPACT_SLACK)
+        compact();
+}
@@ -7,6 +7,7 @@
 #include "FaubEntry.h"
 #include "BackupConfig.h"
 #include "util_generic.h"
+#include "FaubDB.h"
 
 #include "FaubEntry.h"
 
@@ -25,6 +26,7 @@ FaubEntry& FaubEntry::operator=(const DiskStats& stats) {
 FaubEntry::FaubEntry(string dir, string aProfile, string aUuid) {
     directory = dir;
     uuid = aUuid;
+    cacheKey = slashConcat(GLOBALS.cacheDir, uuid, MD5string(directory));
     ds.usedInBytes = ds.usedInBlocks = ds.savedInBytes = ds.savedInBlocks = finishTime = duration = modifiedFiles = unchangedFiles = dirs = slinks = 0;
     startDay = startMonth = startYear = mtimeDayAge = dow = holdDate = 0;
     profile = aProfile;
@@ -37,7 +39,7 @@ FaubEntry::~FaubEntry() {
     if (updated)
         saveStats();
 
-    if (inodes.size())
+    if (!inodes.empty() && !inodes.isMapped())
         saveInodes();
 }
 
@@ -77,19 +79,14 @@ void FaubEntry::string2stats(string& data) {
 }
 
 
+// stats live in the profile's FaubDB rather than a file of their own
 bool FaubEntry::loadStats() {
-    ifstream cacheFile;
+    faubRecordType record;
 
-    cacheFile.open(cacheFilename(SUFFIX_FAUBSTATS));
-    if (cacheFile.is_open()) {
-        string data;
+    if (FaubDB::forUuid(uuid).get(directory, record)) {
+        string2stats(record.stats);
 
-        cacheFile >> data;  // path in the file; ignore it here
-        cacheFile >> data;  // actual stats
-        string2stats(data);
-        cacheFile.close();
-
-        DEBUG(D_cache) DFMT("loaded " + cacheFilename(SUFFIX_FAUBSTATS));
+        DEBUG(D_cache) DFMT("loaded stats for " + directory);
         return true;
     }
 
@@ -98,84 +95,63 @@ bool FaubEntry::loadStats() {
 
 
 void FaubEntry::saveStats() {
-    ofstream cacheFile;
-    string filename = cacheFilename(SUFFIX_FAUBSTATS);
-    
-    mkdirp(pathSplit(filename).dir);
-    
-    cacheFile.open(filename);
-    if (cacheFile.is_open()) {
-        string data = stats2string();
-
-        cacheFile << directory << ";;" << profile << endl;
-        cacheFile << data << endl;
-        cacheFile.close();
-    }
-    else {
-        string error = "error: unable to create " + filename + " - " + strerror(errno);
-        log(error);
-        SCREENERR(error);
-    }
+    // put() has already logged the specifics
+    if (!FaubDB::forUuid(uuid).put(directory, profile, stats2string()))
+        SCREENERR("error: unable to save the cached stats for " + directory);
 }
 
 
 
 void FaubEntry::saveInodes() {
-    ofstream cacheFile;
-    string inodeData;
     string filename = cacheFilename(SUFFIX_FAUBINODES);
 
     mkdirp(pathSplit(filename).dir);
 
-    cacheFile.open(filename);
-    if (cacheFile.is_open()) {
-        int x = 0;
-        for (auto &i: inodes) {
-            inodeData += to_string(i) + ",";
-
-            if (++x > 200) {
-                inodeData.pop_back();
-                inodeData += "\n";
-                x = 0;
-            }
-        }
-
-        cacheFile << inodeData << endl;
-        cacheFile.close();
-    }
+    if (!inodes.saveFile(filename))
+        log("error: unable to save " + filename + errtext());
 }
 
 
+/*
+ the inode list is normally in InodeSet's binary format and is mapped rather than
+ read.  older caches have it as comma-separated text; those are parsed once and
+ rewritten in the binary format.
+ */
 void FaubEntry::loadInodes() {
     ifstream cacheFile;
-    Pcre inodeRE("(\\d+)");
-    string match;
+    string filename = cacheFilename(SUFFIX_FAUBINODES);
+
+    if (!inodes.empty())
+        return;
 
-    if (inodes.size())
+    if (inodes.mapFile(filename))
         return;
 
-    cacheFile.open(cacheFilename(SUFFIX_FAUBINODES));
+    cacheFile.open(filename);
     if (cacheFile.is_open()) {
         string data;
 
-        while (!cacheFile.eof()) {
-            cacheFile >> data;
-
-            size_t pos = 0;
-            while (pos <= data.length() && inodeRE.search(data, (int)pos)) {
-                pos = inodeRE.get_match_end(0);
-                match = inodeRE.get_match(0);
-                ++pos;
-
-                if (match.length())
-                    inodes.insert(stoll(match)); 
+        while (getline(cacheFile, data)) {
+            const char *pos = data.c_str();
+
+            while (*pos) {
+                if (isdigit(*pos)) {
+                    char *end;
+                    inodes.insert((ino_t)strtoull(pos, &end, 10));
+                    pos = end;
+                }
+                else
+                    ++pos;
             }
         }
 
         cacheFile.close();
+        
+        DEBUG(D_cache) DFMT("converting " << filename << " to binary");
+        saveInodes();
     }
     else {
-        set<ino_t> seenInodes;
+        InodeSet seenInodes;
         // here we only care about dus() updating 'inodes'
         dus(directory, seenInodes, inodes);
     }
@@ -183,9 +159,7 @@ void FaubEntry::loadInodes() {
 
 
 void FaubEntry::removeEntry() {
-    int result = 0;
-    if ((result = unlink(cacheFilename(SUFFIX_FAUBSTATS).c_str())))
-        DEBUG(D_prune) DFMT("no cache to delete - " << cacheFilename(SUFFIX_FAUBSTATS));
+    FaubDB::forUuid(uuid).remove(directory);
     
     if (unlink(cacheFilename(SUFFIX_FAUBINODES).c_str()))
         DEBUG(D_prune) DFMT("no cache to delete - " << cacheFilename(SUFFIX_FAUBINODES));
@@ -193,7 +167,13 @@ void FaubEntry::removeEntry() {
     if (unlink(cacheFilename(SUFFIX_FAUBDIFF).c_str()))
         DEBUG(D_prune) DFMT("no cache to delete - " << cacheFilename(SUFFIX_FAUBDIFF));
     
-    DEBUG(D_prune) DFMT("cache files deleted - " << cacheFilename(SUFFIX_FAUBSTATS) << " for " << directory << " (result " << result << ")");
+    if (unlink(cacheFilename(SUFFIX_FAUBMANIFEST).c_str()))
+        DEBUG(D_prune) DFMT("no cache to delete - " << cacheFilename(SUFFIX_FAUBMANIFEST));
+    
+    if (unlink(cacheFilename(SUFFIX_FAUBDIRLINKS).c_str()))
+        DEBUG(D_prune) DFMT("no cache to delete - " << cacheFilename(SUFFIX_FAUBDIRLINKS));
+    
+    DEBUG(D_prune) DFMT("cache files deleted - " << cacheKey << " for " << directory);
     updated = false;  // otherwise the destructor recreates these files
 }
 
@@ -222,6 +202,27 @@ void FaubEntry::updateDiffFiles(set<string> files) {
 }
 
 
+/*
+ * The paths (relative to the backup) that changed in this backup, as recorded
+ * by updateDiffFiles().  Returns false if there's no record.
+ */
+bool FaubEntry::loadDiffFiles(set<string>& files) {
+    ifstream cacheFile;
+    string data;
+    
+    cacheFile.open(cacheFilename(SUFFIX_FAUBDIFF));
+    if (!cacheFile.is_open())
+        return false;
+    
+    while (getline(cacheFile, data))
+        if (data.length() && data != NO_CHANGES)
+            files.insert(files.end(), data);
+    
+    cacheFile.close();
+    return true;
+}
+
+
 bool FaubEntry::displayDiffFiles() {
     ifstream cacheFile;
     string data;
@@ -265,6 +266,107 @@ bool FaubEntry::displayDiffFiles() {
 }
 
 
+/*
+ * manifest format: one line per regular file of "digest,size,mtime,path".  path is
+ * last so it can contain commas.
+ */
+void FaubEntry::saveManifest(map<string, manifestEntry>& manifest) {
+    ofstream cacheFile;
+    string filename = cacheFilename(SUFFIX_FAUBMANIFEST);
+    
+    mkdirp(pathSplit(filename).dir);
+    
+    cacheFile.open(filename);
+    if (cacheFile.is_open()) {
+        for (auto &entry: manifest)
+            cacheFile << entry.second.digest << "," << entry.second.size << "," << entry.second.mtime << "," << entry.first << "\n";
+        
+        cacheFile.close();
+    }
+    else {
+        string error = "error: unable to create " + filename + " - " + strerror(errno);
+        log(error);
+        SCREENERR(error);
+    }
+}
+
+
+bool FaubEntry::loadManifest(map<string, manifestEntry>& manifest) {
+    ifstream cacheFile;
+    string data;
+    
+    cacheFile.open(cacheFilename(SUFFIX_FAUBMANIFEST));
+    if (!cacheFile.is_open())
+        return false;
+    
+    while (getline(cacheFile, data)) {
+        auto c1 = data.find(",");
+        auto c2 = c1 == string::npos ? c1 : data.find(",", c1 + 1);
+        auto c3 = c2 == string::npos ? c2 : data.find(",", c2 + 1);
+        
+        if (c3 == string::npos)
+            continue;
+        
+        try {
+            manifestEntry entry;
+            entry.digest = data.substr(0, c1);
+            entry.size = stol(data.substr(c1 + 1, c2 - c1 - 1));
+            entry.mtime = stol(data.substr(c2 + 1, c3 - c2 - 1));
+            manifest.insert(manifest.end(), make_pair(data.substr(c3 + 1), entry));
+        }
+        catch (...) {
+            DEBUG(D_cache) DFMT("unable to parse manifest line: " << data);
+        }
+    }
+    
+    cacheFile.close();
+    DEBUG(D_cache) DFMT("loaded " << manifest.size() << " manifest entries from " << cacheFilename(SUFFIX_FAUBMANIFEST));
+    return true;
+}
+
+
+/*
+ * The directories and symlinks in this backup (the manifest only has its regular
+ * files), one path per line.  Returns false if there's no record.
+ */
+void FaubEntry::saveDirLinks(set<string>& paths) {
+    ofstream cacheFile;
+    string filename = cacheFilename(SUFFIX_FAUBDIRLINKS);
+    
+    mkdirp(pathSplit(filename).dir);
+    
+    cacheFile.open(filename);
+    if (cacheFile.is_open()) {
+        for (auto &path: paths)
+            cacheFile << path << "\n";
+        
+        cacheFile.close();
+    }
+    else {
+        string error = "error: unable to create " + filename + " - " + strerror(errno);
+        log(error);
+        SCREENERR(error);
+    }
+}
+
+
+bool FaubEntry::loadDirLinks(set<string>& paths) {
+    ifstream cacheFile;
+    string data;
+    
+    cacheFile.open(cacheFilename(SUFFIX_FAUBDIRLINKS));
+    if (!cacheFile.is_open())
+        return false;
+    
+    while (getline(cacheFile, data))
+        if (data.length())
+            paths.insert(paths.end(), data);
+    
+    cacheFile.close();
+    return true;
+}
+
+
 int FaubEntry::filenameDayAge() {
     return floor((time(NULL) - filename2Mtime(directory)) / SECS_PER_DAY);
 }
@@ -273,26 +375,31 @@ int FaubEntry::filenameDayAge() {
 void FaubEntry::renameDirectoryTo(string newDir, string oldDir) {
     Pcre regex("^(" + oldDir+ ")");
     
-    auto origStats = cacheFilename(SUFFIX_FAUBSTATS);
     auto origInodes = cacheFilename(SUFFIX_FAUBINODES);
     auto origDiff = cacheFilename(SUFFIX_FAUBDIFF);
+    auto origManifest = cacheFilename(SUFFIX_FAUBMANIFEST);
+    auto origDirLinks = cacheFilename(SUFFIX_FAUBDIRLINKS);
+    
+    FaubDB::forUuid(uuid).remove(directory);
     
     if (regex.search(directory) && regex.matches()) {
         directory.erase(0, regex.get_match(0).length());
         directory = slashConcat(newDir, directory);
     }
 
-    auto newStats = cacheFilename(SUFFIX_FAUBSTATS);
+    cacheKey = slashConcat(GLOBALS.cacheDir, uuid, MD5string(directory));
     auto newInodes = cacheFilename(SUFFIX_FAUBINODES);
     auto newDiff = cacheFilename(SUFFIX_FAUBDIFF);
+    auto newManifest = cacheFilename(SUFFIX_FAUBMANIFEST);
+    auto newDirLinks = cacheFilename(SUFFIX_FAUBDIRLINKS);
 
     // need to rename these if they exist but if they don't
     // that's okay too so no need to error out
-    rename(origStats.c_str(), newStats.c_str());
     rename(origInodes.c_str(), newInodes.c_str());
     rename(origDiff.c_str(), newDiff.c_str());
+    rename(origManifest.c_str(), newManifest.c_str());
+    rename(origDirLinks.c_str(), newDirLinks.c_str());
     
-    // still need to call save because the 'directory' variable is written
-    // into the stats file and needs to be updated.
+    // the stats are recorded under the backup's directory, so re-record them under the new one
     saveStats();
 }
@@ -0,0 +1,911 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <sys/event.h>
+#endif
+
+#include "FaubReceiver.h"
+#include "notify.h"
+#include "debug.h"
+#include "globals.h"
+#include "exception.h"
+
+#define RECEIVER_BATCH  4096    // phase 1 entries compared per job
+
+
+// SIGINT & SIGTERM while run() is in charge; the loop takes it from there
+static int receiverWakeFd = -1;
+static volatile sig_atomic_t receiverInterrupted = 0;
+
+static void receiverSignal(int sig) {
+    receiverInterrupted = 1;
+    char wakeUp = 0;
+    if (write(receiverWakeFd, &wakeUp, 1) < 0)
+        return;
+}
+
+
+static void setFlags(int fd, bool nonBlocking) {
+    if (fd < 0)
+        return;
+
+    fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+    if (nonBlocking)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+
+/* input buffer helpers; each consumes what it returns, or nothing if it isn't all here yet */
+static size_t available(receiverSessionType *rs) {
+    return rs->inBuf.length() - rs->inPos;
+}
+
+
+static bool takeInt(receiverSessionType *rs, __int64_t& value) {
+    if (available(rs) < sizeof(value))
+        return false;
+
+    memcpy(&value, rs->inBuf.data() + rs->inPos, sizeof(value));
+    rs->inPos += sizeof(value);
+
+#if defined(__linux__)
+    value = be64toh(value);
+#else
+    value = ntohll(value);
+#endif
+    return true;
+}
+
+
+static bool takeTo(receiverSessionType *rs, string& text) {
+    auto index = rs->inBuf.find(NET_DELIM, rs->inPos);
+    if (index == string::npos)
+        return false;
+
+    text = rs->inBuf.substr(rs->inPos, index - rs->inPos);
+    rs->inPos = index + strlen(NET_DELIM);
+    return true;
+}
+
+
+FaubReceiver::FaubReceiver(size_t workerThreads, size_t maxConcurrent) {
+    workers = workerThreads > 0 ? workerThreads : 1;
+    maxSessions = maxConcurrent;
+    throttled = interrupted = stopping = false;
+    pendingBytes = 0;
+    lastTick = 0;
+
+#if defined(__linux__)
+    pollFd = epoll_create1(EPOLL_CLOEXEC);
+#else
+    pollFd = kqueue();
+#endif
+
+    if (pollFd < 0 || pipe(wakePipe))
+        throw MBException(string("unable to set up the multiplex event loop: ") + strerror(errno));
+
+    setFlags(wakePipe[0], true);
+    setFlags(wakePipe[1], true);
+    wakeWatch = {NULL, wakePipe[0], 0};
+    reconcile(wakeWatch, WANT_READ);
+}
+
+
+FaubReceiver::~FaubReceiver() {
+    close(pollFd);
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+}
+
+
+/*
+ * run()
+ * Back up every profile that's been add()ed, up to maxSessions of them at a time
+ * (0 for no limit).  False if we were interrupted, in which case the backups in
+ * progress have been abandoned and their temp dirs removed.
+ */
+bool FaubReceiver::run() {
+    if (!waiting.size())
+        return true;
+
+    struct sigaction action, oldInt, oldTerm, oldPipe;
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    action.sa_handler = receiverSignal;
+    receiverWakeFd = wakePipe[1];
+    receiverInterrupted = 0;
+    sigaction(SIGINT, &action, &oldInt);
+    sigaction(SIGTERM, &action, &oldTerm);
+
+    // a client that goes away shows up as a failed write to its session alone
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, &oldPipe);
+
+    log("[MULTIPLEX] receiving " + plural(waiting.size(), "profile") + " with " + plural(workers, "worker thread") +
+        (maxSessions ? " (" + to_string(maxSessions) + " at a time)" : ""));
+
+    vector<thread> pool;
+    for (size_t i = 0; i < workers; ++i)
+        pool.insert(pool.end(), thread(&FaubReceiver::worker, this));
+
+    vector<pair<receiverWatchType*, unsigned int>> readyWatches;
+
+    while (waiting.size() || sessions.size() || reaping.size()) {
+        while (waiting.size() && !interrupted && (!maxSessions || sessions.size() < maxSessions)) {
+            start(waiting.front());
+            waiting.erase(waiting.begin());
+        }
+
+        readyWatches.clear();
+        waitReady(readyWatches);
+
+        // sessions only go away in complete(), so everything in this batch is still valid
+        bool woken = false;
+        for (auto &readyWatch: readyWatches) {
+            auto w = readyWatch.first;
+
+            if (w == &wakeWatch) {
+                char drain[256];
+                while (read(wakePipe[0], drain, sizeof(drain)) > 0);
+                woken = true;
+                continue;
+            }
+
+            if ((readyWatch.second & WANT_READ) && (w->events & WANT_READ))
+                readable(w->rs);
+
+            if ((readyWatch.second & WANT_WRITE) && (w->events & WANT_WRITE))
+                writable(w->rs);
+        }
+
+        if (woken)
+            complete();
+
+        if (receiverInterrupted && !interrupted) {
+            interrupted = true;
+            log("[MULTIPLEX] interrupted; abandoning " + plural(sessions.size(), "backup") + " in progress");
+            waiting.clear();
+
+            for (auto rs: sessions)
+                fail(rs, rs->config->ifTitle() + " backup interrupted");
+        }
+
+        tick();
+    }
+
+    {
+        lock_guard<mutex> guard(poolLock);
+        stopping = true;
+    }
+    poolReady.notify_all();
+    for (auto &worker: pool)
+        worker.join();
+
+    sigaction(SIGINT, &oldInt, NULL);
+    sigaction(SIGTERM, &oldTerm, NULL);
+    sigaction(SIGPIPE, &oldPipe, NULL);
+    receiverWakeFd = -1;
+
+    return !interrupted;
+}
+
+
+/*******************************************************************************
+ * worker pool
+ *******************************************************************************/
+
+void FaubReceiver::worker() {
+    unique_lock<mutex> guard(poolLock);
+
+    while (1) {
+        poolReady.wait(guard, [this]() { return stopping || ready.size(); });
+        if (!ready.size())
+            return;
+
+        // one job per turn so a session with a lot queued can't hold a worker to itself
+        auto rs = ready.front();
+        ready.pop_front();
+        auto job = move(rs->jobs.front());
+        rs->jobs.pop_front();
+        bool skip = rs->failed && !job.always;
+        guard.unlock();
+
+        string failure;
+        if (!skip && job.work)
+            try {
+                job.work();
+            }
+            catch (MBException &e) {
+                failure = rs->config->ifTitle() + " error (exception): " + e.detail();
+            }
+            catch (...) {
+                failure = rs->config->ifTitle() + " error (exception): unknown";
+            }
+
+        guard.lock();
+        pendingBytes -= job.bytes;
+
+        if (rs->jobs.size())
+            ready.insert(ready.end(), rs);
+        else
+            rs->scheduled = false;
+
+        bool wasIdle = !completions.size();
+        completions.insert(completions.end(), {rs, skip ? function<void()>() : job.then, failure, job.always});
+        if (wasIdle)
+            wake();
+    }
+}
+
+
+void FaubReceiver::queue(receiverSessionType *rs, function<void()> work, function<void()> then, size_t bytes, bool always) {
+    if (rs->failing && !always)
+        return;
+
+    lock_guard<mutex> guard(poolLock);
+    pendingBytes += bytes;
+    rs->jobs.insert(rs->jobs.end(), {work, then, bytes, always});
+
+    if (!rs->scheduled) {
+        rs->scheduled = true;
+        ready.insert(ready.end(), rs);
+        poolReady.notify_one();
+    }
+}
+
+
+void FaubReceiver::wake() {
+    char wakeUp = 0;
+    if (write(wakePipe[1], &wakeUp, 1) < 0)
+        return;     // the pipe's full, so a wake up is already pending
+}
+
+
+// back on the event loop: finish up what the workers have done
+void FaubReceiver::complete() {
+    deque<receiverCompletionType> done;
+    bool resume;
+
+    {
+        lock_guard<mutex> guard(poolLock);
+        done.swap(completions);
+        resume = throttled && pendingBytes <= RECEIVER_LOWWATER;
+    }
+
+    for (auto &completion: done)
+        if (completion.failure.length())
+            fail(completion.rs, completion.failure);
+        else
+            if (completion.then && (completion.always || !completion.rs->failing))
+                completion.then();
+
+    if (resume) {
+        DEBUG(D_netproto) DFMT("multiplex: disk caught up; reading again");
+        throttled = false;
+
+        // the wait was ours, not the clients'
+        for (auto rs: sessions) {
+            rs->lastHeard = time(NULL);
+            watch(rs);
+        }
+    }
+}
+
+
+/*******************************************************************************
+ * sessions
+ *******************************************************************************/
+
+void FaubReceiver::start(BackupConfig *config) {
+    auto rs = new receiverSessionType();
+    rs->config = config;
+    rs->state = psConnecting;
+    rs->readWatch = {rs, -1, 0};
+    rs->writeWatch = {rs, -1, 0};
+    rs->lastHeard = time(NULL);
+    sessions.insert(sessions.end(), rs);
+
+    DEBUG(D_netproto) DFMT("multiplex: starting " << config->settings[sTitle].value);
+    queue(rs, [this, rs]() { connect(rs); }, [this, rs]() { connected(rs); });
+}
+
+
+/*
+ * connect() - worker
+ * Reach the profile's client the way fs_startServer() does: its agent if it has
+ * one, otherwise (or failing that) by running its faub command.
+ */
+void FaubReceiver::connect(receiverSessionType *rs) {
+    auto& config = *rs->config;
+
+    rs->newDir = newBackupDir(config);
+    rs->prevDir = mostRecentBackupDirSince(config.settings[sDirectory].value, rs->newDir, config.settings[sTitle].value);
+
+    if (config.settings[sAgent].value.length()) {
+        string error;
+        auto agent = fs_connectAgent(config, error);
+
+        if (agent != NULL) {
+            setFlags(agent->descriptor(), false);
+            rs->client = agent;
+            return;
+        }
+
+        string message = "unable to use faub agent " + config.settings[sAgent].value + ": " + error;
+        if (!config.settings[sFaub].value.length())
+            throw MBException(message);
+
+        message = config.ifTitle() + " " + message;
+        log(message + "; falling back to the faub command");
+        SCREENERR(message + "; falling back to the faub command");
+    }
+
+    string faubCommand = fs_faubCommand(config);
+    DEBUG(D_netproto) DFMT("executing: \"" << faubCommand << "\"");
+
+    lock_guard<mutex> guard(forkLock);
+    rs->command = new PipeExec(faubCommand, 60);
+    rs->command->execute(GLOBALS.cli.count(CLI_LEAVEOUTPUT) ? config.settings[sTitle].value : "", false, false, false, true);
+    setFlags(rs->command->descriptor(), false);
+    setFlags(rs->command->writeDescriptor(), false);
+    rs->client = rs->command;
+}
+
+
+void FaubReceiver::connected(receiverSessionType *rs) {
+    rs->timeout = rs->client->getTimeout();
+    rs->inBuf = rs->client->takeBuffered();     // anything an agent sent after its handshake
+    rs->readWatch.fd = rs->client->descriptor();
+    rs->writeWatch.fd = rs->client->writeDescriptor();
+    setFlags(rs->readWatch.fd, true);
+    setFlags(rs->writeWatch.fd, true);
+
+    rs->state = psCaps;
+    rs->lastHeard = time(NULL);
+    parse(rs);
+}
+
+
+// the client's announced what it has; start the backup proper
+void FaubReceiver::begin(receiverSessionType *rs) {
+    DEBUG(D_netproto) DFMT(rs->config->ifTitle() << " client capabilities: " << rs->clientCaps);
+
+    // another backup server sending its backups is a different conversation entirely
+    if (rs->clientCaps & NET_CAP_REPLICA) {
+        log(rs->config->ifTitle() + " faub client is a replica source; receiving it separately");
+        handBack.insert(handBack.end(), rs->config);
+        closeSession(rs);
+        return;
+    }
+
+    rs->state = psFsName;
+    queue(rs, [rs]() {
+        rs->session.reset(new FaubSession(*rs->config, rs->prevDir, rs->newDir, false, rs->clientCaps, rs->totalFS, ".tmp." + to_string(GLOBALS.pid)));
+        rs->session->animate = rs->session->trackInterrupt = false;
+        rs->tempDir = rs->session->currentDir;
+    });
+}
+
+
+/*
+ * step()
+ * Consume the next piece of the protocol from the session's input, if it's all
+ * arrived, and queue whatever it calls for.  False once there's nothing more to do
+ * until more input (or our own work) arrives.
+ */
+bool FaubReceiver::step(receiverSessionType *rs) {
+    __int64_t value;
+    string text;
+
+    switch (rs->state) {
+        /* the capabilities & filesystem count */
+        case psCaps:
+            if (!takeInt(rs, value))
+                return false;
+
+            if (value == NET_CAPS)
+                rs->state = psCapsValue;
+            else {
+                rs->totalFS = value;
+                begin(rs);
+            }
+            return true;
+
+        case psCapsValue:
+            if (!takeInt(rs, rs->clientCaps))
+                return false;
+
+            rs->state = psCount;
+            return true;
+
+        case psCount:
+            if (!takeInt(rs, rs->totalFS))
+                return false;
+
+            begin(rs);
+            return true;
+
+        /* phase 1 */
+        case psFsName:
+            if (!takeTo(rs, text))
+                return false;
+
+            queue(rs, [rs, text]() { rs->session->startFS(text); });
+            rs->state = psEntryName;
+            return true;
+
+        case psEntryName:
+            if (!takeTo(rs, text))
+                return false;
+
+            if (text == NET_ABORT) {
+                fail(rs, rs->config->ifTitle() + " backup aborted by client");
+                return false;
+            }
+
+            if (text == NET_OVER)
+                compareEntries(rs, true);
+            else {
+                rs->entryName = text;
+                rs->state = psEntryInts;
+            }
+            return true;
+
+        case psEntryInts: {
+            if (available(rs) < 3 * sizeof(__int64_t))
+                return false;
+
+            __int64_t mtime, mode, size;
+            takeInt(rs, mtime);
+            takeInt(rs, mode);
+            takeInt(rs, size);
+            rs->entries.insert(rs->entries.end(), {rs->entryName, (time_t)mtime, (mode_t)mode, (off_t)size});
+
+            if (rs->entries.size() >= RECEIVER_BATCH)
+                compareEntries(rs, false);
+
+            rs->state = psEntryName;
+            return true;
+        }
+
+        /* phase 3 */
+        case psTouchReply:
+            if (!takeInt(rs, value))
+                return false;
+
+            if (value == NET_TOUCH_MATCH) {
+                string file = rs->needed[rs->nextNeeded];
+                queue(rs, [rs, file]() { rs->session->linkTouched(file); });
+                ++rs->nextNeeded;
+                expectNeeded(rs);
+            }
+            else
+                rs->state = psHeader;
+            return true;
+
+        case psHeader: {
+            if (available(rs) < sizeof(rs->header))
+                return false;
+
+            for (auto &field: rs->header)
+                takeInt(rs, field);
+
+            string file = rs->needed[rs->nextNeeded];
+            long uid = rs->header[0], gid = rs->header[1], mode = rs->header[2], mtime = rs->header[3];
+
+            queue(rs, [rs, file, uid, gid, mode, mtime]() {
+                rs->writer.reset(new DirEntryWriter(rs->session->destination(file), !rs->session->incTime));
+                rs->writer->header(uid, gid, mode, mtime);
+            });
+
+            if (S_ISDIR(mode))
+                entryDone(rs);
+            else
+                rs->state = S_ISLNK(mode) ? psLinkLength : psFileSize;
+            return true;
+        }
+
+        case psLinkLength:
+            if (!takeInt(rs, rs->remaining))
+                return false;
+
+            if (rs->remaining < 0 || rs->remaining > PATH_MAX) {
+                fail(rs, rs->config->ifTitle() + " invalid symlink length (" + to_string(rs->remaining) + ") for " + rs->needed[rs->nextNeeded]);
+                return false;
+            }
+
+            rs->state = psLinkTarget;
+            return true;
+
+        case psLinkTarget:
+            if ((__int64_t)available(rs) < rs->remaining)
+                return false;
+
+            text = rs->inBuf.substr(rs->inPos, rs->remaining);
+            rs->inPos += rs->remaining;
+            queue(rs, [rs, text]() { rs->writer->symlinkTarget(text); });
+            entryDone(rs);
+            return true;
+
+        case psFileSize:
+            if (!takeInt(rs, rs->remaining))
+                return false;
+
+            if (rs->remaining < 0) {
+                fail(rs, rs->config->ifTitle() + " invalid size (" + to_string(rs->remaining) + ") for " + rs->needed[rs->nextNeeded]);
+                return false;
+            }
+
+            value = rs->remaining;
+            queue(rs, [rs, value]() { rs->writer->fileSize(value); });
+
+            if (rs->remaining)
+                rs->state = psFileData;
+            else
+                entryDone(rs);
+            return true;
+
+        case psFileData: {
+            size_t count = available(rs);
+            if ((__int64_t)count > rs->remaining)
+                count = rs->remaining;
+            if (count > RECEIVER_CHUNK)
+                count = RECEIVER_CHUNK;
+            if (!count)
+                return false;
+
+            auto chunk = make_shared<string>(rs->inBuf, rs->inPos, count);
+            rs->inPos += count;
+            rs->remaining -= count;
+            queue(rs, [rs, chunk]() { rs->writer->fileData(chunk->data(), chunk->length()); }, NULL, count);
+
+            if (!rs->remaining)
+                entryDone(rs);
+            return true;
+        }
+
+        /* phase 4, then another filesystem or the end */
+        case psMore:
+            if (!takeInt(rs, value))
+                return false;
+
+            queue(rs, [rs]() { rs->session->finishFS(); });
+
+            if (value) {
+                rs->state = psFsName;
+                return true;
+            }
+
+            rs->state = psFinishing;
+            queue(rs, [this, rs]() {
+                lock_guard<mutex> guard(finishLock);
+                if (!rs->session->finish())
+                    rmrf(rs->tempDir);
+            }, [this, rs]() { closeSession(rs); });
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+
+void FaubReceiver::parse(receiverSessionType *rs) {
+    while (!rs->blocked && !rs->failing && rs->state > psConnecting && rs->state < psFinishing && step(rs));
+
+    if (rs->inPos) {
+        rs->inBuf.erase(0, rs->inPos);
+        rs->inPos = 0;
+    }
+
+    watch(rs);
+}
+
+
+/*
+ * compareEntries()
+ * Hand phase 1 entries to a worker to compare to the previous backup.  The last
+ * batch also works out phase 2's requests, and we don't read any further (the client
+ * won't have sent anything) until they're ready to go out.
+ */
+void FaubReceiver::compareEntries(receiverSessionType *rs, bool last) {
+    auto batch = make_shared<vector<localEntryType>>();
+    batch->swap(rs->entries);
+
+    if (!last) {
+        queue(rs, [rs, batch]() {
+            for (auto &entry: *batch)
+                rs->session->compare(entry.filename, entry.mtime, entry.mode, entry.size);
+        });
+        return;
+    }
+
+    rs->state = psWaitRequests;
+    rs->blocked = true;
+
+    queue(rs, [rs, batch]() {
+        auto& session = *rs->session;
+
+        for (auto &entry: *batch)
+            session.compare(entry.filename, entry.mtime, entry.mode, entry.size);
+
+        rs->needed.assign(session.neededFiles.begin(), session.neededFiles.end());
+        rs->touched.clear();
+        rs->requests.clear();
+
+        for (auto &file: rs->needed) {
+            rs->requests += file + NET_DELIM;
+
+            if (session.hashFirst)
+                rs->requests += session.requestDigest(file) + NET_DELIM;
+
+            rs->touched.insert(rs->touched.end(), session.isTouchCandidate(file));
+        }
+
+        rs->requests += NET_OVER_DELIM;
+        DEBUG(D_netproto) DFMT(session.fs << " server phase 1 complete; total:" << session.fileTotal << ", need:" << rs->needed.size() <<
+                               ", willLink:" << session.hardLinkList.size());
+    },
+    [this, rs]() {
+        rs->outBuf += rs->requests;
+        rs->requests.clear();
+        rs->blocked = false;
+        rs->nextNeeded = 0;
+        rs->lastHeard = time(NULL);
+        expectNeeded(rs);
+        parse(rs);
+    });
+}
+
+
+// what phase 3 brings next: the next needed entry, or the client's "more" once they're all in
+void FaubReceiver::expectNeeded(receiverSessionType *rs) {
+    if (rs->nextNeeded >= rs->needed.size())
+        rs->state = psMore;
+    else
+        rs->state = rs->touched[rs->nextNeeded] ? psTouchReply : psHeader;
+}
+
+
+void FaubReceiver::entryDone(receiverSessionType *rs) {
+    string file = rs->needed[rs->nextNeeded];
+
+    queue(rs, [rs, file]() {
+        rs->session->received(file, rs->writer->result());
+        rs->writer.reset();
+    });
+
+    ++rs->nextNeeded;
+    expectNeeded(rs);
+}
+
+
+/*******************************************************************************
+ * I/O
+ *******************************************************************************/
+
+// register interest in whatever the session can use right now
+void FaubReceiver::watch(receiverSessionType *rs) {
+    bool active = !rs->failing && rs->state > psConnecting && rs->state < psFinishing;
+    unsigned int reading = active && !throttled ? WANT_READ : 0;
+    unsigned int writing = active && rs->outBuf.length() ? WANT_WRITE : 0;
+
+    if (rs->readWatch.fd == rs->writeWatch.fd)
+        reconcile(rs->readWatch, reading | writing);
+    else {
+        reconcile(rs->readWatch, reading);
+        reconcile(rs->writeWatch, writing);
+    }
+}
+
+
+void FaubReceiver::unwatch(receiverSessionType *rs) {
+    reconcile(rs->readWatch, 0);
+    reconcile(rs->writeWatch, 0);
+}
+
+
+void FaubReceiver::reconcile(receiverWatchType& w, unsigned int events) {
+    if (w.fd < 0 || events == w.events)
+        return;
+
+#if defined(__linux__)
+    struct epoll_event change;
+    change.events = (events & WANT_READ ? (uint32_t)EPOLLIN : 0) | (events & WANT_WRITE ? (uint32_t)EPOLLOUT : 0);
+    change.data.ptr = &w;
+    epoll_ctl(pollFd, !w.events ? EPOLL_CTL_ADD : events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL, w.fd, &change);
+#else
+    struct kevent changes[2];
+    int count = 0;
+
+    if ((events ^ w.events) & WANT_READ)
+        EV_SET(&changes[count++], w.fd, EVFILT_READ, events & WANT_READ ? EV_ADD : EV_DELETE, 0, 0, &w);
+    if ((events ^ w.events) & WANT_WRITE)
+        EV_SET(&changes[count++], w.fd, EVFILT_WRITE, events & WANT_WRITE ? EV_ADD : EV_DELETE, 0, 0, &w);
+
+    kevent(pollFd, changes, count, NULL, 0, NULL);
+#endif
+
+    w.events = events;
+}
+
+
+// wait up to a second for registered descriptors to be ready; an error or hangup shows as ready
+void FaubReceiver::waitReady(vector<pair<receiverWatchType*, unsigned int>>& readyWatches) {
+#if defined(__linux__)
+    struct epoll_event events[64];
+    int count = epoll_wait(pollFd, events, 64, 1000);
+
+    for (int i = 0; i < count; ++i)
+        readyWatches.insert(readyWatches.end(), {(receiverWatchType*)events[i].data.ptr,
+            (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR) ? WANT_READ : 0) | (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR) ? WANT_WRITE : 0)});
+#else
+    struct kevent events[64];
+    struct timespec second = {1, 0};
+    int count = kevent(pollFd, NULL, 0, events, 64, &second);
+
+    for (int i = 0; i < count; ++i)
+        readyWatches.insert(readyWatches.end(), {(receiverWatchType*)events[i].udata, events[i].filter == EVFILT_READ ? WANT_READ : WANT_WRITE});
+#endif
+
+    if (count < 0 && errno != EINTR)
+        log(string("[MULTIPLEX] error waiting on clients: ") + strerror(errno));
+}
+
+
+void FaubReceiver::readable(receiverSessionType *rs) {
+    char buffer[BUFFER_SIZE];
+    auto bytes = read(rs->readWatch.fd, buffer, sizeof(buffer));
+
+    if (bytes < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            fail(rs, rs->config->ifTitle() + " unable to read from the faub client: " + strerror(errno));
+        return;
+    }
+
+    if (!bytes) {
+        fail(rs, rs->config->ifTitle() + " backup aborted due to premature closure of the network connection");
+        return;
+    }
+
+    GLOBALS.netLimit.consume(bytes);
+    rs->lastHeard = time(NULL);
+    rs->inBuf.append(buffer, bytes);
+    parse(rs);
+
+    bool behind;
+    {
+        lock_guard<mutex> guard(poolLock);
+        behind = pendingBytes > RECEIVER_HIGHWATER;
+    }
+
+    if (behind && !throttled) {
+        DEBUG(D_netproto) DFMT("multiplex: " << approximate(RECEIVER_HIGHWATER) << " waiting on the disk; holding off reading");
+        throttled = true;
+        for (auto session: sessions)
+            watch(session);
+    }
+}
+
+
+void FaubReceiver::writable(receiverSessionType *rs) {
+    auto bytes = write(rs->writeWatch.fd, rs->outBuf.data(), rs->outBuf.length());
+
+    if (bytes < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            fail(rs, rs->config->ifTitle() + " unable to write to the faub client: " + strerror(errno));
+        return;
+    }
+
+    GLOBALS.netLimit.consume(bytes);
+    rs->outBuf.erase(0, bytes);
+    rs->lastHeard = time(NULL);
+    watch(rs);
+}
+
+
+/*******************************************************************************
+ * endings
+ *******************************************************************************/
+
+void FaubReceiver::closeClient(receiverSessionType *rs) {
+    unwatch(rs);
+    rs->readWatch.fd = rs->writeWatch.fd = -1;
+
+    // the command's children get reaped in tick() as they exit
+    if (rs->command != NULL) {
+        rs->command->closeAll();
+        reaping.insert(reaping.end(), rs->command);
+    }
+    else
+        delete rs->client;
+
+    rs->client = rs->command = NULL;
+}
+
+
+// the session is over; it goes once its last queued job has run
+void FaubReceiver::closeSession(receiverSessionType *rs) {
+    rs->state = psClosing;
+    closeClient(rs);
+    queue(rs, NULL, [this, rs]() { retire(rs); }, 0, true);
+}
+
+
+/*
+ * fail()
+ * Abandon a session: stop talking to its client, skip whatever work is still
+ * queued for it and remove its partial backup.
+ */
+void FaubReceiver::fail(receiverSessionType *rs, string reason) {
+    if (rs->failing || rs->state == psClosing)
+        return;
+
+    rs->failing = true;
+    {
+        lock_guard<mutex> guard(poolLock);
+        rs->failed = true;
+    }
+
+    // while connecting the client belongs to the worker; it's closed once that's done
+    if (rs->state != psConnecting)
+        closeClient(rs);
+
+    queue(rs, [this, rs, reason]() {
+        lock_guard<mutex> guard(finishLock);
+        log(reason);
+        SCREENERR(reason);
+        notify(*rs->config, "\t• " + reason, false);
+
+        if (rs->tempDir.length())
+            rmrf(rs->tempDir);
+    },
+    [this, rs]() {
+        if (rs->client != NULL)
+            closeClient(rs);
+        retire(rs);
+    }, 0, true);
+}
+
+
+void FaubReceiver::retire(receiverSessionType *rs) {
+    DEBUG(D_netproto) DFMT("multiplex: finished with " << rs->config->settings[sTitle].value);
+
+    auto it = find(sessions.begin(), sessions.end(), rs);
+    if (it != sessions.end())
+        sessions.erase(it);
+
+    delete rs;
+}
+
+
+// once a second: time out quiet clients and reap finished commands
+void FaubReceiver::tick() {
+    time_t now = time(NULL);
+    if (now == lastTick)
+        return;
+    lastTick = now;
+
+    for (auto rs: sessions)
+        if (!rs->failing && !rs->blocked && !throttled && rs->state > psConnecting && rs->state < psFinishing &&
+            now - rs->lastHeard > rs->timeout)
+            fail(rs, rs->config->ifTitle() + " backup aborted: timeout waiting on the faub client");
+
+    for (auto it = reaping.begin(); it != reaping.end(); )
+        if ((*it)->reapIfDone()) {
+            delete *it;
+            it = reaping.erase(it);
+        }
+        else
+            ++it;
+}
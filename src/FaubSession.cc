@@ -0,0 +1,618 @@
+
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "FaubSession.h"
+#include "faub.h"
+#include "notify.h"
+#include "debug.h"
+#include "globals.h"
+#include "tagging.h"
+
+
+FaubSession::FaubSession(BackupConfig& sessionConfig, string previousDir, string newDir, bool localSource, __int64_t clientCaps,
+                         __int64_t filesystems, string tempExtension) : config(sessionConfig) {
+    backupTime.start();
+
+    prevDir = previousDir;
+    originalCurrentDir = newDir;
+    currentDir = newDir + tempExtension;
+    local = localSource;
+    totalFS = filesystems;
+    completeFS = 0;
+    animate = NOTQUIET && ANIMATE;
+    trackInterrupt = true;
+
+    maxLinksReached = fileTotal = filesModified = filesHardLinked = filesSymLinked = 0;
+    receivedSymLinks = unmodDirs = linkErrors = touchMatches = 0;
+    unlistableNames = false;
+    abortBackupAtEnd = false;
+    fsTotalBytesNeeded = fsBytesReceived = 0;
+    checkpointTotal = 0;
+
+    incTime = str2bool(config.settings[sIncTime].value);
+    ignoreTouch = str2bool(config.settings[sIgnoreTouch].value);
+    hashFirst = ignoreTouch && (local || (clientCaps & NET_CAP_HASHFIRST));
+
+    // unchanged files inherit their digest from the previous backup's manifest rather than being re-read
+    if (prevDir.length())
+        config.fcache.loadManifest(prevDir, prevManifest);
+
+    log(config.ifTitle() + " starting backup to " + currentDir);
+}
+
+
+void FaubSession::progress(int step) {
+    animate && cout << progressPercentageA((int)totalFS, 7, completeFS, step) << flush;
+}
+
+
+/* disk usage of the new backup, tallied as it's built so the cache entry can be written
+ * without walking the backup afterwards.  this mirrors dus(): a file is "saved" if it's
+ * a hardlink to the previous backup and "used" if it's a new inode. */
+void FaubSession::tallyFile(struct stat& fileStat, bool linkedToPrev) {
+    if (S_ISLNK(fileStat.st_mode))
+        ++backupStats.symLinks;
+    else {
+        if (linkedToPrev || backupFiles.find(fileStat.st_ino) != backupFiles.end()) {
+            backupStats.savedInBytes += fileStat.st_size;
+            backupStats.savedInBlocks += 512 * fileStat.st_blocks;
+        }
+        else {
+            backupStats.usedInBytes += fileStat.st_size;
+            backupStats.usedInBlocks += 512 * fileStat.st_blocks;
+            ++backupStats.mods;
+        }
+
+        backupFiles[fileStat.st_ino] = {(size_t)fileStat.st_size, 512 * (size_t)fileStat.st_blocks};
+    }
+}
+
+
+// every directory in the backup, including parents that are only created along the way
+void FaubSession::tallyDirs(string entry, bool isDir) {
+    auto slash = isDir ? entry.length() : entry.rfind("/");
+
+    while (slash != string::npos && slash > 0 && backupDirs.insert(entry.substr(0, slash)).second)
+        slash = entry.rfind("/", slash - 1);
+}
+
+
+// digest of the previous backup's copy, if its manifest still describes it
+string FaubSession::prevDigest(string file, long size, time_t mtime) {
+    auto prevIt = prevManifest.find(file);
+    return (prevIt != prevManifest.end() && prevIt->second.size == size && prevIt->second.mtime == mtime ? prevIt->second.digest : "");
+}
+
+
+void FaubSession::startFS(string fsName) {
+    fsTime.start();
+    fs = fsName;
+    neededFiles.clear();
+    dirMtimes.clear();
+    hardLinkList.clear();
+    symLinkList.clear();
+    duplicateList.clear();
+    touchCandidates.clear();
+    fsTotalBytesNeeded = fsBytesReceived = 0;
+    checkpointTotal = fileTotal;
+}
+
+
+/*
+ * compare() - phase 1
+ * See if an entry the client described is different from what we have in the most
+ * recent backup.
+ */
+void FaubSession::compare(string remoteFilename, long mtime, long mode, long size) {
+    struct stat statData;
+    unsigned int maxLinksAllowed = config.settings[sMaxLinks].ivalue();
+
+    ++fileTotal;
+    tallyDirs(remoteFilename, S_ISDIR(mode));
+    if (S_ISLNK(mode))
+        backupSymLinks.insert(remoteFilename);
+    if (remoteFilename.find('\n') != string::npos)
+        unlistableNames = true;
+
+    DEBUG(D_netproto) DFMTNOENDL("server learned about " << remoteFilename << " (" << to_string(mode) << ") ");
+
+    string localPrevFilename = slashConcat(prevDir, remoteFilename);
+    string localCurFilename = slashConcat(currentDir, remoteFilename);
+
+    /*
+     * What do we need from the client based on the directory entry they've just described?
+     * The general process is to compare the remote filename to the local filename in the
+     * most recent backup and if both exist, compare their mtimes.  If there's a match we
+     * can assume the data hasn't changed. When they match we hard link the new file to
+     * the previous backup's copy of it.  Because of the order entries come over we can't
+     * guarantee that a parent directory will come over before a file within it.  So we
+     * make a list of all the entries as they come over the wire then go back and create
+     * the links at the end.  Details inline below.
+
+     * The nuances of directories in this model can be incredibly confusing.  When you
+     * stumble upon a subdir you could examine its mtime and decide if its changed,
+     * effectively treating it just like a file (trasnfer its metadata only if necessary).
+     * Or you could say just transfer them all regardless of mtime (its only uid, gid,
+     * mode and mtime).  Either way you're getting files and directories in a non-intuitive
+     * order.  The problem is every time you add a file (or subdir) to a directory, you
+     * update that directory's mtime.  So if you want an accurate backup --including the
+     * mtimes on all your directories-- you need to reset those directory mtimes last.
+     * Either you track every directory where you've added a file/subdir or just do them all.
+     * I've elected to do them all because nearly every directory (except empty ones) are
+     * going to have this issue, regardless of whether the entries in them are newly
+     * transfered files or existing hardlinked ones.
+     */
+
+    // if it's a directory, request it.  hardlinks don't work for directories. we don't
+    // have this mtime at this point in the protocol so we just add it to the list to
+    // request from the client.  when the client actually sends all its data, we'll save
+    // the mtime for processing at the very end.
+    if (S_ISDIR(mode)) {
+        neededFiles.insert(neededFiles.end(), remoteFilename);
+        ++unmodDirs;
+        DEBUG(D_netproto) DFMTNOPREFIX("[dir]");
+        return;
+    }
+
+    // lstat the previous backup's copy of the file and compare the mtimes
+    int statResult = mylstat(localPrevFilename, &statData);
+
+    if (prevDir.length() && !statResult && statData.st_mtime == mtime) {
+
+        /* check that hard links aren't maxed out against the configured limit.
+         * if we're at the limit & the backup includes the Time field OR
+         * if we're at the limit & the backup doesn't include Time & the new file doesn't exist
+         * then we mark this as a dup.  i.e. one we have to copy instead of hardlink.
+         */
+        struct stat statData2;
+        if ((statData.st_nlink >= maxLinksAllowed) &&
+            ((!incTime && mylstat(localCurFilename, &statData2)) || incTime)) {
+            duplicateList.insert(duplicateList.end(), pair<string, string>(localPrevFilename, localCurFilename));
+            ++maxLinksReached;
+            DEBUG(D_netproto) DFMTNOPREFIX("[matches, but links maxed]");
+        }
+        else {
+            // if they match then add it to the appropriate list to be symlinked or hardlinked, depending
+            // on whether its a symlink on the remote system
+            if (S_ISLNK(mode)) {
+                symLinkList.insert(symLinkList.end(), pair<string, string>(localPrevFilename, localCurFilename));
+                DEBUG(D_netproto) DFMTNOPREFIX("[remote symlink]");
+            }
+            else {
+                hardLinkList.insert(hardLinkList.end(), pair<string, string>(localPrevFilename, localCurFilename));
+                tallyFile(statData, true);
+                DEBUG(D_netproto) DFMTNOPREFIX("[matches, can hardlink]");
+            }
+        }
+
+        if (S_ISREG(mode))
+            manifest[remoteFilename] = {prevDigest(remoteFilename, size, mtime), size, mtime};
+    }
+    else {
+        // if the mtimes don't match or the file doesn't exist in the previous backup
+        // add it to the list of ones we need the client to send in full
+        fsTotalBytesNeeded += size;
+        neededFiles.insert(neededFiles.end(), remoteFilename);
+        modifiedFiles.insert(modifiedFiles.end(), remoteFilename);
+
+        if (hashFirst && prevDir.length() && !statResult && S_ISREG(mode) && S_ISREG(statData.st_mode) && statData.st_size == size)
+            touchCandidates.insert(touchCandidates.end(), make_pair(remoteFilename,
+                touchCandidateType{localPrevFilename, size, prevDigest(remoteFilename, statData.st_size, statData.st_mtime)}));
+
+        DEBUG(D_netproto) DFMTNOPREFIX("[" << (!prevDir.length() ? "no prev dir" : statResult < 0 ? "unable to stat " + localPrevFilename :
+                                               string("mtime mismatch (") + to_string(statData.st_mtime) + "; " + to_string(mtime)) << "]");
+    }
+}
+
+
+/*
+ * requestDigest() - phase 2 (hashfirst)
+ * With hashfirst every request carries a digest of the previous copy, empty when
+ * there's nothing to compare against.  The client only replies with a match verdict
+ * for the non-empty ones.
+ */
+string FaubSession::requestDigest(string file) {
+    auto touchIt = touchCandidates.find(file);
+    if (touchIt == touchCandidates.end())
+        return "";
+
+    if (!touchIt->second.digest.length())
+        touchIt->second.digest = MD5file(touchIt->second.prevFilename, true);
+
+    if (!touchIt->second.digest.length()) {
+        touchCandidates.erase(touchIt);
+        return "";
+    }
+
+    return touchIt->second.digest;
+}
+
+
+/*
+ * linkTouched() - phase 3 (hashfirst)
+ * The client's copy matched the previous backup's digest, so it wasn't sent; link it.
+ * If the previous copy's links are maxed out (or the link fails) copy it instead, the
+ * same as compare() does via duplicateList, since the client won't be sending it.
+ */
+void FaubSession::linkTouched(string file) {
+    auto touchIt = touchCandidates.find(file);
+    auto currentFilename = destination(file);
+    auto &prevFilename = touchIt->second.prevFilename;
+    unsigned int maxLinksAllowed = config.settings[sMaxLinks].ivalue();
+    struct stat statBuf;
+
+    DEBUG(D_netproto) DFMTNOPREFIX(file << " [ignoretouch match, not transferred]");
+    mkbasedirs(currentFilename);
+
+    if (!incTime)
+        unlink(currentFilename.c_str());
+
+    bool linksMaxed = !mylstat(prevFilename, &statBuf) && statBuf.st_nlink >= maxLinksAllowed;
+    if (linksMaxed)
+        ++maxLinksReached;
+
+    if (!linksMaxed && !link(prevFilename.c_str(), currentFilename.c_str())) {
+        if (!mylstat(prevFilename, &statBuf)) {
+            manifest[file] = {touchIt->second.digest, touchIt->second.size, statBuf.st_mtime};
+            tallyFile(statBuf, true);
+        }
+    }
+    else if (copyFile(prevFilename, currentFilename)) {
+        if (!mylstat(prevFilename, &statBuf)) {
+            setFilePerms(currentFilename, statBuf, false);
+            manifest[file] = {touchIt->second.digest, touchIt->second.size, statBuf.st_mtime};
+        }
+
+        if (!mylstat(currentFilename, &statBuf))
+            tallyFile(statBuf, false);
+    }
+    else {
+        ++linkErrors;
+        SCREENERR(fs << " error: unable to link or copy " << prevFilename << " to " << currentFilename << " - " << strerror(errno));
+        log(config.ifTitle() + " " + fs + " error: unable to link or copy " + prevFilename + " to " + currentFilename + " - " + strerror(errno));
+    }
+
+    ++touchMatches;
+    fsBytesReceived += touchIt->second.size;
+}
+
+
+/*
+ * received() - phase 3
+ * Account for an entry the client sent in full, now saved at destination(file).
+ */
+void FaubSession::received(string file, tuple<string, int, time_t, long, string> entryResult) {
+    auto [errorMsg, mode, mtime, size, digest] = entryResult;
+    auto currentFilename = destination(file);
+    fsBytesReceived += size;
+    bool linkedToPrev = false;
+
+    // local copies are made by the kernel without us seeing the data, so they have no digest
+    if (S_ISREG(mode) && (digest.length() || local))
+        manifest[file] = {digest, size, mtime};
+
+    if (S_ISDIR(mode))
+        dirMtimes.insert(dirMtimes.end(), make_pair(currentFilename, mtime));
+    else
+        if (ignoreTouch && !hashFirst && !S_ISLNK(mode)) {
+            string prevFilename = slashConcat(prevDir, file);
+
+            struct stat statBuf;
+            if (!mylstat(prevFilename, &statBuf))
+                if (statBuf.st_size == size) {
+                    /* perform one last check.  if --ignoretouch is set then the user wants to consider 'touch' changes
+                       (i.e. only the mtime has been updated, not the file contents) to be the same as no change.  that means
+                        if only the mtime has changed then still hardlink it to the previous backup's copy.
+
+                       At this point we've verified:
+                            - user wants ignoretouch
+                            - file is not a dir or a symlink
+                            - previousDir (previous backup) copy exists
+                            - size of previous copy matches what was just sent over the wire by the client (though different mtime)
+                       Now we compare the MD5 of the previous copy (from its manifest when available) to the one calculated
+                       as the new copy came over the wire.  If they match, we hardlink the file instead of keeping the new copy.
+                    */
+
+                    string md5A = prevDigest(file, statBuf.st_size, statBuf.st_mtime);
+                    if (!md5A.length())
+                        md5A = MD5file(prevFilename, true);
+
+                    if (md5A.length() && md5A == digest) {
+                        DEBUG(D_netproto) DFMTNOPREFIX(file << " [ignoretouch match]");
+                        unlink(currentFilename.c_str());
+                        if (link(prevFilename.c_str(), currentFilename.c_str())) {
+                            errorMsg = "error: unable to link " + currentFilename + " to " + prevFilename + " - " + strerror(errno);
+                            mode = 0;
+                        }
+                        else {
+                            manifest[file] = {digest, size, statBuf.st_mtime};
+                            tallyFile(statBuf, true);
+                            linkedToPrev = true;
+                        }
+                    }
+                }
+        }
+
+    if (errorMsg.length()) {
+        SCREENERR(fs << " " << errorMsg);
+        log(config.ifTitle() + " " + fs + errorMsg);
+    }
+
+    if (mode < 1)
+        ++linkErrors;
+    else {
+        if (S_ISLNK(mode))
+            ++receivedSymLinks;
+
+        struct stat statBuf;
+        if (!S_ISDIR(mode) && !linkedToPrev && !mylstat(currentFilename, &statBuf))
+            tallyFile(statBuf, false);
+    }
+}
+
+
+/*
+ * finishFS() - phase 4
+ * Post-administrative work.  Create the hardlinks for everything that matches the
+ * previous backup, symlinks for everything that's a symlink on the remote server, copy
+ * files from the previous backup when maxLinks is reached, and set the mtime on all
+ * directories.
+ */
+void FaubSession::finishFS() {
+    struct stat statData;
+
+    /*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*
+     create hard links
+     *-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*/
+    for (auto &links: hardLinkList) {
+        mkbasedirs(links.second);
+
+        // when Time isn't included we're potentially overwriting an existing backup. pre-delete
+        // so we don't get an error.
+        if (!incTime)
+            unlink(links.second.c_str());
+
+        if (link(links.first.c_str(), links.second.c_str()) < 0) {
+            ++linkErrors;
+
+            struct stat statBuf;
+            if (!mylstat(links.first, &statBuf)) {
+                backupStats.savedInBytes -= statBuf.st_size;
+                backupStats.savedInBlocks -= 512 * statBuf.st_blocks;
+            }
+
+            SCREENERR(fs << " error: unable to link " << links.second << " to " << links.first << " - " << strerror(errno));
+            log(config.ifTitle() + " " + fs + " error: unable to link " + links.second + " to " + links.first + " - " + strerror(errno));
+        }
+    }
+    progress(4);
+
+    /*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*
+     duplicate (copy) files for maxLinks
+     *-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*/
+    for (auto &dups: duplicateList) {
+        mkbasedirs(dups.second);
+
+        if (!copyFile(dups.first, dups.second)) {
+            ++linkErrors;
+            SCREENERR(fs << " error: unable to copy (attempted due to maxed out links) " << dups.first << " to " << dups.second << " - " << strerror(errno));
+            log(config.ifTitle() + " " + fs + " error: unable to copy (attempted due to maxed out links) " + dups.first + " to " + dups.second + " - " + strerror(errno));
+        }
+        else {
+            if (!mylstat(dups.first, &statData))
+                setFilePerms(dups.second, statData, false);
+
+            if (!mylstat(dups.second, &statData))
+                tallyFile(statData, false);
+        }
+    }
+    progress(5);
+
+    /*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*
+     create symlinks
+     *-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*/
+    char linkBuf[1000];
+    for (auto &links: symLinkList) {
+        mkbasedirs(links.second);
+
+        // when Time isn't included we're potentially overwriting an existing backup. pre-delete
+        // so we don't get an error.
+        if (!incTime)
+            unlink(links.second.c_str());
+
+        auto bytes = readlink(links.first.c_str(), linkBuf, sizeof(linkBuf));
+        if (bytes >= 0 && bytes < sizeof(linkBuf)) {
+            linkBuf[bytes] = 0;
+            if (!symlink(linkBuf, links.second.c_str())) {
+                ++backupStats.symLinks;
+
+                if (!mylstat(links.first, &statData)) {
+                    if (lchown(links.second.c_str(), statData.st_uid, statData.st_gid)) {
+                        SCREENERR(fs << " error: unable to chown symlink " << links.second << ": " << strerror(errno));
+                        log(config.ifTitle() + " " + fs + " error: unable to chown symlink " + links.second + ": " + strerror(errno));
+                    }
+
+                    struct timeval tv[2];
+                    tv[0].tv_sec  = tv[1].tv_sec  = statData.st_mtime;
+                    tv[0].tv_usec = tv[1].tv_usec = 0;
+                    lutimes(links.second.c_str(), tv);
+                }
+            }
+            else {
+                ++linkErrors;
+                SCREENERR(fs << " error: unable to symlink " << links.second << " to " << links.first << ": " << strerror(errno));
+                log(config.ifTitle() + " " + fs + " error: unable to symlink " + links.second + " to " + links.first + ": " + strerror(errno));
+            }
+        }
+        else {
+            ++linkErrors;
+            SCREENERR(fs << " error: unable to dereference symlink " << links.first << ": " << strerror(errno));
+            log(config.ifTitle() + " " + fs + " error: unable to dereference symlink " + links.first + ": " + strerror(errno));
+        }
+
+    }
+    progress(6);
+
+    /*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*
+     set mtimes on all directories
+     *-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*/
+    struct utimbuf timeBuf;
+    for (auto &dirTime: dirMtimes) {
+        timeBuf.actime = timeBuf.modtime = dirTime.second;
+        if (utime(dirTime.first.c_str(), &timeBuf))
+            SCREENERR(log(config.ifTitle() + " " + fs + ": error: unable to call utime() on " + dirTime.first + " - " + strerror(errno)));
+    }
+
+    progress(7);
+    DEBUG(D_netproto) DFMT(fs << " server phase 4 complete; created " << plural(hardLinkList.size() - linkErrors, "link")  <<
+                           " to previously backed up files" << (linkErrors ? string(" (" + plural(linkErrors, "error") + ")") : ""));
+    log(config.ifTitle() + " processed " + fs + ": " + plurali((int)fileTotal - checkpointTotal, "entr") + ", " +
+        plural(neededFiles.size(), "request") + ", " + plural(hardLinkList.size() - linkErrors, "hardlink") + ", " + plural(symLinkList.size(), "symlink"));
+
+    filesModified += neededFiles.size();
+    filesHardLinked += hardLinkList.size();
+    filesSymLinked += symLinkList.size();
+    ++completeFS;
+
+    fsTime.stop();
+
+    // if it's been more than 5 minutes and no files are found (modified, unmodified, anything)
+    // then we have a timeout error - such as when the OS prompts for permission to read a
+    // protected directory but there's no user around to answer.  we have to finish the network
+    // conversation to let the client instance terminate, then we'll blow away the failed backup
+    // on the server side.
+    if (!neededFiles.size() && !hardLinkList.size() && !symLinkList.size() && fsTime.seconds() > 600)
+        abortBackupAtEnd = true;
+}
+
+
+/*
+ * finish()
+ * Put the completed backup in place, cache what we know about it and report on it.
+ * False if it couldn't be renamed into place; the temp dir is left for the caller
+ * to clean up.
+ */
+bool FaubSession::finish() {
+    backupTime.stop();
+
+    if (abortBackupAtEnd) {
+        string errorDetail = config.ifTitle() + " backup aborted due to timeout on the faub client end";
+        log(errorDetail);
+        SCREENERR(errorDetail);
+        notify(config, "\t• " + errorDetail, false);
+        rmrf(currentDir);
+        return true;
+    }
+
+    // if time isn't included we may be about to overwrite a previous backup for this date
+    if (!incTime)
+        rmrf(originalCurrentDir);
+
+    if (!filesModified && !filesHardLinked && !filesSymLinked) {
+        log(config.ifTitle() + " no files available to backup; backup aborted");
+        NOTQUIET && cout << "\t• " << config.ifTitle() << " no files to backup" << endl;
+        return true;
+    }
+
+    if (rename(string(currentDir).c_str(), originalCurrentDir.c_str())) {
+        string errorDetail = config.ifTitle() + " unable to rename " + currentDir + " to " + originalCurrentDir + ": " + strerror(errno);
+        log(errorDetail);
+        SCREENERR(errorDetail);
+        notify(config, "\t• " + errorDetail, false);
+        return false;
+    }
+
+    currentDir = originalCurrentDir;
+    if (trackInterrupt)
+        GLOBALS.interruptFilename = currentDir;
+
+    // add the backup to the cache. the full walk is only needed to check our own tally.
+    backupStats.dirs = backupDirs.size();
+    config.fcache.recordStats(currentDir, backupStats, backupFiles);
+
+    if (GLOBALS.cli.count(CLI_VERIFYSTATS))
+        fs_verifyStats(config, currentDir, backupStats);
+
+    // record which files changed in this backup
+    config.fcache.updateDiffFiles(currentDir, modifiedFiles);
+    config.fcache.updateManifest(currentDir, manifest);
+
+    // and the entries the manifest doesn't cover, so replication can tell when they go away.
+    // a name with a newline would read back from these one-per-line records as two bogus
+    // paths, so leave faub_dirlinks out and incremental replication takes the full walk.
+    if (unlistableNames) {
+        auto dirLinksIt = config.fcache.getBackupByDir(currentDir);
+        if (dirLinksIt != config.fcache.getEnd())
+            unlink(dirLinksIt->second.cacheFilename(SUFFIX_FAUBDIRLINKS).c_str());
+    }
+    else {
+        backupSymLinks.insert(backupDirs.begin(), backupDirs.end());
+        config.fcache.updateDirLinks(currentDir, backupSymLinks);
+    }
+
+    // we can pull these out to display
+    auto fcacheCurrent = config.fcache.getBackupByDir(currentDir);
+    auto backupSize = fcacheCurrent->second.ds.getSize();
+    auto backupSaved = fcacheCurrent->second.ds.getSaved();
+
+    // and only need to update the remaining fields
+    fcacheCurrent->second.duration = backupTime.seconds();
+    fcacheCurrent->second.finishTime = time(NULL);
+    fcacheCurrent->second.modifiedFiles = filesModified - unmodDirs;
+    fcacheCurrent->second.unchangedFiles = filesHardLinked;
+    fcacheCurrent->second.dirs = unmodDirs;
+    fcacheCurrent->second.slinks = filesSymLinked + receivedSymLinks;
+
+    if (trackInterrupt)
+        GLOBALS.interruptFilename = "";  // here we consider the backup complete; only notification & screen UI remain
+
+    string maxLinkMsg = maxLinksReached ? " [" + plural(maxLinksReached, "max link") + " reached]" : "";
+    string message1 = string("backup completed to ") + BOLDMAGENTA + currentDir + RESET + " in " + backupTime.elapsed();
+    string message2 = "(total: " +
+        to_string(fileTotal) + ", modified: " + to_string(filesModified - unmodDirs) + ", unmodified: " + to_string(filesHardLinked) + ", dirs: " +
+        to_string(unmodDirs) + ", symlinks: " + to_string(filesSymLinked + receivedSymLinks) +
+        (linkErrors ? ", linkErrors: " + to_string(linkErrors) : "") +
+        (touchMatches ? ", touched: " + to_string(touchMatches) : "") +
+        ", size: " + approximate(backupSize + backupSaved) + ", usage: " + approximate(backupSize) + maxLinkMsg + ")";
+
+    if (GLOBALS.cli.count(CLI_TAG)) {
+        string tag = GLOBALS.cli[CLI_TAG].as<string>();
+        GLOBALS.tags.tagBackup(tag, currentDir);
+        message1 += " [tagged " + tag;
+
+        string hold = GLOBALS.tags.getTagsHoldTime(tag);
+            string holdText = config.fcache.holdBackup(hold, currentDir, true);
+            if (holdText.length())
+                message1 += ", " + holdText + " hold";
+
+        message1 += "]";
+    }
+
+    if (GLOBALS.cli.count(CLI_HOLD)) {
+        string hold = config.fcache.holdBackup(GLOBALS.cli[CLI_HOLD].as<string>(), currentDir, true);
+        message1 += " [" + hold + " hold]";
+    }
+
+    log(config.ifTitle() + " " + message1);
+    log(config.ifTitle() + " " + message2);
+    NOTQUIET && cout << "\t• " << config.ifTitle() << " " << message1 << "\n\t\t" << message2 << endl;
+
+    if (config.settings[sBloat].value.length()) {
+        string bloat = config.settings[sBloat].value;
+        auto [target, average, detail] = config.getBloatTarget();
+        if (fcacheCurrent->second.ds.usedInBytes > target) {
+            string message = config.ifTitle() + " warning: backup is larger than the bloat threshold -\n" + detail + "\tbackup: " + approximate(fcacheCurrent->second.ds.usedInBytes);
+            log(message);
+            SCREENERR(message);
+            message += maxLinkMsg;
+            notify(config, "\t• " + message, false);
+            return true;
+        }
+    }
+
+    notify(config, "\t• " + message1 + "\n\t\t" + message2 + "\n", true);
+    return true;
+}
@@ -0,0 +1,543 @@
+
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "InodeIndex.h"
+#include "util_generic.h"
+#include "debug.h"
+
+#define INDEX_MAGIC     "mbinodes2\n"
+#define INDEX_MAGIC_V1  "mbinodes1\n"
+#define MAGIC_LENGTH    (sizeof(INDEX_MAGIC) - 1)
+
+// rewrite the index once this many changes follow its snapshot
+#define INDEX_COMPACT   16
+
+// record types
+#define REC_BACKUPS     'B'     // snapshot: the backups covered
+#define REC_INODES      'I'     // snapshot: every inode's size, blocks & reference count
+#define REC_ADD         'A'     // a backup and the size & blocks of each of its inodes
+#define REC_REMOVE      'R'     // a backup and its inodes
+#define REC_RENAME      'N'     // the old & new base directory
+
+#define HEADER_LENGTH   (1 + sizeof(uint64_t))
+
+
+/* the index is stored in binary as it can run to millions of entries.  after the
+ * magic string each record is its type, the length of its payload and the payload.
+ * integers are 64 bits (reference counts 32), strings are a length + characters.
+ *
+ *      B   count of backups, each backup's directory
+ *      I   count of inodes, each inode's number, size, blocks and reference count
+ *      A   directory, count of inodes, each inode's number, size and blocks
+ *      R   directory, count of inodes, each inode's number
+ *      N   old base directory, new base directory
+ *
+ * a snapshot is a B record followed by an I record; the old single-snapshot format
+ * (mbinodes1) is the two payloads without their headers and is rewritten on save. */
+
+struct InodeIndex::recordReader {
+    string& data;
+    size_t pos;
+    size_t end;
+    bool ok;
+
+    template <typename T> T get() {
+        T value = 0;
+
+        if (ok && end - pos >= sizeof(value)) {
+            memcpy(&value, &data[pos], sizeof(value));
+            pos += sizeof(value);
+        }
+        else
+            ok = false;
+
+        return value;
+    }
+
+    string getString() {
+        auto length = get<uint64_t>();
+
+        if (!ok || length > PATH_MAX || length > end - pos) {
+            ok = false;
+            return "";
+        }
+
+        pos += length;
+        return data.substr(pos - length, length);
+    }
+
+    recordReader(string& source, size_t start, size_t stop) : data(source), pos(start), end(stop), ok(true) {}
+};
+
+
+template <typename T> static void putValue(string& data, T value) {
+    data.append((char*)&value, sizeof(value));
+}
+
+
+static void putString(string& data, string value) {
+    putValue<uint64_t>(data, value.length());
+    data += value;
+}
+
+
+static void putHeader(string& data, char type, size_t length) {
+    data += type;
+    putValue<uint64_t>(data, length);
+}
+
+
+static bool readAt(int fd, off_t offset, size_t length, string& data) {
+    size_t got = 0;
+    ssize_t bytes;
+
+    data.resize(length);
+    while (got < length && (bytes = pread(fd, &data[got], length - got, offset + got)) > 0)
+        got += bytes;
+
+    data.resize(got);
+    return got == length;
+}
+
+
+/* apply one record to the index.  without 'withInodes' only the backups covered are
+ * tracked and the inode table (and the inodes of A & R records) is skipped. */
+bool InodeIndex::apply(char type, recordReader& reader, bool withInodes, size_t *freedBytes, size_t *freedBlocks) {
+    switch (type) {
+        case REC_BACKUPS: {
+            backups.clear();
+            inodes.clear();
+            logRecords = 0;
+
+            auto count = reader.get<uint64_t>();
+            for (uint64_t i = 0; i < count && reader.ok; ++i)
+                backups.insert(reader.getString());
+
+            break;
+        }
+
+        case REC_INODES: {
+            if (!withInodes)
+                break;
+
+            auto count = reader.get<uint64_t>();
+            inodes.reserve(min(count, (uint64_t)(reader.end - reader.pos) / (3 * sizeof(uint64_t) + sizeof(uint32_t))));
+
+            for (uint64_t i = 0; i < count && reader.ok; ++i) {
+                auto inode = reader.get<uint64_t>();
+                auto size = reader.get<uint64_t>();
+                auto blocks = reader.get<uint64_t>();
+                auto refs = reader.get<uint32_t>();
+
+                if (reader.ok)
+                    inodes[inode] = {size, blocks, refs};
+            }
+
+            break;
+        }
+
+        case REC_ADD: {
+            ++logRecords;
+
+            // two runs can each add the same backup; only the first counts
+            if (!backups.insert(reader.getString()).second || !withInodes)
+                break;
+
+            auto count = reader.get<uint64_t>();
+            for (uint64_t i = 0; i < count && reader.ok; ++i) {
+                auto inode = reader.get<uint64_t>();
+                auto size = reader.get<uint64_t>();
+                auto blocks = reader.get<uint64_t>();
+
+                if (reader.ok) {
+                    auto [it, added] = inodes.insert({inode, {size, blocks, 0}});
+                    ++it->second.refs;
+                }
+            }
+
+            break;
+        }
+
+        case REC_REMOVE: {
+            ++logRecords;
+
+            if (!backups.erase(reader.getString()) || !withInodes)
+                break;
+
+            auto count = reader.get<uint64_t>();
+            for (uint64_t i = 0; i < count && reader.ok; ++i) {
+                auto it = inodes.find(reader.get<uint64_t>());
+                if (!reader.ok || it == inodes.end())
+                    continue;
+
+                if (--it->second.refs < 1) {
+                    if (freedBytes != NULL) {
+                        *freedBytes += it->second.size;
+                        *freedBlocks += it->second.blocks;
+                    }
+
+                    inodes.erase(it);
+                }
+            }
+
+            break;
+        }
+
+        case REC_RENAME: {
+            ++logRecords;
+
+            auto oldBaseDir = reader.getString();
+            auto newBaseDir = reader.getString();
+            set<string> renamed;
+
+            for (auto backupDir: backups) {
+                if (backupDir.find(oldBaseDir) == 0)
+                    backupDir = slashConcat(newBaseDir, backupDir.substr(oldBaseDir.length()));
+
+                renamed.insert(backupDir);
+            }
+
+            backups.swap(renamed);
+            break;
+        }
+
+        default:
+            return false;
+    }
+
+    return reader.ok;
+}
+
+
+// apply the records in 'data' from 'pos' on; false if one is unreadable
+bool InodeIndex::replayLog(string& data, size_t pos, bool withInodes) {
+    while (pos < data.length()) {
+        recordReader header(data, pos, data.length());
+        char type = header.get<char>();
+        auto length = header.get<uint64_t>();
+
+        if (!header.ok || length > data.length() - header.pos) {
+            damaged = true;
+            break;
+        }
+
+        recordReader reader(data, header.pos, header.pos + length);
+        if (!apply(type, reader, withInodes))
+            return false;
+
+        pos = header.pos + length;
+    }
+
+    return true;
+}
+
+
+/* rebuild the index from an open file.  a partial record at the end (e.g. a full disk)
+ * is ignored; an unreadable one anywhere leaves the index empty, i.e. covering nothing.
+ * either way the next save() rewrites the file. */
+void InodeIndex::replay(int fd, bool withInodes) {
+    struct stat statData;
+    string data;
+    bool ok = true;
+
+    inodes.clear();
+    backups.clear();
+    logRecords = 0;
+
+    if (fstat(fd, &statData) || !statData.st_size)
+        return;
+
+    size_t fileSize = statData.st_size;
+    if (!readAt(fd, 0, MAGIC_LENGTH, data)) {
+        damaged = true;
+        return;
+    }
+
+    if (data == INDEX_MAGIC_V1) {
+        readAt(fd, 0, fileSize, data);
+        recordReader reader(data, MAGIC_LENGTH, data.length());
+        ok = apply(REC_BACKUPS, reader, true) && apply(REC_INODES, reader, true);
+        damaged = true;
+    }
+    else if (data != INDEX_MAGIC)
+        ok = false;
+    else if (withInodes) {
+        readAt(fd, 0, fileSize, data);
+        ok = replayLog(data, MAGIC_LENGTH, true);
+    }
+    else {
+        // just the backups: skip over the inode table and read only the start of A & R records
+        size_t pos = MAGIC_LENGTH;
+
+        while (pos < fileSize) {
+            if (!readAt(fd, pos, HEADER_LENGTH, data)) {
+                damaged = true;
+                break;
+            }
+
+            recordReader header(data, 0, data.length());
+            char type = header.get<char>();
+            auto length = header.get<uint64_t>();
+
+            if (length > fileSize - pos - HEADER_LENGTH) {
+                damaged = true;
+                break;
+            }
+
+            if (type != REC_INODES) {
+                auto wanted = type == REC_ADD || type == REC_REMOVE ? min(length, (uint64_t)(sizeof(uint64_t) + PATH_MAX)) : length;
+                readAt(fd, pos + HEADER_LENGTH, wanted, data);
+
+                recordReader reader(data, 0, data.length());
+                if (!apply(type, reader, false)) {
+                    ok = false;
+                    break;
+                }
+            }
+
+            pos += HEADER_LENGTH + length;
+        }
+    }
+
+    if (!ok) {
+        inodes.clear();
+        backups.clear();
+        damaged = true;
+    }
+}
+
+
+void InodeIndex::load(bool withInodes) {
+    if (loaded && (inodesLoaded || !withInodes))
+        return;
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        flock(fd, LOCK_SH);
+        replay(fd, withInodes);
+        close(fd);
+    }
+    else {
+        inodes.clear();
+        backups.clear();
+        logRecords = 0;
+    }
+
+    loaded = true;
+    inodesLoaded = withInodes;
+
+    // changes made before a fuller load still apply on top of it
+    replayLog(pending, 0, withInodes);
+
+    DEBUG(D_cache) DFMT("loaded inode index " << filename << ": " << plural(backups.size(), "backup") <<
+                        (withInodes ? ", " + plural(inodes.size(), "inode") : ""));
+}
+
+
+// make a change in memory and queue its record for save()
+void InodeIndex::record(char type, string& payload, size_t *freedBytes, size_t *freedBlocks) {
+    recordReader reader(payload, 0, payload.length());
+    apply(type, reader, inodesLoaded, freedBytes, freedBlocks);
+
+    if (rewrite)
+        return;
+
+    putHeader(pending, type, payload.length());
+    pending += payload;
+}
+
+
+// replace the file with a snapshot of the index; called holding the file's lock
+bool InodeIndex::writeSnapshot() {
+    string tempFilename = filename + ".tmp." + to_string(getpid());
+
+    ofstream indexFile(tempFilename, ios::binary | ios::trunc);
+    if (!indexFile.is_open()) {
+        log("error: unable to create " + tempFilename + errtext());
+        return false;
+    }
+
+    string data = INDEX_MAGIC;
+    string payload;
+
+    putValue<uint64_t>(payload, backups.size());
+    for (auto &backupDir: backups)
+        putString(payload, backupDir);
+
+    putHeader(data, REC_BACKUPS, payload.length());
+    indexFile << data << payload;
+
+    data.clear();
+    putHeader(data, REC_INODES, sizeof(uint64_t) + inodes.size() * (3 * sizeof(uint64_t) + sizeof(uint32_t)));
+    putValue<uint64_t>(data, inodes.size());
+    indexFile << data;
+
+    for (auto &inode: inodes) {
+        uint64_t values[3] = { inode.first, inode.second.size, inode.second.blocks };
+        uint32_t refs = inode.second.refs;
+        indexFile.write((char*)values, sizeof(values));
+        indexFile.write((char*)&refs, sizeof(refs));
+    }
+
+    indexFile.close();
+    if (indexFile.fail() || rename(tempFilename.c_str(), filename.c_str())) {
+        log("error: unable to save " + filename + errtext());
+        unlink(tempFilename.c_str());
+        return false;
+    }
+
+    DEBUG(D_cache) DFMT("compacted inode index " << filename << ": " << plural(backups.size(), "backup") << ", " << plural(inodes.size(), "inode"));
+    logRecords = 0;
+    return true;
+}
+
+
+/* append the changes since the last save.  the file is rewritten instead when it's
+ * due for compaction, damaged or in the old format, re-reading it under the lock
+ * first so that changes another process appended since we loaded are kept. */
+void InodeIndex::save() {
+    if (!rewrite && pending.empty())
+        return;
+
+    mkdirp(pathSplit(filename).dir);
+
+    int fd;
+    struct stat fdStat, fileStat;
+
+    while (1) {
+        fd = open(filename.c_str(), O_RDWR | O_APPEND | O_CREAT, 0644);
+        if (fd < 0) {
+            log("error: unable to update " + filename + errtext());
+            return;
+        }
+
+        flock(fd, LOCK_EX);
+
+        // as in FaubDB, if another run replaced the file while we waited for the lock, use the new one
+        if (!fstat(fd, &fdStat) && !stat(filename.c_str(), &fileStat) && fdStat.st_ino == fileStat.st_ino)
+            break;
+
+        close(fd);
+    }
+
+    string magic;
+    bool empty = !fdStat.st_size;
+    bool current = !empty && readAt(fd, 0, MAGIC_LENGTH, magic) && magic == INDEX_MAGIC;
+    bool success;
+
+    if (rewrite)
+        success = writeSnapshot();
+    else if (!damaged && (empty || current)) {
+        string data = empty ? INDEX_MAGIC : "";
+        data += pending;
+
+        // a partial append would hide every record after it, so it's cut back off
+        success = write(fd, data.data(), data.length()) == (ssize_t)data.length();
+        if (!success) {
+            log("error: unable to update " + filename + errtext());
+            damaged = ftruncate(fd, fdStat.st_size) != 0;
+        }
+        else if (logRecords > INDEX_COMPACT) {
+            replay(fd, true);
+            inodesLoaded = true;
+            writeSnapshot();
+        }
+    }
+    else {
+        replay(fd, true);
+        inodesLoaded = true;
+        replayLog(pending, 0, true);
+        success = writeSnapshot();
+    }
+
+    close(fd);
+
+    if (success) {
+        pending.clear();
+        rewrite = damaged = false;
+    }
+}
+
+
+bool InodeIndex::covers(const set<string>& backupDirs) {
+    load();
+    return backups == backupDirs;
+}
+
+
+void InodeIndex::addBackup(string backupDir, map<ino_t, inodeSizeType>& files) {
+    if (contains(backupDir))
+        return;
+
+    string payload;
+    payload.reserve(sizeof(uint64_t) * 2 + backupDir.length() + files.size() * 3 * sizeof(uint64_t));
+    putString(payload, backupDir);
+    putValue<uint64_t>(payload, files.size());
+
+    for (auto &file: files) {
+        putValue<uint64_t>(payload, file.first);
+        putValue<uint64_t>(payload, file.second.size);
+        putValue<uint64_t>(payload, file.second.blocks);
+    }
+
+    record(REC_ADD, payload);
+}
+
+
+size_t InodeIndex::removeBackup(string backupDir, InodeSet& backupInodes, size_t& freedBlocks) {
+    size_t freedBytes = 0;
+    freedBlocks = 0;
+    load(true);
+
+    if (backups.find(backupDir) == backups.end())
+        return 0;
+
+    string payload;
+    putString(payload, backupDir);
+    putValue<uint64_t>(payload, backupInodes.size());
+
+    for (auto inode: backupInodes)
+        putValue<uint64_t>(payload, inode);
+
+    record(REC_REMOVE, payload, &freedBytes, &freedBlocks);
+    return freedBytes;
+}
+
+
+bool InodeIndex::sizeOf(ino_t inode, inodeSizeType& size) {
+    load(true);
+
+    auto it = inodes.find(inode);
+    if (it == inodes.end())
+        return false;
+
+    size = {it->second.size, it->second.blocks};
+    return true;
+}
+
+
+void InodeIndex::renameBackups(string oldBaseDir, string newBaseDir) {
+    load();
+
+    string payload;
+    putString(payload, oldBaseDir);
+    putString(payload, newBaseDir);
+    record(REC_RENAME, payload);
+}
+
+
+void InodeIndex::clear() {
+    inodes.clear();
+    backups.clear();
+    pending.clear();
+    loaded = inodesLoaded = rewrite = true;
+}
+
@@ -0,0 +1,144 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "InodeSet.h"
+
+#define INODESET_MAGIC      "MBINODES"
+#define INODESET_VERSION    2           // version 1 was the comma-separated text list
+
+
+/* the file is a header followed by 'count' inodes, sorted and unique, each 'width' bytes
+ * in the machine's byte order.  the header is 8-byte aligned so the array can be used
+ * in place once the file is mapped. */
+struct inodeFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint64_t count;
+};
+
+
+bool InodeSet::mapFile(string filename) {
+    clear();
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat statData;
+    inodeFileHeader header;
+
+    if (fstat(fd, &statData) || read(fd, &header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, INODESET_MAGIC, sizeof(header.magic)) || header.version != INODESET_VERSION ||
+        header.width != sizeof(ino_t) || (size_t)statData.st_size < sizeof(header) ||
+        header.count > ((size_t)statData.st_size - sizeof(header)) / sizeof(ino_t) ||
+        (size_t)statData.st_size != sizeof(header) + header.count * sizeof(ino_t)) {
+        close(fd);
+        return false;
+    }
+
+    // an empty set has nothing worth mapping
+    if (!header.count) {
+        close(fd);
+        return true;
+    }
+
+    void *base = mmap(NULL, statData.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED)
+        return false;
+
+    mapBase = base;
+    mapLength = statData.st_size;
+    mapped = (const ino_t*)((char*)base + sizeof(header));
+    mappedCount = header.count;
+    return true;
+}
+
+
+/* written to a temporary file and renamed into place so that a set mapped from
+ * the old file (in this or another process) is never truncated underneath it */
+bool InodeSet::saveFile(string filename) {
+    string tempFilename = filename + ".tmp." + to_string(getpid());
+    inodeFileHeader header;
+
+    memcpy(header.magic, INODESET_MAGIC, sizeof(header.magic));
+    header.version = INODESET_VERSION;
+    header.width = sizeof(ino_t);
+    header.count = size();
+
+    FILE *file = fopen(tempFilename.c_str(), "w");
+    if (file == NULL)
+        return false;
+
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        (!header.count || fwrite(begin(), sizeof(ino_t), header.count, file) == header.count);
+
+    if (fclose(file) || !success || rename(tempFilename.c_str(), filename.c_str())) {
+        unlink(tempFilename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+void InodeSet::unmap() {
+    if (mapBase != NULL)
+        munmap(mapBase, mapLength);
+
+    mapBase = NULL;
+    mapLength = mappedCount = 0;
+    mapped = NULL;
+}
+
+
+void InodeSet::unmapToMemory() {
+    vector<ino_t> copy(begin(), end());
+
+    unmap();
+    inodes.swap(copy);
+    sorted = true;
+}
+
+
+InodeSet& InodeSet::operator=(const InodeSet& other) {
+    if (this != &other) {
+        clear();
+
+        if (other.mapped != NULL)
+            inodes.assign(other.mapped, other.mapped + other.mappedCount);
+        else
+            inodes = other.inodes;
+
+        sorted = other.mapped != NULL || other.sorted;
+    }
+
+    return *this;
+}
+
+
+InodeSet& InodeSet::operator=(InodeSet&& other) {
+    if (this != &other) {
+        clear();
+
+        inodes.swap(other.inodes);
+        sorted = other.sorted;
+        mapped = other.mapped;
+        mappedCount = other.mappedCount;
+        mapBase = other.mapBase;
+        mapLength = other.mapLength;
+
+        other.mapBase = NULL;
+        other.clear();
+    }
+
+    return *this;
+}
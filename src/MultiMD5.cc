@@ -0,0 +1,300 @@
+
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include "MultiMD5.h"
+#include "lanes.h"
+
+#define BLOCK_SIZE      64
+#define MAX_LANES       16
+#define MAX_PENDING     (4 * 1024 * 1024)     // bytes a stream buffers before it's hashed regardless
+
+
+static const uint32_t initialState[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+
+
+static inline uint32_t le32(const unsigned char *data) {
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+
+/* the 64 MD5 steps (RFC 1321) over 'V', which is either a plain uint32_t or a vector of
+ * them, one per lane.  written once as a template and inlined below into each engine,
+ * each built for the instruction set its width needs. */
+#define ROTL(x, n)  (((x) << (n)) | ((x) >> (32 - (n))))
+#define F(b, c, d)  ((d) ^ ((b) & ((c) ^ (d))))
+#define G(b, c, d)  ((c) ^ ((d) & ((b) ^ (c))))
+#define H(b, c, d)  ((b) ^ (c) ^ (d))
+#define I(b, c, d)  ((c) ^ ((b) | ~(d)))
+#define STEP(f, a, b, c, d, w, k, s)  a = b + ROTL(a + f(b, c, d) + w + (uint32_t)k, s)
+
+template<typename V>
+static inline __attribute__((always_inline)) void md5Compress(V state[4], const V w[16]) {
+    V a = state[0], b = state[1], c = state[2], d = state[3];
+
+    STEP(F, a, b, c, d, w[ 0], 0xd76aa478,  7);  STEP(F, d, a, b, c, w[ 1], 0xe8c7b756, 12);
+    STEP(F, c, d, a, b, w[ 2], 0x242070db, 17);  STEP(F, b, c, d, a, w[ 3], 0xc1bdceee, 22);
+    STEP(F, a, b, c, d, w[ 4], 0xf57c0faf,  7);  STEP(F, d, a, b, c, w[ 5], 0x4787c62a, 12);
+    STEP(F, c, d, a, b, w[ 6], 0xa8304613, 17);  STEP(F, b, c, d, a, w[ 7], 0xfd469501, 22);
+    STEP(F, a, b, c, d, w[ 8], 0x698098d8,  7);  STEP(F, d, a, b, c, w[ 9], 0x8b44f7af, 12);
+    STEP(F, c, d, a, b, w[10], 0xffff5bb1, 17);  STEP(F, b, c, d, a, w[11], 0x895cd7be, 22);
+    STEP(F, a, b, c, d, w[12], 0x6b901122,  7);  STEP(F, d, a, b, c, w[13], 0xfd987193, 12);
+    STEP(F, c, d, a, b, w[14], 0xa679438e, 17);  STEP(F, b, c, d, a, w[15], 0x49b40821, 22);
+
+    STEP(G, a, b, c, d, w[ 1], 0xf61e2562,  5);  STEP(G, d, a, b, c, w[ 6], 0xc040b340,  9);
+    STEP(G, c, d, a, b, w[11], 0x265e5a51, 14);  STEP(G, b, c, d, a, w[ 0], 0xe9b6c7aa, 20);
+    STEP(G, a, b, c, d, w[ 5], 0xd62f105d,  5);  STEP(G, d, a, b, c, w[10], 0x02441453,  9);
+    STEP(G, c, d, a, b, w[15], 0xd8a1e681, 14);  STEP(G, b, c, d, a, w[ 4], 0xe7d3fbc8, 20);
+    STEP(G, a, b, c, d, w[ 9], 0x21e1cde6,  5);  STEP(G, d, a, b, c, w[14], 0xc33707d6,  9);
+    STEP(G, c, d, a, b, w[ 3], 0xf4d50d87, 14);  STEP(G, b, c, d, a, w[ 8], 0x455a14ed, 20);
+    STEP(G, a, b, c, d, w[13], 0xa9e3e905,  5);  STEP(G, d, a, b, c, w[ 2], 0xfcefa3f8,  9);
+    STEP(G, c, d, a, b, w[ 7], 0x676f02d9, 14);  STEP(G, b, c, d, a, w[12], 0x8d2a4c8a, 20);
+
+    STEP(H, a, b, c, d, w[ 5], 0xfffa3942,  4);  STEP(H, d, a, b, c, w[ 8], 0x8771f681, 11);
+    STEP(H, c, d, a, b, w[11], 0x6d9d6122, 16);  STEP(H, b, c, d, a, w[14], 0xfde5380c, 23);
+    STEP(H, a, b, c, d, w[ 1], 0xa4beea44,  4);  STEP(H, d, a, b, c, w[ 4], 0x4bdecfa9, 11);
+    STEP(H, c, d, a, b, w[ 7], 0xf6bb4b60, 16);  STEP(H, b, c, d, a, w[10], 0xbebfbc70, 23);
+    STEP(H, a, b, c, d, w[13], 0x289b7ec6,  4);  STEP(H, d, a, b, c, w[ 0], 0xeaa127fa, 11);
+    STEP(H, c, d, a, b, w[ 3], 0xd4ef3085, 16);  STEP(H, b, c, d, a, w[ 6], 0x04881d05, 23);
+    STEP(H, a, b, c, d, w[ 9], 0xd9d4d039,  4);  STEP(H, d, a, b, c, w[12], 0xe6db99e5, 11);
+    STEP(H, c, d, a, b, w[15], 0x1fa27cf8, 16);  STEP(H, b, c, d, a, w[ 2], 0xc4ac5665, 23);
+
+    STEP(I, a, b, c, d, w[ 0], 0xf4292244,  6);  STEP(I, d, a, b, c, w[ 7], 0x432aff97, 10);
+    STEP(I, c, d, a, b, w[14], 0xab9423a7, 15);  STEP(I, b, c, d, a, w[ 5], 0xfc93a039, 21);
+    STEP(I, a, b, c, d, w[12], 0x655b59c3,  6);  STEP(I, d, a, b, c, w[ 3], 0x8f0ccc92, 10);
+    STEP(I, c, d, a, b, w[10], 0xffeff47d, 15);  STEP(I, b, c, d, a, w[ 1], 0x85845dd1, 21);
+    STEP(I, a, b, c, d, w[ 8], 0x6fa87e4f,  6);  STEP(I, d, a, b, c, w[15], 0xfe2ce6e0, 10);
+    STEP(I, c, d, a, b, w[ 6], 0xa3014314, 15);  STEP(I, b, c, d, a, w[13], 0x4e0811a1, 21);
+    STEP(I, a, b, c, d, w[ 4], 0xf7537e82,  6);  STEP(I, d, a, b, c, w[11], 0xbd3af235, 10);
+    STEP(I, c, d, a, b, w[ 2], 0x2ad7d2bb, 15);  STEP(I, b, c, d, a, w[ 9], 0xeb86d391, 21);
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+
+// move the lanes' states in and out of vectors (state[0] holds every lane's A, etc)
+template<typename V, int LANES>
+static inline __attribute__((always_inline)) void loadStates(uint32_t *states[], V state[4]) {
+    uint32_t words[4][LANES];
+
+    for (int lane = 0; lane < LANES; ++lane)
+        for (int word = 0; word < 4; ++word)
+            words[word][lane] = states[lane][word];
+
+    memcpy(state, words, sizeof(words));
+}
+
+
+template<typename V, int LANES>
+static inline __attribute__((always_inline)) void storeStates(uint32_t *states[], V state[4]) {
+    uint32_t words[4][LANES];
+    memcpy(words, state, sizeof(words));
+
+    for (int lane = 0; lane < LANES; ++lane)
+        for (int word = 0; word < 4; ++word)
+            states[lane][word] = words[word][lane];
+}
+
+
+/* each engine hashes 'blocks' consecutive blocks from every lane's data (see lanes.h for
+ * how the vector ones load them). */
+typedef void (*md5BlocksFunc)(uint32_t *states[], const unsigned char *data[], size_t blocks);
+
+static void md5BlocksScalar(uint32_t *states[], const unsigned char *data[], size_t blocks) {
+    uint32_t w[16];
+
+    for (size_t offset = 0; offset < blocks * BLOCK_SIZE; offset += BLOCK_SIZE) {
+        for (int word = 0; word < 16; ++word)
+            w[word] = le32(data[0] + offset + word * 4);
+
+        md5Compress(states[0], w);
+    }
+}
+
+#if defined(HAVE_LANES)
+static void md5BlocksSSE2(uint32_t *states[], const unsigned char *data[], size_t blocks) {
+    v4u state[4], w[16];
+    loadStates<v4u, 4>(states, state);
+
+    for (size_t offset = 0; offset < blocks * BLOCK_SIZE; offset += BLOCK_SIZE) {
+        loadBlocks4(data, offset, w);
+        md5Compress(state, w);
+    }
+
+    storeStates<v4u, 4>(states, state);
+}
+
+__attribute__((target("avx2")))
+static void md5BlocksAVX2(uint32_t *states[], const unsigned char *data[], size_t blocks) {
+    v8u state[4], w[16];
+    loadStates<v8u, 8>(states, state);
+
+    for (size_t offset = 0; offset < blocks * BLOCK_SIZE; offset += BLOCK_SIZE) {
+        loadBlocks8(data, offset, w);
+        md5Compress(state, w);
+    }
+
+    storeStates<v8u, 8>(states, state);
+}
+
+__attribute__((target("avx512f")))
+static void md5BlocksAVX512(uint32_t *states[], const unsigned char *data[], size_t blocks) {
+    v16u state[4], w[16];
+    loadStates<v16u, 16>(states, state);
+
+    for (size_t offset = 0; offset < blocks * BLOCK_SIZE; offset += BLOCK_SIZE) {
+        loadBlocks16(data, offset, w);
+        md5Compress(state, w);
+    }
+
+    storeStates<v16u, 16>(states, state);
+}
+#endif
+
+
+struct md5EngineType {
+    md5BlocksFunc blocks;
+    unsigned int lanes;
+    string name;
+};
+
+
+static const md5EngineType& md5Engine() {
+    static md5EngineType engine = []() -> md5EngineType {
+        auto lanes = laneEngine();
+
+        switch (lanes.lanes) {
+#if defined(HAVE_LANES)
+            case 16: return { md5BlocksAVX512, 16, lanes.name };
+            case 8:  return { md5BlocksAVX2, 8, lanes.name };
+            case 4:  return { md5BlocksSSE2, 4, lanes.name };
+#endif
+            default: return { md5BlocksScalar, 1, lanes.name };
+        }
+    }();
+
+    return engine;
+}
+
+
+unsigned int MultiMD5::lanes() { return md5Engine().lanes; }
+string MultiMD5::engine() { return md5Engine().name; }
+
+
+/* hash the whole blocks the streams have waiting, up to a lane's worth of streams at a
+ * time, each pass running as many blocks as the shortest of them has.  unless 'partial'
+ * is set it stops once there aren't enough streams with data to fill the lanes (or all
+ * the ones in use), leaving the rest for when more has arrived. */
+void MultiMD5::hashReady(bool partial) {
+    auto &engine = md5Engine();
+    size_t inUse = 0;
+
+    for (auto &stream: streams)
+        inUse += stream.active;
+
+    while (1) {
+        vector<streamType*> ready;
+
+        for (auto &stream: streams)
+            if (stream.active && stream.pending.length() - stream.consumed >= BLOCK_SIZE)
+                ready.insert(ready.end(), &stream);
+
+        if (!ready.size() || (!partial && ready.size() < min((size_t)engine.lanes, inUse)))
+            break;
+
+        // the ones with the most waiting go first
+        sort(ready.begin(), ready.end(), [](streamType *a, streamType *b) {
+            return a->pending.length() - a->consumed > b->pending.length() - b->consumed; });
+
+        if (ready.size() > engine.lanes)
+            ready.resize(engine.lanes);
+
+        size_t blocks = (ready.back()->pending.length() - ready.back()->consumed) / BLOCK_SIZE;
+        uint32_t *states[MAX_LANES];
+        const unsigned char *data[MAX_LANES];
+        uint32_t spareStates[MAX_LANES][4];
+
+        for (size_t lane = 0; lane < engine.lanes; ++lane)
+            if (lane < ready.size()) {
+                states[lane] = ready[lane]->state;
+                data[lane] = (const unsigned char*)ready[lane]->pending.data() + ready[lane]->consumed;
+            }
+            else {
+                // unused lanes run over the first stream's data and their result is dropped
+                states[lane] = spareStates[lane];
+                data[lane] = data[0];
+            }
+
+        // a lone stream is quicker through the plain version than one lane of the vectors
+        if (ready.size() == 1)
+            md5BlocksScalar(states, data, blocks);
+        else
+            engine.blocks(states, data, blocks);
+
+        for (auto stream: ready)
+            stream->consumed += blocks * BLOCK_SIZE;
+    }
+
+    for (auto &stream: streams)
+        if (stream.consumed) {
+            stream.pending.erase(0, stream.consumed);
+            stream.consumed = 0;
+        }
+}
+
+
+void MultiMD5::update(size_t stream, const void *data, size_t count) {
+    auto &aStream = streams[stream];
+
+    if (!aStream.active) {
+        memcpy(aStream.state, initialState, sizeof(initialState));
+        aStream.length = 0;
+        aStream.pending.clear();
+        aStream.consumed = 0;
+        aStream.active = true;
+    }
+
+    aStream.pending.append((const char*)data, count);
+    aStream.length += count;
+
+    hashReady(aStream.pending.length() > MAX_PENDING);
+}
+
+
+string MultiMD5::final(size_t stream) {
+    auto &aStream = streams[stream];
+
+    if (!aStream.active)
+        update(stream, "", 0);
+
+    hashReady(true);
+
+    // pad with a 1 bit, zeros up to 8 bytes short of a block, then the length in bits
+    string tail = aStream.pending;
+    uint64_t bits = aStream.length * 8;
+
+    tail += (char)0x80;
+    while (tail.length() % BLOCK_SIZE != BLOCK_SIZE - 8)
+        tail += (char)0;
+
+    for (int byte = 0; byte < 8; ++byte)
+        tail += (char)(bits >> (byte * 8));
+
+    uint32_t *states[1] = { aStream.state };
+    const unsigned char *data[1] = { (const unsigned char*)tail.data() };
+    md5BlocksScalar(states, data, tail.length() / BLOCK_SIZE);
+
+    aStream.active = false;
+    aStream.pending.clear();
+
+    char hex[33];
+    for (int word = 0; word < 4; ++word)
+        for (int byte = 0; byte < 4; ++byte)
+            snprintf(hex + word * 8 + byte * 2, 3, "%02x", (aStream.state[word] >> (byte * 8)) & 0xff);
+
+    return hex;
+}
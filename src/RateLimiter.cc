@@ -0,0 +1,148 @@
+
+#include <time.h>
+#include <math.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "RateLimiter.h"
+#include "util_generic.h"
+
+
+// "HH[:MM]" to minutes past midnight
+bool parseTimeOfDay(string timeStr, int& minutes) {
+    int hour = 0;
+    int minute = 0;
+
+    if (sscanf(timeStr.c_str(), "%d:%d", &hour, &minute) < 1 || hour < 0 || hour > 24 || minute < 0 || minute > 59)
+        return false;
+
+    minutes = hour * 60 + minute;
+    return true;
+}
+
+
+bool RateLimiter::setSpec(string spec, string& error) {
+    schedule.clear();
+    rateCheckedAt = 0;
+
+    for (auto &entry: perlSplit(",", spec)) {
+        entry = trimSpace(entry);
+        if (!entry.length())
+            continue;
+
+        rateWindowType window = {0, 24 * 60, 0};
+        auto at = entry.find("@");
+
+        if (at != string::npos) {
+            string times = entry.substr(at + 1);
+            auto dash = times.find("-");
+
+            if (dash == string::npos || !parseTimeOfDay(times.substr(0, dash), window.startMinute) ||
+                !parseTimeOfDay(times.substr(dash + 1), window.endMinute)) {
+                error = "invalid time window in rate limit \"" + entry + "\" (expected rate@HH[:MM]-HH[:MM])";
+                return false;
+            }
+
+            entry = trimSpace(entry.substr(0, at));
+        }
+
+        try {
+            window.bytesPerSec = approx2bytes(entry);
+        }
+        catch (...) {
+            window.bytesPerSec = 0;
+        }
+
+        if (!window.bytesPerSec) {
+            error = "invalid rate limit \"" + entry + "\" (expected a size per second, e.g. 500K or 10M)";
+            return false;
+        }
+
+        schedule.insert(schedule.end(), window);
+    }
+
+    return true;
+}
+
+
+size_t RateLimiter::currentRate() {
+    if (!schedule.size())
+        return 0;
+
+    // the applicable entry only changes on the minute
+    time_t now = time(NULL);
+    if (now / 60 == rateCheckedAt)
+        return rate;
+
+    rateCheckedAt = now / 60;
+    rate = 0;
+
+    struct tm *timeFields = localtime(&now);
+    int minute = timeFields->tm_hour * 60 + timeFields->tm_min;
+
+    for (auto &window: schedule) {
+        bool inWindow = window.startMinute <= window.endMinute ?
+            minute >= window.startMinute && minute < window.endMinute :
+            minute >= window.startMinute || minute < window.endMinute;
+
+        if (inWindow) {
+            rate = window.bytesPerSec;
+            break;
+        }
+    }
+
+    return rate;
+}
+
+
+void RateLimiter::consume(size_t bytes) {
+    lock_guard<mutex> guard(limitLock);
+    auto allowed = currentRate();
+    if (!allowed || !bytes)
+        return;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    // refill for the time that's passed, holding at most a second's worth
+    double elapsed = last.tv_sec ? (now.tv_sec - last.tv_sec) + (now.tv_usec - last.tv_usec) / 1000000.0 : 0;
+    tokens = fmin((double)allowed, tokens + elapsed * allowed) - bytes;
+    last = now;
+
+    if (tokens < 0) {
+        double wait = -tokens / allowed;
+        struct timespec sleepTime;
+        sleepTime.tv_sec = (time_t)wait;
+        sleepTime.tv_nsec = (long)((wait - sleepTime.tv_sec) * 1000000000);
+
+        while (nanosleep(&sleepTime, &sleepTime) && errno == EINTR);
+
+        gettimeofday(&last, NULL);
+        tokens = 0;
+    }
+}
+
+
+string RateLimiter::divideSpec(string spec, int parts) {
+    if (parts < 2)
+        return spec;
+
+    string result;
+    for (auto &entry: perlSplit(",", spec)) {
+        entry = trimSpace(entry);
+        auto at = entry.find("@");
+        size_t bytes = 0;
+
+        try {
+            bytes = approx2bytes(trimSpace(entry.substr(0, at)));
+        }
+        catch (...) {}
+
+        if (!entry.length() || !bytes)
+            continue;
+
+        result += (result.length() ? "," : "") + to_string(max(bytes / parts, (size_t)1)) + (at != string::npos ? entry.substr(at) : "");
+    }
+
+    return result;
+}
@@ -43,7 +43,12 @@ map<string, int>settingMap =
     { CLI_EXCLUDE, sExclude },
     { CLI_FILTERDIRS, sFilterDirs },
     { CLI_PATHS, sPaths },
-    { CLI_ARCHIVE, sArchive }
+    { CLI_ARCHIVE, sArchive },
+    { CLI_AGENT, sAgent },
+    { CLI_AGENTKEY, sAgentKey },
+    { CLI_BWLIMIT, sBwLimit },
+    { CLI_IOLIMIT, sIOLimit },
+    { CLI_DIGEST, sDigest }
 };
 
 
@@ -1,11 +1,18 @@
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
 #include <netinet/tcp.h>
+#include <netdb.h>
 #include <algorithm>
 #include <unistd.h>
 #include <utime.h>
+#include <signal.h>
+#include <fstream>
+#include <sstream>
 
 #include "FaubCache.h"
+#include "FaubSession.h"
 #include "faub.h"
 #include "ipc.h"
 #include "notify.h"
@@ -23,7 +30,6 @@ struct mostRecentBDataType {
     time_t sinceTime;
     time_t recentTime;
     string recentName;
-    Pcre *dateRE;
 };
 
 
@@ -44,9 +50,7 @@ bool mostRecentBCallback(pdCallbackData &file) {
 
 
 string mostRecentBackupDirSince(string backupDir, string sinceDir, string profileName) {
-    Pcre dateRE(DATE_REGEX);
     mostRecentBDataType data;
-    data.dateRE = &dateRE;
     data.recentTime = 0;
 
     struct stat statData;
@@ -83,52 +87,527 @@ string newBackupDir(BackupConfig& config) {
 }
 
 
-void fs_startServer(BackupConfig& config) {
+/*
+ * backupDateId()
+ * The date (and time, if included) from a backup's directory name in a normalized
+ * form, e.g. "2023-01-05@10:15:23".  Replicas are matched to the backups they were
+ * made from by this alone, since the two servers' profiles needn't share a title.
+ */
+string backupDateId(string backupDir) {
+    backupDateType date;
+    char id[30];
+
+    if (!parseBackupDate(pathSplit(backupDir).file, date))
+        return "";
+
+    if (date.hasTime)
+        snprintf(id, sizeof(id), "%04d-%02d-%02d@%02d:%02d:%02d", date.year, date.month, date.day, date.hour, date.minute, date.second);
+    else
+        snprintf(id, sizeof(id), "%04d-%02d-%02d", date.year, date.month, date.day);
+
+    return id;
+}
+
+
+/*
+ * replicaBackupDir()
+ * Where a replica of the backup identified by 'id' (see backupDateId()) goes.  It's
+ * named for the original's date rather than the time of replication.
+ */
+string replicaBackupDir(BackupConfig& config, string id) {
+    bool incTime = id.length() > 10;
+    string subDir = id.substr(0, 4) + "/" + id.substr(5, 2) + (incTime ? "/" + id.substr(8, 2) : "");
+
+    return slashConcat(config.settings[sDirectory].value, subDir, safeFilename(config.settings[sTitle].value) + "-" + id);
+}
+
+
+/*
+ * fc_expandPaths()
+ * The vector of paths given to a faub client can be from the profile (conf file).
+ * Each item could be a quoted list of multiple sub paths, any of which may
+ * contain wildcards.  Break them down to the final list of paths to scan.
+ */
+vector<string> fc_expandPaths(vector<string> origPaths) {
+    vector<string> paths;
+    
+    for (auto &p : origPaths) {
+        auto dirVec = string2vectorOnSpace(p, true, true);
+        
+        for (auto &d : dirVec) {
+            auto fileVec = expandWildcardFilespec(d);
+            paths.insert(paths.end(), fileVec.begin(), fileVec.end());
+        }
+    }
+    
+    return paths;
+}
+
+
+/*
+ * fs_localPaths()
+ * If the faub command just runs managebackups on this host (no ssh or other
+ * wrapper) return the paths it would scan so the backup can be done in-process.
+ * Anything we don't recognize returns an empty list and the command is executed
+ * as usual.
+ */
+vector<string> fs_localPaths(string faubCommand) {
+    vector<string> paths;
+    auto tokens = string2vectorOnSpace(faubCommand, true, false);
+    
+    if (!tokens.size())
+        return {};
+    
+    auto binary = locateBinary(tokens[0]);
+    if (pathSplit(tokens[0]).file != "managebackups" &&
+        (!binary.length() || realpathcpp(binary) != realpathcpp("/proc/self/exe")))
+        return {};
+    
+    // options that don't change what the client would send
+    set<string> passive = { "--" CLI_LOGDIR, "--" CLI_CONFDIR, "--" CLI_CACHEDIR };
+    
+    for (auto it = tokens.begin() + 1; it != tokens.end(); ++it) {
+        if (*it == "-s" || *it == "--" CLI_PATHS) {
+            if (++it == tokens.end())
+                return {};
+            
+            paths.insert(paths.end(), *it);
+        }
+        else
+            if (passive.find(*it) != passive.end()) {
+                if (++it == tokens.end())
+                    return {};
+            }
+            else
+                if (*it != "-q" && *it != "--" CLI_QUIET)
+                    return {};
+    }
+    
+    return fc_expandPaths(paths);
+}
+
+
+/*
+ * fs_localCopyToFile()
+ * The local equivalent of ipcReadToFile() - copy one directory entry from a local
+ * source into the backup, preserving ownership, mode and mtime.  Regular files are
+ * copied via copyFile(), which lets the kernel clone or copy the data when it can.
+ */
+tuple<string, int, time_t, long, string> fs_localCopyToFile(string source, string filename, bool preDelete) {
+    struct stat statData;
+    string errorMsg;
+    
+    if (mylstat(source, &statData))
+        return {("error: unable to stat " + source + errtext()), 0, 0, 0, ""};
+    
+    if (S_ISDIR(statData.st_mode)) {
+        if (mkdirp(filename, statData.st_mode))
+            errorMsg += (errorMsg.length() ? "\n" : "") + string("error: unable to mkdir ") + filename + errtext();
+        
+        if (chown(filename.c_str(), statData.st_uid, statData.st_gid))
+            errorMsg += (errorMsg.length() ? "\n" : "") + string("error: unable to chown directory ") + filename + errtext();
+        
+        return {errorMsg, statData.st_mode, statData.st_mtime, 0, ""};
+    }
+    
+    if (mkbasedirs(filename))
+        return {("error: unable to mkdir " + filename + errtext()), 0, 0, 0, ""};
+    
+    if (preDelete)
+        unlink(filename.c_str());
+    
+    if (S_ISLNK(statData.st_mode)) {
+        char target[PATH_MAX + 1];
+        auto bytes = readlink(source.c_str(), target, PATH_MAX);
+        
+        if (bytes < 0)
+            return {("error: unable to dereference symlink " + source + errtext()), -1, 0, 0, ""};
+        
+        target[bytes] = 0;
+        if (symlink(target, filename.c_str()))
+            return {("error: unable to create symlink " + filename + errtext()), -1, 0, 0, ""};
+        
+        if (lchown(filename.c_str(), statData.st_uid, statData.st_gid))
+            return {("error: unable to chown symlink " + filename + errtext()), -1, 0, 0, ""};
+        
+        struct timeval tv[2];
+        tv[0].tv_sec  = tv[1].tv_sec  = statData.st_mtime;
+        tv[0].tv_usec = tv[1].tv_usec = 0;
+        lutimes(filename.c_str(), tv);
+        
+        return {"", statData.st_mode, 0, 0, ""};
+    }
+    
+    if (!copyFile(source, filename))
+        return {("error: unable to copy " + source + " to " + filename + errtext()), 0, 0, statData.st_size, ""};
+    
+    if (chown(filename.c_str(), statData.st_uid, statData.st_gid))
+        errorMsg += (errorMsg.length() ? "\n" : "") + string("error: unable to chown file ") + filename + errtext();
+    
+    if (chmod(filename.c_str(), statData.st_mode))
+        errorMsg += (errorMsg.length() ? "\n" : "") + string("error: unable to chmod file ") + filename + errtext();
+    
+    struct utimbuf timeBuf;
+    timeBuf.actime = timeBuf.modtime = statData.st_mtime;
+    utime(filename.c_str(), &timeBuf);
+    
+    return {errorMsg, statData.st_mode, statData.st_mtime, statData.st_size, ""};
+}
+
+
+/*
+ * agentAddress()
+ * Split a faub agent address into its host and port.  Accepts "host:port", "host",
+ * ":port", "port", "[ipv6]:port" or the path of a unix domain socket.
+ */
+bool agentAddress(string address, string& host, int& port) {
+    host = trimSpace(address);
+    port = FAUB_AGENT_PORT;
+    
+    if (!host.length())
+        return false;
+    
+    if (host[0] == '/')
+        return true;
+    
+    string portStr;
+    if (host[0] == '[') {
+        auto bracket = host.find(']');
+        if (bracket == string::npos)
+            return false;
+        
+        if (bracket + 1 < host.length()) {
+            if (host[bracket + 1] != ':')
+                return false;
+            portStr = host.substr(bracket + 2);
+        }
+        
+        host = host.substr(1, bracket - 1);
+    }
+    else {
+        auto colon = host.find(':');
+        
+        if (colon != string::npos) {
+            if (host.rfind(':') != colon)
+                return true;        // bare ipv6 address
+            
+            portStr = host.substr(colon + 1);
+            host = host.substr(0, colon);
+        }
+        else
+            if (host.find_first_not_of("0123456789") == string::npos) {
+                portStr = host;
+                host = "";
+            }
+    }
+    
+    if (portStr.length()) {
+        if (portStr.find_first_not_of("0123456789") != string::npos)
+            return false;
+        
+        port = stoi(portStr);
+    }
+    
+    return port > 0 && port < 65536;
+}
+
+
+/*
+ * agentLoopback()
+ * True if a faub agent address parsed by agentAddress() is a unix domain socket or
+ * only resolves to loopback addresses, i.e. it can't be reached from the network
+ * without a tunnel.  An empty host (all interfaces) isn't.
+ */
+bool agentLoopback(string host) {
+    if (host.length() && host[0] == '/')
+        return true;
+    
+    if (!host.length())
+        return false;
+    
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    
+    if (getaddrinfo(host.c_str(), NULL, &hints, &result))
+        return false;
+    
+    bool loopback = true;
+    for (auto ai = result; ai != NULL; ai = ai->ai_next)
+        if (ai->ai_family == AF_INET)
+            loopback &= (ntohl(((struct sockaddr_in*)ai->ai_addr)->sin_addr.s_addr) >> 24) == 127;
+        else
+            loopback &= ai->ai_family == AF_INET6 && IN6_IS_ADDR_LOOPBACK(&((struct sockaddr_in6*)ai->ai_addr)->sin6_addr);
+    
+    freeaddrinfo(result);
+    return loopback;
+}
+
+
+/*
+ * agentKey()
+ * Read the pre-shared key that faub agents and servers authenticate each other with.
+ */
+string agentKey(string keyFile, string& error) {
+    if (!keyFile.length()) {
+        error = "no --" CLI_AGENTKEY " specified";
+        return "";
+    }
+    
+    ifstream keyStream(keyFile);
+    if (!keyStream.is_open()) {
+        error = "unable to read " + keyFile + errtext();
+        return "";
+    }
+    
+    stringstream keyData;
+    keyData << keyStream.rdbuf();
+    string key = trimSpace(keyData.str());
+    
+    if (key.length() < 16) {
+        error = keyFile + " must contain a key of at least 16 characters";
+        return "";
+    }
+    
+    struct stat statData;
+    if (!stat(keyFile.c_str(), &statData) && (statData.st_mode & (S_IRWXG | S_IRWXO)))
+        log("warning: faub agent key " + keyFile + " is accessible by group/other users");
+    
+    return key;
+}
+
+
+/*
+ * fs_commandPaths()
+ * The --path (-s) arguments given to managebackups within a faub command, if any.
+ * These are what a faub agent gets asked to serve in place of running the command.
+ */
+vector<string> fs_commandPaths(string faubCommand) {
+    vector<string> paths;
+    auto tokens = string2vectorOnSpace(faubCommand, true, false);
+    
+    auto it = find_if(tokens.begin(), tokens.end(), [](string &token) { return pathSplit(token).file == "managebackups"; });
+    if (it == tokens.end())
+        return {};
+    
+    while (++it != tokens.end())
+        if ((*it == "-s" || *it == "--" CLI_PATHS) && (it + 1) != tokens.end())
+            paths.insert(paths.end(), *++it);
+    
+    return paths;
+}
+
+
+/*
+ * fs_connectAgent()
+ * Connect and authenticate to the profile's faub agent and ask it to serve a session.
+ * On success the returned socket is ready for fs_serverProcessing().  On failure NULL
+ * is returned with the reason in 'error'.
+ */
+TCP_Socket *fs_connectAgent(BackupConfig& config, string& error) {
+    string host;
+    int port;
+    
+    if (!agentAddress(config.settings[sAgent].value, host, port)) {
+        error = "invalid agent address \"" + config.settings[sAgent].value + "\"";
+        return NULL;
+    }
+    
+    string key = agentKey(config.settings[sAgentKey].value, error);
+    if (!key.length())
+        return NULL;
+    
+    TCP_Socket *agent = NULL;
+    try {
+        DEBUG(D_netproto) DFMT("connecting to faub agent at " << config.settings[sAgent].value);
+        agent = new TCP_Socket(host, port, FAUB_AGENT_TIMEOUT);
+        
+        /* mutual challenge-response: each side proves it holds the key by returning an
+         * HMAC of the other's random nonce.  the key itself never crosses the wire. */
+        if (agent->ipcRead() != NET_AGENT_HELLO)
+            throw MBException("unexpected greeting from agent");
+        
+        string agentNonce = agent->ipcReadTo(NET_DELIM);
+        string serverNonce = randomHex(16);
+        agent->ipcWrite(string(HMACsha256(key, "server:" + agentNonce) + NET_DELIM).c_str());
+        agent->ipcWrite(string(serverNonce + NET_DELIM).c_str());
+        
+        string response = agent->ipcReadTo(NET_DELIM);
+        if (response == NET_ABORT)
+            throw MBException("agent rejected our key");
+        
+        if (!serverNonce.length() || !secureEquals(response, HMACsha256(key, "agent:" + serverNonce)))
+            throw MBException("agent failed authentication");
+        
+        // describe the session - what the agent would otherwise get on its command line
+        bool exclude = !config.settings[sInclude].value.length() && config.settings[sExclude].value.length();
+        __int64_t flags = (str2bool(config.settings[sIgnoreTouch].value) ? NET_AGENT_IGNORETOUCH : 0) | (exclude ? NET_AGENT_EXCLUDE : 0);
+        auto paths = fs_commandPaths(config.settings[sFaub].value);
+        
+        agent->ipcWrite(flags);
+        agent->ipcWrite(string(config.settings[exclude ? sExclude : sInclude].value + NET_DELIM).c_str());
+        agent->ipcWrite(string(config.settings[sTitle].value + NET_DELIM).c_str());
+        agent->ipcWrite((__int64_t)paths.size());
+        for (auto &path: paths)
+            agent->ipcWrite(string(path + NET_DELIM).c_str());
+        
+        string reply = agent->ipcReadTo(NET_DELIM);
+        if (reply.length())
+            throw MBException("agent refused session: " + reply);
+        
+        // an agent running with --fanout can hold the session until the rest of its group
+        // arrives and then feeds us alongside them, so allow for waiting on the others
+        int destinations = atoi(agent->ipcReadTo(NET_DELIM).c_str());
+        if (destinations > 1) {
+            agent->setTimeout(FAUB_FANOUT_TIMEOUT);
+            log(config.ifTitle() + " faub agent session shared with " + plural(destinations - 1, "other server"));
+        }
+        
+        DEBUG(D_netproto) DFMT("faub agent session established");
+        return agent;
+    }
+    catch (MBException &e) {
+        error = e.detail();
+        delete agent;
+        return NULL;
+    }
+}
+
+
+/*
+ * fs_faubCommand()
+ * The profile's faub command with the options that describe the session appended.
+ */
+string fs_faubCommand(BackupConfig& config) {
     string clude = config.settings[sInclude].value.length() ? " --include \"" + config.settings[sInclude].value + "\"" :
         config.settings[sExclude].value.length() ? " --exclude \"" + config.settings[sExclude].value + "\"" : "";
+
+    // ask the client to compare digests before sending touched files. clients that
+    // predate hashfirst accept and ignore --ignoretouch, which is what the server
+    // falls back to when the client doesn't announce NET_CAP_HASHFIRST.
+    if (str2bool(config.settings[sIgnoreTouch].value))
+        clude += string(" --") + CLI_IGNORETOUCH;
+    
+    return config.settings[sFaub].value + clude;
+}
+
+
+/*
+ * fs_multiplexable()
+ * Whether --multiplex can receive this profile's backups: a faub profile whose source
+ * is reached through a client (its agent or faub command) rather than read locally,
+ * and whose client is being backed up rather than being another backup server.
+ */
+bool fs_multiplexable(BackupConfig& config) {
+    string faub = config.settings[sFaub].value;
+    
+    if (!config.isFaub() || (faub.length() && (fs_localPaths(faub).size() || faub.find("--" CLI_REPLICASOURCE) != string::npos)))
+        return false;
     
-    PipeExec faub(config.settings[sFaub].value + clude, 60);
+    return faub.length() || config.settings[sAgent].value.length();
+}
+
+
+void fs_startServer(BackupConfig& config) {
+    string faubCommand = fs_faubCommand(config);
+    PipeExec faub(faubCommand, 60);
 
     if (GLOBALS.cli.count(CLI_NOBACKUP))
         return; 
 
     string newDir = newBackupDir(config);
     string prevDir = mostRecentBackupDirSince(config.settings[sDirectory].value, newDir, config.settings[sTitle].value);
+    
+    // a source on this host doesn't need a client; compare and copy in-process
+    auto localPaths = fs_localPaths(config.settings[sFaub].value);
 
     if (GLOBALS.cli.count(CLI_TEST)) {
-        cout << YELLOW << config.ifTitle() << " TESTMODE: would have begun backup by executing \"" << config.settings[sFaub].value + clude << "\"" << endl;
+        if (config.settings[sAgent].value.length())
+            cout << YELLOW << config.ifTitle() << " TESTMODE: would have begun backup via faub agent " << config.settings[sAgent].value << endl;
+        else
+            if (localPaths.size())
+                cout << YELLOW << config.ifTitle() << " TESTMODE: would have begun local backup of " << perlJoin(", ", localPaths) << endl;
+            else
+                cout << YELLOW << config.ifTitle() << " TESTMODE: would have begun backup by executing \"" << faubCommand << "\"" << endl;
         cout << "saving to " << newDir << endl;
         cout << "comparing to previous " << prevDir << RESET << endl;
         return;
     }
+    
+    // a configured agent replaces executing the faub command, which remains the fallback
+    if (config.settings[sAgent].value.length()) {
+        string error;
+        auto agent = fs_connectAgent(config, error);
+        
+        if (agent != NULL) {
+            fs_serverProcessing(agent, config, prevDir, newDir);
+            delete agent;
+            return;
+        }
+        
+        string message = config.ifTitle() + " unable to use faub agent " + config.settings[sAgent].value + ": " + error;
+        if (!config.settings[sFaub].value.length()) {
+            log(message);
+            SCREENERR(message);
+            notify(config, "\t• " + message, false);
+            return;
+        }
+        
+        log(message + "; falling back to the faub command");
+        SCREENERR(message + "; falling back to the faub command");
+    }
+    
+    if (localPaths.size()) {
+        DEBUG(D_faub) DFMT("local source detected; backing up " << localPaths.size() << " path(s) in-process");
+        fs_serverProcessing(NULL, config, prevDir, newDir, localPaths);
+        return;
+    }
 
     DEBUG(D_netproto) DFMT("executing: \"" << config.settings[sFaub].value << "\"");
     faub.execute(GLOBALS.cli.count(CLI_LEAVEOUTPUT) ? config.settings[sTitle].value : "", false, false, false, true);
-    fs_serverProcessing(faub, config, prevDir, newDir);
+    fs_serverProcessing(&faub, config, prevDir, newDir);
 }
 
 
-void fs_serverProcessing(PipeExec& client, BackupConfig& config, string prevDir, string currentDir) {
-    size_t maxLinksReached = 0;
-    string remoteFilename;
-    string localPrevFilename;
-    string localCurFilename;
-    string originalCurrentDir = currentDir;
-    struct stat statData;
-    size_t fileTotal = 0;
-    size_t filesModified = 0;
-    size_t filesHardLinked = 0;
-    size_t filesSymLinked = 0;
-    size_t receivedSymLinks = 0;
-    size_t unmodDirs = 0;
-    size_t linkErrors = 0;
-    string tempExtension = ".tmp." + to_string(GLOBALS.pid);
-    bool abortBackupAtEnd = false;
-
-    // note start time
-    timer backupTime;
-    timer fsTime;
-    backupTime.start();
+/*
+ * fs_verifyStats()
+ * Walk a newly received backup the way recache() does and compare the result to the
+ * usage the server tallied while building it (--verifystats).  The walk's numbers are
+ * the ones that end up cached.
+ */
+void fs_verifyStats(BackupConfig& config, string backupDir, DiskStats& tallied) {
+    config.fcache.recache(backupDir);
+    
+    auto backup = config.fcache.getBackupByDir(backupDir);
+    if (backup == config.fcache.getEnd())
+        return;
+    
+    auto describe = [](DiskStats& ds) {
+        return to_string(ds.usedInBytes) + " used, " + to_string(ds.savedInBytes) + " saved, " + to_string(ds.usedInBlocks) + "/" +
+            to_string(ds.savedInBlocks) + " blocks, " + plural(ds.dirs, "dir") + ", " + plural(ds.symLinks, "symlink") + ", " + plural(ds.mods, "mod");
+    };
+    
+    auto& walked = backup->second.ds;
+    if (walked.usedInBytes != tallied.usedInBytes || walked.savedInBytes != tallied.savedInBytes ||
+        walked.usedInBlocks != tallied.usedInBlocks || walked.savedInBlocks != tallied.savedInBlocks ||
+        walked.dirs != tallied.dirs || walked.symLinks != tallied.symLinks || walked.mods != tallied.mods) {
+        string message = config.ifTitle() + " warning: usage tallied for " + backupDir + " differs from a full walk (tallied " +
+            describe(tallied) + "; walked " + describe(walked) + ")";
+        log(message);
+        SCREENERR(message);
+    }
+    else {
+        log(config.ifTitle() + " verified usage tally for " + backupDir);
+        NOTQUIET && cout << "\t• " << config.ifTitle() << " usage tally verified against a full walk" << endl;
+    }
+}
+
+
+void fs_serverProcessing(IPC_Base *client, BackupConfig& config, string prevDir, string currentDir, vector<string> localPaths) {
+    // hold the transfer to --bwlimit; local copies are covered by --iolimit instead
+    if (client != NULL)
+        client->setLimiter(&GLOBALS.netLimit);
 
     /*
      FAUB PROTOCOL - 4 PHASES
@@ -148,167 +627,85 @@ void fs_serverProcessing(PipeExec& client, BackupConfig& config, string prevDir,
             - symlinks all entries that are symlinks on the remote server to their specified targets
             - copies files from the previous backup to the current if maxLinks is exceeeded
             - sets the mtime on all directories in the newly created backup
+
+     The server's side of each phase is in FaubSession; this drives it with blocking reads.
      */
     
     try {
         DEBUG(D_any) DFMT("current: " << currentDir);
         DEBUG(D_any) DFMT("previous: " << prevDir);
         
+        // without a client the source is local and we do the client's half ourselves
+        bool local = client == NULL;
+        
         // record number of filesystems the client is going to send (again, not really "filesystems")
-        auto totalFS = client.ipcRead();
-        int completeFS = 0;
+        auto totalFS = local ? (__int64_t)localPaths.size() : client->ipcRead();
 
-        currentDir += tempExtension;
-        string screenMessage = config.ifTitle() + " backing up to temp dir " + currentDir + "... ";
+        // newer clients may announce capabilities ahead of the filesystem count
+        __int64_t clientCaps = 0;
+        if (!local && totalFS == NET_CAPS) {
+            clientCaps = client->ipcRead();
+            totalFS = client->ipcRead();
+            DEBUG(D_netproto) DFMT("client capabilities: " << clientCaps);
+        }
+
+        // another backup server sending us its backups rather than a client being backed up
+        if (!local && (clientCaps & NET_CAP_REPLICA)) {
+            fs_replicaReceive(client, config);
+            return;
+        }
+
+        FaubSession session(config, prevDir, currentDir, local, clientCaps, totalFS, ".tmp." + to_string(GLOBALS.pid));
+        string screenMessage = config.ifTitle() + " backing up to temp dir " + session.currentDir + "... ";
         string backspaces = string(screenMessage.length(), '\b');
         string blankspaces = string(screenMessage.length() , ' ');
         NOTQUIET && ANIMATE && cout << screenMessage << flush;
         DEBUG(D_any) cerr << "\n";
         DEBUG(D_netproto) DFMT("faub server ready to receive");
-        NOTQUIET && ANIMATE && cout << progressPercentageA((int)totalFS, 7, completeFS, 0) << flush;
+        session.progress(0);
 
-        log(config.ifTitle() + " starting backup to " + currentDir);
-        GLOBALS.interruptFilename = currentDir;  // interruptFilename gets cleaned up on SIGTERM & SIGINT
-        bool incTime = str2bool(config.settings[sIncTime].value);
-        
-        // all modified files from this client (used to create --diff list)
-        set<string> modifiedFiles;
+        GLOBALS.interruptFilename = session.currentDir;  // interruptFilename gets cleaned up on SIGTERM & SIGINT
         
         /* loop through filesystems */
         do {
-            fsTime.start();
-
-            // needed (i.e. modified) files for this filesystem (pass of the protocol)
-            set<string> neededFiles;
-            
-            // mtimes for all directories so we can set them at the very end
-            map<string, time_t> dirMtimes;
-            
-            // hardlinks to create after receiving new files
-            map<string,string> hardLinkList;
-            
-            // symlinks to create (bc they exist on the remote system) after receiving new files
-            map<string,string> symLinkList;
-            
-            // files to copy from previous backup due to reaching maxLinks
-            map<string,string> duplicateList;
-            
-            // total size of files neede from client for this fs - used for progress bar
-            long fsTotalBytesNeeded = 0;
-            long fsBytesReceived = 0;
-            
             /*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*
              * phase 1 - get list of filenames and mtimes from client
              * and see if the remote file is different from what we
              * have locally in the most recent backup.
              */
             
-            string fs = client.ipcReadTo(NET_DELIM);
+            string fs = local ? localPaths[session.completeFS] : client->ipcReadTo(NET_DELIM);
+            session.startFS(fs);
             
-            unsigned int maxLinksAllowed = config.settings[sMaxLinks].ivalue();
-            size_t checkpointTotal = fileTotal;
+            // a local source gets scanned up front, exactly as the client would have
+            vector<localEntryType> localEntries;
+            if (local)
+                fc_scanLocal(config, fs, localEntries);
             
-            /* loop through files in this "filesystem" */
-            while (1) {
-                remoteFilename = client.ipcReadTo(NET_DELIM);
-        
-                if (remoteFilename == NET_ABORT) {
-                    log(config.ifTitle() + " backup aborted by client");
-                    cleanupAndExitOnError();
-                }
-                
-                if (remoteFilename == NET_OVER)
-                    break;
-                
-                ++fileTotal;
-                long mtime = client.ipcRead();
-                long mode  = client.ipcRead();
-                long size = client.ipcRead();
-                
-                DEBUG(D_netproto) DFMTNOENDL("server learned about " << remoteFilename << " (" << to_string(mode) << ") ");
-                
-                localPrevFilename = slashConcat(prevDir, remoteFilename);
-                localCurFilename = slashConcat(currentDir, remoteFilename);
-                
-                /*
-                 * What do we need from the client based on the directory entry they've just described?
-                 * The general process is to compare the remote filename to the local filename in the
-                 * most recent backup and if both exist, compare their mtimes.  If there's a match we
-                 * can assume the data hasn't changed. When they match we hard link the new file to
-                 * the previous backup's copy of it.  Because of the order entries come over we can't
-                 * guarantee that a parent directory will come over before a file within it.  So we
-                 * make a list of all the entries as they come over the wire then go back and create
-                 * the links at the end.  Details inline below.
-                 
-                 * The nuances of directories in this model can be incredibly confusing.  When you
-                 * stumble upon a subdir you could examine its mtime and decide if its changed,
-                 * effectively treating it just like a file (trasnfer its metadata only if necessary).
-                 * Or you could say just transfer them all regardless of mtime (its only uid, gid,
-                 * mode and mtime).  Either way you're getting files and directories in a non-intuitive
-                 * order.  The problem is every time you add a file (or subdir) to a directory, you
-                 * update that directory's mtime.  So if you want an accurate backup --including the
-                 * mtimes on all your directories-- you need to reset those directory mtimes last.
-                 * Either you track every directory where you've added a file/subdir or just do them all.
-                 * I've elected to do them all because nearly every directory (except empty ones) are
-                 * going to have this issue, regardless of whether the entries in them are newly
-                 * transfered files or existing hardlinked ones.
-                 */
-                
-                // if it's a directory, request it.  hardlinks don't work for directories. we don't
-                // have this mtime at this point in the protocol so we just add it to the list to
-                // request from the client.  when the client actually sends all its data, we'll save
-                // the mtime for processing at the very end.
-                if (S_ISDIR(mode)) {
-                    neededFiles.insert(neededFiles.end(), remoteFilename);
-                    ++unmodDirs;
-                    DEBUG(D_netproto) DFMTNOPREFIX("[dir]");
-                }
-                else {
-                    // lstat the previous backup's copy of the file and compare the mtimes
-                    int statResult = mylstat(localPrevFilename, &statData);
+            if (local)
+                for (auto &entry: localEntries)
+                    session.compare(entry.filename, entry.mtime, entry.mode, entry.size);
+            else
+                while (1) {
+                    string remoteFilename = client->ipcReadTo(NET_DELIM);
                     
-                    if (prevDir.length() && !statResult && statData.st_mtime == mtime) {
-                        
-                        /* check that hard links aren't maxed out against the configured limit.
-                         * if we're at the limit & the backup includes the Time field OR
-                         * if we're at the limit & the backup doesn't include Time & the new file doesn't exist
-                         * then we mark this as a dup.  i.e. one we have to copy instead of hardlink.
-                         */
-                        struct stat statData2;
-                        if ((statData.st_nlink >= maxLinksAllowed) &&
-                            ((!incTime && mylstat(localCurFilename, &statData2)) || incTime)) {
-                            duplicateList.insert(duplicateList.end(), pair<string, string>(localPrevFilename, localCurFilename));
-                            ++maxLinksReached;
-                            DEBUG(D_netproto) DFMTNOPREFIX("[matches, but links maxed]");
-                        }
-                        else {
-                            // if they match then add it to the appropriate list to be symlinked or hardlinked, depending
-                            // on whether its a symlink on the remote system
-                            if (S_ISLNK(mode)) {
-                                symLinkList.insert(symLinkList.end(), pair<string, string>(localPrevFilename, localCurFilename));
-                                DEBUG(D_netproto) DFMTNOPREFIX("[remote symlink]");
-                            }
-                            else {
-                                hardLinkList.insert(hardLinkList.end(), pair<string, string>(localPrevFilename, localCurFilename));
-                                DEBUG(D_netproto) DFMTNOPREFIX("[matches, can hardlink]");
-                            }
-                        }
-                    }
-                    else {
-                        // if the mtimes don't match or the file doesn't exist in the previous backup
-                        // add it to the list of ones we need the client to send in full
-                        fsTotalBytesNeeded += size;
-                        neededFiles.insert(neededFiles.end(), remoteFilename);
-                        modifiedFiles.insert(modifiedFiles.end(), remoteFilename);
-                        DEBUG(D_netproto) DFMTNOPREFIX("[" << (!prevDir.length() ? "no prev dir" : statResult < 0 ? "unable to stat " + localPrevFilename :
-                                                               string("mtime mismatch (") + to_string(statData.st_mtime) + "; " + to_string(mtime)) << "]");
+                    if (remoteFilename == NET_ABORT) {
+                        log(config.ifTitle() + " backup aborted by client");
+                        cleanupAndExitOnError();
                     }
+                    
+                    if (remoteFilename == NET_OVER)
+                        break;
+                    
+                    long mtime = client->ipcRead();
+                    long mode  = client->ipcRead();
+                    long size = client->ipcRead();
+                    session.compare(remoteFilename, mtime, mode, size);
                 }
-            }
             
-            NOTQUIET && ANIMATE && cout << progressPercentageA((int)totalFS, 7, completeFS, 1) << flush;
-            DEBUG(D_netproto) DFMT(fs << " server phase 1 complete; total:" << fileTotal << ", need:" << neededFiles.size()
-                                   << ", willLink:" << hardLinkList.size());
+            session.progress(1);
+            DEBUG(D_netproto) DFMT(fs << " server phase 1 complete; total:" << session.fileTotal << ", need:" << session.neededFiles.size()
+                                   << ", willLink:" << session.hardLinkList.size());
             
             
             /*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*
@@ -316,16 +713,24 @@ void fs_serverProcessing(PipeExec& client, BackupConfig& config, string prevDir,
              * because they've changed or are missing from the previous backup.
              * this includes every directory regardless of it changed.
              */
-            for (auto &file: neededFiles) {
-                //DEBUG(D_netproto) DFMT("server requesting " << file);
-                client.ipcWrite(string(file + NET_DELIM).c_str());
+            for (auto &file: session.neededFiles) {
+                if (!local)
+                    client->ipcWrite(string(file + NET_DELIM).c_str());
+                
+                if (session.hashFirst) {
+                    string digest = session.requestDigest(file);
+                    
+                    if (!local)
+                        client->ipcWrite(string(digest + NET_DELIM).c_str());
+                }
             }
             
             // tell the client we're done requesting and ready to listen to the replies
-            client.ipcWrite(NET_OVER_DELIM);
+            if (!local)
+                client->ipcWrite(NET_OVER_DELIM);
             
-            NOTQUIET && ANIMATE && cout << progressPercentageA((int)totalFS, 7, completeFS, 2) << flush;
-            DEBUG(D_netproto) DFMT(fs << " server phase 2 complete; told client we need " << neededFiles.size() << " of " << fileTotal);
+            session.progress(2);
+            DEBUG(D_netproto) DFMT(fs << " server phase 2 complete; told client we need " << session.neededFiles.size() << " of " << session.fileTotal);
             
             
             /*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*
@@ -333,295 +738,46 @@ void fs_serverProcessing(PipeExec& client, BackupConfig& config, string prevDir,
              * in the order we've requested in the format of 8 bytes each for uid, gid,
              * mode, mtime, size and then the data ('size' number of bytes).
              */
-            bool showDetail = NOTQUIET && ANIMATE && fsTotalBytesNeeded > 1000000;
+            bool showDetail = NOTQUIET && ANIMATE && session.fsTotalBytesNeeded > 1000000;
             string label = ": transferred ";
             auto backs = string(label.length(), '\b');
             auto blanks = string(label.length(), ' ');
             showDetail && cout << label;
             
-            bool ignoreTouch = str2bool(config.settings[sIgnoreTouch].value);
-            for (auto &file: neededFiles) {
-                auto currentFilename = slashConcat(currentDir, file);
-                auto [errorMsg, mode, mtime, size] = client.ipcReadToFile(currentFilename, !incTime);
-                fsBytesReceived += size;
-
-                if (S_ISDIR(mode))
-                    dirMtimes.insert(dirMtimes.end(), make_pair(currentFilename, mtime));
-                else
-                    if (ignoreTouch && !S_ISLNK(mode)) {
-                        string prevFilename = slashConcat(prevDir, file);
-                        
-                        struct stat statBuf;
-                        if (!mylstat(prevFilename, &statBuf))
-                            if (statBuf.st_size == size) {
-                                /* perform one last check.  if --ignoretouch is set then the user wants to consider 'touch' changes
-                                   (i.e. only the mtime has been updated, not the file contents) to be the same as no change.  that means
-                                    if only the mtime has changed then still hardlink it to the previous backup's copy.
-                                 
-                                   At this point we've verified:
-                                        - user wants ignoretouch
-                                        - file is not a dir or a symlink
-                                        - previousDir (previous backup) copy exists
-                                        - size of previous copy matches what was just sent over the wire by the client (though different mtime)
-                                   Now we do an expensive MD5 of both the previous copy and the new copy just sent by the client.  If
-                                   they match, we hardlink the file instead of keeping the new copy.
-                                */
-                                
-                                string md5A = MD5file(prevFilename, true);
-                                string md5B = MD5file(currentFilename, true);
-                                
-                                if (md5A.length() && md5A == md5B) {
-                                    DEBUG(D_netproto) DFMTNOPREFIX(file << " [ignoretouch match]");
-                                    unlink(currentFilename.c_str());
-                                    if (link(prevFilename.c_str(), currentFilename.c_str())) {
-                                        errorMsg = "error: unable to link " + currentFilename + " to " + prevFilename + " - " + strerror(errno);
-                                        mode = 0;
-                                    }
-                                }
-                            }
-                    }
-                
-                if (errorMsg.length()) {
-                    SCREENERR(fs << " " << errorMsg);
-                    log(config.ifTitle() + " " + fs + errorMsg);
+            for (auto &file: session.neededFiles) {
+                // hashfirst: the client already compared its copy to the previous backup's digest
+                // (or we do it here for a local source)
+                if (session.isTouchCandidate(file) &&
+                    (local ? MD5file(file, true) == session.touchDigest(file) : client->ipcRead() == NET_TOUCH_MATCH)) {
+                    session.linkTouched(file);
+                    showDetail && cout << progressPercentageB(session.fsTotalBytesNeeded, session.fsBytesReceived) << flush;
+                    continue;
                 }
                 
-                if (mode < 1)
-                    ++linkErrors;
-                else
-                    if (S_ISLNK(mode))
-                        ++receivedSymLinks;
-            
-                    showDetail && cout << progressPercentageB(fsTotalBytesNeeded, fsBytesReceived) << flush;
+                auto currentFilename = session.destination(file);
+                session.received(file, local ? fs_localCopyToFile(file, currentFilename, !session.incTime) :
+                                 client->ipcReadToFile(currentFilename, !session.incTime));
+                
+                showDetail && cout << progressPercentageB(session.fsTotalBytesNeeded, session.fsBytesReceived) << flush;
             }
             
             showDetail && cout << progressPercentageB((long)0, (long)0) << backs << blanks << backs << flush;
             
-            NOTQUIET && ANIMATE && cout << progressPercentageA((int)totalFS, 7, completeFS, 3) << flush;
-            DEBUG(D_netproto) DFMT(fs << " server phase 3 complete; received " << plural((int)neededFiles.size(), "file") + " from client");
+            session.progress(3);
+            DEBUG(D_netproto) DFMT(fs << " server phase 3 complete; received " << plural((int)session.neededFiles.size(), "file") + " from client");
             
             
             /*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*
-             * phase 4 - post-administrative work.
-             * create the hardlinks for everything that matches the previous backup,
-             * symlinks for everything that's a symlink on the remote server, copy
-             * files from the previous backup when maxLinks is reached, and set the
-             * mtime on all directories.
+             * phase 4 - post-administrative work (links, copies, symlinks & directory mtimes)
              */
+            session.finishFS();
             
-            /*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*
-             create hard links
-             *-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*/
-            for (auto &links: hardLinkList) {
-                mkbasedirs(links.second);
-                
-                // when Time isn't included we're potentially overwriting an existing backup. pre-delete
-                // so we don't get an error.
-                if (!incTime)
-                    unlink(links.second.c_str());
-                
-                if (link(links.first.c_str(), links.second.c_str()) < 0) {
-                    ++linkErrors;
-                    SCREENERR(fs << " error: unable to link " << links.second << " to " << links.first << " - " << strerror(errno));
-                    log(config.ifTitle() + " " + fs + " error: unable to link " + links.second + " to " + links.first + " - " + strerror(errno));
-                }
-            }
-            NOTQUIET && ANIMATE && cout << progressPercentageA((int)totalFS, 7, completeFS, 4) << flush;
-
-            /*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*
-             duplicate (copy) files for maxLinks
-             *-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*/
-            for (auto &dups: duplicateList) {
-                mkbasedirs(dups.second);
-                
-                if (!copyFile(dups.first, dups.second)) {
-                    ++linkErrors;
-                    SCREENERR(fs << " error: unable to copy (attempted due to maxed out links) " << dups.first << " to " << dups.second << " - " << strerror(errno));
-                    log(config.ifTitle() + " " + fs + " error: unable to copy (attempted due to maxed out links) " + dups.first + " to " + dups.second + " - " + strerror(errno));
-                }
-                else {
-                    struct stat statData;
-                    if (!mylstat(dups.first, &statData))
-                        setFilePerms(dups.second, statData, false);
-                }
-            }
-            NOTQUIET && ANIMATE && cout << progressPercentageA((int)totalFS, 7, completeFS, 5) << flush;
-
-            /*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*
-             create symlinks
-             *-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*/
-            char linkBuf[1000];
-            for (auto &links: symLinkList) {
-                mkbasedirs(links.second);
-                
-                // when Time isn't included we're potentially overwriting an existing backup. pre-delete
-                // so we don't get an error.
-                if (!incTime)
-                    unlink(links.second.c_str());
-                
-                auto bytes = readlink(links.first.c_str(), linkBuf, sizeof(linkBuf));
-                if (bytes >= 0 && bytes < sizeof(linkBuf)) {
-                    linkBuf[bytes] = 0;
-                    if (!symlink(linkBuf, links.second.c_str())) {
-                        if (!mylstat(links.first, &statData)) {
-                            if (lchown(links.second.c_str(), statData.st_uid, statData.st_gid)) {
-                                SCREENERR(fs << " error: unable to chown symlink " << links.second << ": " << strerror(errno));
-                                log(config.ifTitle() + " " + fs + " error: unable to chown symlink " + links.second + ": " + strerror(errno));
-                            }
-                            
-                            struct timeval tv[2];
-                            tv[0].tv_sec  = tv[1].tv_sec  = statData.st_mtime;
-                            tv[0].tv_usec = tv[1].tv_usec = 0;
-                            lutimes(links.second.c_str(), tv);
-                        }
-                    }
-                    else {
-                        ++linkErrors;
-                        SCREENERR(fs << " error: unable to symlink " << links.second << " to " << links.first << ": " << strerror(errno));
-                        log(config.ifTitle() + " " + fs + " error: unable to symlink " + links.second + " to " + links.first + ": " + strerror(errno));
-                    }
-                }
-                else {
-                    ++linkErrors;
-                    SCREENERR(fs << " error: unable to dereference symlink " << links.first << ": " << strerror(errno));
-                    log(config.ifTitle() + " " + fs + " error: unable to dereference symlink " + links.first + ": " + strerror(errno));
-                }
-                
-            }
-            NOTQUIET && ANIMATE && cout << progressPercentageA((int)totalFS, 7, completeFS, 6) << flush;
-
-            /*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*
-             set mtimes on all directories
-             *-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*-*/
-            struct utimbuf timeBuf;
-            for (auto &dirTime: dirMtimes) {
-                timeBuf.actime = timeBuf.modtime = dirTime.second;
-                if (utime(dirTime.first.c_str(), &timeBuf))
-                    SCREENERR(log(config.ifTitle() + " " + fs + ": error: unable to call utime() on " + dirTime.first + " - " + strerror(errno)));
-            }
-
-            NOTQUIET && ANIMATE && cout << progressPercentageA((int)totalFS, 7, completeFS, 7) << flush;
-            DEBUG(D_netproto) DFMT(fs << " server phase 4 complete; created " << plural(hardLinkList.size() - linkErrors, "link")  <<
-                                   " to previously backed up files" << (linkErrors ? string(" (" + plural(linkErrors, "error") + ")") : ""));
-            log(config.ifTitle() + " processed " + fs + ": " + plurali((int)fileTotal - checkpointTotal, "entr") + ", " +
-                plural(neededFiles.size(), "request") + ", " + plural(hardLinkList.size() - linkErrors, "hardlink") + ", " + plural(symLinkList.size(), "symlink"));
-            
-            filesModified += neededFiles.size();
-            filesHardLinked += hardLinkList.size();
-            filesSymLinked += symLinkList.size();
-            ++completeFS;
-            
-            fsTime.stop();
-            
-            // if it's been more than 5 minutes and no files are found (modified, unmodified, anything)
-            // then we have a timeout error - such as when the OS prompts for permission to read a
-            // protected directory but there's no user around to answer.  we have to finish the network
-            // conversation to let the client instance terminate, then we'll blow away the failed backup
-            // on the server side.
-            if (!neededFiles.size() && !hardLinkList.size() && !symLinkList.size() && fsTime.seconds() > 600)
-                abortBackupAtEnd = true;
-            
-        } while (client.ipcRead());
+        } while (local ? session.completeFS < totalFS : client->ipcRead());
 
-        // note finish time
-        backupTime.stop();
         NOTQUIET && ANIMATE && cout << progressPercentageA((int)0, (int)0) << backspaces << blankspaces << backspaces << flush;
         
-        if (abortBackupAtEnd) {
-            string errorDetail = config.ifTitle() + " backup aborted due to timeout on the faub client end";
-            log(errorDetail);
-            SCREENERR(errorDetail);
-            notify(config, "\t• " + errorDetail, false);
-            rmrf(currentDir);
-            return;
-        }
-        
-        // if time isn't included we may be about to overwrite a previous backup for this date
-        if (!incTime)
-            rmrf(originalCurrentDir);
-       
-        if (!filesModified && !filesHardLinked && !filesSymLinked) {
-            log(config.ifTitle() + " no files available to backup; backup aborted");
-            NOTQUIET && cout << "\t• " << config.ifTitle() << " no files to backup" << endl;
-            return;
-        }
-        
-        if (rename(string(currentDir).c_str(), originalCurrentDir.c_str())) {
-            string errorDetail = config.ifTitle() + " unable to rename " + currentDir + " to " + originalCurrentDir + ": " + strerror(errno);
-            log(errorDetail);
-            SCREENERR(errorDetail);
-            notify(config, "\t• " + errorDetail, false);
+        if (!session.finish())
             cleanupAndExitOnError();
-        }
-        
-        currentDir = originalCurrentDir;
-        GLOBALS.interruptFilename = currentDir;
-        
-        // add the backup to the cache, including running a dus()
-        config.fcache.recache(currentDir);
-        
-        // record which files changed in this backup
-        config.fcache.updateDiffFiles(currentDir, modifiedFiles);
-        
-        // we can pull these out to display
-        auto fcacheCurrent = config.fcache.getBackupByDir(currentDir);
-        auto backupSize = fcacheCurrent->second.ds.getSize();
-        auto backupSaved = fcacheCurrent->second.ds.getSaved();
-        
-        // and only need to update the remaining fields
-        fcacheCurrent->second.duration = backupTime.seconds();
-        fcacheCurrent->second.finishTime = time(NULL);
-        fcacheCurrent->second.modifiedFiles = filesModified - unmodDirs;
-        fcacheCurrent->second.unchangedFiles = filesHardLinked;
-        fcacheCurrent->second.dirs = unmodDirs;
-        fcacheCurrent->second.slinks = filesSymLinked + receivedSymLinks;
-
-        GLOBALS.interruptFilename = "";  // here we consider the backup complete; only notification & screen UI remain
-
-        string maxLinkMsg = maxLinksReached ? " [" + plural(maxLinksReached, "max link") + " reached]" : "";
-        string message1 = string("backup completed to ") + BOLDMAGENTA + currentDir + RESET + " in " + backupTime.elapsed();
-        string message2 = "(total: " +
-            to_string(fileTotal) + ", modified: " + to_string(filesModified - unmodDirs) + ", unmodified: " + to_string(filesHardLinked) + ", dirs: " +
-            to_string(unmodDirs) + ", symlinks: " + to_string(filesSymLinked + receivedSymLinks) +
-            (linkErrors ? ", linkErrors: " + to_string(linkErrors) : "") +
-            ", size: " + approximate(backupSize + backupSaved) + ", usage: " + approximate(backupSize) + maxLinkMsg + ")";
-
-        if (GLOBALS.cli.count(CLI_TAG)) {
-            string tag = GLOBALS.cli[CLI_TAG].as<string>();
-            GLOBALS.tags.tagBackup(tag, currentDir);
-            message1 += " [tagged " + tag;
-            
-            string hold = GLOBALS.tags.getTagsHoldTime(tag);
-                string holdText = config.fcache.holdBackup(hold, currentDir, true);
-                if (holdText.length())
-                    message1 += ", " + holdText + " hold";
-            
-            message1 += "]";
-        }
-        
-        if (GLOBALS.cli.count(CLI_HOLD)) {
-            string hold = config.fcache.holdBackup(GLOBALS.cli[CLI_HOLD].as<string>(), currentDir, true);
-            message1 += " [" + hold + " hold]";
-        }
-        
-        log(config.ifTitle() + " " + message1);
-        log(config.ifTitle() + " " + message2);
-        NOTQUIET && cout << "\t• " << config.ifTitle() << " " << message1 << "\n\t\t" << message2 << endl;
-        
-        if (config.settings[sBloat].value.length()) {
-            string bloat = config.settings[sBloat].value;
-            auto [target, average, detail] = config.getBloatTarget();
-            if (fcacheCurrent->second.ds.usedInBytes > target) {
-                string message = config.ifTitle() + " warning: backup is larger than the bloat threshold -\n" + detail + "\tbackup: " + approximate(fcacheCurrent->second.ds.usedInBytes);
-                log(message);
-                SCREENERR(message);
-                message += maxLinkMsg;
-                notify(config, "\t• " + message, false);
-                return;
-            }
-        }
-
-        notify(config, "\t• " + message1 + "\n\t\t" + message2 + "\n", true);
     }
     catch (MBException &e) {
         notify(config, "\t• " + config.ifTitle() + " Error (exception): " + e.detail(), false);
@@ -638,9 +794,72 @@ void fs_serverProcessing(PipeExec& client, BackupConfig& config, string prevDir,
 }
 
 
+/*
+ * fs_replicaReceive() - faub server
+ * The client is another backup server (fc_replicaSource()) offering us its backups.
+ * We tell it which dates we already have and it sends each newer backup, oldest
+ * first, as an ordinary faub session of that backup's contents.  Each replica is
+ * compared against the one before it, so unchanged files are hard linked locally
+ * and only the daily delta crosses the wire or takes up space.
+ */
+void fs_replicaReceive(IPC_Base *client, BackupConfig& config) {
+    Pcre idRE("^20\\d{2}-\\d{2}-\\d{2}(?:@\\d{2}:\\d{2}:\\d{2})?$");
+    map<string, string> replicas;
+
+    for (auto backupIt = config.fcache.getFirstBackup(); backupIt != config.fcache.getEnd(); ++backupIt) {
+        string id = backupDateId(backupIt->first);
+        if (id.length())
+            replicas[id] = backupIt->first;
+    }
+
+    client->ipcWrite((__int64_t)replicas.size());
+    for (auto &replica: replicas)
+        client->ipcWrite(string(replica.first + NET_DELIM).c_str());
+
+    auto total = client->ipcRead();
+    log(config.ifTitle() + " replica source has " + plural(total, "new backup"));
+    DEBUG(D_netproto) DFMT("replica source sending " << total << " backup(s); we have " << replicas.size());
+
+    string prevDir = replicas.size() ? replicas.rbegin()->second : "";
+
+    for (__int64_t count = 0; count < total; ++count) {
+        string id = client->ipcReadTo(NET_DELIM);
+        time_t finishTime = client->ipcRead();
+        unsigned long duration = client->ipcRead();
+
+        if (!idRE.search(id)) {
+            string errorDetail = config.ifTitle() + " replica source sent an invalid backup date (" + id + ")";
+            log(errorDetail);
+            SCREENERR(errorDetail);
+            notify(config, "\t• " + errorDetail, false);
+            cleanupAndExitOnError();
+        }
+
+        string currentDir = replicaBackupDir(config, id);
+        NOTQUIET && cout << "\t• " << config.ifTitle() << " replicating " << id << " (" << count + 1 << " of " << total << ")" << endl;
+        fs_serverProcessing(client, config, prevDir, currentDir);
+
+        // the replica takes on the original's timing so age, pruning & stats treat it as the same backup
+        auto replicaIt = config.fcache.getBackupByDir(currentDir);
+        if (replicaIt != config.fcache.getEnd()) {
+            replicaIt->second.finishTime = finishTime;
+            replicaIt->second.duration = duration;
+            replicaIt->second.updated = true;
+
+            struct utimbuf timeBuf;
+            timeBuf.actime = timeBuf.modtime = finishTime;
+            utime(currentDir.c_str(), &timeBuf);
+
+            prevDir = currentDir;
+        }
+    }
+}
+
+
 struct scanToServerDataType {
     size_t totalEntries;
-    IPC_Base *server;
+    vector<IPC_Base*> servers;
+    vector<localEntryType> *localEntries;
 };
 
 
@@ -648,34 +867,71 @@ bool scanToServerCallback(pdCallbackData &file) {
     scanToServerDataType *data = (scanToServerDataType*)file.dataPtr;
     
     data->totalEntries++;
-    data->server->ipcWrite(string(file.filename + NET_DELIM).c_str());
-    data->server->ipcWrite(file.statData.st_mtime);
-    data->server->ipcWrite(file.statData.st_mode);
-    data->server->ipcWrite(file.statData.st_size);
+    
+    if (data->localEntries != NULL) {
+        data->localEntries->insert(data->localEntries->end(), {file.filename, file.statData.st_mtime, file.statData.st_mode, file.statData.st_size});
+        return true;
+    }
+    
+    for (auto server: data->servers) {
+        server->ipcWrite(string(file.filename + NET_DELIM).c_str());
+        server->ipcWrite(file.statData.st_mtime);
+        server->ipcWrite(file.statData.st_mode);
+        server->ipcWrite(file.statData.st_size);
+    }
     DEBUG(D_netproto) DFMT("  client provided stats on " << file.filename);
     
     return true;
 }
 
 
+size_t fc_scan(BackupConfig& config, string entryName, scanToServerDataType& data) {
+    string clude = config.settings[sInclude].value.length() ? trimQuotes(config.settings[sInclude].value) : config.settings[sExclude].value.length() ? trimQuotes(config.settings[sExclude].value) : "";
+
+    entryName.erase(remove(entryName.begin(), entryName.end(), '\\'), entryName.end());
+    auto error = processDirectory(entryName, clude, config.settings[sExclude].value.length(), config.settings[sFilterDirs].value.length(), scanToServerCallback, &data, -1, true, false);
+    if (error.find("system call") != string::npos)
+        throw MBException(ABORTED_SYSTEM_CALL, error);  // this is most often MacOS timing out on a UI permission dialog box (e.g. access to desktop, etc)
+    
+    return data.totalEntries;
+}
+
+
 /*
  * fc_scanToServer() - faub client
  * Scan a filesystem, sending the filenames and their associated mtime's back
  * to the remote server. This is the client's side of phase 1.
  */
 size_t fc_scanToServer(BackupConfig& config, string entryName, IPC_Base& server) {
+    return fc_scanToServers(config, entryName, {&server});
+}
+
+
+/*
+ * fc_scanToServers() - faub client
+ * One scan sent to every server in a fan-out session.
+ */
+size_t fc_scanToServers(BackupConfig& config, string entryName, vector<IPC_Base*> servers) {
     scanToServerDataType data;
-    data.server = &server;
+    data.servers = servers;
+    data.localEntries = NULL;
     data.totalEntries = 0;
     
-    string clude = config.settings[sInclude].value.length() ? trimQuotes(config.settings[sInclude].value) : config.settings[sExclude].value.length() ? trimQuotes(config.settings[sExclude].value) : "";
+    return fc_scan(config, entryName, data);
+}
 
-    entryName.erase(remove(entryName.begin(), entryName.end(), '\\'), entryName.end());
-    auto error = processDirectory(entryName, clude, config.settings[sExclude].value.length(), config.settings[sFilterDirs].value.length(), scanToServerCallback, &data, -1, true, false);
-    if (error.find("system call") != string::npos)
-        throw MBException(ABORTED_SYSTEM_CALL, error);  // this is most often MacOS timing out on a UI permission dialog box (e.g. access to desktop, etc)
+
+/*
+ * fc_scanLocal()
+ * The same scan as fc_scanToServer() but collected into 'entries' for a
+ * server that's backing up a local source itself.
+ */
+size_t fc_scanLocal(BackupConfig& config, string entryName, vector<localEntryType>& entries) {
+    scanToServerDataType data;
+    data.localEntries = &entries;
+    data.totalEntries = 0;
     
-    return data.totalEntries;
+    return fc_scan(config, entryName, data);
 }
 
 /*
@@ -683,67 +939,161 @@ size_t fc_scanToServer(BackupConfig& config, string entryName, IPC_Base& server)
  * Receive a list of files from the server (client side of phase 2) and
  * send each file back to the server (client side of phase 3).
  */
-size_t fc_sendFilesToServer(IPC_Base& server) {
-    vector<string> neededFiles;
+size_t fc_sendFilesToServer(IPC_Base& server, bool hashFirst) {
+    vector<clientDestType> dests = { {&server, hashFirst} };
+    return fc_sendFilesToServers(dests);
+}
+
+
+/*
+ * fc_sendFilesToServers() - faub client
+ * fc_sendFilesToServer() for a fan-out session.  Each server's requests are merged
+ * so a file wanted by several of them is read (and hashed) only once.  Servers ask
+ * in sorted order and the merge keeps that order, so every server still receives
+ * exactly its own requests in the sequence it expects.
+ */
+size_t fc_sendFilesToServers(vector<clientDestType>& dests) {
+    map<string, vector<pair<size_t, string>>> neededFiles;
+    size_t totalRequests = 0;
     
-    while (1) {
-        string filename = server.ipcReadTo(NET_DELIM);
-        
-        if (filename == NET_OVER)
-            break;
+    for (size_t idx = 0; idx < dests.size(); ++idx) {
+        auto server = dests[idx].server;
         
-        DEBUG(D_netproto) DFMT("  client received request for " << filename);
-        neededFiles.insert(neededFiles.end(), filename);
+        try {
+            while (!server->failed()) {
+                string filename = server->ipcReadTo(NET_DELIM);
+                
+                if (filename == NET_OVER)
+                    break;
+                
+                // with hashfirst each request is followed by the digest of the server's previous copy
+                string digest = dests[idx].hashFirst ? server->ipcReadTo(NET_DELIM) : "";
+                
+                DEBUG(D_netproto) DFMT("  client received request for " << filename << (digest.length() ? " [" + digest + "]" : ""));
+                neededFiles[filename].insert(neededFiles[filename].end(), make_pair(idx, digest));
+                ++totalRequests;
+            }
+        }
+        catch (MBException &e) {
+            // in a fan-out session the others carry on without it (see fc_dropFailed())
+            if (dests.size() == 1)
+                throw;
+            
+            log("error: faub client unable to read requests from a server: " + e.detail());
+            server->setFailed();
+        }
     }
     
-    DEBUG(D_netproto) DFMT("client received requests for " << to_string(neededFiles.size()) << " file(s)");
+    DEBUG(D_netproto) DFMT("client received requests for " << to_string(neededFiles.size()) << " file(s)" <<
+                           (dests.size() > 1 ? " from " + to_string(dests.size()) + " servers" : ""));
     
+    size_t touchMatches = 0;
     for (auto &file: neededFiles) {
-        DEBUG(D_netproto) DFMT("  client sending " << file << " to server");
-        server.ipcSendDirEntry(file);
+        vector<IPC_Base*> senders;
+        string localDigest;
+        bool hashed = false;
+        
+        for (auto &request: file.second) {
+            auto server = dests[request.first].server;
+            
+            // a touched file whose content matches the server's copy costs a local read instead of a transfer
+            if (request.second.length()) {
+                if (!hashed) {
+                    struct stat statData;
+                    if (!mylstat(file.first, &statData) && S_ISREG(statData.st_mode))
+                        localDigest = MD5file(file.first, true);
+                    hashed = true;
+                }
+                
+                if (localDigest.length() && localDigest == request.second) {
+                    DEBUG(D_netproto) DFMT("  client matched digest for " << file.first);
+                    server->ipcWrite((__int64_t)NET_TOUCH_MATCH);
+                    ++touchMatches;
+                    continue;
+                }
+                
+                server->ipcWrite((__int64_t)NET_TOUCH_SEND);
+            }
+            
+            senders.insert(senders.end(), server);
+        }
+        
+        if (senders.size()) {
+            DEBUG(D_netproto) DFMT("  client sending " << file.first << " to " << plural(senders.size(), "server"));
+            IPC_Base::ipcSendDirEntry(file.first, senders);
+        }
     }
+    
+    if (touchMatches)
+        log("faub_client skipped " + plural(touchMatches, "touched file") + " with matching content");
 
-    return neededFiles.size();
+    return totalRequests;
 }
 
 
-void fc_mainEngine(BackupConfig& config, vector<string> origPaths) {
-    IPC_Base server(0, 1, 60);  // use stdin and stdout
+/*
+ * fc_dropFailed() - faub client
+ * Take any server whose connection has failed out of the session.  In a fan-out
+ * session the rest carry on without it; once none are left there's nothing more
+ * to do.
+ */
+void fc_dropFailed(vector<clientDestType>& dests, vector<IPC_Base*>& servers) {
+    auto before = dests.size();
+    
+    dests.erase(remove_if(dests.begin(), dests.end(), [](clientDestType& dest) { return dest.server->failed(); }), dests.end());
+    if (dests.size() == before)
+        return;
+    
+    servers.clear();
+    for (auto &dest: dests)
+        servers.insert(servers.end(), dest.server);
+    
+    if (!dests.size())
+        throw MBException("lost the connection to the server");
+    
+    log("error: faub client dropped " + plural(before - dests.size(), "server") + " with a failed connection; continuing with " +
+        to_string(dests.size()));
+}
+
+
+/*
+ * fc_clientSession() - faub client
+ * Run the client's side of the protocol for 'paths' over an established
+ * connection to the server (stdin/stdout or a faub agent's socket).
+ */
+void fc_clientSession(BackupConfig& config, vector<string> paths, IPC_Base& server, bool hashFirst) {
+    vector<clientDestType> dests = { {&server, hashFirst} };
+    fc_clientSession(config, paths, dests);
+}
+
 
+/*
+ * fc_clientSession() - faub client
+ * The same for any number of servers at once (fan-out).  The scan and the reading
+ * of each file happen once no matter how many servers are being fed.
+ */
+void fc_clientSession(BackupConfig& config, vector<string> paths, vector<clientDestType>& dests) {
+    vector<IPC_Base*> servers;
+    for (auto &dest: dests) {
+        dest.server->setLimiter(&GLOBALS.netLimit);
+        dest.server->setSoftFail(dests.size() > 1);
+        servers.insert(servers.end(), dest.server);
+    }
+    
     try {
-        vector<string> paths;
-        
-        // the vector of paths that come into the function can be from the profile (conf file).
-        // each item could be a quoted list of multiple sub paths.  so we have to break it down
-        // a second time.
-        for (auto &p : origPaths) {
-            auto dirVec = string2vectorOnSpace(p, true, true);
-            
-            for (auto &d : dirVec) {
-                auto fileVec = expandWildcardFilespec(d);
-                paths.insert(paths.end(), fileVec.begin(), fileVec.end());
+        DEBUG(D_faub) DFMT("faub client starting with " << paths.size() << " request(s)" <<
+                           (dests.size() > 1 ? " for " + to_string(dests.size()) + " servers" : ""));
+
+        for (auto &dest: dests) {
+            if (dest.hashFirst) {
+                dest.server->ipcWrite(NET_CAPS);
+                dest.server->ipcWrite((__int64_t)NET_CAP_HASHFIRST);
             }
-        }
-        
-        if (GLOBALS.cli.count(CLI_TEST)) {
-            cout << YELLOW << config.ifTitle() << " TESTMODE: faub client would have scanned " << plural(paths.size(), "path") << ":";
-            for (auto it = paths.begin(); it != paths.end(); ++it)
-                cout << endl << "\t• " << *it;
             
-            if (config.settings[sInclude].value.length())
-                cout << endl << "including only files that match [" << config.settings[sInclude].value << "]";
-            else
-                if (config.settings[sExclude].value.length())
-                    cout << endl << "excluding files that match [" << config.settings[sExclude].value << "]";
-            
-            cout << RESET << endl;
-            return;
+            // tell server the number of filesystems we're going to process
+            dest.server->ipcWrite((__int64_t)paths.size());
         }
-        
-        DEBUG(D_faub) DFMT("faub client starting with " << paths.size() << " request(s)");
-
-        // tell server the number of filesystems we're going to process
-        server.ipcWrite((__int64_t)paths.size());
+        fc_dropFailed(dests, servers);
 
         for (auto it = paths.begin(); it != paths.end(); ++it) {
             timer clientTime;
@@ -751,18 +1101,27 @@ void fc_mainEngine(BackupConfig& config, vector<string> origPaths) {
             
             DEBUG(D_faub) DFMT("faub client looping on path " << *it);
             
-            server.ipcWrite(string(*it + NET_DELIM).c_str());
-            auto entries = fc_scanToServer(config, *it, server);
+            for (auto server: servers)
+                server->ipcWrite(string(*it + NET_DELIM).c_str());
+            
+            auto entries = fc_scanToServers(config, *it, servers);
                 
-            server.ipcWrite(NET_OVER_DELIM);
-            auto requests = fc_sendFilesToServer(server);
+            for (auto server: servers)
+                server->ipcWrite(NET_OVER_DELIM);
+            fc_dropFailed(dests, servers);
+            
+            auto requests = fc_sendFilesToServers(dests);
+            fc_dropFailed(dests, servers);
 
             clientTime.stop();
             log("faub_client request for " + *it + " served " + plurali(entries, "entr") +
-                ", " + plural(requests, "request") + " in " + clientTime.elapsed());
+                ", " + plural(requests, "request") + (dests.size() > 1 ? " to " + to_string(dests.size()) + " servers" : "") +
+                " in " + clientTime.elapsed());
 
             __int64_t end = (it+1) != paths.end();
-            server.ipcWrite(end);
+            for (auto server: servers)
+                server->ipcWrite(end);
+            fc_dropFailed(dests, servers);
         }
         
         DEBUG(D_netproto) DFMT("client complete.");
@@ -773,7 +1132,8 @@ void fc_mainEngine(BackupConfig& config, vector<string> origPaths) {
     }
     catch (MBException &e) {
         if (e.detail() == ABORTED_SYSTEM_CALL) {
-            server.ipcWrite(NET_ABORT);
+            for (auto server: servers)
+                server->ipcWrite(NET_ABORT);
             log("client aborting on " + e.getData());
         }
         
@@ -785,3 +1145,407 @@ void fc_mainEngine(BackupConfig& config, vector<string> origPaths) {
         log("error: faub client caught unknown exception");
     }
 }
+
+
+void fc_mainEngine(BackupConfig& config, vector<string> origPaths) {
+    IPC_Base server(0, 1, 60);  // use stdin and stdout
+    auto paths = fc_expandPaths(origPaths);
+    
+    if (GLOBALS.cli.count(CLI_TEST)) {
+        cout << YELLOW << config.ifTitle() << " TESTMODE: faub client would have scanned " << plural(paths.size(), "path") << ":";
+        for (auto it = paths.begin(); it != paths.end(); ++it)
+            cout << endl << "\t• " << *it;
+        
+        if (config.settings[sInclude].value.length())
+            cout << endl << "including only files that match [" << config.settings[sInclude].value << "]";
+        else
+            if (config.settings[sExclude].value.length())
+                cout << endl << "excluding files that match [" << config.settings[sExclude].value << "]";
+        
+        cout << RESET << endl;
+        return;
+    }
+    
+    // the server adds --ignoretouch when it wants digests compared before transfer
+    bool hashFirst = GLOBALS.cli.count(CLI_IGNORETOUCH) && GLOBALS.cli[CLI_IGNORETOUCH].as<bool>();
+    fc_clientSession(config, paths, server, hashFirst);
+}
+
+
+/*
+ * fc_agentPathAllowed()
+ * A faub agent only serves paths at or beneath the ones it was started with.
+ */
+bool fc_agentPathAllowed(string path, vector<string>& allowedPaths) {
+    string real = realpathcpp(path);
+    
+    if (!real.length())
+        return false;
+    
+    for (auto &allowed: allowedPaths) {
+        string realAllowed = realpathcpp(allowed);
+        
+        if (realAllowed.length() && (real == realAllowed || realAllowed == "/" || real.find(realAllowed + "/") == 0))
+            return true;
+    }
+    
+    return false;
+}
+
+
+/*
+ * fc_fanoutGroup() - faub agent
+ * When the agent runs with --fanout, servers asking for the same backup (paths and
+ * include/exclude) share one session.  The first to arrive leads: it waits on a unix
+ * socket in the cache directory for the others, which hand it their connections and
+ * are done.  Returns the leader's servers (its own first) or none if this server was
+ * handed to a leader.  Grouping is best effort; a server that can't join a group is
+ * simply served on its own.  Leading takes a lock on a file beside the socket so two
+ * agent processes arriving together can't both start a group on the same socket.
+ */
+vector<clientDestType> fc_fanoutGroup(string key, IPC_Base& server, bool hashFirst, vector<TCP_Socket*>& followers) {
+    size_t members = GLOBALS.cli[CLI_FANOUT].as<int>();   // > 1, checked by the caller
+    int waitSecs = GLOBALS.cli.count(CLI_FANOUTWAIT) ? GLOBALS.cli[CLI_FANOUTWAIT].as<int>() : FAUB_FANOUT_WAIT;
+    string rendezvous = slashConcat(GLOBALS.cacheDir, "fanout-" + key + ".sock");
+    vector<clientDestType> dests = { {&server, hashFirst} };
+    int lockFd = -1;
+    
+    for (int attempt = 0; attempt < 10; ++attempt) {
+        // join a group that's already forming
+        try {
+            TCP_Socket leader(rendezvous, 0, FAUB_AGENT_TIMEOUT);
+            
+            if (leader.sendFd(server.descriptor(), hashFirst) && leader.ipcRead() == 1)
+                return {};
+        }
+        catch (MBException &e) {
+            DEBUG(D_netproto) DFMT("no fan-out group to join (" << e.detail() << ")");
+        }
+        
+        // or lead one, unless another agent process is just starting to
+        lockFd = open((rendezvous + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (lockFd < 0) {
+            log("error: faub agent unable to open fan-out lock " + rendezvous + ".lock" + errtext());
+            return dests;
+        }
+        
+        if (!flock(lockFd, LOCK_EX | LOCK_NB))
+            break;
+        
+        close(lockFd);
+        lockFd = -1;
+        usleep(100000);
+    }
+    
+    if (lockFd < 0)
+        return dests;
+    
+    // start one
+    try {
+        TCP_Socket group(rendezvous, 0, members, 0);
+        
+        time_t deadline = time(NULL) + waitSecs;
+        while (dests.size() < members && time(NULL) < deadline) {
+            if (simpleSelect(group.descriptor(), -1, (int)(deadline - time(NULL))) < 1)
+                break;
+            
+            TCP_Socket member(group.accept(), FAUB_AGENT_TIMEOUT);
+            __int64_t memberHashFirst;
+            int fd = member.receiveFd(memberHashFirst);
+            
+            if (fd >= 0) {
+                followers.insert(followers.end(), new TCP_Socket(fd, FAUB_FANOUT_TIMEOUT));
+                dests.insert(dests.end(), {followers.back(), memberHashFirst != 0});
+                member.ipcWrite((__int64_t)1);
+            }
+        }
+        
+        // stop taking members while still listening (and still holding the lock, so no
+        // new group can take the socket's name first); anyone already queued sees us
+        // close without an acknowledgement and serves their server on their own.
+        unlink(rendezvous.c_str());
+    }
+    catch (MBException &e) {
+        log("error: faub agent unable to form fan-out group: " + e.detail());
+    }
+    
+    close(lockFd);
+    return dests;
+}
+
+
+/*
+ * fc_agentSession() - faub agent
+ * Authenticate a server that has connected to the agent, read what it wants
+ * backed up and then run a normal client session over the connection.
+ */
+void fc_agentSession(BackupConfig& config, IPC_Base& server, string key, vector<string>& allowedPaths) {
+    try {
+        // a peer that never finishes the handshake shouldn't tie up this process
+        alarm(FAUB_AGENT_TIMEOUT);
+        
+        string agentNonce = randomHex(16);
+        server.ipcWrite(NET_AGENT_HELLO);
+        server.ipcWrite(string(agentNonce + NET_DELIM).c_str());
+        
+        string response = server.ipcReadTo(NET_DELIM);
+        string serverNonce = server.ipcReadTo(NET_DELIM);
+        
+        if (!agentNonce.length() || !serverNonce.length() || !secureEquals(response, HMACsha256(key, "server:" + agentNonce))) {
+            server.ipcWrite(NET_ABORT NET_DELIM);
+            log("faub agent rejected a connection that failed authentication");
+            return;
+        }
+        
+        server.ipcWrite(string(HMACsha256(key, "agent:" + serverNonce) + NET_DELIM).c_str());
+        
+        auto flags = server.ipcRead();
+        string clude = server.ipcReadTo(NET_DELIM);
+        string title = server.ipcReadTo(NET_DELIM);
+        auto count = server.ipcRead();
+        
+        vector<string> requested;
+        for (__int64_t i = 0; i < count && i < 10000; ++i)
+            requested.insert(requested.end(), server.ipcReadTo(NET_DELIM));
+        
+        alarm(0);
+        
+        // no paths in the request means everything this agent serves
+        auto paths = requested.size() ? fc_expandPaths(requested) : allowedPaths;
+        string error = paths.size() ? "" : "no paths to backup";
+        
+        for (auto &path: paths)
+            if (!fc_agentPathAllowed(path, allowedPaths)) {
+                error = path + " is not served by this agent";
+                break;
+            }
+        
+        server.ipcWrite(string(error + NET_DELIM).c_str());
+        if (error.length()) {
+            log("faub agent refused session for " + (title.length() ? title : "server") + ": " + error);
+            return;
+        }
+        
+        // an include/exclude from the server overrides our own, as it would on the command line
+        if (clude.length()) {
+            config.settings[sInclude].value = flags & NET_AGENT_EXCLUDE ? "" : clude;
+            config.settings[sExclude].value = flags & NET_AGENT_EXCLUDE ? clude : "";
+        }
+        
+        bool hashFirst = flags & NET_AGENT_IGNORETOUCH;
+        vector<clientDestType> dests = { {&server, hashFirst} };
+        vector<TCP_Socket*> followers;
+        
+        if (GLOBALS.cli.count(CLI_FANOUT) && GLOBALS.cli[CLI_FANOUT].as<int>() > 1) {
+            dests = fc_fanoutGroup(MD5string(perlJoin("\n", paths) + "\n" + to_string(flags & NET_AGENT_EXCLUDE) + clude), server, hashFirst, followers);
+            
+            if (!dests.size()) {
+                log("faub agent handed " + (title.length() ? "[" + title + "]" : "a server") + " to its fan-out group");
+                return;
+            }
+        }
+        
+        // tell each server how many are fed by this session. fanned-out servers
+        // wait on each other so they all allow for longer gaps.
+        for (auto &dest: dests)
+            dest.server->ipcWrite(string(to_string(dests.size()) + NET_DELIM).c_str());
+        
+        // a server that goes away shows up as a failed write, which drops it alone (see fc_dropFailed())
+        if (dests.size() > 1) {
+            server.setTimeout(FAUB_FANOUT_TIMEOUT);
+            signal(SIGPIPE, SIG_IGN);
+        }
+        
+        log("faub agent serving " + (title.length() ? "[" + title + "] " : "") + plural(paths.size(), "path") +
+            (dests.size() > 1 ? " to " + to_string(dests.size()) + " servers" : ""));
+        fc_clientSession(config, paths, dests);
+        
+        for (auto follower: followers)
+            delete follower;
+    }
+    catch (MBException &e) {
+        log("error: faub agent session: " + e.detail());
+    }
+}
+
+
+/*
+ * fc_agent() - faub agent
+ * Listen on 'address' (see agentAddress()) and serve any number of faub sessions,
+ * each in its own process, in place of the server executing a faub command.
+ */
+void fc_agent(BackupConfig& config, string address, vector<string> origPaths) {
+    string host;
+    int port;
+    string error;
+    
+    if (!agentAddress(address, host, port)) {
+        SCREENERR("error: invalid --" << CLI_LISTEN << " address \"" << address << "\"");
+        exit(1);
+    }
+    
+    /* sessions are authenticated but not encrypted, so the agent only listens where the
+     * network can't see it (a tunnel such as ssh -L can carry it from there) unless the
+     * user says otherwise */
+    if (!agentLoopback(host) && !GLOBALS.cli.count(CLI_UNENCRYPTED)) {
+        SCREENERR("error: faub agent sessions aren't encrypted; --" << CLI_LISTEN << " only accepts a unix socket or loopback "
+                  << "address unless --" << CLI_UNENCRYPTED << " is given");
+        exit(1);
+    }
+    
+    string key = agentKey(config.settings[sAgentKey].value, error);
+    if (!key.length()) {
+        SCREENERR("error: faub agent requires a key - " << error);
+        exit(1);
+    }
+    
+    auto allowedPaths = fc_expandPaths(origPaths);
+    if (!allowedPaths.size()) {
+        SCREENERR("error: --" << CLI_LISTEN << " requires at least one --" << CLI_PATHS << " to serve");
+        exit(1);
+    }
+    
+    if (GLOBALS.cli.count(CLI_TEST)) {
+        cout << YELLOW << config.ifTitle() << " TESTMODE: faub agent would have listened on " << address << " serving " << perlJoin(", ", allowedPaths) << RESET << endl;
+        return;
+    }
+    
+    try {
+        TCP_Socket listener(host, port, 20, 0);
+        signal(SIGCHLD, SIG_IGN);   // sessions reap themselves
+        
+        log("faub agent listening on " + address + " for " + perlJoin(", ", allowedPaths));
+        NOTQUIET && cout << "faub agent listening on " << address << endl;
+        
+        while (1) {
+            int fd;
+            
+            try {
+                fd = listener.accept();
+            }
+            catch (MBException &e) {
+                log("error: faub agent: " + e.detail());
+                sleep(1);
+                continue;
+            }
+            
+            auto pid = fork();
+            
+            if (pid < 0) {
+                log("error: faub agent unable to fork" + errtext());
+                close(fd);
+                continue;
+            }
+            
+            if (!pid) {
+                signal(SIGCHLD, SIG_DFL);
+                listener.ipcClose();
+                GLOBALS.pid = getpid();
+                
+                TCP_Socket server(fd, FAUB_AGENT_TIMEOUT);
+                fc_agentSession(config, server, key, allowedPaths);
+                server.ipcClose();
+                exit(0);
+            }
+            
+            close(fd);
+        }
+    }
+    catch (MBException &e) {
+        SCREENERR("error: faub agent: " << e.detail());
+        log("error: faub agent: " + e.detail());
+        exit(1);
+    }
+}
+
+
+/*
+ * fc_replicaSource() - faub client
+ * Serve this profile's own backups over stdin/stdout to another backup server
+ * (fs_replicaReceive()).  Each backup the replica doesn't have yet is sent in date
+ * order with its paths relative to the backup's directory, so the replica ends up
+ * with the same tree its original has.
+ */
+void fc_replicaSource(BackupConfig& config) {
+    IPC_Base server(0, 1, 60);  // use stdin and stdout
+    bool hashFirst = GLOBALS.cli.count(CLI_IGNORETOUCH) && GLOBALS.cli[CLI_IGNORETOUCH].as<bool>();
+
+    struct replicaBackupType {
+        string dir;
+        time_t finishTime;
+        unsigned long duration;
+    };
+
+    // our backups by date, oldest first
+    map<string, replicaBackupType> backups;
+    for (auto backupIt = config.fcache.getFirstBackup(); backupIt != config.fcache.getEnd(); ++backupIt) {
+        string id = backupDateId(backupIt->first);
+        if (id.length())
+            backups[id] = {backupIt->first, backupIt->second.finishTime, backupIt->second.duration};
+    }
+
+    // a backup is replicated exactly as stored; the profile's include/exclude applied when it was made
+    config.settings[sInclude].value = "";
+    config.settings[sExclude].value = "";
+    config.settings[sFilterDirs].value = "";
+
+    try {
+        server.ipcWrite(NET_CAPS);
+        server.ipcWrite((__int64_t)NET_CAP_REPLICA);
+        server.ipcWrite((__int64_t)0);
+
+        set<string> theirs;
+        for (auto count = server.ipcRead(); count > 0; --count)
+            theirs.insert(server.ipcReadTo(NET_DELIM));
+
+        // anything older than the replica's newest has either been sent before or
+        // pruned by the replica since; neither needs sending again
+        string newest = theirs.size() ? *theirs.rbegin() : "";
+        vector<pair<string, vector<string>>> toSend;
+
+        for (auto &backup: backups) {
+            if (backup.first <= newest)
+                continue;
+
+            vector<string> entries;
+            DIR *dir = opendir(backup.second.dir.c_str());
+            if (dir == NULL) {
+                log("error: replica source unable to read " + backup.second.dir + errtext());
+                continue;
+            }
+
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != NULL)
+                if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+                    entries.insert(entries.end(), entry->d_name);
+            closedir(dir);
+
+            if (entries.size()) {
+                sort(entries.begin(), entries.end());
+                toSend.insert(toSend.end(), make_pair(backup.first, entries));
+            }
+        }
+
+        log(config.ifTitle() + " replica source sending " + plural(toSend.size(), "backup"));
+        server.ipcWrite((__int64_t)toSend.size());
+
+        for (auto &backup: toSend) {
+            auto &detail = backups[backup.first];
+
+            server.ipcWrite(string(backup.first + NET_DELIM).c_str());
+            server.ipcWrite((__int64_t)detail.finishTime);
+            server.ipcWrite((__int64_t)detail.duration);
+
+            // scanning from inside the backup yields paths relative to it
+            if (chdir(detail.dir.c_str()))
+                throw MBException("unable to chdir to " + detail.dir + errtext());
+
+            DEBUG(D_faub) DFMT("replica source sending " << detail.dir);
+            fc_clientSession(config, backup.second, server, hashFirst);
+        }
+    }
+    catch (MBException &e) {
+        cerr << "replica source caught exception: " << e.detail() << endl;
+        log("error: replica source caught exception: " + e.detail());
+    }
+}
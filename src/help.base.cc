@@ -35,6 +35,8 @@ void showHelp(enum helpType kind) {
             + "   --gid [gid]         chgrp newly created backups to this numeric GID.\n"
             + "   --minsize [size]    Single-file backups less than this size are considered failures and discarded.\n"
             + "   --minspace [size]   Minimum local free space required before taking a backup\n"          
+            + "   --bwlimit [rate]    Limit network transfers (faub, SCP, SFTP) to rate per second; e.g. 2M@08-18,20M.\n"
+            + "   --iolimit [rate]    Limit local disk reads & writes to rate per second; same format as --bwlimit.\n"
             + "   --scp [dest]        SCP the new backup to the destination. Dest can include user@machine:/dir/dirs.\n"
             + "   --sftp [dest]       SFTP the new backup to the destination. Dest can include SCP details plus SFTP flags (like -P for port).\n"
             + "                       SCP & SFTP also support variable interpolation of these strings which will be sustituted with values\n"
@@ -43,6 +45,12 @@ void showHelp(enum helpType kind) {
             + string(BOLDBLUE) + "EXECUTE A BACKUP (faub-style)" + string(RESET) + "\n"
             + "   --faub [command]    Command to take a faub-style backup; managebackups will be required on the remote server as well.\n"
             + "   -s, --path [string] Remote end directories to backup.  See 'FAUB-STYLE BACKUPS' in the man page.\n"
+            + "   --agent [address]   Use the faub agent at address (host:port or socket path) instead of executing --faub\n"
+            + "   --agentkey [file]   Pre-shared key file for authenticating with a faub agent\n"
+            + "   --listen [address]  Run as a faub agent serving --path to servers on address (host:port or socket path)\n"
+            + "   --unencrypted       Let --listen use a network address; agent sessions aren't encrypted\n"
+            + "   --fanout [x]        With --listen, feed up to x servers backing up the same paths from one scan\n"
+            + "   --replicasource     Serve this profile's backups to a replica server (as its --faub command)\n"
             + "   --replicateto [des] Replicate the latest backup to des (local, overwrite).\n\n"
             + string(BOLDBLUE) + "EXECUTE A BACKUP (both)" + string(RESET) + "\n"
             + "   --directory [dir]   Directory to save to and look for backups in\n"
@@ -68,6 +76,7 @@ void showHelp(enum helpType kind) {
             + "   --fp                FAILSAFE: Paranoid mode; sets --fs_backups 1 --fs_days 2 --fs_limit 2\n"
             + "\n" + string(BOLDBLUE) + "HARD LINKING\n" + RESET
             + "   -l, --maxlinks [x]  Max number of links to a file (default 200).\n"
+            + "   --digest [name]     Content digest for linking: md5 (default) or blake3\n"
             + "\n" + string(BOLDBLUE) + "GENERAL\n" + RESET
             + "   -p, --profile [p]   Use the specified profile for the current run; can be a partial name\n"
             + "   --save              Save all the specified settings to the specified profile.\n"
@@ -78,12 +87,16 @@ void showHelp(enum helpType kind) {
             + "   --threshold [x]     Specify the --compare size threshold via unit suffix or percentage (defaults to 0)\n\n"
             + "   -a, --all           Execute all profiles sequentially\n"
             + "   -A, --All           Execute all profiles in parallel\n"
+            + "   --maxparallel [x]   Limit --All/--Cron to x profiles running at a time\n"
+            + "   --multiplex         Receive all faub profiles in one process; alone or with -a/-A/-k/-K\n"
             + "   -k, --cron          Execute all profiles sequentially for cron (equivalent to '-a -x -q')\n"
             + "   -K, --Cron          Execute all profiles in parallel for cron (equivalent to '-A -x -q')\n\n"
             + "   -0                  Provide a summary of backups; can be combined with -p to limit output\n"
             + "   -1                  Provide detail of backups; can be combined with -p to limit output\n\n"
             + "   --relocate [newDir] Move all backups to a new directory; use with -p\n"
             + "   --recalc            Recalculate disk usage for all backups; use with -p\n"
+            + "   --threads [num]     Number of backups to walk or MD5 at once (default: one per CPU)\n"
+            + "   --verifystats       Check the disk usage tallied by a faub backup against a full walk of it\n"
             + "   --install           Install this binary in /usr/local/bin, update directory perms and create the man page\n"
             + "   --installsuid       Install this binary in /usr/local/bin with SUID to run as root; create the man page\n"
             + "   --installman        Only create and install the man page\n\n"
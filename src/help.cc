@@ -35,6 +35,8 @@ void showHelp(enum helpType kind) {
             + "   --gid [gid]         chgrp newly created backups to this numeric GID.\n"
             + "   --minsize [size]    Single-file backups less than this size are considered failures and discarded.\n"
             + "   --minspace [size]   Minimum local free space required before taking a backup\n"          
+            + "   --bwlimit [rate]    Limit network transfers (faub, SCP, SFTP) to rate per second; e.g. 2M@08-18,20M.\n"
+            + "   --iolimit [rate]    Limit local disk reads & writes to rate per second; same format as --bwlimit.\n"
             + "   --scp [dest]        SCP the new backup to the destination. Dest can include user@machine:/dir/dirs.\n"
             + "   --sftp [dest]       SFTP the new backup to the destination. Dest can include SCP details plus SFTP flags (like -P for port).\n"
             + "                       SCP & SFTP also support variable interpolation of these strings which will be sustituted with values\n"
@@ -43,6 +45,12 @@ void showHelp(enum helpType kind) {
             + string(BOLDBLUE) + "EXECUTE A BACKUP (faub-style)" + string(RESET) + "\n"
             + "   --faub [command]    Command to take a faub-style backup; managebackups will be required on the remote server as well.\n"
             + "   -s, --path [string] Remote end directories to backup.  See 'FAUB-STYLE BACKUPS' in the man page.\n"
+            + "   --agent [address]   Use the faub agent at address (host:port or socket path) instead of executing --faub\n"
+            + "   --agentkey [file]   Pre-shared key file for authenticating with a faub agent\n"
+            + "   --listen [address]  Run as a faub agent serving --path to servers on address (host:port or socket path)\n"
+            + "   --unencrypted       Let --listen use a network address; agent sessions aren't encrypted\n"
+            + "   --fanout [x]        With --listen, feed up to x servers backing up the same paths from one scan\n"
+            + "   --replicasource     Serve this profile's backups to a replica server (as its --faub command)\n"
             + "   --replicateto [des] Replicate the latest backup to des (local, overwrite).\n\n"
             + string(BOLDBLUE) + "EXECUTE A BACKUP (both)" + string(RESET) + "\n"
             + "   --directory [dir]   Directory to save to and look for backups in\n"
@@ -68,6 +76,7 @@ void showHelp(enum helpType kind) {
             + "   --fp                FAILSAFE: Paranoid mode; sets --fs_backups 1 --fs_days 2 --fs_limit 2\n"
             + "\n" + string(BOLDBLUE) + "HARD LINKING\n" + RESET
             + "   -l, --maxlinks [x]  Max number of links to a file (default 200).\n"
+            + "   --digest [name]     Content digest for linking: md5 (default) or blake3\n"
             + "\n" + string(BOLDBLUE) + "GENERAL\n" + RESET
             + "   -p, --profile [p]   Use the specified profile for the current run; can be a partial name\n"
             + "   --save              Save all the specified settings to the specified profile.\n"
@@ -78,12 +87,16 @@ void showHelp(enum helpType kind) {
             + "   --threshold [x]     Specify the --compare size threshold via unit suffix or percentage (defaults to 0)\n\n"
             + "   -a, --all           Execute all profiles sequentially\n"
             + "   -A, --All           Execute all profiles in parallel\n"
+            + "   --maxparallel [x]   Limit --All/--Cron to x profiles running at a time\n"
+            + "   --multiplex         Receive all faub profiles in one process; alone or with -a/-A/-k/-K\n"
             + "   -k, --cron          Execute all profiles sequentially for cron (equivalent to '-a -x -q')\n"
             + "   -K, --Cron          Execute all profiles in parallel for cron (equivalent to '-A -x -q')\n\n"
             + "   -0                  Provide a summary of backups; can be combined with -p to limit output\n"
             + "   -1                  Provide detail of backups; can be combined with -p to limit output\n\n"
             + "   --relocate [newDir] Move all backups to a new directory; use with -p\n"
             + "   --recalc            Recalculate disk usage for all backups; use with -p\n"
+            + "   --threads [num]     Number of backups to walk or MD5 at once (default: one per CPU)\n"
+            + "   --verifystats       Check the disk usage tallied by a faub backup against a full walk of it\n"
             + "   --install           Install this binary in /usr/local/bin, update directory perms and create the man page\n"
             + "   --installsuid       Install this binary in /usr/local/bin with SUID to run as root; create the man page\n"
             + "   --installman        Only create and install the man page\n\n"
@@ -350,6 +363,32 @@ Equivalent to \[lq]-a -x -q\[rq].
 Parallel cron execution.
 Equivalent to \[lq]-A -x -q\[rq].
 .TP
+\f[B]\[en]maxparallel\f[R] [\f[I]x\f[R]]
+Limit \f[B]\[en]All\f[R] and \f[B]\[en]Cron\f[R] to \f[I]x\f[R]
+profiles running at a time.
+The remaining profiles are started as earlier ones finish, which keeps a
+server with a large number of (typically small) faub clients from
+running a process and connection for every one of them at once.
+Defaults to no limit.
+With \f[B]\[en]multiplex\f[R] it also limits how many faub backups the
+multiplexed process receives at once.
+.TP
+\f[B]\[en]multiplex\f[R]
+Receive all faub profiles\[cq] backups in a single process rather than
+one process per profile.
+That process talks to every client from one event loop and hands the
+disk work to a pool of \f[B]\[en]threads\f[R] worker threads, so a
+server with hundreds of faub clients runs one process instead of
+hundreds.
+When received data gets ahead of the disk the process stops reading from
+clients until it catches up.
+Can be specified by itself to back up all faub profiles or combined with
+\f[B]-a\f[R], \f[B]-A\f[R], \f[B]-k\f[R] or \f[B]-K\f[R], in
+which case the faub profiles are handed to one multiplexed process and
+the rest are run as usual.
+Profiles that back up a local directory or receive from a replica source
+aren\[cq]t multiplexed.
+.TP
 \f[B]-g\f[R], \f[B]\[en]go\f[R]
 Run (backup, prune, link) the default profile.
 Or can be combined with limiting options like \f[B]\[en]nobackup\f[R],
@@ -541,6 +580,24 @@ files in a hardlink-aware way.
 The \f[B]\[en]relocate\f[R] option handles all three of these.
 Use it in conjunction with \f[B]-p\f[R].
 .TP
+\f[B]\[en]replicasource\f[R]
+{FB} Serve the specified (\f[B]-p\f[R]) profile\[cq]s backups to another
+backup server so that it can keep a full replica of them, history
+included.
+This is meant to be the \f[B]\[en]faub\f[R] command of a profile on the
+receiving server, e.g.\ \f[B]\[en]faub\f[R] \[lq]ssh backup1
+managebackups -p webserver \[en]replicasource\[rq].
+The receiver reports which backups it already has and every newer one
+is sent, oldest first, over the usual faub protocol.
+Each replica is named for the date of its original and compared against
+the replica before it, so unchanged files are hard linked on the
+receiving end and only each day\[cq]s changes cross the network or take
+up space.
+Backups older than the receiver\[cq]s newest replica aren\[cq]t sent,
+which lets the receiver prune on its own schedule.
+See also \f[B]\[en]replicateto\f[R] for a local copy of just the latest
+backup.
+.TP
 \f[B]\[en]replicateto\f[R] [\f[I]targetDir\f[R]]
 {FB} The replicate option makes a hardlink-aware copy (i.e.\ no
 appreciable additional storage) of the most recent backup of the
@@ -561,6 +618,9 @@ directory, resulting in a larger cloud bill because the provider would
 ignore the hardlinks and see each copy as additional storage.
 The copy of the backup in \f[I]targetDir\f[R] is not tracked and does
 not appear in \f[B]-1\f[R] output.
+After the first run, replication only applies the changes recorded as
+each newer backup was taken, rather than comparing the whole backup to
+\f[I]targetDir\f[R], whenever those records are complete.
 .TP
 \f[B]\[en]rmo\f[R] [\f[I]num\f[R]]
 {FB} Remove the \f[I]num\f[R] oldest backups from the specified profile
@@ -606,6 +666,29 @@ See \f[B]\[en]sched\f[R].
 Recalcuate all disk usage for a profile.
 Use with -p.\ This should never be necessary unless you manually modify
 a backup.
+It also rebuilds the profile\[cq]s inode index, which lets removing a
+faub backup update the disk usage of the remaining ones without walking
+them.
+Profiles with backups from before the index existed get one this way;
+until then removals fall back to walking the next backup.
+\f[B]\[en]recalc\f[R] also rereads every directory of the
+profile\[cq]s backup tree; otherwise directories that haven\[cq]t
+changed since they were last read are skipped.
+.TP
+\f[B]\[en]threads\f[R] [\f[I]num\f[R]]
+Walk up to \f[I]num\f[R] faub backups at once when disk usage is
+recalculated (such as with \f[B]\[en]recalc\f[R]), and calculate the
+MD5s of up to \f[I]num\f[R] single-file backups at once when they
+aren\[cq]t cached yet (such as after the cache is removed).
+Backups on a disk that isn\[cq]t known to be solid state are read one
+at a time regardless.
+The default is one per CPU.
+.TP
+\f[B]\[en]verifystats\f[R]
+{FB} A faub backup\[cq]s disk usage is tallied as the backup is received
+rather than by walking it afterwards.
+\f[B]\[en]verifystats\f[R] walks the new backup anyway, caches the
+walked numbers and reports any difference from the tally.
 .TP
 \f[B]-v\f[R][\f[I]options\f[R]]
 Provide verbose debugging output.
@@ -675,10 +758,74 @@ Ultimately \f[I]cmd\f[R] should execute \f[B]managebackups\f[R] with
 \f[B]\[en]path\f[R] or \f[B]-s\f[R] on the server to be backed up.
 If the backup is of the localhost \f[I]cmd\f[R] can simply be
 \[lq]managebackups -s filesystemToBeBackedup\[rq].
+In that case (no ssh or other wrapper) the backup is performed
+in-process without a pipe and changed files are copied with reflinks or
+copy_file_range() where the filesystem supports it.
 If the backup is of a remote host \f[I]cmd\f[R] needs to execute
 \f[B]managebackups\f[R] on that remote server, such as via ssh.
 See the FAUB-STYLE BACKUPS section below.
 .TP
+\f[B]\[en]agent\f[R] [\f[I]address\f[R]]
+{FB} Connect to a \f[B]managebackups\f[R] faub agent (see
+\f[B]\[en]listen\f[R]) at \f[I]address\f[R] instead of executing the
+\f[B]\[en]faub\f[R] command.
+\f[I]address\f[R] is host:port, host (port 4750) or the path of a unix
+domain socket.
+The agent is asked to serve the \f[B]\[en]path\f[R] arguments found in
+the \f[B]\[en]faub\f[R] command, or all of its own paths if there
+aren\[cq]t any.
+If the agent can\[cq]t be reached or refuses the session the
+\f[B]\[en]faub\f[R] command is executed as usual.
+Requires \f[B]\[en]agentkey\f[R].
+The session isn\[cq]t encrypted; see \f[B]\[en]listen\f[R].
+.TP
+\f[B]\[en]agentkey\f[R] [\f[I]file\f[R]]
+{FB} \f[I]file\f[R] holds the pre-shared key (at least 16 characters)
+used by \f[B]\[en]agent\f[R] and \f[B]\[en]listen\f[R].
+The server and agent each prove they have the same key via a
+challenge-response; the key itself is never sent.
+\f[I]file\f[R] should only be readable by its owner.
+.TP
+\f[B]\[en]listen\f[R] [\f[I]address\f[R]]
+Run as a long-lived faub agent on the machine to be backed up, serving
+any number of backup sessions from servers configured with
+\f[B]\[en]agent\f[R].
+\f[I]address\f[R] is [host]:port, port or the path of a unix domain
+socket.
+The directories served are given via \f[B]\[en]path\f[R] (or a
+profile that includes them); sessions can request those or anything
+beneath them.
+Requires \f[B]\[en]agentkey\f[R].
+This avoids the ssh session and process startup for each backup.
+Sessions are authenticated but the files and their metadata are then
+sent unencrypted and without integrity protection, so
+\f[I]address\f[R] must be a unix domain socket or a loopback address
+unless \f[B]\[en]unencrypted\f[R] is given.
+A backup server on another host reaches it through a tunnel (ssh -L, a
+VPN, etc).
+.TP
+\f[B]\[en]unencrypted\f[R]
+With \f[B]\[en]listen\f[R], allow an address that\[cq]s reachable
+from the network.
+The backup data then crosses the network in the clear, where it could
+be read or altered in transit.
+Only use it on a trusted network.
+.TP
+\f[B]\[en]fanout\f[R] [\f[I]x\f[R]]
+With \f[B]\[en]listen\f[R], serve backups of the same paths (and
+include/exclude) to up to \f[I]x\f[R] servers from a single session.
+The first server to connect waits up to \f[B]\[en]fanoutwait\f[R]
+seconds for the rest of its group; then the trees are scanned once and
+each changed file is read once and streamed to every server that
+requested it.
+Useful when the same host is backed up to more than one backup server.
+Servers that don\[cq]t arrive in time are served on their own as usual.
+.TP
+\f[B]\[en]fanoutwait\f[R] [\f[I]secs\f[R]]
+How long the first server of a \f[B]\[en]fanout\f[R] group waits for
+the others.
+Defaults to 600.
+.TP
 \f[B]-c\f[R], \f[B]\[en]command\f[R] [\f[I]cmd\f[R]]
 {1F} Use \f[I]cmd\f[R] to perform a single-file backup.
 \f[I]cmd\f[R] should be double-quoted and may include as many pipes as
@@ -808,6 +955,27 @@ before SFTPing a file.
 \f[I]minsftpspace\f[R] is assumed to be in bytes unless a suffix is
 specified (K, M, G, T, P, E, Z, Y).
 .TP
+\f[B]\[en]bwlimit\f[R] [\f[I]rate\f[R]]
+{both} Limit network transfers to \f[I]rate\f[R] bytes per second.
+This covers faub sessions (on either end, including agents and
+replicas) as well as \f[B]\[en]scp\f[R] and \f[B]\[en]sftp\f[R].
+\f[I]rate\f[R] is assumed to be in bytes unless a suffix is specified
+(K, M, G, T, P, E, Z, Y).
+It can be restricted to a time of day by appending
+\[at]\f[I]HH[:MM]\f[R]-\f[I]HH[:MM]\f[R] and several comma-separated
+rates can be given; the first whose window covers the current time
+applies and a rate without a window applies at any time.
+For example, \[lq]2M\[at]08-18,20M\[rq] allows 2MB/s during business
+hours and 20MB/s the rest of the time.
+Given with \f[B]-A\f[R] or \f[B]\[en]All\f[R] the limit covers the
+whole run, so it\[cq]s divided among profiles that run in parallel.
+.TP
+\f[B]\[en]iolimit\f[R] [\f[I]rate\f[R]]
+{both} Limit local disk I/O while taking a backup to \f[I]rate\f[R]
+bytes per second, using the same format as \f[B]\[en]bwlimit\f[R].
+Reads and writes count against the same limit, so a local copy of a
+file is charged twice its size.
+.TP
 \f[B]\[en]nobackup\f[R]
 {both} Disable performing backups for this run.
 To disable permanently moving forward, remove the \[lq]command\[rq] &
@@ -959,6 +1127,10 @@ they won\[cq]t use any disk space or be verifiable via mtime.
 This will allow the entire backup to be removed on the next run if
 \f[B]\[en]dataonly\f[R] is selected and no other files had actual
 content changes.
+When the faub client supports it, the server sends a digest of its
+previous copy of each touched file and the client compares it locally,
+so touched files with unchanged content aren\[cq]t transferred at all;
+older clients send the file and the comparison is done on the server.
 .SS 2. Pruning Options
 .TP
 \f[B]\[en]prune\f[R]
@@ -1035,8 +1207,24 @@ of data are taking up the space of 3 copies, not 25.
 In effect, increasing \f[B]\[en]maxlinks\f[R] saves disk space.
 But an accidental mis-edit to one of those files could damage more
 backups with a higher number.
+A new single-file backup is compared against the most recent one\[cq]s
+content as it\[cq]s written; if it turns out identical it\[cq]s linked
+straight away instead of being written out.
 Set \f[B]\[en]maxlinks\f[R] to 0 or 1 to disable linking.
 Defaults to 200.
+.TP
+\f[B]\[en]digest\f[R] [\f[I]name\f[R]]
+{1F} Use \f[I]name\f[R], either md5 or blake3, to identify the content
+of backups for linking.
+BLAKE3 is several times faster than MD5 on large backups; only its first
+128 bits are kept (the same as \f[B]b3sum \[en]length 16\f[R]).
+Changing a profile\[cq]s digest doesn\[cq]t rehash its existing backups
+all at once.
+New backups get the new digest and an older backup is only rehashed when
+it\[cq]s the same size as one that has it (i.e.\ it might be identical
+and should be linked), or when it needs its digest recalculated anyway.
+Faub backups always use MD5.
+Defaults to md5.
 .SH NOTIFICATIONS
 .PP
 \f[B]managebackups\f[R] can notify on success or failure of a backup via
@@ -1169,6 +1357,32 @@ Then the \[en]faub command on the server could become:
 \f[R]
 .fi
 .PP
+For hosts that are backed up frequently the ssh session and process
+startup of each run can be avoided by running a faub agent on
+dataserver, for example from its init system:
+.IP
+.nf
+\f[C]
+managebackups -p dataclient --listen localhost:4750 --agentkey /etc/managebackups.key
+\f[R]
+.fi
+.PP
+and adding \f[B]\[en]agent\f[R] localhost:4750 and
+\f[B]\[en]agentkey\f[R] (a copy of the same key) to the profile on
+the backup server, along with a long-running tunnel from the backup
+server to the agent:
+.IP
+.nf
+\f[C]
+ssh -N -L 4750:localhost:4750 dataserver
+\f[R]
+.fi
+.PP
+The agent\[cq]s sessions aren\[cq]t encrypted, which is why it only
+listens on loopback and the tunnel carries it across the network.
+The \f[B]\[en]faub\f[R] command is kept as the fallback for when the
+agent isn\[cq]t running.
+.PP
 Complications with configuration of faub, particularly if ssh is
 involved, are much easier to debug given the output of the various
 subcommands.
@@ -3,6 +3,8 @@
 #include <utime.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
+#include <netdb.h>
 #include <sys/stat.h>
 #include <pcre++.h>
 #include <algorithm>
@@ -47,7 +49,7 @@ ssize_t IPC_Base::ipcRead(void *data, size_t count) {
         count -= dataLen;
     }
 
-    int result = simpleSelect(readFd, 0, timeoutSecs);
+    int result = simpleSelect(readFd, -1, timeoutSecs);
 
     if (result == 0) {
         log("timeout on read()");
@@ -68,8 +70,11 @@ ssize_t IPC_Base::ipcRead(void *data, size_t count) {
                 if (ioErrors > 2)
                     throw MBException(string("unable to read from the client network connection"));
             }
-            else
+            else {
+                if (limiter != NULL)
+                    limiter->consume(bytes);
                 return bytes;
+            }
         }
 
     return 0;
@@ -129,6 +134,9 @@ string IPC_Base::ipcReadTo(string delimiter) {
         }
         else
             if (bytes) {
+                if (limiter != NULL)
+                    limiter->consume(bytes);
+                
                 string tempStr(rawBuf, bytes);
                 strBuf += tempStr;
             }
@@ -138,12 +146,70 @@ string IPC_Base::ipcReadTo(string delimiter) {
 }
 
 
-tuple<string, int, time_t, long> IPC_Base::ipcReadToFile(string filename, bool preDelete) {
+/*
+ * ipcReadToFile()
+ * Receive one directory entry (as sent by ipcSendDirEntry) and write it to 'filename'.
+ * Returns error text, mode, mtime, size and, for regular files that were written
+ * successfully, the MD5 of the content calculated as it came over the wire.
+ */
+tuple<string, int, time_t, long, string> IPC_Base::ipcReadToFile(string filename, bool preDelete) {
+    DirEntryWriter entry(filename, preDelete);
     long uid = ipcRead();
     long gid = ipcRead();
     long mode = ipcRead();
     long mtime = ipcRead();
-    string errorMsg;
+    entry.header(uid, gid, mode, mtime);
+
+    if (S_ISDIR(mode))
+        return entry.result();
+
+    // handle symlinks
+    if (S_ISLNK(mode)) {
+        __int64_t bytes = ipcRead();
+        if (bytes < 0 || bytes > PATH_MAX)
+            throw MBException("invalid symlink length (" + to_string(bytes) + ") for " + filename);
+
+        string target(bytes, 0);
+        for (__int64_t received = 0; received < bytes; )
+            received += ipcRead(&target[received], bytes - received);
+
+        entry.symlinkTarget(target);
+        return entry.result();
+    }
+
+    // handle files
+    auto bytesRemaining = ipcRead();
+    entry.fileSize(bytesRemaining);
+
+    /*
+     * To maintain the network protocol with the client we have to read 'bytesRemaining' bytes
+     * even if the file can't be saved to the local disk. That way all the other read()s in this
+     * network connection still line up and subsequent files may transfer even if there was an
+     * issue with this one.
+     */
+    auto bufSize = sizeof(rawBuf);
+    while (bytesRemaining) {
+        auto readSize = bytesRemaining < bufSize ? bytesRemaining : bufSize;
+        auto bytesRead = ipcRead(rawBuf, readSize);
+        bytesRemaining -= bytesRead;
+        entry.fileData(rawBuf, bytesRead);
+    }
+
+    return entry.result();
+}
+
+
+/********************************************************************
+ *
+ * DirEntryWriter
+ *
+ *******************************************************************/
+
+void DirEntryWriter::header(long entryUid, long entryGid, long entryMode, long entryMtime) {
+    uid = entryUid;
+    gid = entryGid;
+    mode = entryMode;
+    mtime = entryMtime;
 
     // handle directories that are specifically sent
     if (S_ISDIR(mode)) {
@@ -158,85 +224,97 @@ tuple<string, int, time_t, long> IPC_Base::ipcReadToFile(string filename, bool p
         if (utime(filename.c_str(), &timeBuf))
             errorMsg += "error: unable to set utime() on " + filename + errtext();
         
-        return {errorMsg, mode, mtime, 0};
+        outcome = {errorMsg, mode, mtime, 0, ""};
+        decided = true;
     }
+}
 
-    // handle symlinks
-    if (S_ISLNK(mode)) {
-        char target[PATH_MAX + 1];
-        __int64_t bytes = ipcRead();
-        ipcRead(target, bytes);
-        target[bytes] = 0;
-
-        if (preDelete)
-            unlink(filename.c_str());
 
-        if (symlink(target, filename.c_str()))
-            return {("error: unable to create symlink " + filename + errtext()), -1, 0, 0};
+void DirEntryWriter::symlinkTarget(string target) {
+    decided = true;
 
-        if (lchown(filename.c_str(), (int)uid, (int)gid))
-            return {("error: unable to chown symlink " + filename + errtext()), -1, 0, 0};
+    if (preDelete)
+        unlink(filename.c_str());
 
-        struct timeval tv[2];
-        tv[0].tv_sec  = tv[1].tv_sec  = mtime;
-        tv[0].tv_usec = tv[1].tv_usec = 0;
-        lutimes(filename.c_str(), tv);
+    if (symlink(target.c_str(), filename.c_str())) {
+        outcome = {("error: unable to create symlink " + filename + errtext()), -1, 0, 0, ""};
+        return;
+    }
 
-        return {"", mode, 0, 0};
+    if (lchown(filename.c_str(), (int)uid, (int)gid)) {
+        outcome = {("error: unable to chown symlink " + filename + errtext()), -1, 0, 0, ""};
+        return;
     }
 
+    struct timeval tv[2];
+    tv[0].tv_sec  = tv[1].tv_sec  = mtime;
+    tv[0].tv_usec = tv[1].tv_usec = 0;
+    lutimes(filename.c_str(), tv);
+
+    outcome = {"", mode, 0, 0, ""};
+}
+
+
+void DirEntryWriter::fileSize(long size) {
+    totalBytes = size;
+
     // handle directories that are inherent in the filename
     string dirName = filename.substr(0, filename.find_last_of("/"));
-    if (mkdirp(dirName))
-        return {("error: unable to mkdir " + filename + ": " + strerror(errno)), 0, 0, 0};
-
-    // handle files
-    auto bytesRemaining = ipcRead();
-    auto totalBytes = bytesRemaining;
+    if (mkdirp(dirName)) {
+        outcome = {("error: unable to mkdir " + filename + ": " + strerror(errno)), 0, 0, 0, ""};
+        decided = skipData = true;
+        return;
+    }
 
-    FILE *dataf;
-    auto bufSize = sizeof(rawBuf);
     dataf = fopen(ue(filename).c_str(), "wb");
+}
 
-    /*
-     * To maintain the network protocol with the client we have to read 'bytesRemaining' bytes
-     * even if our fopen() failed and we can't save them to the local disk. That way all the
-     * other read()s in this network connection still line up and subsequent files may transfer
-     * even if there was an issue with this one.
-     */
 
-    bool errorLogged = false;
-    while (bytesRemaining) {
-        auto readSize = bytesRemaining < bufSize ? bytesRemaining : bufSize;
-        auto bytesRead = ipcRead(rawBuf, readSize);
-        bytesRemaining -= bytesRead;
+void DirEntryWriter::fileData(const char *data, size_t count) {
+    if (skipData)
+        return;
 
-        if (dataf != NULL && !errorLogged) {
-            if (fwrite(rawBuf, 1, bytesRead, dataf) < bytesRead) {
-                errorLogged = true;
-                errorMsg += (errorMsg.length() ? "\n" : "") + string("error: unable to fwrite to ") + filename + ": " + strerror(errno);
-                fclose(dataf);
-            }
+    digest.update(data, count);
+
+    if (dataf != NULL) {
+        GLOBALS.diskLimit.consume(count);
+        
+        if (fwrite(data, 1, count, dataf) < count) {
+            errorMsg += (errorMsg.length() ? "\n" : "") + string("error: unable to fwrite to ") + filename + ": " + strerror(errno);
+            fclose(dataf);
+            dataf = NULL;
         }
     }
+}
+
+
+tuple<string, int, time_t, long, string> DirEntryWriter::result() {
+    if (decided)
+        return outcome;
 
     if (dataf != NULL) {
-        fclose(dataf);
-        if (chown(filename.c_str(), (int)uid, (int)gid))
-            errorMsg += (errorMsg.length() ? "\n" : "") + string("error: unable to chown file ") + filename + ": " + strerror(errno);
+        bool closeFailed = fclose(dataf) != 0;
+        dataf = NULL;
 
-        if (chmod(filename.c_str(), mode))
-            errorMsg += (errorMsg.length() ? "\n" : "") + string("error: unable to chmod file ") + filename + ": " + strerror(errno);
+        if (closeFailed)
+            errorMsg += (errorMsg.length() ? "\n" : "") + string("error: unable to fwrite to ") + filename + ": " + strerror(errno);
+        else {
+            if (chown(filename.c_str(), (int)uid, (int)gid))
+                errorMsg += (errorMsg.length() ? "\n" : "") + string("error: unable to chown file ") + filename + ": " + strerror(errno);
 
-        struct utimbuf timeBuf;
-        timeBuf.actime = timeBuf.modtime = mtime;
-        utime(filename.c_str(), &timeBuf);
-        DEBUG(D_netproto) cerr << " [" << totalBytes << " bytes]" << flush;
-        return {errorMsg, mode, mtime, totalBytes};
+            if (chmod(filename.c_str(), mode))
+                errorMsg += (errorMsg.length() ? "\n" : "") + string("error: unable to chmod file ") + filename + ": " + strerror(errno);
+
+            struct utimbuf timeBuf;
+            timeBuf.actime = timeBuf.modtime = mtime;
+            utime(filename.c_str(), &timeBuf);
+            DEBUG(D_netproto) cerr << " [" << totalBytes << " bytes]" << flush;
+            return {errorMsg, mode, mtime, totalBytes, digest.final()};
+        }
     }
 
     DEBUG(D_netproto) cerr << " [" << totalBytes << " bytes] can't write file " << filename << endl;
-    return {errorMsg, mode, mtime, totalBytes};
+    return {errorMsg, mode, mtime, totalBytes, ""};
 }
 
 
@@ -287,21 +365,43 @@ string IPC_Base::statefulReadAndMatchRegex(string regex) {
 }
 
 
+/* a short count means the connection has failed (see failed()); nothing more is sent on it */
 ssize_t IPC_Base::ipcWrite(const void *data, size_t count) {
     ssize_t bytesWritten;
     ssize_t totalBytesWritten = 0;
 
-    int result = simpleSelect(0, writeFd, timeoutSecs);
+    if (writeFailed)
+        return 0;
+
+    int result = simpleSelect(-1, writeFd, timeoutSecs);
+
+    if (result > 0) {
+        while (count) {
+            bytesWritten = write(writeFd, (char*)data + totalBytesWritten, count);
+
+            if (bytesWritten < 0 && errno == EINTR)
+                continue;
+
+            if (bytesWritten < 1) {
+                log(string("error on write(): ") + (bytesWritten < 0 ? strerror(errno) : "nothing written"));
+                writeFailed = true;
+                break;
+            }
 
-    if (result > 0)
-        while (count && ((bytesWritten = write(writeFd, (char*)data + totalBytesWritten, count)) > 0)) {
             count -= bytesWritten;
             totalBytesWritten += bytesWritten;
+            
+            if (limiter != NULL)
+                limiter->consume(bytesWritten);
         }
+    }
     else {
+        writeFailed = true;
+
         if (result == 0) {
             log("timeout on write()");
-            throw MBException("timeout on write()");
+            if (!softFail)
+                throw MBException("timeout on write()");
         }
         else
             log(string("error on select() of write: ") + strerror(errno));
@@ -328,31 +428,50 @@ ssize_t IPC_Base::ipcWrite(__int64_t data) {
 
 
 void IPC_Base::ipcSendDirEntry(string filename) {
+    ipcSendDirEntry(filename, {this});
+}
+
+
+/*
+ * Send one directory entry to several receivers, reading the file only once.
+ * Each receiver gets exactly what ipcSendDirEntry() would have sent it.
+ */
+void IPC_Base::ipcSendDirEntry(string filename, vector<IPC_Base*> destinations) {
     struct stat statData;
 
     if (!mylstat(filename, &statData) && statData.st_mode) {
-        ipcWrite(statData.st_uid);
-        ipcWrite(statData.st_gid);
-        ipcWrite(statData.st_mode);
-        ipcWrite(statData.st_mtime);
+        for (auto dest: destinations) {
+            dest->ipcWrite(statData.st_uid);
+            dest->ipcWrite(statData.st_gid);
+            dest->ipcWrite(statData.st_mode);
+            dest->ipcWrite(statData.st_mtime);
+        }
 
         if (S_ISLNK(statData.st_mode)) {
             char target[1024];
             auto bytes = readlink(filename.c_str(), target, sizeof(target));
-            ipcWrite(bytes);
-            ipcWrite(target, bytes);
+            for (auto dest: destinations) {
+                dest->ipcWrite(bytes);
+                dest->ipcWrite(target, bytes);
+            }
         }
         else
             if (!S_ISDIR(statData.st_mode)) {
-                ipcSendRawFile(filename, statData.st_size);
+                ipcSendRawFile(filename, statData.st_size, destinations);
             }
     }
     else
-        ipcWrite((__int64_t)0);
+        for (auto dest: destinations)
+            dest->ipcWrite((__int64_t)0);
 }
 
 
 void IPC_Base::ipcSendRawFile(string filename, __int64_t fileSize) {
+    ipcSendRawFile(filename, fileSize, {this});
+}
+
+
+void IPC_Base::ipcSendRawFile(string filename, __int64_t fileSize, vector<IPC_Base*> destinations) {
     FILE *dataf;
 
     struct stat statData;
@@ -362,24 +481,37 @@ void IPC_Base::ipcSendRawFile(string filename, __int64_t fileSize) {
         statData.st_size = fileSize;
 
     if ((dataf = fopen(ue(filename).c_str(), "rb")) != NULL) {
-        ipcWrite(statData.st_size);
+        for (auto dest: destinations)
+            dest->ipcWrite(statData.st_size);
 
+        auto buffer = destinations.front()->rawBuf;
         ssize_t bytesRead;
-        while ((bytesRead = fread(rawBuf, 1, sizeof(rawBuf), dataf)))
-            ipcWrite(rawBuf, bytesRead);
+        while ((bytesRead = fread(buffer, 1, BUFFER_SIZE, dataf))) {
+            GLOBALS.diskLimit.consume(bytesRead);
+            
+            for (auto dest: destinations)
+                dest->ipcWrite(buffer, bytesRead);
+        }
 
         fclose(dataf);
     }
     else {
-        ipcWrite((__int64_t)0);
+        for (auto dest: destinations)
+            dest->ipcWrite((__int64_t)0);
         log("error: unable to read " + filename);
     }
 }
 
 
 void IPC_Base::ipcClose() {
-    close(readFd);
-    close(writeFd);
+    if (readFd >= 0)
+        close(readFd);
+
+    // sockets use the same fd both ways
+    if (writeFd >= 0 && writeFd != readFd)
+        close(writeFd);
+
+    readFd = writeFd = -1;
 }
 
 
@@ -389,91 +521,231 @@ void IPC_Base::ipcClose() {
  *
  *******************************************************************/
 
-TCP_Socket::TCP_Socket(int port, int backlog, unsigned int timeout) : IPC_Base(0, 0, timeout) {
-    if ((readFd = socket(AF_INET, SOCK_STREAM, 0)) > 0) {
-        writeFd = readFd;
-        int option = 1;
+TCP_Socket::TCP_Socket(int port, int backlog, unsigned int timeout) : TCP_Socket("", port, backlog, timeout) {}
 
-        if (!setsockopt(readFd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option))) {
-            struct sockaddr_in address;
-            address.sin_family = AF_INET;
-            address.sin_addr.s_addr = INADDR_ANY;
-            address.sin_port = htons(port);
 
-            if (::bind(readFd, (struct sockaddr*)&address, sizeof(address)) == 0) {
-                if (!listen(readFd, backlog))
-                    return;
-                else {
-                    readFd = writeFd = 0;
-                    throw(MBException(string("listen(server): ") + strerror(errno)));
-                }
-            }
-            else {
-                readFd = writeFd = 0;
-                throw(MBException(string("bind(server): ") + string(strerror(errno))));
-            }
+/*
+ * Listen on 'address', which is either the path of a unix domain socket (starts with
+ * a slash) or a local hostname/IP to bind to.  An empty address binds all interfaces.
+ */
+TCP_Socket::TCP_Socket(string address, int port, int backlog, unsigned int timeout) : IPC_Base(-1, -1, timeout) {
+    if (address.length() && address[0] == '/') {
+        struct sockaddr_un unixAddress;
+        
+        if (address.length() >= sizeof(unixAddress.sun_path))
+            throw(MBException("socket path too long: " + address));
+        
+        if ((readFd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+            readFd = -1;
+            throw(MBException(string("socket(server): ") + strerror(errno)));
         }
-        else {
-            readFd = writeFd = 0;
-            throw(MBException(string("setsockopt(server): ") + string(strerror(errno))));
+        
+        memset(&unixAddress, 0, sizeof(unixAddress));
+        unixAddress.sun_family = AF_UNIX;
+        strncpy(unixAddress.sun_path, address.c_str(), sizeof(unixAddress.sun_path) - 1);
+        unlink(address.c_str());  // stale socket from a previous run
+        
+        if (::bind(readFd, (struct sockaddr*)&unixAddress, sizeof(unixAddress))) {
+            string error = strerror(errno);
+            close(readFd);
+            readFd = -1;
+            throw(MBException("bind(server): " + error));
         }
     }
     else {
-        readFd = writeFd = 0;
-        throw(MBException(string("socket(server): ") + string(strerror(errno))));
+        struct addrinfo hints, *result;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        
+        int error = getaddrinfo(address.length() ? address.c_str() : NULL, to_string(port).c_str(), &hints, &result);
+        if (error)
+            throw(MBException(string("getaddrinfo(server): ") + gai_strerror(error)));
+        
+        string lastError = "no usable address";
+        for (auto ai = result; ai != NULL; ai = ai->ai_next) {
+            if ((readFd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) {
+                lastError = string("socket(server): ") + strerror(errno);
+                continue;
+            }
+            
+            int option = 1;
+            if (setsockopt(readFd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option)))
+                lastError = string("setsockopt(server): ") + strerror(errno);
+            else
+                if (::bind(readFd, ai->ai_addr, ai->ai_addrlen) == 0)
+                    break;
+                else
+                    lastError = string("bind(server): ") + strerror(errno);
+            
+            close(readFd);
+            readFd = -1;
+        }
+        
+        freeaddrinfo(result);
+        if (readFd < 0)
+            throw(MBException(lastError));
+    }
+    
+    writeFd = readFd;
+    if (listen(readFd, backlog)) {
+        string error = strerror(errno);
+        close(readFd);
+        readFd = writeFd = -1;
+        throw(MBException("listen(server): " + error));
     }
 }
 
 
-TCP_Socket::TCP_Socket(string server, int port, unsigned int timeout) : IPC_Base(0, 0, timeout) {
-    if ((readFd = socket(AF_INET, SOCK_STREAM, 0)) > 0) {
-        writeFd = readFd;
-        struct sockaddr_in address;
-        address.sin_family = AF_INET;
-        address.sin_port = htons(port);
-
-        if (inet_pton(AF_INET, server.c_str(), &address.sin_addr) > 0) {
-            if (!connect(readFd, (struct sockaddr*)&address, sizeof(address)))
-                return;
-            else {
-                readFd = writeFd = 0;
-                throw(MBException(string("connect(client): ") + string(strerror(errno))));
-            }
+/*
+ * Connect to 'server', which is either the path of a unix domain socket (starts with
+ * a slash) or a hostname/IP.  The connection attempt itself is bound by 'timeout'.
+ */
+TCP_Socket::TCP_Socket(string server, int port, unsigned int timeout) : IPC_Base(-1, -1, timeout) {
+    auto tryConnect = [&](int family, struct sockaddr *address, socklen_t addrLen) {
+        if ((readFd = socket(family, SOCK_STREAM, 0)) < 0) {
+            readFd = -1;
+            return string("socket(client): ") + strerror(errno);
         }
-        else {
-            readFd = writeFd = 0;
-            throw(MBException(string("inet_pton(client): ") + string(strerror(errno))));
+        
+        // connect without blocking so an unreachable host can't hang us beyond the timeout
+        int flags = fcntl(readFd, F_GETFL, 0);
+        fcntl(readFd, F_SETFL, flags | O_NONBLOCK);
+        
+        int result = connect(readFd, address, addrLen);
+        if (result && errno == EINPROGRESS) {
+            int soError = 0;
+            socklen_t soLen = sizeof(soError);
+            
+            if (simpleSelect(-1, readFd, timeoutSecs) < 1)
+                soError = ETIMEDOUT;
+            else
+                getsockopt(readFd, SOL_SOCKET, SO_ERROR, &soError, &soLen);
+            
+            errno = soError;
+            result = soError ? -1 : 0;
+        }
+        
+        if (!result) {
+            fcntl(readFd, F_SETFL, flags);
+            writeFd = readFd;
+            return string("");
         }
+        
+        string error = string("connect(client): ") + strerror(errno);
+        close(readFd);
+        readFd = -1;
+        return error;
+    };
+    
+    string error;
+    if (server.length() && server[0] == '/') {
+        struct sockaddr_un unixAddress;
+        memset(&unixAddress, 0, sizeof(unixAddress));
+        unixAddress.sun_family = AF_UNIX;
+        strncpy(unixAddress.sun_path, server.c_str(), sizeof(unixAddress.sun_path) - 1);
+        
+        error = tryConnect(AF_UNIX, (struct sockaddr*)&unixAddress, sizeof(unixAddress));
     }
     else {
-        readFd = writeFd = 0;
-        throw(MBException(string("socket(client): ") + string(strerror(errno))));
+        struct addrinfo hints, *result;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        
+        int gaiError = getaddrinfo(server.c_str(), to_string(port).c_str(), &hints, &result);
+        if (gaiError)
+            throw(MBException(string("getaddrinfo(client): ") + gai_strerror(gaiError)));
+        
+        error = "no usable address for " + server;
+        for (auto ai = result; ai != NULL; ai = ai->ai_next)
+            if (!(error = tryConnect(ai->ai_family, ai->ai_addr, ai->ai_addrlen)).length())
+                break;
+        
+        freeaddrinfo(result);
     }
+    
+    if (error.length())
+        throw(MBException(error));
 }
 
 
 TCP_Socket::TCP_Socket(int fd, unsigned int timeout) : IPC_Base(fd, fd, timeout) {};
 
 
-TCP_Socket TCP_Socket::accept() {
-    if (!simpleSelect(readFd, 0, timeoutSecs)) {
+/*
+ * Wait for and accept the next connection, returning its file descriptor.  The caller
+ * wraps it in TCP_Socket(fd, timeout), which takes ownership.  A timeout of 0 waits
+ * indefinitely.
+ */
+int TCP_Socket::accept() {
+    if (timeoutSecs && !simpleSelect(readFd, -1, timeoutSecs)) {
         log("timeout on socket accept()");
         throw MBException("timeout on socket accept()");
     }
 
     int newFd;
-    struct sockaddr_in address;
-    int addrlen = sizeof(address);
-
-    if ((newFd = ::accept(readFd, (struct sockaddr*)&address, (socklen_t*)&addrlen)) > 0) {
-        TCP_Socket client(newFd, timeoutSecs);
-        return client;
-    }
+    if ((newFd = ::accept(readFd, NULL, NULL)) >= 0)
+        return newFd;
 
     throw MBException(string("accept(client): " ) + strerror(errno));
 }
 
 
+bool TCP_Socket::sendFd(int fd, __int64_t data) {
+    struct msghdr message;
+    struct iovec iov;
+    char control[CMSG_SPACE(sizeof(int))];
+    
+    memset(&message, 0, sizeof(message));
+    memset(control, 0, sizeof(control));
+    iov.iov_base = &data;
+    iov.iov_len = sizeof(data);
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    
+    return sendmsg(writeFd, &message, 0) == sizeof(data);
+}
+
+
+int TCP_Socket::receiveFd(__int64_t& data) {
+    struct msghdr message;
+    struct iovec iov;
+    char control[CMSG_SPACE(sizeof(int))];
+    
+    if (timeoutSecs && simpleSelect(readFd, -1, timeoutSecs) < 1)
+        return -1;
+    
+    memset(&message, 0, sizeof(message));
+    iov.iov_base = &data;
+    iov.iov_len = sizeof(data);
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    
+    if (recvmsg(readFd, &message, 0) != sizeof(data))
+        return -1;
+    
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        return -1;
+    
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+
 /********************************************************************
  *
  * PipeExec
@@ -576,6 +848,30 @@ void PipeExec::pickupTheKids() {
 }
 
 
+/*
+ * reapIfDone()
+ * Reap any children that have exited without waiting on the rest.  True once they're
+ * all gone, after which the destructor has nothing to wait for.  For callers that
+ * can't block (FaubReceiver); a child someone else's wait() already collected counts
+ * as gone.
+ */
+bool PipeExec::reapIfDone() {
+    bool done = true;
+    
+    for (auto &proc: procs)
+        if (proc.childPID && !proc.reaped) {
+            auto result = waitpid(proc.childPID, NULL, WNOHANG);
+            
+            if (result > 0 || (result < 0 && errno == ECHILD))
+                proc.reaped = true;
+            else
+                done = false;
+        }
+    
+    return done;
+}
+
+
 PipeExec::~PipeExec() {
     if (!bypassDestructor) {
         closeAll();
@@ -611,6 +907,11 @@ int PipeExec::closeAll() {
         close(procs[0].writefd[READ_END]);
         int a = close(procs[0].writefd[WRITE_END]);
         int b = close(procs[0].readfd[READ_END]);
+        
+        // forget them so a second closeAll() (or the destructors) can't close a descriptor
+        // that's since been reused elsewhere in the process
+        procs[0].writefd[READ_END] = procs[0].writefd[WRITE_END] = procs[0].readfd[READ_END] = -1;
+        readFd = writeFd = -1;
         return(!(a == 0 && b == 0));
     }
 
@@ -626,8 +927,11 @@ int PipeExec::closeRead() {
 }
 
 int PipeExec::closeWrite() {
-    if (procs.size() > 0)
-        return close(procs[0].writefd[WRITE_END]);
+    if (procs.size() > 0) {
+        int result = close(procs[0].writefd[WRITE_END]);
+        procs[0].writefd[WRITE_END] = writeFd = -1;
+        return result;
+    }
 
     return 0;
 }
@@ -741,6 +1045,9 @@ int PipeExec::execute(string procName, bool leaveFinalOutput, bool noDestruct, b
                 //pipedetail(procIt->writefd[READ_END], procIt->readfd[WRITE_END], "closed (primary parent)");
                 close(procIt->writefd[READ_END]);
                 close(procIt->readfd[WRITE_END]);
+                
+                // forget the child's ends so closeAll() can't close whatever reuses their numbers
+                procIt->writefd[READ_END] = procIt->readfd[WRITE_END] = -1;
                 if (procName.length())
                     errorDir = "";  // reset errorDir so that we don't clean up stderr files for a named proc
 
@@ -801,29 +1108,142 @@ int PipeExec::execute(string procName, bool leaveFinalOutput, bool noDestruct, b
 }
 
 
-bool PipeExec::execute2file(string toFile, string procName) {
+// write all of 'count' bytes, retrying short & interrupted writes
+static bool writeAll(int fd, const char *data, size_t count) {
+    while (count) {
+        auto bytesWritten = write(fd, data, count);
+
+        if (bytesWritten < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        data += bytesWritten;
+        count -= bytesWritten;
+    }
+
+    return true;
+}
+
+
+// read up to 'count' bytes, only stopping short at the end of the file (or an error)
+static size_t readAll(int fd, char *data, size_t count) {
+    size_t total = 0;
+
+    while (total < count) {
+        auto bytesRead = read(fd, data + total, count - total);
+
+        if (bytesRead < 0 && errno == EINTR)
+            continue;
+
+        if (bytesRead <= 0)
+            break;
+
+        total += bytesRead;
+    }
+
+    return total;
+}
+
+
+/* run the command and save its output to 'toFile'.  if 'digest' is given it's set to the
+ * 'algorithm' digest of what was written, calculated as the output streams through, so the
+ * file doesn't have to be read back; it's left empty if any of the output couldn't be
+ * written.
+ *
+ * if 'likelyMatch' is given the output is compared to that file instead of being written,
+ * for as long as it's the same.  at the first difference the part that matched is copied
+ * from 'likelyMatch' and writing carries on from there.  if the output turns out to be
+ * identical to all of 'likelyMatch', 'toFile' becomes a hard link to it and nothing is
+ * written at all. */
+bool PipeExec::execute2file(string toFile, string procName, string *digest, string likelyMatch, digestType algorithm) {
     int outFile;
+    int matchFile = -1;
     int bytesRead;
-    int bytesWritten;
-    int pos;
+    size_t matched = 0;
     bool success = false;
+    bool writeFailed = false;
     char data[64 * 1024];
+    char matchData[64 * 1024];
+    digestStream outputDigest(algorithm);
+
+    DEBUG(D_exec) DFMT("toFile=" << toFile << "; procName=" << procName << "; likelyMatch=" << likelyMatch);
 
-    DEBUG(D_exec) DFMT("toFile=" << toFile << "; procName=" << procName);
+    // catch up on writing the output that matched, copying it from the file it matched
+    auto writeMatched = [&]() {
+        lseek(matchFile, 0, SEEK_SET);
+
+        while (matched && !writeFailed) {
+            auto bytes = readAll(matchFile, matchData, min(matched, sizeof(matchData)));
+
+            if (!bytes || !writeAll(outFile, matchData, bytes)) {
+                log("error: unable to copy " + likelyMatch + " to " + toFile + ": " + strerror(errno));
+                writeFailed = true;
+            }
+
+            matched -= bytes;
+        }
+
+        close(matchFile);
+        matchFile = -1;
+    };
 
     if ((outFile = open(toFile.c_str(), O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR)) > 0) {
+        if (likelyMatch.length())
+            matchFile = open(likelyMatch.c_str(), O_RDONLY);
+
         execute(procName, false, false, false, true);
 
         while ((bytesRead = (int)ipcRead(&data, sizeof(data)))) {
-            pos = 0;
-            while (((bytesWritten = (int)write(outFile, data+pos, bytesRead)) < bytesRead) && (errno == EINTR)) {
-                pos += bytesRead;
+            GLOBALS.diskLimit.consume(bytesRead);
+
+            if (digest != NULL)
+                outputDigest.update(data, bytesRead);
+
+            if (matchFile >= 0) {
+                if (readAll(matchFile, matchData, bytesRead) == bytesRead && !memcmp(data, matchData, bytesRead)) {
+                    matched += bytesRead;
+                    continue;
+                }
+
+                DEBUG(D_exec) DFMT("output differs from " << likelyMatch << " after " << matched << " bytes");
+                writeMatched();
+            }
+
+            // once a write has failed, keep draining the pipe so the command can finish
+            if (!writeFailed && !writeAll(outFile, data, bytesRead)) {
+                log("error: unable to write to " + toFile + ": " + strerror(errno));
+                writeFailed = true;
+            }
+        }
+
+        // everything matched; if that's all of likelyMatch, link to it rather than copying it
+        if (matchFile >= 0) {
+            if (!readAll(matchFile, matchData, 1) && !unlink(toFile.c_str()) && !link(likelyMatch.c_str(), toFile.c_str())) {
+                DEBUG(D_exec) DFMT("output identical to " << likelyMatch << "; linked");
+                close(matchFile);
+                matchFile = -1;
+            }
+            else {
+                close(outFile);
+                if ((outFile = open(toFile.c_str(), O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR)) > 0)
+                    writeMatched();
+                else {
+                    log("error: unable to write to " + toFile + ": " + strerror(errno));
+                    close(matchFile);
+                    writeFailed = true;
+                }
             }
         }
 
         close(outFile);
         close(procs[0].readfd[READ_END]);
-        success = true;
+        success = !writeFailed;
+
+        if (digest != NULL)
+            *digest = success ? outputDigest.final() : "";
     }
     else
         log("unable to write to " + toFile + ": " + strerror(errno));
@@ -53,9 +53,14 @@
 #include <sys/wait.h>
 #include <time.h>
 
+#include <algorithm>
+#include <iterator>
 #include <filesystem>
 #include <iostream>
 #include <fstream>
+#include <thread>
+#include <functional>
+#include <condition_variable>
 
 #include "syslog.h"
 #include "unistd.h"
@@ -73,6 +78,7 @@
 #include "BackupEntry.h"
 #include "ConfigManager.h"
 #include "FaubCache.h"
+#include "FaubReceiver.h"
 #include "FastCache.h"
 #include "colors.h"
 #include "cxxopts.hpp"
@@ -138,6 +144,9 @@ void verifyTripwireParams(string param)
 struct parseDirDataType {
     Pcre *tempRE;
     BackupCache *cache;
+    digestType algorithm;           // the profile's
+    vector<BackupEntry> toMD5;      // found needing an md5, in the order found
+    vector<string> reasons;
 };
 
 
@@ -149,6 +158,7 @@ bool parseDirCallback(pdCallbackData &file) {
     auto ps = pathSplit(file.filename);
     if (data->tempRE->search(ps.file)) {
         DEBUG(D_scan) DFMT("in-process file found (" << file.filename << ")");
+        data->cache->dirStamps.rescan(ps.dir);
         
         if (GLOBALS.startupTime - file.statData.st_mtime > 3600 * 5) {
             DEBUG(D_scan) DFMT("removing abandoned in-process file (" << file.filename << ")");
@@ -167,7 +177,7 @@ bool parseDirCallback(pdCallbackData &file) {
         string reason;
         BackupEntry *pCacheEntry;
         if ((pCacheEntry = data->cache->getByFilename(file.filename)) != NULL) {
-            if (pCacheEntry->md5.length() && pCacheEntry->size == file.statData.st_size &&
+            if (!pCacheEntry->md5.empty() && pCacheEntry->size == file.statData.st_size &&
                 pCacheEntry->mtime && pCacheEntry->mtime == file.statData.st_mtime) {
                 pCacheEntry->links = file.statData.st_nlink;
                 pCacheEntry->inode = file.statData.st_ino;
@@ -176,7 +186,7 @@ bool parseDirCallback(pdCallbackData &file) {
                 shouldCalculateMD5 = false;
             }
             else {
-                if (!pCacheEntry->md5.length()) { reason = "{no md5}"; }
+                if (pCacheEntry->md5.empty()) { reason = "{no md5}"; }
                 else
                     if (pCacheEntry->size != file.statData.st_size) { reason = "{size change}"; }
                     else
@@ -192,22 +202,18 @@ bool parseDirCallback(pdCallbackData &file) {
         
         if (shouldCalculateMD5) {
             // otherwise let's update the cache with everything we just read and
-            // then calculate a new md5
+            // then calculate a new md5 (once the scan is done, see parseDirToCache)
             BackupEntry cacheEntry;
             cacheEntry.filename = file.filename;
+            cacheEntry.algorithm = data->algorithm;
             cacheEntry.links = file.statData.st_nlink;
             cacheEntry.mtime = file.statData.st_mtime;
             cacheEntry.inode = file.statData.st_ino;
             cacheEntry.size = file.statData.st_size;
             cacheEntry.updateAges(GLOBALS.startupTime);
             
-            if (cacheEntry.calculateMD5(reason)) {
-                data->cache->addOrUpdate(cacheEntry, true, true);
-            }
-            else {
-                log("error: unable to read " + file.filename + " (MD5)" + errtext());
-                SCREENERR("error: unable to read " << file.filename << " (MD5)" + errtext());
-            }
+            data->toMD5.insert(data->toMD5.end(), cacheEntry);
+            data->reasons.insert(data->reasons.end(), reason);
         }
     }
     
@@ -216,8 +222,51 @@ bool parseDirCallback(pdCallbackData &file) {
 
 
 
+/* hash the entries' files and add them to the cache in the order given, so the result is
+ * the same as hashing them one by one even though they're hashed in parallel (see
+ * digestFiles()).  a lone file is hashed the usual way, with its progress shown.  an
+ * entry whose file can't be read is left without a digest. */
+void hashToCache(vector<BackupEntry>& entries, vector<string>& reasons, digestType algorithm, BackupCache &cache) {
+    if (entries.size() == 1) {
+        if (entries[0].calculateMD5(reasons[0]))
+            cache.addOrUpdate(entries[0], true, true);
+        else {
+            log("error: unable to read " + entries[0].filename + " (" + digestName(algorithm, true) + ")" + errtext());
+            SCREENERR("error: unable to read " << entries[0].filename << " (" << digestName(algorithm, true) << ")" + errtext());
+        }
+    }
+    else if (entries.size()) {
+        statusMessage message(digestName(algorithm, true) + " " + plural(entries.size(), "file") + "...");
+        vector<string> filenames;
+        
+        for (size_t index = 0; index < entries.size(); ++index) {
+            filenames.insert(filenames.end(), entries[index].filename);
+            DEBUG(D_scan) DFMT(digestName(algorithm, true) << " " << entries[index].filename << " " << reasons[index]);
+        }
+        
+        NOTQUIET && ANIMATE && message.show();
+        auto digests = digestFiles(filenames, algorithm, GLOBALS.cli.count(CLI_THREADS) ? GLOBALS.cli[CLI_THREADS].as<int>() : (int)thread::hardware_concurrency());
+        NOTQUIET && ANIMATE && message.remove();
+        
+        for (size_t index = 0; index < entries.size(); ++index) {
+            auto &cacheEntry = entries[index];
+            cacheEntry.md5 = md5Digest::fromHex(digests[index]);
+            
+            if (!cacheEntry.md5.empty()) {
+                ++GLOBALS.md5Count;
+                cache.addOrUpdate(cacheEntry, true, true);
+            }
+            else {
+                log("error: unable to read " + cacheEntry.filename + " (" + digestName(algorithm, true) + ")");
+                SCREENERR("error: unable to read " << cacheEntry.filename << " (" << digestName(algorithm, true) << ")");
+            }
+        }
+    }
+}
+
+
 /*******************************************************************************
- * parseDirToCache(directory, fnamePattern, cache)
+ * parseDirToCache(directory, fnamePattern, algorithm, cache)
  *
  * [for single-file backups only]
  * Recursively walk the given directory looking for all files that match the
@@ -231,14 +280,87 @@ bool parseDirCallback(pdCallbackData &file) {
  *      update everything in the cache, most noteably, calcuclate its md5
  *
  *  (c) if a file isn't in the cache create the entry and treat it as (b) above
+ *
+ * Directories that haven't changed since they were last read (see DirStamps.h)
+ * aren't read again; the files the cache has in them are stat'd and handled
+ * the same way.
+ *
+ * The md5s for (b) and (c) are calculated after the walk, several files at a
+ * time (--threads), using the profile's digest ('algorithm').  Files in (a)
+ * keep the digest they were cached with, even if the profile has since changed
+ * to another, unless they're the same size as a file that has the new one (i.e.
+ * they might be identical to it); those are rehashed so that identical backups
+ * still share a digest for linking and stats.  Old digests are otherwise
+ * replaced as files come to be rehashed for other reasons.
  *******************************************************************************/
-void parseDirToCache(string directory, string fnamePattern, BackupCache &cache) {
+void parseDirToCache(string directory, string fnamePattern, digestType algorithm, BackupCache &cache) {
     Pcre tempRE("\\.tmp\\.\\d+$");
     parseDirDataType data;
     data.tempRE = &tempRE;
     data.cache = &cache;
+    data.algorithm = algorithm;
+    
+    processDirectoryBackups(ue(directory), fnamePattern, false, parseDirCallback, &data, SINGLE_ONLY, -1, true, &cache.dirStamps);
+    
+    // directories that haven't changed since they were last read were skipped; the cache
+    // already knows what's in them, but the files themselves still get a stat for their
+    // links & inode (and in case one was rewritten in place)
+    vector<string> heldFiles;
+    for (auto entry: cache.getAll())
+        if (!entry->current && cache.dirStamps.holds(entry->filename))
+            heldFiles.insert(heldFiles.end(), entry->filename);
+
+    for (auto &heldFile: heldFiles) {
+        pdCallbackData file;
+        file.filename = heldFile;
+        file.depth = 0;
+        file.dirEntries = 0;
+        file.dataPtr = &data;
+
+        if (!mystat(heldFile, &file.statData))
+            parseDirCallback(file);
+    }
+    
+    hashToCache(data.toMD5, data.reasons, algorithm, cache);
+    
+    // files with another digest that could be identical to one with the profile's;
+    // of those that share an inode only the first is hashed and the rest copy it
+    set<unsigned long> sizes;
+    for (auto entry: cache.getAll())
+        if (entry->current && entry->algorithm == algorithm && !entry->md5.empty())
+            sizes.insert(entry->size);
     
-    processDirectoryBackups(ue(directory), fnamePattern, false, parseDirCallback, &data, SINGLE_ONLY);
+    vector<BackupEntry> toRehash, sameInode;
+    vector<string> reasons;
+    map<unsigned long, size_t> inodes;
+    
+    for (auto entry: cache.getAll())
+        if (entry->current && entry->algorithm != algorithm && sizes.count(entry->size)) {
+            auto inode_it = inodes.find(entry->inode);
+            
+            if (entry->inode && inode_it != inodes.end())
+                sameInode.insert(sameInode.end(), *entry);
+            else {
+                inodes[entry->inode] = toRehash.size();
+                toRehash.insert(toRehash.end(), *entry);
+                toRehash.back().algorithm = algorithm;
+                reasons.insert(reasons.end(), "{digest change}");
+            }
+        }
+    
+    hashToCache(toRehash, reasons, algorithm, cache);
+    
+    for (auto &entry: sameInode) {
+        auto &rehashed = toRehash[inodes[entry.inode]];
+        
+        if (!rehashed.md5.empty()) {
+            entry.md5 = rehashed.md5;
+            entry.algorithm = algorithm;
+            cache.addOrUpdate(entry, true, true);
+        }
+    }
+    
+    cache.dirStamps.save();
 }
 
 
@@ -286,7 +408,7 @@ void scanConfigToCache(BackupConfig &config) {
         }
     }
     
-    parseDirToCache(directory, fnamePattern, config.cache);
+    parseDirToCache(directory, fnamePattern, config.digest(), config.cache);
 }
 
 
@@ -537,10 +659,10 @@ BackupConfig *selectOrSetupConfig(ConfigManager &configManager, bool allowDefaul
         !GLOBALS.cli.count(CLI_HOLD) &&
         !GLOBALS.cli.count(CLI_MAPTAGHOLD) &&
 
-        // & user hasn't selected --all/--All where there's a dir configured in at least one (first)
-        // profile
+        // & user hasn't selected --all/--All (or --multiplex) where there's a dir configured in at
+        // least one (first) profile
         !((GLOBALS.cli.count(CLI_ALLSEQ) || GLOBALS.cli.count(CLI_ALLPAR) ||
-           GLOBALS.cli.count(CLI_CRONS) || GLOBALS.cli.count(CLI_CRONP)) &&
+           GLOBALS.cli.count(CLI_CRONS) || GLOBALS.cli.count(CLI_CRONP) || GLOBALS.cli.count(CLI_MULTIPLEX)) &&
           configManager.configs.size() &&
           configManager.configs[0].settings[sDirectory].value.length())) {
         SCREENERR("error: --directory is required, or a --profile previously saved with a directory");
@@ -687,11 +809,14 @@ void pruneFaubBackups(BackupConfig &config) {
             auto deadBackupIt = cacheEntryIt++;
             auto savedMtime = filename2Mtime(deadBackupIt->first);
             
-            // remove the backup's cache files
-            config.fcache.removeBackup(deadBackupIt);
-            
-            // recalculate the disk usage (dus) for the subsequent backup
-            config.fcache.recache("", savedMtime, false);
+            // remove the backup's cache files. the inode index updates the subsequent
+            // backup's disk usage; without one it has to be recalculated (dus).
+            size_t freed = 0;
+            auto dir = deadBackupIt->second.getDir();
+            if (config.fcache.removeBackup(deadBackupIt, &freed))
+                log(config.ifTitle() + " freed " + approximate(freed) + " removing " + dir);
+            else
+                config.fcache.recache("", savedMtime, false);
         }
     }
     
@@ -749,16 +874,14 @@ bool shouldPrune(BackupConfig &config) {
         }
         // single-file style failsafe
         else {
-            for (auto &fnameIdx : config.cache.indexByFilename) {
-                auto raw_it = config.cache.rawData.find(fnameIdx.second);
-                
+            for (auto entry : config.cache.getSorted()) {
                 descrip = "";
-                if (raw_it != config.cache.rawData.end() && raw_it->second.fnameDayAge <= fd) {
+                if (entry->fnameDayAge <= fd) {
                     ++minValidBackups;
                     descrip = " [valid for fs]";
                 }
                 
-                DEBUG(D_prune) DFMT("failsafe: " << raw_it->second.filename << " (age=" << raw_it->second.fnameDayAge
+                DEBUG(D_prune) DFMT("failsafe: " << entry->filename << " (age=" << entry->fnameDayAge
                                     << ")" << descrip);
                 
                 if (minValidBackups >= fb)
@@ -802,78 +925,67 @@ void pruneBackups(BackupConfig &config) {
         return;
     }
     
-    set<string> changedMD5s;
+    set<md5Digest> changedMD5s;
     DEBUG(D_prune) DFMT("weeklies set to dow " << dw(config.settings[sDOW].ivalue()));
     
     size_t backupAge = 0, backupCountOnDay = 0, backupsPruned = 0;
     auto fsSlowLimit = config.settings[sFailsafeSlow].ivalue();
     
-    // loop through the filename index sorted by filename (i.e. all backups by age)
-    for (auto fIdx_it = config.cache.indexByFilename.begin(), next_it = fIdx_it;
-         fIdx_it != config.cache.indexByFilename.end(); fIdx_it = next_it) {
-        // the second iterator (next_it) is necessary because a function called within
-        // this loop (config.cache.remove()) calls erase() on our primary iterator. while
-        // that appears to be handled on darwin it crashes under linux. next_it allows
-        // the loop to track the next value for the iterator without dereferencing a deleted
-        // pointer.
-        ++next_it;
-        
+    // loop through the backups sorted by filename (i.e. by age).  removing entries from
+    // the cache as we go leaves the others where they are.
+    for (auto entry : config.cache.getSorted()) {
         if (fsSlowLimit && backupsPruned >= fsSlowLimit) {
             DEBUG(D_prune) DFMT("failsafe_slow limit reached (" << plural(fsSlowLimit, "backup") << " pruned, aborting further prunes");
             break;
         }
         
-        auto raw_it = config.cache.rawData.find(fIdx_it->second);
+        unsigned long filenameAge = entry->fnameDayAge;
+        int filenameDOW = entry->dow;
         
-        if (raw_it != config.cache.rawData.end()) {
-            unsigned long filenameAge = raw_it->second.fnameDayAge;
-            int filenameDOW = raw_it->second.dow;
-            
-            auto shouldKeep = pruneShouldKeep(config, raw_it->second.filename, (int)filenameAge,
-                                              filenameDOW, raw_it->second.date_day,
-                                              raw_it->second.date_month, raw_it->second.date_year);
-            
-            if (backupAge != filenameAge) {
-                backupAge = filenameAge;
-                backupCountOnDay = 1;
-            }
-            else
-                backupCountOnDay += 1;
-            
-            // if standard retention pruning deletes this backup and there's only one other
-            // backup on this day, we don't want consolidation to delete the other one
-            if (!shouldKeep.length()) backupCountOnDay -= 1;
-            
-            auto shouldConsolidate = config.settings[sConsolidate].ivalue() && backupAge >= config.settings[sConsolidate].ivalue() && backupCountOnDay > 1;
-            
-            
-            if (shouldKeep.length() && !shouldConsolidate) {
-                DEBUG(D_prune) DFMT(shouldKeep);
-                continue;
+        auto shouldKeep = pruneShouldKeep(config, entry->filename, (int)filenameAge,
+                                          filenameDOW, entry->date_day,
+                                          entry->date_month, entry->date_year);
+        
+        if (backupAge != filenameAge) {
+            backupAge = filenameAge;
+            backupCountOnDay = 1;
+        }
+        else
+            backupCountOnDay += 1;
+        
+        // if standard retention pruning deletes this backup and there's only one other
+        // backup on this day, we don't want consolidation to delete the other one
+        if (!shouldKeep.length()) backupCountOnDay -= 1;
+        
+        auto shouldConsolidate = config.settings[sConsolidate].ivalue() && backupAge >= config.settings[sConsolidate].ivalue() && backupCountOnDay > 1;
+        
+        
+        if (shouldKeep.length() && !shouldConsolidate) {
+            DEBUG(D_prune) DFMT(shouldKeep);
+            continue;
+        }
+        
+        if (GLOBALS.cli.count(CLI_TEST))
+            cout << YELLOW << config.ifTitle() << " TESTMODE: would have deleted "
+            << entry->filename << " (age=" + to_string(filenameAge)
+            << ", dow=" + dw(filenameDOW) << ")" << (shouldConsolidate ? " consolidation" : "") << RESET << endl;
+        else {
+            // delete the file and remove it from all caches
+            if (!unlink(entry->filename.c_str())) {
+                NOTQUIET && cout << "\t• " << config.ifTitle() + " removed " << entry->filename << (shouldConsolidate ? " (consolidation)" : "") << endl;
+                log(config.ifTitle() + " removed " + entry->filename +
+                    " (age=" + to_string(filenameAge) + ", dow=" + dw(filenameDOW) + ")" + (shouldConsolidate ? " consolidation" : ""));
+                
+                auto fname = entry->filename;
+                changedMD5s.insert(entry->md5);
+                config.cache.remove(*entry);
+                config.cache.updated = true;  // updated causes the cache to get saved in the BackupCache destructor
+                DEBUG(D_prune) DFMT("completed removal of " << fname);
+                ++backupsPruned;
             }
-            
-            if (GLOBALS.cli.count(CLI_TEST))
-                cout << YELLOW << config.ifTitle() << " TESTMODE: would have deleted "
-                << raw_it->second.filename << " (age=" + to_string(filenameAge)
-                << ", dow=" + dw(filenameDOW) << ")" << (shouldConsolidate ? " consolidation" : "") << RESET << endl;
             else {
-                // delete the file and remove it from all caches
-                if (!unlink(raw_it->second.filename.c_str())) {
-                    NOTQUIET && cout << "\t• " << config.ifTitle() + " removed " << raw_it->second.filename << (shouldConsolidate ? " (consolidation)" : "") << endl;
-                    log(config.ifTitle() + " removed " + raw_it->second.filename +
-                        " (age=" + to_string(filenameAge) + ", dow=" + dw(filenameDOW) + ")" + (shouldConsolidate ? " consolidation" : ""));
-                    
-                    auto fname = raw_it->second.filename;
-                    changedMD5s.insert(raw_it->second.md5);
-                    config.cache.remove(raw_it->second);
-                    config.cache.updated = true;  // updated causes the cache to get saved in the BackupCache destructor
-                    DEBUG(D_prune) DFMT("completed removal of " << fname);
-                    ++backupsPruned;
-                }
-                else {
-                    log(config.ifTitle() + " unable to remove " + (shouldConsolidate ? " (consolidation) " : "") + raw_it->second.filename + errtext());
-                    SCREENERR(string("unable to remove ") + (shouldConsolidate ? " (consolidation) " : "") + raw_it->second.filename + errtext());
-                }
+                log(config.ifTitle() + " unable to remove " + (shouldConsolidate ? " (consolidation) " : "") + entry->filename + errtext());
+                SCREENERR(string("unable to remove ") + (shouldConsolidate ? " (consolidation) " : "") + entry->filename + errtext());
             }
         }
     }
@@ -906,8 +1018,8 @@ void updateLinks(BackupConfig &config)
     bool rescanRequired;
     unsigned long maxedOutLinkedFiles = 0;
     
-    /* The indexByMD5 is a list of lists ("map" of "set"s).  Here we loop through the list of MD5s
-     * (the map) once.  For each MD5, we loop through its list of associated files (the set) twice:
+    /* The MD5 index is a list of lists (a hash of id lists).  Here we loop through the list of MD5s
+     * once.  For each MD5, we loop through its list of associated files twice:
      *     - 1st time to find the file with the greatest number of existing hard links (call this
      * the reference file)
      *     - 2nd time to relink any individual file to the reference file
@@ -918,9 +1030,9 @@ void updateLinks(BackupConfig &config)
     
     if (maxLinksAllowed < 2) return;
     
-    // loop through list of MD5s (the map)
-    set<string> changedMD5s;
-    for (auto &md5 : config.cache.indexByMD5) {
+    // loop through list of MD5s
+    set<md5Digest> changedMD5s;
+    for (auto &md5 : config.cache.getMD5Index()) {
         // only consider md5s with more than one file associated
         if (md5.second.size() < 2) continue;
         
@@ -941,23 +1053,23 @@ void updateLinks(BackupConfig &config)
             
             DEBUG(D_link) DFMT("top of scan for " << md5.first);
             
-            // 1st time: loop through the list of files (the set)
+            // 1st time: loop through the list of files
             for (auto &fileID : md5.second) {
-                auto raw_it = config.cache.rawData.find(fileID);
+                auto entry = config.cache.getById(fileID);
                 
-                if (raw_it != config.cache.rawData.end()) {
+                if (entry != NULL) {
                     DEBUG(D_link)
                     DFMT("ref loop - considering for ref file "
-                         << raw_it->second.filename << " (links=" << raw_it->second.links
+                         << entry->filename << " (links=" << entry->links
                          << ", found=" << maxLinksFound << ", max=" << maxLinksAllowed
-                         << ", age=" << raw_it->second.fnameDayAge << ")");
+                         << ", age=" << entry->fnameDayAge << ")");
                     
-                    if (raw_it->second.links > maxLinksFound &&   // more links than previous files for this md5
-                        raw_it->second.links < maxLinksAllowed && // still less than the configured max
-                        raw_it->second.fnameDayAge) {                 // at least a day old (i.e. don't relink today's file)
+                    if (entry->links > maxLinksFound &&   // more links than previous files for this md5
+                        entry->links < maxLinksAllowed && // still less than the configured max
+                        entry->fnameDayAge) {                 // at least a day old (i.e. don't relink today's file)
                         
-                        referenceFile = &raw_it->second;
-                        maxLinksFound = raw_it->second.links;
+                        referenceFile = entry;
+                        maxLinksFound = entry->links;
                         
                         DEBUG(D_link)
                         DFMT("ref loop - new ref file selected " << referenceFile->md5 << " "
@@ -975,46 +1087,47 @@ void updateLinks(BackupConfig &config)
                 continue;
             }
             
-            // 2nd time: loop through the list of files (the set)
+            // 2nd time: loop through the list of files
             for (auto &fileID : md5.second) {
-                auto raw_it = config.cache.rawData.find(fileID);
-                DEBUG(D_link) DFMT("\tlink loop - examining " << raw_it->second.filename);
+                auto entry = config.cache.getById(fileID);
                 
-                if (raw_it != config.cache.rawData.end()) {
+                if (entry != NULL) {
+                    DEBUG(D_link) DFMT("\tlink loop - examining " << entry->filename);
+                    
                     // skip the reference file; can't relink it to itself
-                    if (referenceFile == &raw_it->second) {
+                    if (referenceFile == entry) {
                         DEBUG(D_link) DFMT("\t\treference file itself");
                         continue;
                     }
                     
                     // skip files that are already linked
-                    if (referenceFile->inode == raw_it->second.inode) {
+                    if (referenceFile->inode == entry->inode) {
                         DEBUG(D_link) DFMT("\t\talready linked");
                         continue;
                     }
                     
                     // skip today's file as it could still be being updated
-                    if (!raw_it->second.fnameDayAge && !includeTime) {
+                    if (!entry->fnameDayAge && !includeTime) {
                         DEBUG(D_link) DFMT("\t\ttoday's file");
                         continue;
                     }
                     
                     // skip if this file already has the max links
-                    if (raw_it->second.links >= maxLinksAllowed) {
+                    if (entry->links >= maxLinksAllowed) {
                         DEBUG(D_link) DFMT("\t\tfile links already maxed out");
                         ++maxedOutLinkedFiles;
                         continue;
                     }
                     
                     // relink the file to the reference file
-                    string detail = raw_it->second.filename + " <-> " + referenceFile->filename;
+                    string detail = entry->filename + " <-> " + referenceFile->filename;
                     if (GLOBALS.cli.count(CLI_TEST))
                         cout << YELLOW << config.ifTitle() << " TESTMODE: would have linked "
                         << detail << RESET << endl;
                     else {
-                        if (!unlink(raw_it->second.filename.c_str())) {
+                        if (!unlink(entry->filename.c_str())) {
                             if (!link(referenceFile->filename.c_str(),
-                                      raw_it->second.filename.c_str())) {
+                                      entry->filename.c_str())) {
                                 NOTQUIET &&cout << "\t• linked " << detail << endl;
                                 log(config.ifTitle() + " linked " + detail);
                                 
@@ -1031,11 +1144,11 @@ void updateLinks(BackupConfig &config)
                             }
                         }
                         else {
-                            SCREENERR("error: unable to remove " << raw_it->second.filename
+                            SCREENERR("error: unable to remove " << entry->filename
                                       << " in prep to link it"
                                       << errtext());
                             log(config.ifTitle() + " error: unable to remove " +
-                                raw_it->second.filename + " in prep to link it" +
+                                entry->filename + " in prep to link it" +
                                 errtext());
                         }
                     }
@@ -1077,6 +1190,13 @@ string interpolate(string command, string subDir, string fullDirectory, string b
     return (command);
 }
 
+// scp & sftp take their bandwidth limit (-l) in Kbit/s
+string transferLimitParam() {
+    auto rate = GLOBALS.netLimit.currentRate();
+    return rate ? " -l " + to_string(max(rate * 8 / 1000, (size_t)1)) : "";
+}
+
+
 /*******************************************************************************
  * sCpBackup(config, backupFilename, subDir, sCpParams)
  *
@@ -1105,7 +1225,7 @@ methodStatus sCpBackup(BackupConfig &config, string backupFilename, string subDi
     
     // execute the scp
     sCpTime.start();
-    int result = system(string(sCpBinary + " " + backupFilename + " " + sCpParams).c_str());
+    int result = system(string(sCpBinary + transferLimitParam() + " " + backupFilename + " " + sCpParams).c_str());
     
     sCpTime.stop();
     NOTQUIET && ANIMATE && screenMessage.remove();
@@ -1135,7 +1255,7 @@ methodStatus sFtpBackup(BackupConfig &config, string backupFilename, string subD
     string sFtpBinary = locateBinary("sftp");
     bool makeDirs = sFtpParams.find("//") == string::npos;
     strReplaceAll(sFtpParams, "//", "/");
-    PipeExec sFtp(sFtpBinary + " " + sFtpParams);
+    PipeExec sFtp(sFtpBinary + transferLimitParam() + " " + sFtpParams);
     string command;
     timer sFtpTime;
     
@@ -1302,6 +1422,43 @@ bool performTripwire(BackupConfig &config)
 }
 
 
+/*******************************************************************************
+ * likelyDuplicate(config)
+ *
+ * A new backup is most likely to be identical to the most recent one.  Return the
+ * file a new backup should be compared against as it's written (see
+ * PipeExec::execute2file()): whichever copy of the most recent backup's content
+ * updateLinks() would pick as its reference file, i.e. the one with the most links
+ * that's at least a day old and can take another link.  Empty if there's no such
+ * file or linking is disabled.
+ *******************************************************************************/
+string likelyDuplicate(BackupConfig &config) {
+    unsigned int maxLinksAllowed = config.settings[sMaxLinks].ivalue();
+    auto backups = config.cache.getSorted();
+    
+    if (maxLinksAllowed < 2 || !backups.size() || backups.back()->md5.empty())
+        return "";
+    
+    auto md5_it = config.cache.getMD5Index().find(backups.back()->md5);
+    if (md5_it == config.cache.getMD5Index().end())
+        return "";
+    
+    BackupEntry *referenceFile = NULL;
+    unsigned int maxLinksFound = 0;
+    
+    for (auto &fileID: md5_it->second) {
+        auto entry = config.cache.getById(fileID);
+        
+        if (entry != NULL && entry->links > maxLinksFound && entry->links < maxLinksAllowed && entry->fnameDayAge) {
+            referenceFile = entry;
+            maxLinksFound = entry->links;
+        }
+    }
+    
+    return referenceFile == NULL ? "" : referenceFile->filename;
+}
+
+
 /*******************************************************************************
  * performBackup(config)
  *
@@ -1356,10 +1513,14 @@ void performBackup(BackupConfig &config) {
     backupTime.start();
     
     // begin backing up
+    // identical output is linked to the likely duplicate as it's written, rather than
+    // being written out in full and linked by updateLinks() later
     PipeExec backup(setCommand);
+    string digest;
+    string likelyMatch = likelyDuplicate(config);
     GLOBALS.interruptFilename = backupFilename + tempExtension;
-    backup.execute2file(GLOBALS.interruptFilename,
-                        GLOBALS.cli.count(CLI_LEAVEOUTPUT) ? config.settings[sTitle].value : "");
+    bool written = backup.execute2file(GLOBALS.interruptFilename,
+                                       GLOBALS.cli.count(CLI_LEAVEOUTPUT) ? config.settings[sTitle].value : "", &digest, likelyMatch, config.digest());
     GLOBALS.interruptFilename = "";  // interruptFilename gets cleaned up on SIGINT & SIGTERM
     
     // note finish time
@@ -1367,14 +1528,26 @@ void performBackup(BackupConfig &config) {
     NOTQUIET && ANIMATE && screenMessage.remove();
     
     // determine results
+    // output that couldn't all be written (e.g. a full disk) leaves a truncated temp file
+    // that mustn't be renamed & cached as a good backup; execute2file() logged why
     struct stat statData;
-    if (!mystat(string(backupFilename + tempExtension), &statData)) {
+    if (!written) {
+        unlink(string(backupFilename + tempExtension).c_str());
+        notify(config,
+               errorcom(config.ifTitle(), "backup failed to " + backupFilename +
+                        " (unable to write the backup's output)") +
+               "\n",
+               false);
+        backup.flushErrors();
+    }
+    else if (!mystat(string(backupFilename + tempExtension), &statData)) {
         if (statData.st_size >= approx2bytes(config.settings[sMinSize].value)) {
             backup.flushErrors();
             
-            // calculate the md5 while its still a temp file so that its ignored by other
-            // invocations of managebackups (i.e. someone running -0 while a backup is still
-            // running in the background). then rename the file when we're all done.
+            // the md5 was calculated as the backup was written.  if that didn't work out, calculate
+            // it now while its still a temp file so that its ignored by other invocations of
+            // managebackups (i.e. someone running -0 while a backup is still running in the
+            // background). then rename the file when we're all done.
             BackupEntry cacheEntry;
             cacheEntry.filename = backupFilename + tempExtension;
             cacheEntry.links = statData.st_nlink;
@@ -1383,7 +1556,13 @@ void performBackup(BackupConfig &config) {
             cacheEntry.size = statData.st_size;
             cacheEntry.duration = backupTime.seconds();
             cacheEntry.updateAges(backupTime.getEndTimeSecs());
-            cacheEntry.calculateMD5();
+            cacheEntry.algorithm = config.digest();
+            cacheEntry.md5 = md5Digest::fromHex(digest);
+            
+            if (cacheEntry.md5.empty())
+                cacheEntry.calculateMD5();
+            else
+                ++GLOBALS.md5Count;
             
             // rename the file
             if (!rename(string(backupFilename + tempExtension).c_str(), backupFilename.c_str())) {
@@ -1404,6 +1583,13 @@ void performBackup(BackupConfig &config) {
                 log(config.ifTitle() + " " + message);
                 NOTQUIET &&cout << "\t• " << config.ifTitle() << " " << message << endl;
                 
+                // a freshly written file has a single link; more means it was linked to likelyMatch
+                if (statData.st_nlink > 1) {
+                    string detail = backupFilename + " <-> " + likelyMatch;
+                    NOTQUIET && cout << "\t• linked " << detail << endl;
+                    log(config.ifTitle() + " linked " + detail);
+                }
+                
                 try {  // could get an exception converting settings[sMode] to an octal number
                     int mode = (int)strtol(config.settings[sMode].value.c_str(), NULL, 8);
                     
@@ -1495,20 +1681,11 @@ void performBackup(BackupConfig &config) {
      time as any.
      */
     
-    for (auto fIdx_it = config.cache.indexByFilename.begin(), next_it = fIdx_it; fIdx_it != config.cache.indexByFilename.end(); fIdx_it = next_it) {
-        // the second iterator (next_it) is necessary because a function called within
-        // this loop (config.cache.remove()) calls erase() on our primary iterator. next_it allows
-        // the loop to track the next value for the iterator without dereferencing a deleted
-        // pointer.
-        ++next_it;
-        
-        if (!exists(fIdx_it->first)) {
-            auto rawIt = config.cache.rawData.find(fIdx_it->second);
-            if (rawIt != config.cache.rawData.end()) {
-                log(config.ifTitle() + " " + fIdx_it->first + " has vanished, updating cache");
-                config.cache.remove(rawIt->second);
-                config.cache.updated = true;
-            }
+    for (auto entry : config.cache.getSorted()) {
+        if (!exists(entry->filename)) {
+            log(config.ifTitle() + " " + entry->filename + " has vanished, updating cache");
+            config.cache.remove(*entry);
+            config.cache.updated = true;
         }
     }
 }
@@ -1762,7 +1939,7 @@ void relocateBackups(BackupConfig &config, string newBaseDir) {
     
     bool sameFS = isSameFileSystem(oldBaseDir, newBaseDir);
     
-    auto numBackups = config.isFaub() ? config.fcache.getNumberOfBackups() : config.cache.rawData.size();
+    auto numBackups = config.isFaub() ? config.fcache.getNumberOfBackups() : config.cache.numberOfBackups();
     NOTQUIET && ANIMATE && cout << "moving backups " << (sameFS ? "[local filesystem]... " : "[cross-filesystem]... ");
     
     // declare the crossFSDataType to hold the inode map.  we pass this to all the moveBackup() calls so it can use it
@@ -1782,26 +1959,20 @@ void relocateBackups(BackupConfig &config, string newBaseDir) {
             ++backupIt;
         }
     }
-    else
-        for (auto fIdx_it = config.cache.indexByFilename.begin(), next_it = fIdx_it;
-             fIdx_it != config.cache.indexByFilename.end(); fIdx_it = next_it) {
-            // the second iterator (next_it) is necessary because a function called within
-            // this loop (config.cache.remove()) calls erase() on our primary iterator. next_it allows
-            // the loop to track the next value for the iterator without dereferencing a deleted
-            // pointer.
-            ++next_it;
-            
-            NOTQUIET && ANIMATE && cout << progressPercentageA((int)numBackups, 1, (int)distance(config.cache.indexByFilename.begin(), fIdx_it), 1, fIdx_it->first) << flush;
+    else {
+        auto entries = config.cache.getSorted();
+        
+        for (size_t index = 0; index < entries.size(); ++index) {
+            auto entry = entries[index];
+            NOTQUIET && ANIMATE && cout << progressPercentageA((int)numBackups, 1, (int)index, 1, entry->filename) << flush;
             
-            if (!moveBackup(fIdx_it->first, oldBaseDir, newBaseDir, sameFS, numBackups, fsData)) {
-                auto rawIt = config.cache.rawData.find(fIdx_it->second);
-                if (rawIt != config.cache.rawData.end()) {
-                    log(config.ifTitle() + " " + fIdx_it->first + " has vanished, updating cache");
-                    config.cache.remove(rawIt->second);
-                    config.cache.updated = true;
-                }
+            if (!moveBackup(entry->filename, oldBaseDir, newBaseDir, sameFS, numBackups, fsData)) {
+                log(config.ifTitle() + " " + entry->filename + " has vanished, updating cache");
+                config.cache.remove(*entry);
+                config.cache.updated = true;
             }
         }
+    }
     
     NOTQUIET && ANIMATE && cout << progressPercentageA(0) << "\nupdating config..." << flush;
     
@@ -1837,34 +2008,34 @@ struct replicateDataType {
 };
 
 
-bool replicateCallback1(pdCallbackData &file) {
-    replicateDataType *replicateData = (replicateDataType*)file.dataPtr;
-    string newFilename = file.filename;
-    newFilename.replace(0, file.topLevelDir.length(), "");
-    newFilename = slashConcat(replicateData->dataDir, newFilename);
+/*
+ * replicateEntry()
+ * Bring newFilename in the replica in line with the backup's entry 'source'.
+ */
+void replicateEntry(string source, struct stat& sourceStat, string newFilename, replicateDataType *replicateData) {
     struct stat targetStat;
     
     auto targetExists = !mylstat(newFilename.c_str(), &targetStat);
 
-    if (S_ISDIR(file.statData.st_mode)) {
-        if (!targetExists || !statModeOwnerTimeEqual(targetStat, file.statData)) {
-            if (mkdirp(newFilename, file.statData.st_mode)) {
+    if (S_ISDIR(sourceStat.st_mode)) {
+        if (!targetExists || !statModeOwnerTimeEqual(targetStat, sourceStat)) {
+            if (mkdirp(newFilename, sourceStat.st_mode)) {
                 log("error: creating directory " + newFilename + errtext());
                 SCREENERR("error: unable to create directory " + newFilename + errtext());
                 exit(1);
             }
-            setFilePerms(newFilename, file.statData);
+            setFilePerms(newFilename, sourceStat);
             replicateData->changes++;
         }
     }
     else {
         auto ps = pathSplit(newFilename);
         
-        if (S_ISLNK(file.statData.st_mode)) {
-            auto sourceTarget = readlink(file.filename);
+        if (S_ISLNK(sourceStat.st_mode)) {
+            auto sourceTarget = readlink(source);
             auto targetTarget = readlink(newFilename);
             
-            if (!targetExists || sourceTarget != targetTarget || file.statData.st_uid != targetStat.st_uid || file.statData.st_gid != targetStat.st_gid) {
+            if (!targetExists || sourceTarget != targetTarget || sourceStat.st_uid != targetStat.st_uid || sourceStat.st_gid != targetStat.st_gid) {
                 if (targetExists) {
                     if (unlink(newFilename.c_str())) {
                         log("error: unable to delete " + newFilename + " in prep to recreate it" + errtext());
@@ -1884,13 +2055,13 @@ bool replicateCallback1(pdCallbackData &file) {
                     SCREENERR("error: unable to create symlink " + newFilename + " -> " + sourceTarget + errtext());
                     exit(1);
                 }
-                setFilePerms(newFilename, file.statData);
+                setFilePerms(newFilename, sourceStat);
                 replicateData->changes++;
             }
             
         }
         else
-            if (!targetExists || file.statData.st_ino != targetStat.st_ino) {
+            if (!targetExists || sourceStat.st_ino != targetStat.st_ino) {
                 if (targetExists) {
                     if (unlink(newFilename.c_str())) {
                         log("error: unable to delete " + newFilename + " in prep to recreate it" + errtext());
@@ -1910,9 +2081,9 @@ bool replicateCallback1(pdCallbackData &file) {
                         setFilePerms(ps.dir, containingDirStat);
                 }
                                 
-                if (link(file.filename.c_str(), newFilename.c_str())) {
-                    log("error: creating link " + newFilename + " to " + file.filename + errtext());
-                    SCREENERR("error: unable to create link " + newFilename + " to " + file.filename + errtext());
+                if (link(source.c_str(), newFilename.c_str())) {
+                    log("error: creating link " + newFilename + " to " + source + errtext());
+                    SCREENERR("error: unable to create link " + newFilename + " to " + source + errtext());
                     exit(1);
                 }
 
@@ -1920,7 +2091,15 @@ bool replicateCallback1(pdCallbackData &file) {
                 // owner/mode/time don't need to be set on hardlinks because they share them with the original file
             }
     }
+}
+
+
+bool replicateCallback1(pdCallbackData &file) {
+    replicateDataType *replicateData = (replicateDataType*)file.dataPtr;
+    string newFilename = file.filename;
+    newFilename.replace(0, file.topLevelDir.length(), "");
     
+    replicateEntry(file.filename, file.statData, slashConcat(replicateData->dataDir, newFilename), replicateData);
     return true;
 }
 
@@ -1953,6 +2132,97 @@ bool replicateCallback2(pdCallbackData &file) {
 }
 
 
+/*
+ * replicateIncremental()
+ * Bring a replica last made from the backup 'fromDir' up to date with the most recent
+ * backup using only the records kept as each backup was taken: the paths that changed
+ * (faub_diff), the files that disappeared between one manifest and the next and the
+ * directories & symlinks that came or went between one faub_dirlinks and the next. The
+ * work is proportional to the changes rather than to the size of the backup.  Returns
+ * false, having touched nothing, if those records can't account for every change; the
+ * caller then falls back to walking both trees.
+ */
+bool replicateIncremental(BackupConfig &config, string fromDir, string newBaseDir, replicateDataType &replicateData) {
+    auto fromIt = config.fcache.getBackupByDir(fromDir);
+    auto lastIt = config.fcache.getLastBackup();
+    
+    if (fromIt == config.fcache.getEnd() || fromIt->first != fromDir)
+        return false;
+
+    set<string> paths;
+    map<string, manifestEntry> prevManifest;
+    set<string> prevDirLinks;
+    
+    if (fromIt != lastIt && (!fromIt->second.loadManifest(prevManifest) || !fromIt->second.loadDirLinks(prevDirLinks)))
+        return false;
+    
+    for (auto prevIt = fromIt; prevIt != lastIt; ++prevIt) {
+        auto backupIt = next(prevIt);
+        map<string, manifestEntry> manifest;
+        set<string> dirLinks;
+
+        if (!backupIt->second.loadDiffFiles(paths) || !backupIt->second.loadManifest(manifest) ||
+            !backupIt->second.loadDirLinks(dirLinks))
+            return false;
+        
+        for (auto &entry: prevManifest)
+            if (manifest.find(entry.first) == manifest.end())
+                paths.insert(paths.end(), entry.first);
+        
+        // faub_diff doesn't list directories, so any that come or go are found here along with symlinks
+        set_symmetric_difference(prevDirLinks.begin(), prevDirLinks.end(), dirLinks.begin(), dirLinks.end(), inserter(paths, paths.end()));
+        
+        prevManifest = move(manifest);
+        prevDirLinks = move(dirLinks);
+    }
+    
+    DEBUG(D_any) DFMT("incremental replication from " << fromDir << ": " << plural(paths.size(), "path"));
+    
+    string lastBackupDir = lastIt->first;
+    set<string> parentDirs;
+    
+    for (auto &path: paths) {
+        string source = slashConcat(lastBackupDir, path);
+        string removeFrom = path;
+        struct stat statData;
+        
+        if (!mylstat(source, &statData))
+            replicateEntry(source, statData, slashConcat(newBaseDir, path), &replicateData);
+        else {
+            // gone from the backup; remove it along with any directories that went with it
+            for (auto ps = pathSplit(removeFrom); ps.dir != "/" && ps.dir != "." && !exists(slashConcat(lastBackupDir, ps.dir)); ps = pathSplit(removeFrom))
+                removeFrom = ps.dir;
+            
+            string target = slashConcat(newBaseDir, removeFrom);
+            struct stat targetStat;
+            if (!mylstat(target, &targetStat)) {
+                if (S_ISDIR(targetStat.st_mode) ? !rmrf(target) : unlink(target.c_str())) {
+                    log("error: unable to remove for replication " + target + errtext());
+                    SCREENERR("error: unable to remove " + target + errtext());
+                    exit(1);
+                }
+                
+                replicateData.changes++;
+            }
+        }
+        
+        for (auto dir = pathSplit(removeFrom).dir; dir != "/" && dir != "."; dir = pathSplit(dir).dir)
+            parentDirs.insert(dir);
+    }
+    
+    // directories last (deepest first) so their mtimes aren't disturbed by the entries within them
+    for (auto dirIt = parentDirs.rbegin(); dirIt != parentDirs.rend(); ++dirIt) {
+        string source = slashConcat(lastBackupDir, *dirIt);
+        struct stat statData;
+        
+        if (!mylstat(source, &statData))
+            replicateEntry(source, statData, slashConcat(newBaseDir, *dirIt), &replicateData);
+    }
+    
+    return true;
+}
+
+
 /*
  Replication is straight-forward by walking through a file tree and making hardlinks to
  it under the traget directory. The goal here is to do so with minimal disk changes, as
@@ -1982,6 +2252,7 @@ unsigned long replicateBackup(BackupConfig &config, string newBaseDir) {
     newBaseDir = resolveGivenDirectory(newBaseDir, false);
     auto origBaseDir = config.fcache.getBaseDir();
     auto lastBackupDir = config.fcache.getLastBackup()->second.getDir();
+    bool targetExisted = exists(newBaseDir);
             
     if (newBaseDir == origBaseDir) {
         NOTQUIET && cout << GREEN << "backups for " << config.settings[sTitle].value << " are already in " << origBaseDir << RESET << endl;
@@ -2017,13 +2288,34 @@ unsigned long replicateBackup(BackupConfig &config, string newBaseDir) {
     timer replicateTimer;
     replicateTimer.start();
     
-    /* Pass 1 - walk source to add/update to target */
-    replicateData.dataDir = newBaseDir;
-    processDirectory(lastBackupDir, "", false, false, replicateCallback1, &replicateData);
-
-    /* Pass 2 - walk target to delete what's no longer in source */
-    replicateData.dataDir = lastBackupDir;
-    processDirectory(newBaseDir, "", false, false, replicateCallback2, &replicateData);
+    // the backup this target was last replicated from, if we know it
+    string stateFilename = slashConcat(GLOBALS.cacheDir, config.settings[sUUID].value, "replica." + MD5string(newBaseDir));
+    string lastReplicated;
+    ifstream stateFile(stateFilename);
+    if (targetExisted && stateFile.is_open())
+        getline(stateFile, lastReplicated);
+    stateFile.close();
+    
+    if (!lastReplicated.length() || !replicateIncremental(config, lastReplicated, newBaseDir, replicateData)) {
+        DEBUG(D_any) DFMT("full replication walk" << (lastReplicated.length() ? " (change records incomplete since " + lastReplicated + ")" : ""));
+        
+        /* Pass 1 - walk source to add/update to target */
+        replicateData.dataDir = newBaseDir;
+        processDirectory(lastBackupDir, "", false, false, replicateCallback1, &replicateData);
+        
+        /* Pass 2 - walk target to delete what's no longer in source */
+        replicateData.dataDir = lastBackupDir;
+        processDirectory(newBaseDir, "", false, false, replicateCallback2, &replicateData);
+    }
+    
+    mkdirp(pathSplit(stateFilename).dir);
+    ofstream newStateFile(stateFilename);
+    if (newStateFile.is_open()) {
+        newStateFile << lastBackupDir << endl;
+        newStateFile.close();
+    }
+    else
+        log("warning: unable to record replication state in " + stateFilename + errtext());
 
     replicateTimer.stop();
     
@@ -2082,6 +2374,135 @@ bool getGlobalStats(unsigned long& stats, unsigned long& md5s, string& elapsedTi
 }
 
 
+/*******************************************************************************
+ * lockProfile(config)
+ *
+ * Take the profile's lock for this run, clearing out a stale one.  False if a
+ * previous invocation is still running with it, in which case this run should
+ * skip the profile.
+ *******************************************************************************/
+bool lockProfile(BackupConfig &config) {
+    auto [pid, lockTime] = config.getLockPID();
+    
+    if (pid > 0) {
+        if (!kill(pid, 0)) {
+            if (GLOBALS.cli.count(CLI_FORCE)) {
+                kill(pid, 15);
+                NOTQUIET && cerr << config.ifTitle() << " previous profile lock (running as pid " << pid <<
+                ") released due to --force" << endl;
+                log("[ALL] previous lock (pid " + to_string(pid) + ") released due to --force");
+                GLOBALS.interruptLock = config.setLockPID(0);
+            }
+            if (GLOBALS.startupTime - lockTime < 60 * 60 * 24) {
+                NOTQUIET &&cerr << config.ifTitle() <<
+                " profile is locked while previous invocation is still running (pid "
+                << pid << "); skipping this run." << endl;
+                log(config.ifTitle() +
+                    " skipped run due to profile lock while previous invocation is "
+                    "still running (pid " +
+                    to_string(pid) + ")");
+                return false;
+            }
+            else {
+                notify(
+                       config,
+                       errorcom(config.ifTitle(),
+                                "abandoning previous lock because it's over 24 hours old"),
+                       false, true);
+                kill(pid, 15);
+            }
+        }
+        else
+            log(config.ifTitle() + " abandoning previous lock because pid " +
+                to_string(pid) + " has vanished");
+    }
+    
+    // locking requested
+    if (GLOBALS.cli.count(CLI_LOCK) || GLOBALS.cli.count(CLI_CRONS) ||
+        GLOBALS.cli.count(CLI_CRONP))
+        GLOBALS.interruptLock = config.setLockPID(GLOBALS.pid);
+    else
+        GLOBALS.interruptLock = config.setLockPID(-GLOBALS.pid);
+    
+    return true;
+}
+
+
+/*******************************************************************************
+ * multiplexRun(configManager)
+ *
+ * --multiplex: the NORMAL RUN (tripwire, prune, backup, replicate) for every faub
+ * profile whose client can be received over a pipe or socket (see fs_multiplexable()),
+ * with all of their backups received by a single process via FaubReceiver rather
+ * than a process per profile.  Returns false if interrupted.
+ *******************************************************************************/
+bool multiplexRun(ConfigManager &configManager) {
+    vector<BackupConfig*> profiles;
+    vector<BackupConfig*> locked;
+    
+    for (auto &config : configManager.configs)
+        if (!config.temp && !str2bool(config.settings[sArchive].value) && fs_multiplexable(config))
+            profiles.insert(profiles.end(), &config);
+    
+    int threads = GLOBALS.cli.count(CLI_THREADS) ? GLOBALS.cli[CLI_THREADS].as<int>() : (int)thread::hardware_concurrency();
+    int maxParallel = GLOBALS.cli.count(CLI_MAXPARALLEL) ? GLOBALS.cli[CLI_MAXPARALLEL].as<int>() : 0;
+    FaubReceiver receiver(threads > 0 ? threads : 1, maxParallel > 0 ? maxParallel : 0);
+    
+    log("[MULTIPLEX] starting multiplexed processing of " + plural(profiles.size(), "faub profile"));
+    NOTQUIET && cout << "starting multiplexed processing of " << plural(profiles.size(), "faub profile") << endl;
+    
+    for (auto config: profiles) {
+        if (!lockProfile(*config))
+            continue;
+        
+        locked.insert(locked.end(), config);
+        scanConfigToCache(*config);
+        
+        if (!performTripwire(*config))
+            continue;
+        
+        if (shouldPrune(*config))
+            pruneBackups(*config);
+        
+        // test mode only describes the backup, which fs_startServer() does without a client
+        if (GLOBALS.cli.count(CLI_TEST))
+            fs_startServer(*config);
+        else
+            if (!GLOBALS.cli.count(CLI_NOBACKUP))
+                receiver.add(*config);
+    }
+    
+    bool completed = receiver.run();
+    
+    if (completed) {
+        // a client that turned out to be another backup server gets a conversation of its own
+        for (auto config: receiver.handBack)
+            fs_startServer(*config);
+        
+        for (auto config: locked)
+            if (config->settings[sReplicateTo].value.length())
+                replicateBackup(*config, config->settings[sReplicateTo].value);
+        
+        configManager.housekeeping();
+        
+        // reload caches to include any newly created backups in the FastCache
+        configManager.loadAllConfigCaches();
+        for (auto &config : configManager.configs)
+            if (!config.temp)
+                scanConfigToCache(config);
+        
+        // update the fast cache
+        produceSummaryStatsWrapper(configManager, 0, true);
+    }
+    
+    for (auto config: locked)
+        config->setLockPID(0);
+    GLOBALS.interruptLock = "";
+    
+    return completed;
+}
+
+
 /*******************************************************************************
  * main(argc, argv)
  *
@@ -2172,6 +2593,9 @@ int main(int argc, char *argv[]) {
         CLI_MODE, "File mode", cxxopts::value<std::string>())(
         CLI_MINSPACE, "Minimum local space", cxxopts::value<std::string>())(
         CLI_MINSFTPSPACE, "Minimum SFTP space", cxxopts::value<std::string>())(
+        CLI_BWLIMIT, "Network bandwidth limit", cxxopts::value<std::string>())(
+        CLI_IOLIMIT, "Disk I/O limit", cxxopts::value<std::string>())(
+        CLI_DIGEST, "Content digest", cxxopts::value<std::string>())(
         CLI_RECREATE, "Recreate config", cxxopts::value<bool>()->default_value("false"))(
         CLI_INSTALLMAN, "Install man", cxxopts::value<bool>()->default_value("false"))(
         CLI_INSTALL, "Install", cxxopts::value<bool>()->default_value("false"))(
@@ -2189,6 +2613,8 @@ int main(int argc, char *argv[]) {
         CLI_THRESHOLD, "Comparison threshold", cxxopts::value<string>())(
         CLI_CONSOLIDATE, "Consolidate backups after days", cxxopts::value<int>())(
         CLI_RECALC, "Recalculate faub space", cxxopts::value<bool>()->default_value("false"))(
+        CLI_VERIFYSTATS, "Verify faub usage tally", cxxopts::value<bool>()->default_value("false"))(
+        CLI_THREADS, "Worker threads", cxxopts::value<int>())(
         CLI_BLOAT, "Bloat size warning", cxxopts::value<string>())(
         CLI_RELOCATE, "Relocate", cxxopts::value<std::string>())(
         CLI_DATAONLY, "Data only", cxxopts::value<bool>()->default_value("false"))(
@@ -2208,6 +2634,15 @@ int main(int argc, char *argv[]) {
         CLI_FORMAT, "Format output numbers", cxxopts::value<int>())(
         CLI_INTERACTIVE, "Interactive install", cxxopts::value<bool>()->default_value("false"))(
         CLI_IGNORETOUCH, "Ignore touch", cxxopts::value<bool>()->default_value("false"))(
+        CLI_AGENT, "Faub agent address", cxxopts::value<std::string>())(
+        CLI_AGENTKEY, "Faub agent key file", cxxopts::value<std::string>())(
+        CLI_LISTEN, "Run as faub agent", cxxopts::value<std::string>())(
+        CLI_UNENCRYPTED, "Allow a network faub agent", cxxopts::value<bool>()->default_value("false"))(
+        CLI_MAXPARALLEL, "Max profiles in parallel", cxxopts::value<int>())(
+        CLI_MULTIPLEX, "Receive faub profiles in one process", cxxopts::value<bool>()->default_value("false"))(
+        CLI_FANOUT, "Faub agent fan-out group size", cxxopts::value<int>())(
+        CLI_FANOUTWAIT, "Faub agent fan-out wait", cxxopts::value<int>())(
+        CLI_REPLICASOURCE, "Serve backups to a replica", cxxopts::value<bool>()->default_value("false"))(
         CLI_TRIPWIRE, "Tripwire", cxxopts::value<std::string>());
     
     try {
@@ -2336,6 +2771,21 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
     
+    if (GLOBALS.cli.count(CLI_LISTEN) &&
+        (GLOBALS.cli.count(CLI_DIR) || GLOBALS.cli.count(CLI_FAUB) || GLOBALS.cli.count(CLI_AGENT) ||
+         GLOBALS.cli.count(CLI_ALLSEQ) || GLOBALS.cli.count(CLI_ALLPAR) ||
+         GLOBALS.cli.count(CLI_CRONS) || GLOBALS.cli.count(CLI_CRONP))) {
+        SCREENERR("error: --" << CLI_LISTEN << " runs a faub agent and is incompatible with --directory, --faub, --agent, --all and --cron");
+        exit(1);
+    }
+    
+    if (GLOBALS.cli.count(CLI_MULTIPLEX) &&
+        (GLOBALS.cli.count(CLI_PROFILE) || GLOBALS.cli.count(CLI_DIR) || GLOBALS.cli.count(CLI_FAUB) ||
+         GLOBALS.cli.count(CLI_AGENT) || GLOBALS.cli.count(CLI_PATHS) || GLOBALS.cli.count(CLI_LISTEN))) {
+        SCREENERR("error: --" << CLI_MULTIPLEX << " runs all saved faub profiles and is incompatible with --profile, --directory, --faub, --agent, --path and --listen");
+        exit(1);
+    }
+    
     if ((GLOBALS.cli.count(CLI_FAUB) || GLOBALS.cli.count(CLI_PATHS)) &&
         (GLOBALS.cli.count(CLI_SFTPTO) || GLOBALS.cli.count(CLI_SCPTO))) {
         SCREENERR("error: --faub and --paths are incompatible with --sftp and --scp");
@@ -2355,6 +2805,19 @@ int main(int argc, char *argv[]) {
     if (currentConfig->modified)
         currentConfig->saveConfig();
     
+    string limitError;
+    if (!GLOBALS.netLimit.setSpec(currentConfig->settings[sBwLimit].value, limitError) ||
+        !GLOBALS.diskLimit.setSpec(currentConfig->settings[sIOLimit].value, limitError)) {
+        SCREENERR("error: " << limitError);
+        exit(1);
+    }
+    
+    digestType algorithm;
+    if (!digestFromName(currentConfig->settings[sDigest].value, algorithm)) {
+        SCREENERR("error: unknown digest '" << currentConfig->settings[sDigest].value << "' (use md5 or blake3)");
+        exit(1);
+    }
+    
     if (GLOBALS.cli.count(CLI_RELOCATE)) {
         if (haveProfile(&configManager)) {
             scanConfigToCache(*currentConfig);
@@ -2655,6 +3118,20 @@ int main(int argc, char *argv[]) {
         currentConfig->fcache.recache("", 0, true);
         exit(0);
     }
+
+    if (GLOBALS.cli.count(CLI_REPLICASOURCE)) {
+        // stdout carries the faub protocol; anything meant for the screen goes to stderr
+        cout.rdbuf(cerr.rdbuf());
+
+        if (!haveProfile(&configManager) || !currentConfig->isFaub()) {
+            SCREENERR("--" << CLI_REPLICASOURCE << " requires a faub-based profile (use -p)");
+            exit(2);
+        }
+
+        scanConfigToCache(*currentConfig);
+        fc_replicaSource(*currentConfig);
+        exit(0);
+    }
         
     
     
@@ -2742,6 +3219,8 @@ int main(int argc, char *argv[]) {
         string(NOTQUIET ? "" : " -q") + BoolParamIfSpecified(CLI_TEST) +
         BoolParamIfSpecified(CLI_NOBACKUP) + BoolParamIfSpecified(CLI_NOPRUNE) +
         BoolParamIfSpecified(CLI_PRUNE) + BoolParamIfSpecified(CLI_FILTERDIRS) +
+        BoolParamIfSpecified(CLI_VERIFYSTATS) +
+        (GLOBALS.cli.count(CLI_THREADS) ? string(" --") + CLI_THREADS + " " + to_string(GLOBALS.cli[CLI_THREADS].as<int>()) : "") +
         (GLOBALS.cli.count(CLI_CONFDIR) ? string("--") + CLI_CONFDIR + " '" + GLOBALS.confDir + "'" : "") +
         (GLOBALS.cli.count(CLI_CACHEDIR) ? string("--") + CLI_CACHEDIR + " '" + GLOBALS.cacheDir + "'" : "") +
         (GLOBALS.cli.count(CLI_LOGDIR) ? string("--") + CLI_LOGDIR + " '" + GLOBALS.logDir + "'" : "") +
@@ -2759,34 +3238,81 @@ int main(int argc, char *argv[]) {
         ValueParamIfSpecified(CLI_YEARS) + ValueParamIfSpecified(CLI_NICE) +
         ValueParamIfSpecified(CLI_INCLUDE) + ValueParamIfSpecified(CLI_EXCLUDE) +
         (GLOBALS.cli.count(CLI_LOCK) || GLOBALS.cli.count(CLI_CRONS) || GLOBALS.cli.count(CLI_CRONP) ? " -x" : "") +
-        ValueParamIfSpecified(CLI_MAXLINKS);
+        ValueParamIfSpecified(CLI_MAXLINKS) + ValueParamIfSpecified(CLI_DIGEST);
         
         if (GLOBALS.debugSelector) commonSwitches += " -v=" + to_string(GLOBALS.debugSelector);
         
+        // --bwlimit & --iolimit given alongside -A/--All cover the run as a whole, so
+        // profiles that run in parallel each get their share
+        auto limitSwitches = [&](int shares) {
+            string result;
+            for (auto option: { CLI_BWLIMIT, CLI_IOLIMIT })
+                if (GLOBALS.cli.count(option))
+                    result += string(" --") + option + " '" + RateLimiter::divideSpec(GLOBALS.cli[option].as<string>(), shares) + "'";
+            return result;
+        };
+        
         try {
+            // run as a faub agent, serving faub sessions over a socket
+            if (GLOBALS.cli.count(CLI_LISTEN)) {
+                fc_agent(*currentConfig, GLOBALS.cli[CLI_LISTEN].as<string>(), string2vectorOnSpace(currentConfig->settings[sPaths].value, true, false));
+                exit(0);
+            }
+            
             // start faub client-side
             if (currentConfig->settings[sPaths].value.length()) {
                 fc_mainEngine(*currentConfig, string2vectorOnSpace(currentConfig->settings[sPaths].value, true, false));
                 exit(1);
             }
             
+            /* MULTIPLEX RUN (prune, backup)
+             * for all faub profiles that can share one receiving process
+             * ****************************/
+            if (GLOBALS.cli.count(CLI_MULTIPLEX) && !GLOBALS.cli.count(CLI_ALLSEQ) && !GLOBALS.cli.count(CLI_CRONS) &&
+                !GLOBALS.cli.count(CLI_ALLPAR) && !GLOBALS.cli.count(CLI_CRONP)) {
+                timer allRunTimer;
+                allRunTimer.start();
+                
+                if (!multiplexRun(configManager))
+                    exit(1);
+                
+                allRunTimer.stop();
+                NOTQUIET &&cout << "completed multiplexed processing of faub profiles in "
+                << allRunTimer.elapsed() << endl;
+                log("[MULTIPLEX] completed multiplexed processing of faub profiles in " +
+                    allRunTimer.elapsed());
+            }
+            
             /* ALL SEQUENTIAL RUN (prune, link, backup)
              * for all profiles
              * ****************************/
-            if (GLOBALS.cli.count(CLI_ALLSEQ) || GLOBALS.cli.count(CLI_CRONS)) {
+            else if (GLOBALS.cli.count(CLI_ALLSEQ) || GLOBALS.cli.count(CLI_CRONS)) {
                 timer allRunTimer;
                 allRunTimer.start();
                 log("[ALL] starting sequential processing of all profiles");
                 NOTQUIET && cout << "starting sequential processing of all profiles" << endl;
                 
+                // with --multiplex the faub profiles that can be are received together, up front
+                bool multiplex = false;
+                for (auto &config : configManager.configs)
+                    if (GLOBALS.cli.count(CLI_MULTIPLEX) && !config.temp && !str2bool(config.settings[sArchive].value) && fs_multiplexable(config))
+                        multiplex = true;
+                
+                if (multiplex) {
+                    NOTQUIET &&cout << "\n" << BOLDBLUE << "[multiplex]" << RESET << "\n";
+                    PipeExec miniMe(string(argv[0]) + " --" + CLI_MULTIPLEX + commonSwitches + limitSwitches(1) +
+                                    (GLOBALS.cli.count(CLI_MAXPARALLEL) ? string(" --") + CLI_MAXPARALLEL + " " + to_string(GLOBALS.cli[CLI_MAXPARALLEL].as<int>()) : ""));
+                    miniMe.execute("", true, false, true);   // fds closed and kids piped up via destructor
+                }
+                
                 for (auto &config : configManager.configs) {
                    if (!config.temp && !config.settings[sPaths].value.length()
-                       && !str2bool(config.settings[sArchive].value)) {
+                       && !str2bool(config.settings[sArchive].value) && !(multiplex && fs_multiplexable(config))) {
                        NOTQUIET &&cout << "\n"
                        << BOLDBLUE << "[" << config.settings[sTitle].value << "]"
                        << RESET << "\n";
                        PipeExec miniMe(string(argv[0]) + " -p " + config.settings[sTitle].value +
-                                        commonSwitches);
+                                        commonSwitches + limitSwitches(1));
                        miniMe.execute("", true, false, true);   // fds closed and kids piped up via destructor
                     }
                 }
@@ -2804,27 +3330,38 @@ int main(int argc, char *argv[]) {
                 timer allRunTimer;
                 allRunTimer.start();
                 
-                log("[ALL] starting parallel processing of all profiles");
-                NOTQUIET &&cout << "starting parallel processing of all profiles" << endl;
+                // optionally cap how many profiles run at once; the rest queue up
+                // and start as earlier ones finish
+                size_t maxParallel = GLOBALS.cli.count(CLI_MAXPARALLEL) && GLOBALS.cli[CLI_MAXPARALLEL].as<int>() > 0 ?
+                    GLOBALS.cli[CLI_MAXPARALLEL].as<int>() : 0;
+                string limitText = maxParallel ? " (" + to_string(maxParallel) + " at a time)" : "";
                 
-                map<int, PipeExec> childProcMap;
+                log("[ALL] starting parallel processing of all profiles" + limitText);
+                NOTQUIET &&cout << "starting parallel processing of all profiles" << limitText << endl;
+                
+                // one child per profile, except that with --multiplex the faub profiles that
+                // can be are all received by a single child (which counts as one toward the cap)
+                vector<string> children;
+                bool multiplex = false;
                 for (auto &config : configManager.configs)
                     if (!config.temp && !config.settings[sPaths].value.length()
                         && !str2bool(config.settings[sArchive].value)) {
-                        // launch each profile in a separate child
-                        PipeExec miniMe(string(argv[0]) + " -p " + config.settings[sTitle].value +
-                                        commonSwitches + " -z");
-                        auto childPID = miniMe.execute("", true, true, true);
-                        miniMe.closeAll();
-                        
-                        // save the child PID and pipe object in our map
-                        // emplace() into the map that's outside this loop keeps the destructor
-                        // from being called yet and blocking our execution with a wait().
-                        childProcMap.emplace(pair<int, PipeExec>(childPID, miniMe));
+                        if (GLOBALS.cli.count(CLI_MULTIPLEX) && fs_multiplexable(config))
+                            multiplex = true;
+                        else
+                            children.insert(children.end(), " -p " + config.settings[sTitle].value);
                     }
                 
-                // wait while all child procs finish
-                while (childProcMap.size()) {
+                if (multiplex)
+                    children.insert(children.begin(), string(" --") + CLI_MULTIPLEX +
+                                    (maxParallel ? string(" --") + CLI_MAXPARALLEL + " " + to_string(maxParallel) : ""));
+                
+                string parallelLimits = limitSwitches((int)(maxParallel ? min(maxParallel, children.size()) : children.size()));
+                
+                map<int, PipeExec> childProcMap;
+                
+                // wait for one child to finish; false if there's nothing left to wait on
+                auto reapChild = [&]() {
                     int pid = wait(NULL);
                     
                     if (pid > 0 && childProcMap.find(pid) != childProcMap.end())
@@ -2834,10 +3371,33 @@ int main(int argc, char *argv[]) {
                         NOTQUIET &&cout << "[ALL] aborting on error: wait() returned "
                         << to_string(errno) << endl;
                         log("[ALL] aborting on error: wait() returned " + to_string(errno));
-                        break;
+                        return false;
                     }
+                    
+                    return true;
+                };
+                
+                for (auto &child : children) {
+                    while (maxParallel && childProcMap.size() >= maxParallel)
+                        if (!reapChild())
+                            break;
+                    
+                    // launch each profile (or the multiplex receiver) in a separate child
+                    PipeExec miniMe(string(argv[0]) + child + commonSwitches + parallelLimits + " -z");
+                    auto childPID = miniMe.execute("", true, true, true);
+                    miniMe.closeAll();
+                    
+                    // save the child PID and pipe object in our map
+                    // emplace() into the map that's outside this loop keeps the destructor
+                    // from being called yet and blocking our execution with a wait().
+                    childProcMap.emplace(pair<int, PipeExec>(childPID, miniMe));
                 }
                 
+                // wait while all child procs finish
+                while (childProcMap.size())
+                    if (!reapChild())
+                        break;
+                
                 allRunTimer.stop();
                 NOTQUIET &&cout << "completed parallel processing of all profiles in "
                 << allRunTimer.elapsed() << endl;
@@ -2848,47 +3408,8 @@ int main(int argc, char *argv[]) {
             /* NORMAL RUN (prune, link, backup)
              * ****************************/
             else {
-                auto [pid, lockTime] = currentConfig->getLockPID();
-                
-                if (pid > 0) {
-                    if (!kill(pid, 0)) {
-                        if (GLOBALS.cli.count(CLI_FORCE)) {
-                            kill(pid, 15);
-                            NOTQUIET && cerr << currentConfig->ifTitle() << " previous profile lock (running as pid " << pid <<
-                            ") released due to --force" << endl;
-                            log("[ALL] previous lock (pid " + to_string(pid) + ") released due to --force");
-                            GLOBALS.interruptLock = currentConfig->setLockPID(0);
-                        }
-                        if (GLOBALS.startupTime - lockTime < 60 * 60 * 24) {
-                            NOTQUIET &&cerr << currentConfig->ifTitle() <<
-                            " profile is locked while previous invocation is still running (pid "
-                            << pid << "); skipping this run." << endl;
-                            log(currentConfig->ifTitle() +
-                                " skipped run due to profile lock while previous invocation is "
-                                "still running (pid " +
-                                to_string(pid) + ")");
-                            exit(1);
-                        }
-                        else {
-                            notify(
-                                   *currentConfig,
-                                   errorcom(currentConfig->ifTitle(),
-                                            "abandoning previous lock because it's over 24 hours old"),
-                                   false, true);
-                            kill(pid, 15);
-                        }
-                    }
-                    else
-                        log(currentConfig->ifTitle() + " abandoning previous lock because pid " +
-                            to_string(pid) + " has vanished");
-                }
-                
-                // locking requested
-                if (GLOBALS.cli.count(CLI_LOCK) || GLOBALS.cli.count(CLI_CRONS) ||
-                    GLOBALS.cli.count(CLI_CRONP))
-                    GLOBALS.interruptLock = currentConfig->setLockPID(GLOBALS.pid);
-                else
-                    GLOBALS.interruptLock = currentConfig->setLockPID(-GLOBALS.pid);
+                if (!lockProfile(*currentConfig))
+                    exit(1);
                 
                 int n = nice(0);
                 if (currentConfig->settings[sNice].ivalue() != n) {
@@ -109,7 +109,7 @@ summaryStats calculateSummaryStats(BackupConfig& config, int statDetail = 0) {
     }
     
     // then regular configs
-    resultStats.numberOfBackups = config.cache.rawData.size();
+    resultStats.numberOfBackups = config.cache.numberOfBackups();
     if (resultStats.numberOfBackups < 1) {
         resultStats.stringOutput[0] = config.settings[sTitle].value;
         resultStats.inProcess = false;
@@ -118,63 +118,57 @@ summaryStats calculateSummaryStats(BackupConfig& config, int statDetail = 0) {
     }
     
     // calcuclate stats from the entire list of backups
-    for (auto &raw: config.cache.rawData) {
+    for (auto entry: config.cache.getAll()) {
         
         // calculate total bytes used and saved
-        if (countedInode.find(raw.second.inode) == countedInode.end()) {
-            countedInode.insert(raw.second.inode);
-            resultStats.totalUsed += raw.second.size;
+        if (countedInode.find(entry->inode) == countedInode.end()) {
+            countedInode.insert(entry->inode);
+            resultStats.totalUsed += entry->size;
         }
         else
-            resultStats.totalSaved += raw.second.size;
+            resultStats.totalSaved += entry->size;
     }
-    resultStats.uniqueBackups = config.cache.indexByMD5.size();
+    resultStats.uniqueBackups = config.cache.numberOfMD5s();
     
     // calcuclate percentage saved
     int saved = floor((1 - ((long double)resultStats.totalUsed / ((long double)resultStats.totalUsed + (long double)resultStats.totalSaved))) * 100 + 0.5);
     
-    auto firstEntry = config.cache.indexByFilename.begin();
-    auto lastEntry = config.cache.indexByFilename.end();
-    --lastEntry;
+    auto sorted = config.cache.getSorted();
+    auto firstEntry = sorted.front();
+    auto lastEntry = sorted.back();
     
-    auto first_it = config.cache.rawData.find(firstEntry->second);
-    auto last_it = config.cache.rawData.find(lastEntry->second);
-    if (last_it != config.cache.rawData.end() && first_it != config.cache.rawData.end()) {
-        string processAge;
-        struct stat statBuf;
-        
 #ifdef __APPLE__
-        if (config.cache.inProcess.length() && !mystat(config.cache.inProcess, &statBuf))
-            processAge = seconds2hms(GLOBALS.startupTime - statBuf.st_birthtime);
+    struct stat statBuf;
+    if (config.cache.inProcess.length() && !mystat(config.cache.inProcess, &statBuf))
+        processAge = seconds2hms(GLOBALS.startupTime - statBuf.st_birthtime);
 #endif
-        
-        auto t = localtime(&last_it->second.mtime);
-        char fileTime[20];
-        strftime(fileTime, sizeof(fileTime), "%X", t);
-        
-        string soutput[NUMSTATDETAILS] = {
-            config.settings[sTitle].value,
-            pathSplit(last_it->second.filename).file,
-            fileTime,
-            seconds2hms(last_it->second.duration),
-            (approximate(last_it->second.size, precisionLevel, statDetail == 3 || statDetail == 5) + " (" + approximate(resultStats.totalUsed, precisionLevel, statDetail == 3 || statDetail == 5) + ")"),
-            (to_string(resultStats.uniqueBackups) + " (" + to_string(resultStats.numberOfBackups) + ")"),
-            to_string(saved) + "%",
-            first_it->second.mtime ? timeDiff(mktimeval(first_it->second.mtime)) : first_it->second.name_mtime ? timeDiff(mktimeval(first_it->second.name_mtime)) : "?",
-            last_it->second.mtime ? timeDiff(mktimeval(last_it->second.mtime)) : "?",
-            processAge.length() ? processAge : GLOBALS.startupTime - last_it->second.name_mtime > 2*60*60*24 ? oldMessage : ""
-        };
-        
-        for (int i = 0; i < NUMSTATDETAILS; ++i)
-            resultStats.stringOutput[i] = soutput[i];
-        
-        resultStats.inProcess = config.cache.inProcess.length();
-        resultStats.duration = last_it->second.duration;
-        resultStats.lastBackupBytes = last_it->second.size;
-        resultStats.lastBackupTime = last_it->second.mtime;
-        resultStats.firstBackupTime = first_it->second.mtime;
-        resultStats.archived = str2bool(config.settings[sArchive].value);
-    }
+    
+    auto t = localtime(&lastEntry->mtime);
+    char fileTime[20];
+    strftime(fileTime, sizeof(fileTime), "%X", t);
+    
+    string soutput[NUMSTATDETAILS] = {
+        config.settings[sTitle].value,
+        pathSplit(lastEntry->filename).file,
+        fileTime,
+        seconds2hms(lastEntry->duration),
+        (approximate(lastEntry->size, precisionLevel, statDetail == 3 || statDetail == 5) + " (" + approximate(resultStats.totalUsed, precisionLevel, statDetail == 3 || statDetail == 5) + ")"),
+        (to_string(resultStats.uniqueBackups) + " (" + to_string(resultStats.numberOfBackups) + ")"),
+        to_string(saved) + "%",
+        firstEntry->mtime ? timeDiff(mktimeval(firstEntry->mtime)) : firstEntry->name_mtime ? timeDiff(mktimeval(firstEntry->name_mtime)) : "?",
+        lastEntry->mtime ? timeDiff(mktimeval(lastEntry->mtime)) : "?",
+        processAge.length() ? processAge : GLOBALS.startupTime - lastEntry->name_mtime > 2*60*60*24 ? oldMessage : ""
+    };
+    
+    for (int i = 0; i < NUMSTATDETAILS; ++i)
+        resultStats.stringOutput[i] = soutput[i];
+    
+    resultStats.inProcess = config.cache.inProcess.length();
+    resultStats.duration = lastEntry->duration;
+    resultStats.lastBackupBytes = lastEntry->size;
+    resultStats.lastBackupTime = lastEntry->mtime;
+    resultStats.firstBackupTime = firstEntry->mtime;
+    resultStats.archived = str2bool(config.settings[sArchive].value);
     
     return resultStats;
 }
@@ -223,9 +217,9 @@ void produceSummaryStatsWrapper(ConfigManager& configManager, int statDetail, bo
                 if (config.fcache.size())
                     fastCache.appendFile(pathSplit(config.fcache.getLastBackup()->first).dir);
                 else {
-                    auto bIt = config.cache.getLastBackup();
-                    if (bIt != config.cache.getEnd())
-                        fastCache.appendFile(pathSplit(bIt->second.filename).dir);
+                    auto lastEntry = config.cache.getLastBackup();
+                    if (lastEntry != NULL)
+                        fastCache.appendFile(pathSplit(lastEntry->filename).dir);
                 }
                 
                 for (int i = 0; i < NUMSTATDETAILS; ++i)
@@ -346,7 +340,7 @@ void produceSummaryStatsWrapper(ConfigManager& configManager, int statDetail, bo
 }
 
 
-void displaySingleLineDetails(map<unsigned int, BackupEntry>::iterator rawIt, BackupCache& cache, tableManager& table, colorRotator& color, string lastMD5, int dow, int precision, int statDetail) {
+void displaySingleLineDetails(BackupEntry& entry, BackupCache& cache, tableManager& table, colorRotator& color, md5Digest lastMD5, int dow, int precision, int statDetail) {
     // file age can be calculated from the mtime which is an accurate number returned by
     // stat(), but in the case of multiple backups hardlinked together (due to identical content)
     // will actually be the mtime of the most recent of those files
@@ -361,21 +355,21 @@ void displaySingleLineDetails(map<unsigned int, BackupEntry>::iterator rawIt, Ba
     //
     // if the mtime and the name_mtime refer to completely different days then go non-precise and use
     // the name_mtime.
-    bool prectime = mtimesAreSameDay(rawIt->second.mtime, rawIt->second.name_mtime) && (rawIt->second.links == 1 || !rawIt->second.fnameDayAge);
+    bool prectime = mtimesAreSameDay(entry.mtime, entry.name_mtime) && (entry.links == 1 || !entry.fnameDayAge);
     bool commas = statDetail == 3 || statDetail == 5;
     
-    table.addRowData(rawIt->second.filename);
-    table.addRowData(approximate(rawIt->second.size, precision, commas));
-    table.addRowData(seconds2hms(rawIt->second.duration));
-    table.addRowData(rawIt->second.date_month == 1 && rawIt->second.date_day == 1 ? "Year" : rawIt->second.date_day == 1 ? "Mnth" : rawIt->second.dow == dow ? "Week" : "Day");
-    table.addRowData(to_string(rawIt->second.links));
-    table.addRowData(rawIt->second.mtime ? timeDiff(mktimeval(prectime ? rawIt->second.mtime : rawIt->second.name_mtime)) : "?");
+    table.addRowData(entry.filename);
+    table.addRowData(approximate(entry.size, precision, commas));
+    table.addRowData(seconds2hms(entry.duration));
+    table.addRowData(entry.date_month == 1 && entry.date_day == 1 ? "Year" : entry.date_day == 1 ? "Mnth" : entry.dow == dow ? "Week" : "Day");
+    table.addRowData(to_string(entry.links));
+    table.addRowData(entry.mtime ? timeDiff(mktimeval(prectime ? entry.mtime : entry.name_mtime)) : "?");
     
     // if there's more than 1 file with this MD5 then color code it as a set; otherwise no color
-    if (cache.getByMD5(rawIt->second.md5).size() > 1) {
+    if (cache.getByMD5(entry.md5).size() > 1) {
         
         // rotate the color if we're on a new set (i.e. new md5)
-        if (lastMD5.length() && lastMD5 != rawIt->second.md5)
+        if (!lastMD5.empty() && lastMD5 != entry.md5)
             ++color;
         
         cout << color.current();
@@ -454,8 +448,8 @@ void analyseFaubLineDetails(tableManager& table, detailType& detail, myMapIT& ba
 
 void displaySectionIntro(BackupConfig& config, detailType& detail, int precision, int statDetail) {
     auto line = horizontalLine(60);
-    auto bkups = config.isFaub() ? config.fcache.getNumberOfBackups() : config.cache.rawData.size();
-    auto unique = config.isFaub() ? 0 : config.cache.indexByMD5.size();
+    auto bkups = config.isFaub() ? config.fcache.getNumberOfBackups() : config.cache.numberOfBackups();
+    auto unique = config.isFaub() ? 0 : config.cache.numberOfMD5s();
     auto stats = config.fcache.getTotalStats();
     int saved = floor((1 - (long double)stats.getSize() / (stats.getSize() + stats.getSaved())) * 100 + 0.5);
     
@@ -570,8 +564,8 @@ void produceDetailedStats(ConfigManager& configManager, int statDetail) {
             set<ino_t> countedInode;
             detailType detail;
 
-            for (auto &raw: config.cache.rawData) {
-                analyseSingleBackupLineDetails(singleFileTable, detail, countedInode, raw.second, config.settings[sDOW].ivalue(), precisionLevel, statDetail);
+            for (auto entry: config.cache.getAll()) {
+                analyseSingleBackupLineDetails(singleFileTable, detail, countedInode, *entry, config.settings[sDOW].ivalue(), precisionLevel, statDetail);
             }
             
             details.insert(details.end(), detail);
@@ -630,29 +624,24 @@ void produceDetailedStats(ConfigManager& configManager, int statDetail) {
         /* single-file backup configs */
         else {
             colorRotator color;
-            string lastMD5;
+            md5Digest lastMD5;
             
-            for (auto &backup: configItr.first->cache.indexByFilename) {
-               
-                // lookup the the raw data detail
-                auto rawIt = configItr.first->cache.rawData.find(backup.second);
-                if (rawIt != configItr.first->cache.rawData.end()) {
-                    string monthYear = vars2MY(rawIt->second.date_month, rawIt->second.date_year);
+            for (auto entry: configItr.first->cache.getSorted()) {
+                string monthYear = vars2MY(entry->date_month, entry->date_year);
+                
+                // no tag is specified (i.e. everything is valid)
+                if (!GLOBALS.cli.count(CLI_TAG)) {
                     
-                    // no tag is specified (i.e. everything is valid)
-                    if (!GLOBALS.cli.count(CLI_TAG)) {
-                        
-                        if (NOTQUIET && monthYear != lastMonthYear) {
-                            if (lastMonthYear.length())
-                                cout << "\n";
-                            
-                            singleFileTable.displayHeader(monthYear);
-                            lastMonthYear = monthYear;
-                        }
+                    if (NOTQUIET && monthYear != lastMonthYear) {
+                        if (lastMonthYear.length())
+                            cout << "\n";
                         
-                        displaySingleLineDetails(rawIt, configItr.first->cache, singleFileTable, color, lastMD5, configItr.first->settings[sDOW].ivalue(), precisionLevel, statDetail);
-                        lastMD5 = rawIt->second.md5;
+                        singleFileTable.displayHeader(monthYear);
+                        lastMonthYear = monthYear;
                     }
+                    
+                    displaySingleLineDetails(*entry, configItr.first->cache, singleFileTable, color, lastMD5, configItr.first->settings[sDOW].ivalue(), precisionLevel, statDetail);
+                    lastMD5 = entry->md5;
                 }
             }
         }
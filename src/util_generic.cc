@@ -6,24 +6,36 @@
 #include "time.h"
 #include <syslog.h>
 #include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
 #include <algorithm>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <fcntl.h>
 #include <utime.h>
 #include <filesystem>
 #include <pwd.h>
 #include <vector>
 #include <list>
 #include <set>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "util_generic.h"
 #include "globals.h"
 #include "ipc.h"
 #include "exception.h"
+#include "MultiMD5.h"
 
 #if defined(__linux__)
 #  include <endian.h>
+#  include <sys/ioctl.h>
+#  include <sys/sysmacros.h>
+#  include <linux/fs.h>
 #elif defined(__FreeBSD__) || defined(__NetBSD__)
 #  include <sys/endian.h>
 #elif defined(__OpenBSD__)
@@ -219,35 +231,30 @@ string getDirUp(string path) { return pathSplit(path).dir; }
 
 
 string MD5file(string filename, bool quiet, string reason) {
+    return digestFile(filename, dMD5, quiet, reason);
+}
+
+
+string digestFile(string filename, digestType algorithm, bool quiet, string reason) {
     FILE *inputFile;
     
     if ((inputFile = fopen(filename.c_str(), "rb")) != NULL) {
-        string message = "MD5 " + filename + (reason.length() ? " " + reason : "...");
+        string message = digestName(algorithm, true) + " " + filename + (reason.length() ? " " + reason : "...");
         
         if (!quiet)
             cout << message << flush;
         
-        unsigned char data[65536];
+        // big reads let BLAKE3 hash straight from the buffer (see blake3Stream::update())
+        vector<unsigned char> data(1024 * 1024);
         unsigned long bytesRead;
-        EVP_MD_CTX *md5Context;
-        unsigned char *md5Digest;
-        unsigned int md5DigestLen = EVP_MD_size(EVP_md5());
+        digestStream digest(algorithm);
         
-        md5Context = EVP_MD_CTX_new();
-        EVP_DigestInit_ex(md5Context, EVP_md5(), NULL);
-        
-        while ((bytesRead = fread(data, 1, 65536, inputFile)) != 0)
-            EVP_DigestUpdate(md5Context, data, bytesRead);
+        while ((bytesRead = fread(data.data(), 1, data.size(), inputFile)) != 0) {
+            GLOBALS.diskLimit.consume(bytesRead);
+            digest.update(data.data(), bytesRead);
+        }
         
         fclose(inputFile);
-        md5Digest = (unsigned char*)OPENSSL_malloc(md5DigestLen);
-        EVP_DigestFinal_ex(md5Context, md5Digest, &md5DigestLen);
-        EVP_MD_CTX_free(md5Context);
-        
-        char tempStr[md5DigestLen * 2 + 1];
-        for (int i = 0; i < md5DigestLen; i++)
-            snprintf(tempStr+(2*i), 3, "%02x", md5Digest[i]);
-        tempStr[md5DigestLen * 2] = 0;
         
         if (!quiet) {
             string back = string(message.length(), '\b');
@@ -255,13 +262,187 @@ string MD5file(string filename, bool quiet, string reason) {
             cout << back << blank << back << flush;
         }
         
-        return(tempStr);
+        return digest.final();
     }
     
     return "";
 }
 
 
+// true if the OS says the block device behind 'device' doesn't seek (ssd, nvme, ramdisk).
+// partitions don't have a queue of their own; it's on the whole disk, one level up.
+static bool solidStateDevice(dev_t device) {
+#if defined(__linux__)
+    string devPath = "/sys/dev/block/" + to_string(major(device)) + ":" + to_string(minor(device));
+
+    for (auto queuePath: {"/queue/rotational", "/../queue/rotational"}) {
+        ifstream rotationalFile(devPath + queuePath);
+        int rotational;
+
+        if (rotationalFile >> rotational)
+            return !rotational;
+    }
+#endif
+
+    return false;
+}
+
+
+/* digest a list of files with a pool of up to 'threads' workers, returning each file's
+ * digest (or "" if it couldn't be read) at the same position as its filename.  files on
+ * a device that isn't known to be solid state are read one at a time, however many
+ * workers there are, so a spinning disk isn't left seeking back and forth between them.
+ * for MD5 on a solid state device each worker reads as many files as MultiMD5 has lanes,
+ * a chunk from each in turn, and hashes them side by side; BLAKE3 already spreads a
+ * single file across the lanes. */
+vector<string> digestFiles(vector<string>& filenames, digestType algorithm, int threads) {
+    const size_t chunkSize = 256 * 1024;
+    vector<string> digests(filenames.size());
+    vector<dev_t> devices(filenames.size(), 0);
+    map<dev_t, int> deviceSlots;
+    set<dev_t> solidState;
+    struct stat statData;
+
+    for (size_t index = 0; index < filenames.size(); ++index)
+        if (!mystat(filenames[index], &statData))
+            devices[index] = statData.st_dev;
+
+    size_t workers = min(max(threads, 1), (int)filenames.size());
+    for (auto device: devices)
+        if (deviceSlots.find(device) == deviceSlots.end()) {
+            if (device && solidStateDevice(device))
+                solidState.insert(device);
+
+            deviceSlots[device] = solidState.count(device) ? workers : 1;
+        }
+
+    vector<bool> started(filenames.size(), false);
+    size_t firstWaiting = 0;
+    mutex md5Lock;
+    condition_variable slotFreed;
+
+    // (called with md5Lock held) mark a file as started
+    auto startFile = [&](size_t index) {
+        started[index] = true;
+        while (firstWaiting < filenames.size() && started[firstWaiting])
+            ++firstWaiting;
+    };
+
+    // hash the file at 'index' along with as many others from its device as there are lanes,
+    // taking on another from the device each time one finishes
+    auto hashGroup = [&](size_t index) {
+        auto device = devices[index];
+        auto lanes = MultiMD5::lanes();
+        MultiMD5 md5s(lanes);
+        vector<FILE*> laneFiles(lanes, NULL);
+        vector<size_t> laneIndexes(lanes, 0);
+        vector<char> data(chunkSize);
+        size_t openFiles = 0;
+
+        auto fillLane = [&](size_t lane, size_t nextIndex) {
+            while (1) {
+                if (nextIndex >= filenames.size()) {
+                    lock_guard<mutex> guard(md5Lock);
+
+                    for (nextIndex = firstWaiting; nextIndex < filenames.size(); ++nextIndex)
+                        if (!started[nextIndex] && devices[nextIndex] == device)
+                            break;
+
+                    if (nextIndex >= filenames.size())
+                        return;
+
+                    startFile(nextIndex);
+                }
+
+                if ((laneFiles[lane] = fopen(filenames[nextIndex].c_str(), "rb")) != NULL) {
+                    laneIndexes[lane] = nextIndex;
+                    ++openFiles;
+                    return;
+                }
+
+                nextIndex = filenames.size();
+            }
+        };
+
+        fillLane(0, index);
+        for (size_t lane = 1; lane < lanes; ++lane)
+            fillLane(lane, filenames.size());
+
+        while (openFiles)
+            for (size_t lane = 0; lane < lanes; ++lane)
+                if (laneFiles[lane] != NULL) {
+                    auto bytesRead = fread(data.data(), 1, chunkSize, laneFiles[lane]);
+                    GLOBALS.diskLimit.consume(bytesRead);
+
+                    if (bytesRead)
+                        md5s.update(lane, data.data(), bytesRead);
+
+                    if (bytesRead < chunkSize) {
+                        auto digest = md5s.final(lane);
+                        digests[laneIndexes[lane]] = ferror(laneFiles[lane]) ? "" : digest;
+
+                        fclose(laneFiles[lane]);
+                        laneFiles[lane] = NULL;
+                        --openFiles;
+                        fillLane(lane, filenames.size());
+                    }
+                }
+    };
+
+    auto worker = [&]() {
+        while (1) {
+            size_t index;
+            {
+                unique_lock<mutex> guard(md5Lock);
+
+                // the first file not yet started whose device has a slot open
+                slotFreed.wait(guard, [&]() {
+                    for (index = firstWaiting; index < filenames.size(); ++index)
+                        if (!started[index] && deviceSlots[devices[index]] > 0)
+                            return true;
+
+                    return firstWaiting >= filenames.size();
+                });
+
+                if (index >= filenames.size())
+                    return;
+
+                startFile(index);
+                --deviceSlots[devices[index]];
+            }
+
+            if (algorithm == dMD5 && MultiMD5::lanes() > 1 && solidState.count(devices[index]))
+                hashGroup(index);
+            else
+                digests[index] = digestFile(filenames[index], algorithm, true);
+
+            {
+                lock_guard<mutex> guard(md5Lock);
+                ++deviceSlots[devices[index]];
+            }
+            slotFreed.notify_all();
+        }
+    };
+
+    DEBUG(D_scan) DFMT("hashing " << plural(filenames.size(), "file") << " with up to " << plural(workers, "thread") <<
+                       " across " << plural(deviceSlots.size(), "device") << " (" << digestName(algorithm) << ", " <<
+                       (algorithm == dMD5 ? MultiMD5::engine() + ", " + plural(MultiMD5::lanes(), "lane") : blake3Stream::engine()) << ")");
+
+    if (workers > 1) {
+        vector<thread> pool;
+        for (size_t i = 0; i < workers; ++i)
+            pool.insert(pool.end(), thread(worker));
+
+        for (auto &aThread: pool)
+            aThread.join();
+    }
+    else
+        worker();
+
+    return digests;
+}
+
+
 string MD5string(string origString) {
     EVP_MD_CTX *md5Context;
     unsigned char *md5Digest;
@@ -285,6 +466,86 @@ string MD5string(string origString) {
 }
 
 
+md5Stream::md5Stream() {
+    context = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(context, EVP_md5(), NULL);
+}
+
+
+md5Stream::~md5Stream() {
+    EVP_MD_CTX_free(context);
+}
+
+
+void md5Stream::update(const void *data, size_t count) {
+    EVP_DigestUpdate(context, data, count);
+}
+
+
+string md5Stream::final() {
+    unsigned char md5Digest[EVP_MAX_MD_SIZE];
+    unsigned int md5DigestLen;
+    
+    EVP_DigestFinal_ex(context, md5Digest, &md5DigestLen);
+    
+    char tempStr[md5DigestLen * 2 + 1];
+    for (int i = 0; i < md5DigestLen; i++)
+        snprintf(tempStr+(2*i), 3, "%02x", md5Digest[i]);
+    tempStr[md5DigestLen * 2] = 0;
+    
+    return(tempStr);
+}
+
+
+void digestStream::update(const void *data, size_t count) {
+    if (algorithm == dBLAKE3)
+        blake3.update(data, count);
+    else
+        md5.update(data, count);
+}
+
+
+string digestStream::final() {
+    return algorithm == dBLAKE3 ? blake3.final(16) : md5.final();
+}
+
+
+string HMACsha256(string key, string data) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLen = 0;
+    
+    if (HMAC(EVP_sha256(), key.c_str(), (int)key.length(), (const unsigned char*)data.c_str(), data.length(), digest, &digestLen) == NULL)
+        return "";
+    
+    char tempStr[digestLen * 2 + 1];
+    for (int i = 0; i < digestLen; i++)
+        snprintf(tempStr+(2*i), 3, "%02x", digest[i]);
+    tempStr[digestLen * 2] = 0;
+    
+    return(tempStr);
+}
+
+
+string randomHex(size_t bytes) {
+    unsigned char data[bytes];
+    
+    if (RAND_bytes(data, (int)bytes) != 1)
+        return "";
+    
+    char tempStr[bytes * 2 + 1];
+    for (int i = 0; i < bytes; i++)
+        snprintf(tempStr+(2*i), 3, "%02x", data[i]);
+    tempStr[bytes * 2] = 0;
+    
+    return(tempStr);
+}
+
+
+bool secureEquals(string a, string b) {
+    return a.length() == b.length() && !CRYPTO_memcmp(a.c_str(), b.c_str(), a.length());
+}
+
+
 string onevarsprintf(string format, string data) {
     char buffer[1000];
     snprintf(buffer, sizeof(buffer), format.c_str(), data.c_str());
@@ -1083,41 +1344,22 @@ int mkbasedirs(string path) {
 
 
 DiskStats dus(string path) {    // du -s
-    set<ino_t> seenInodes;
-    set<ino_t> newInodes;
+    InodeSet seenInodes;
+    InodeSet newInodes;
     return dus(path, seenInodes, newInodes);
 }
 
 
-struct dsDataType {
-    DiskStats *ds;
-    set<ino_t> *seenI;
-    set<ino_t> *newI;
-};
-
-
 bool dsCallback(pdCallbackData &file) {
-    dsDataType *data = (dsDataType*)file.dataPtr;
+    dusWalkType *walk = (dusWalkType*)file.dataPtr;
     
     if (S_ISDIR(file.statData.st_mode))
-        ++data->ds->dirs;
+        ++walk->dirs;
     else
         if (S_ISLNK(file.statData.st_mode))
-            ++data->ds->symLinks;
-        else {
-            if (data->seenI->find(file.statData.st_ino) == data->seenI->end() &&
-                data->newI->find(file.statData.st_ino) == data->newI->end()) {
-                data->ds->usedInBytes += file.statData.st_size;
-                data->ds->usedInBlocks += 512 * file.statData.st_blocks;
-                ++data->ds->mods;
-            }
-            else {
-                data->ds->savedInBytes += file.statData.st_size;
-                data->ds->savedInBlocks += 512 * file.statData.st_blocks;
-            }
-            
-            data->newI->insert(file.statData.st_ino);
-        }
+            ++walk->symLinks;
+        else
+            walk->files.push_back({file.statData.st_ino, (size_t)file.statData.st_size, 512 * (size_t)file.statData.st_blocks});
     
     return true;
 }
@@ -1129,19 +1371,59 @@ bool dsCallback(pdCallbackData &file) {
  size specific to that entry.  For reasons I don't understand the CLI 'du' command ignores
  those numbers and doesn't add them to a given subdirectory's total.  Maybe they know
  something I don't.  So this function is specifically excluding them as well in the callback.
+ 
+ dus() comes in two halves so the walk, which doesn't depend on anything else, can be run
+ in parallel with others (see FaubCache::recache()).  dusWalk() collects the inode and size
+ of every file.  dusTally() then splits them into used (an inode not in 'seenInodes' and
+ not already counted) and saved, and fills 'newInodes' with the backup's inodes.
  */
-DiskStats dus(string path, set<ino_t>& seenInodes, set<ino_t>& newInodes) {
+void dusWalk(string path, dusWalkType& walk) {
+    walk.files.clear();
+    walk.dirs = walk.symLinks = 0;
+    
+    processDirectory(path, "", false, false, dsCallback, &walk);
+}
+
+
+DiskStats dusTally(dusWalkType& walk, InodeSet& seenInodes, InodeSet& newInodes) {
     DiskStats ds;
-    dsDataType data;
-    data.ds = &ds;
-    data.seenI = &seenInodes;
-    data.newI = &newInodes;
+    ds.dirs = walk.dirs;
+    ds.symLinks = walk.symLinks;
+    
+    // grouped by inode, only the first of a group of hardlinks within the backup can be new
+    sort(walk.files.begin(), walk.files.end(), [](const dusWalkType::fileType& a, const dusWalkType::fileType& b) { return a.inode < b.inode; });
+    
+    newInodes.clear();
+    newInodes.reserve(walk.files.size());
+    
+    for (size_t i = 0; i < walk.files.size(); ++i) {
+        auto &file = walk.files[i];
+        
+        if ((!i || walk.files[i - 1].inode != file.inode) && !seenInodes.contains(file.inode)) {
+            ds.usedInBytes += file.size;
+            ds.usedInBlocks += file.blocks;
+            ++ds.mods;
+        }
+        else {
+            ds.savedInBytes += file.size;
+            ds.savedInBlocks += file.blocks;
+        }
+        
+        newInodes.insert(file.inode);
+    }
     
-    processDirectory(path, "", false, false, dsCallback, &data);
     return ds;
 }
 
 
+DiskStats dus(string path, InodeSet& seenInodes, InodeSet& newInodes) {
+    dusWalkType walk;
+    
+    dusWalk(path, walk);
+    return dusTally(walk, seenInodes, newInodes);
+}
+
+
 // convenience function to consolidate printing screen errors, logging and returning
 // to the notify() function
 string errorcom(string profile, string message) {
@@ -1152,6 +1434,7 @@ string errorcom(string profile, string message) {
 
 
 
+// a negative fd means don't wait on that side (0 is a real fd: stdin)
 int simpleSelect(int rFd, int wFd, int timeoutSecs) {
     fd_set dataSet;
     FD_ZERO(&dataSet);
@@ -1159,12 +1442,12 @@ int simpleSelect(int rFd, int wFd, int timeoutSecs) {
     fd_set errorSet;
     FD_ZERO(&errorSet);
     
-    if (rFd) {
+    if (rFd >= 0) {
         FD_SET(rFd, &dataSet);
         FD_SET(rFd, &errorSet);
     }
     
-    if (wFd) {
+    if (wFd >= 0) {
         FD_SET(wFd, &dataSet);
         FD_SET(wFd, &errorSet);
     }
@@ -1173,7 +1456,7 @@ int simpleSelect(int rFd, int wFd, int timeoutSecs) {
     tv.tv_sec = timeoutSecs;
     tv.tv_usec = 0;
     
-    return select(max(rFd, wFd) + 1, rFd ? &dataSet : NULL, wFd ? &dataSet : NULL, &errorSet, &tv);
+    return select(max(rFd, wFd) + 1, rFd >= 0 ? &dataSet : NULL, wFd >= 0 ? &dataSet : NULL, &errorSet, &tv);
 }
 
 
@@ -1183,23 +1466,71 @@ void showError(string message) {
 }
 
 
+/*
+ * copyFile()
+ * Copy the content of srcFile to destFile.  On Linux the kernel does the work when it
+ * can: a FICLONE reflink shares the extents outright (btrfs, XFS) and copy_file_range()
+ * avoids the trip through user space.  Anything else falls back to read()/write().
+ * A clone moves no data; the other two count against --iolimit as a read plus a write.
+ */
 int copyFile(string srcFile, string destFile) {
-    std::ifstream inF(srcFile, ios_base::in | ios_base::binary);
-    if (!inF) return 0;
+    int inFd = open(srcFile.c_str(), O_RDONLY);
+    if (inFd < 0)
+        return 0;
     
-    std::ofstream outF(destFile, ios_base::out | ios_base::binary | ios_base::trunc);
-    if (!outF) return 0;
+    int outFd = open(destFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (outFd < 0) {
+        close(inFd);
+        return 0;
+    }
     
-    char buffer[32 * 1024];
-    do {
-        inF.read(buffer, sizeof(buffer));
-        outF.write(buffer, inF.gcount());
-    } while (inF.gcount() > 0);
+    bool copied = false;
     
-    inF.close();
-    outF.close();
+#if defined(__linux__)
+#ifdef FICLONE
+    copied = !ioctl(outFd, FICLONE, inFd);
+#endif
     
-    return 1;
+    if (!copied) {
+        ssize_t bytes;
+        off_t total = 0;
+        
+        // small chunks when throttled so the limiter gets a say between them
+        size_t chunk = GLOBALS.diskLimit.currentRate() ? 1024 * 1024 : 1024 * 1024 * 1024;
+        while ((bytes = copy_file_range(inFd, NULL, outFd, NULL, chunk, 0)) > 0) {
+            total += bytes;
+            GLOBALS.diskLimit.consume(bytes * 2);
+        }
+        
+        // on error (e.g. EXDEV on older kernels) the read/write loop picks up at the current offsets.
+        // pseudo filesystems can report nothing copied for a non-empty file; let read() handle those too.
+        struct stat statData;
+        copied = !bytes && (total || (!fstat(inFd, &statData) && !statData.st_size));
+    }
+#endif
+    
+    if (!copied) {
+        char buffer[64 * 1024];
+        ssize_t bytes;
+        
+        while ((bytes = read(inFd, buffer, sizeof(buffer))) > 0) {
+            GLOBALS.diskLimit.consume(bytes * 2);
+            
+            if (write(outFd, buffer, bytes) != bytes) {
+                bytes = -1;
+                break;
+            }
+        }
+        
+        if (bytes < 0) {
+            close(inFd);
+            close(outFd);
+            return 0;
+        }
+    }
+    
+    close(inFd);
+    return !close(outFd);
 }
 
 
@@ -1242,31 +1573,72 @@ int getUidFromName(string userName) {
 }
 
 
-time_t filename2Mtime(string filename) {
-    Pcre dateRE = Pcre(DATE_REGEX);
-    int date_year, date_month, date_day, time_hour = 0, time_min = 0, time_sec = 0;
-    
-    if (dateRE.search(filename) && dateRE.matches() > 2) {
-        date_year  = stoi(dateRE.get_match(0));
-        date_month = stoi(dateRE.get_match(1));
-        date_day   = stoi(dateRE.get_match(2));
-        
-        if (dateRE.matches() > 5) {
-            time_hour = stoi(dateRE.get_match(3));
-            time_min  = stoi(dateRE.get_match(4));
-            time_sec  = stoi(dateRE.get_match(5));
+/* this runs on every backup filename during a scan, so rather than a search with
+ * DATE_REGEX it's done by hand.  it finds exactly what the regex would: the first '-'
+ * that's followed by "20" and two digits, any run of '-' or '.', two digits, another
+ * such run and two digits.  then any number of "@HH:MM:SS", of which the last counts. */
+bool parseBackupDate(const string& filename, backupDateType& date) {
+    auto isDigits = [](const char *p) { return p[0] >= '0' && p[0] <= '9' && p[1] >= '0' && p[1] <= '9'; };
+    auto value = [](const char *p) { return (p[0] - '0') * 10 + p[1] - '0'; };
+
+    for (const char *start = strchr(filename.c_str(), '-'); start != NULL; start = strchr(start + 1, '-')) {
+        const char *p = start + 1;
+
+        if (p[0] != '2' || p[1] != '0' || !isDigits(p + 2))
+            continue;
+
+        date.year = 2000 + value(p + 2);
+        p += 4;
+
+        while (*p == '-' || *p == '.')
+            ++p;
+
+        if (!isDigits(p))
+            continue;
+
+        date.month = value(p);
+        p += 2;
+
+        while (*p == '-' || *p == '.')
+            ++p;
+
+        if (!isDigits(p))
+            continue;
+
+        date.day = value(p);
+        p += 2;
+
+        date.hour = date.minute = date.second = 0;
+        date.hasTime = false;
+
+        while (p[0] == '@' && isDigits(p + 1) && p[3] == ':' && isDigits(p + 4) && p[6] == ':' && isDigits(p + 7)) {
+            date.hour   = value(p + 1);
+            date.minute = value(p + 4);
+            date.second = value(p + 7);
+            date.hasTime = true;
+            p += 9;
         }
+
+        return true;
     }
-    else
+
+    return false;
+}
+
+
+time_t filename2Mtime(string filename) {
+    backupDateType date;
+    
+    if (!parseBackupDate(filename, date))
         return 0;
     
     struct tm fileTime;
-    fileTime.tm_sec  = time_sec;
-    fileTime.tm_min  = time_min;
-    fileTime.tm_hour = time_hour;
-    fileTime.tm_mday = date_day;
-    fileTime.tm_mon  = date_month - 1;
-    fileTime.tm_year = date_year - 1900;
+    fileTime.tm_sec  = date.second;
+    fileTime.tm_min  = date.minute;
+    fileTime.tm_hour = date.hour;
+    fileTime.tm_mday = date.day;
+    fileTime.tm_mon  = date.month - 1;
+    fileTime.tm_year = date.year - 1900;
     fileTime.tm_isdst = -1;
     
     return mktime(&fileTime);
@@ -1411,7 +1783,12 @@ mode_t resolveLinkMode(string dirEntryName, mode_t origMode) {
  
     'includeTopDir' whether to call the callback function for the original directory
  name that as passed in as 'directory'
- 
+
+    'stamps' optionally, the directory stamps of a backup tree (see DirStamps.h).  a
+ directory whose stamp shows it unchanged isn't read - neither it nor anything in it is
+ passed to the callback - though its recorded subdirectories are still walked.  directories
+ that are read are stamped afresh.
+
  callback() is passed a structure that contains the full path of the filename to
  process, its stat() information, and a void pointer that can be setup before processing
  begins to pass any additional data into or out of the callback() functions, such as counters.
@@ -1420,7 +1797,7 @@ mode_t resolveLinkMode(string dirEntryName, mode_t origMode) {
  shown on the screen (via SCREENERR) and returned to the calling function.
  */
 
-string processDirectory(string directory, string pattern, bool exclude, bool filterDirs, bool (*callback)(pdCallbackData&), void *passData, int maxDepth, bool includeTopDir, bool followSymLinks) {
+string processDirectory(string directory, string pattern, bool exclude, bool filterDirs, bool (*callback)(pdCallbackData&), void *passData, int maxDepth, bool includeTopDir, bool followSymLinks, DirStamps *stamps) {
     DIR *dirPtr;
     size_t dirEntries;
     struct dirent *dirEntry;
@@ -1459,6 +1836,21 @@ string processDirectory(string directory, string pattern, bool exclude, bool fil
             if (!mylstat(baseDir, &dirStat)) {
                                 
                 if (S_ISDIR(dirStat.st_mode) || (followSymLinks && S_ISDIR(resolveLinkMode(baseDir, dirStat.st_mode)))) {
+                    struct stat stampStat = dirStat;
+                    vector<string> subDirs, names;
+                    bool stamped = stamps != NULL && stamps->tracks(baseDir, depth) &&
+                        (!S_ISLNK(dirStat.st_mode) || !mystat(baseDir, &stampStat));
+                    
+                    // a directory that hasn't changed since it was last read has the same entries it
+                    // had then.  skip it (and its callback) but still look at its subdirectories.
+                    if (stamped && stamps->unchanged(baseDir, stampStat)) {
+                        if (maxDepth < 1 || depth < maxDepth)
+                            for (auto &subDir: stamps->subDirs(baseDir))
+                                if (stamps->tracks(subDir, depth+1))
+                                    dirsToRead.push_back({slashConcat(baseDir, subDir), depth+1});
+                        
+                        continue;
+                    }
                     
                     // read individual directory entries
                     if ((dirPtr = opendir(baseDir.c_str())) != NULL) {
@@ -1470,6 +1862,9 @@ string processDirectory(string directory, string pattern, bool exclude, bool fil
                             ++dirEntries;
                             file.filename = slashConcat(baseDir, dirEntry->d_name);
                             
+                            if (stamped)
+                                names.push_back(dirEntry->d_name);
+                            
                             if (!mylstat(file.filename, &file.statData)) {
                                 
                                 /* process directories - first we filter (if requested) to make sure we're
@@ -1486,8 +1881,12 @@ string processDirectory(string directory, string pattern, bool exclude, bool fil
                                                 continue;
                                         }
                                     
-                                    if (maxDepth < 1 || depth < maxDepth)
+                                    if (maxDepth < 1 || depth < maxDepth) {
                                         dirsToRead.push_back({file.filename, depth+1});
+                                        
+                                        if (stamped)
+                                            subDirs.push_back(dirEntry->d_name);
+                                    }
                                 }
                                 else {
                                     /* process files - again, first filter (if requested) to make sure we're
@@ -1502,6 +1901,7 @@ string processDirectory(string directory, string pattern, bool exclude, bool fil
                                     file.dirEntries = 0;
                                     if (!callback(file)) {
                                         dirsToRead.clear();
+                                        stamped = false;    // only partly read
                                         break;
                                     }
                                 }
@@ -1509,6 +1909,9 @@ string processDirectory(string directory, string pattern, bool exclude, bool fil
                         }
                         closedir(dirPtr);
                         
+                        if (stamped)
+                            stamps->record(baseDir, stampStat, subDirs, names);
+                        
                         /* here we've finished reading everything in the current directory.  we can't call the
                          callback on the directory itself because we may have found subdirectories that need
                          to be processed first.  those subs will get handled as we get back to the top of our
@@ -1601,15 +2004,15 @@ bool pdBackupsCallback(pdCallbackData &file) {
  for single-file backups the file is returned, for faub backups the containing directory
  is returned.  backupType specifies which types to return.
  */
-string processDirectoryBackups(string directory, string pattern, bool filterDirs, bool (*callback)(pdCallbackData&), void *passData, backupTypes backupType, int maxDepth, bool followSymLinks) {
+string processDirectoryBackups(string directory, string pattern, bool filterDirs, bool (*callback)(pdCallbackData&), void *passData, backupTypes backupType, int maxDepth, bool followSymLinks, DirStamps *stamps) {
     internalPDBDataType data;
-    Pcre backupPattern("./\\d{4}/\\d{2}(?:/\\d{2}){0,1}/(?!\\d{2}\\b)[^/]+$");  // identify backup directories
+    Pcre backupPattern(BACKUP_PATH_REGEX);
     data.backupPattern = &backupPattern;
     data.realCallback = callback;
     data.realDataPtr = passData;
     data.backupType = backupType;
         
-    return processDirectory(directory, "(/\\d{2,4}$)|(" + pattern + ")", false, filterDirs, pdBackupsCallback, &data, maxDepth == -1 ? 4 : maxDepth, false, followSymLinks);
+    return processDirectory(directory, "(/\\d{2,4}$)|(" + pattern + ")", false, filterDirs, pdBackupsCallback, &data, maxDepth == -1 ? 4 : maxDepth, false, followSymLinks, stamps);
 }
 
 